@@ -0,0 +1,60 @@
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.  This file is offered as-is,
+# without any warranty.
+
+
+# Build and run the benchmarks, each prints its results as one JSON object per line.
+
+.PHONY: bench
+bench: benchmarks
+	@printf '\e[00;01;34m%s\e[00m\n' "$@"
+	$(foreach B,$(BENCHMARKS),LD_LIBRARY_PATH=bin bin/bench/$(B) &&) true
+	@echo
+
+.PHONY: benchmarks
+benchmarks: $(foreach B,$(BENCHMARKS),bin/bench/$(B))
+
+
+# Link benchmarks.
+
+ifneq ($(LIBMDSSERVER_IS_INSTALLED),y)
+bin/bench/%: obj/bench/%.o bin/libmdsserver.so
+else
+bin/bench/%: obj/bench/%.o
+endif
+	@printf '\e[00;01;31mLD\e[34m %s\e[00m\n' "$@"
+	@mkdir -p $(shell dirname $@)
+	$(CC) $(C_FLAGS) -o $@ $(LDS) $(filter %.o,$^)
+	@echo
+
+# Benchmarks of libmdsserver's data structures only need libmdsserver, their
+# results have the fields benchmark, operation, size, operations and
+# ns_per_operation, where an operation is done on a structure of size elements.
+
+# Benchmarks of server internals are linked with the benchmarked object files.
+bin/bench/routing: obj/mds-server/interception-index.o obj/mds-server/condition-trie.o
+
+
+# Benchmarks of the display server as a whole spawn it, and use libmdsclient,
+# they share the spawning and the client handshake in obj/bench/harness.o.
+bin/bench/fast-lane: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/fast-lane: LDS += -lmdsclient
+bin/bench/shm-ring: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/shm-ring: LDS += -lmdsclient
+bin/bench/attachment: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/attachment: LDS += -lmdsclient
+bin/bench/contention: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/contention: LDS += -lmdsclient
+bin/bench/framing: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/framing: LDS += -lmdsclient
+bin/bench/stall: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/stall: LDS += -lmdsclient
+bin/bench/closing: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/closing: LDS += -lmdsclient
+bin/bench/reexec: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/reexec: LDS += -lmdsclient
+bin/bench/credit: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/credit: LDS += -lmdsclient
+bin/bench/coalesce: obj/bench/harness.o bin/libmdsclient.so bin/mds-server
+bin/bench/coalesce: LDS += -lmdsclient
@@ -86,26 +86,39 @@ endif
 	$(CC) $(C_FLAGS) -o $@ $(LDS) $(LDS_mds-kbdc) $(OBJ_mds-kbdc)
 	@echo
 
+# The load generator is a client of the display server.
+bin/mds-bench: LDS_mds-bench = -lmdsclient
+
+ifneq ($(LIBMDSSERVER_IS_INSTALLED),y)
+bin/mds-bench: obj/mds-bench.o obj/bench/harness.o bin/libmdsclient.so bin/libmdsserver.so
+else
+bin/mds-bench: obj/mds-bench.o obj/bench/harness.o bin/libmdsclient.so
+endif
+	@printf '\e[00;01;31mLD\e[34m %s\e[00m\n' "$@"
+	@mkdir -p $(shell dirname $@)
+	$(CC) $(C_FLAGS) -o $@ $(LDS) $(LDS_mds-bench) $(filter %.o,$^)
+	@echo
+
 
 # Build object files for kernel/servers/utilities.
 
 ifneq ($(LIBMDSSERVER_IS_INSTALLED),y)
-obj/%.o: src/%.c src/%.h src/mds-base.h src/libmdsserver/*.h $(SEDED)
+obj/%.o: src/%.c src/%.h src/mds-base.h src/libmdsserver/*.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -Isrc -c -o $@ $<
 	@echo
-obj/%.o: src/%.c src/mds-base.h src/libmdsserver/*.h $(SEDED)
+obj/%.o: src/%.c src/mds-base.h src/libmdsserver/*.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -Isrc -c -o $@ $<
 	@echo
-obj/mds-server/%.o: src/mds-server/%.c src/mds-server/*.h src/mds-base.h src/libmdsserver/*.h $(SEDED)
+obj/mds-server/%.o: src/mds-server/%.c src/mds-server/*.h src/mds-base.h src/libmdsserver/*.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -Isrc -c -o $@ $<
 	@echo
-obj/mds-registry/%.o: src/mds-registry/%.c src/mds-registry/*.h src/mds-base.h src/libmdsserver/*.h $(SEDED)
+obj/mds-registry/%.o: src/mds-registry/%.c src/mds-registry/*.h src/mds-base.h src/libmdsserver/*.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -Isrc -c -o $@ $<
@@ -116,22 +129,22 @@ obj/mds-kbdc/%.o: src/mds-kbdc/%.c src/mds-kbdc/*.h src/libmdsserver/*.h $(SEDED
 	$(CC) $(C_FLAGS) -Isrc -c -o $@ $<
 	@echo
 else
-obj/%.o: src/%.c src/%.h src/mds-base.h $(SEDED)
+obj/%.o: src/%.c src/%.h src/mds-base.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -c -o $@ $<
 	@echo
-obj/%.o: src/%.c src/mds-base.h $(SEDED)
+obj/%.o: src/%.c src/mds-base.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -c -o $@ $<
 	@echo
-obj/mds-server/%.o: src/mds-server/%.c src/mds-server/*.h src/mds-base.h $(SEDED)
+obj/mds-server/%.o: src/mds-server/%.c src/mds-server/*.h src/mds-base.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -c -o $@ $<
 	@echo
-obj/mds-registry/%.o: src/mds-registry/%.c src/mds-registry/*.h src/mds-base.h $(SEDED)
+obj/mds-registry/%.o: src/mds-registry/%.c src/mds-registry/*.h src/mds-base.h $(SEDED) $(SCHEMA_H)
 	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(C_FLAGS) -c -o $@ $<
@@ -149,7 +162,7 @@ endif
 bin/libmdsserver.so.$(LIBMDSSERVER_VERSION): $(foreach O,$(SERVEROBJ),obj/libmdsserver/$(O).o)
 	@printf '\e[00;01;31mLD\e[34m %s\e[00m\n' "$@"
 	@mkdir -p $(shell dirname $@)
-	$(CC) $(C_FLAGS) -shared -Wl,-soname,libmdsclient.so.$(LIBMDSSERVER_MAJOR) -o $@ $^
+	$(CC) $(C_FLAGS) -shared -Wl,-soname,libmdsserver.so.$(LIBMDSSERVER_MAJOR) -o $@ $^
 	@echo
 
 bin/libmdsserver.so.$(LIBMDSSERVER_MAJOR): bin/libmdsserver.so.$(LIBMDSSERVER_VERSION)
@@ -168,6 +181,18 @@ obj/libmdsserver/%.o: src/libmdsserver/%.c src/libmdsserver/*.h $(SEDED)
 	$(CC) $(C_FLAGS) -fPIC -c -o $@ $<
 	@echo
 
+# Compile protocol schemas.
+obj/mds-schema: src/schema/mds-schema.c
+	@printf '\e[00;01;31mCC\e[34m %s\e[00m\n' "$@"
+	@mkdir -p $(shell dirname $@)
+	$(CC) $(C_FLAGS) -o $@ $<
+	@echo
+
+$(SCHEMA_H): src/schema/%.h: src/schema/%.schema obj/mds-schema
+	@printf '\e[00;01;31mGEN\e[34m %s\e[00m\n' "$@"
+	obj/mds-schema $< > $@.tmp
+	mv $@.tmp $@
+
 # sed header files.
 ifneq ($(LIBMDSSERVER_IS_INSTALLED),y)
 src/libmdsserver/config.h: src/libmdsserver/config.h.in
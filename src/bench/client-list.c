@@ -0,0 +1,348 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of libmdsserver's client list, which mds-registry
+ * keeps the clients that wait for a protocol in. The lists are short,
+ * and removals search them, so they are measured with few clients.
+ * The results are printed as one JSON object per line, with the fields
+ * `benchmark`, `operation`, `size`, `operations` and `ns_per_operation`,
+ * where an operation is done on one client in a list with `size` clients.
+ */
+
+#include <libmdsserver/client-list.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+
+/**
+ * The number of operations in each measurement,
+ * for each list size
+ */
+#define OPERATIONS  (1 << 20)
+
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(size_t size, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Create a list and fill it
+ * 
+ * @param   list  Memory slot in which to store the list
+ * @param   size  The number of clients
+ * @return        Zero on success, -1 on error, destroy the list on error
+ */
+__attribute__((nonnull))
+static int fill(client_list_t* list, size_t size)
+{
+  size_t i;
+  list->clients = NULL;
+  fail_if (client_list_create(list, 0));
+  for (i = 0; i < size; i++)
+    fail_if (client_list_add(list, (uint64_t)(i + 1) << 32 | (uint64_t)i));
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Measure additions to an empty list
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_add(size_t size, size_t rounds)
+{
+  client_list_t list;
+  double start, elapsed = 0;
+  size_t r;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      start = now();
+      if (fill(&list, size))
+	{
+	  client_list_destroy(&list);
+	  return -1;
+	}
+      elapsed += now() - start;
+      client_list_destroy(&list);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure removals of all clients, in the order
+ * they were added, or in the reverse order
+ * 
+ * @param   size     The number of clients in the list
+ * @param   rounds   The number of times to perform the operation on each client
+ * @param   reverse  Whether the clients are removed in the reverse order
+ * @return           The time spent, in nanoseconds, negative on error
+ */
+static double op_remove_(size_t size, size_t rounds, int reverse)
+{
+  client_list_t list;
+  double start, elapsed = 0;
+  size_t r, i, j;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      if (fill(&list, size))
+	{
+	  client_list_destroy(&list);
+	  return -1;
+	}
+      start = now();
+      for (i = 0; i < size; i++)
+	{
+	  j = reverse ? size - i - 1 : i;
+	  client_list_remove(&list, (uint64_t)(j + 1) << 32 | (uint64_t)j);
+	}
+      elapsed += now() - start;
+      client_list_destroy(&list);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure removals of all clients, in the order they were added
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_remove(size_t size, size_t rounds)
+{
+  return op_remove_(size, rounds, 0);
+}
+
+
+/**
+ * Measure removals of all clients, in the reverse order they were added
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_remove_reverse(size_t size, size_t rounds)
+{
+  return op_remove_(size, rounds, 1);
+}
+
+
+/**
+ * Measure cloning of the list
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_clone(size_t size, size_t rounds)
+{
+  client_list_t list, copy;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  fail_if (fill(&list, size));
+  for (r = 0; r < rounds; r++)
+    {
+      copy.clients = NULL;
+      start = now();
+      if (client_list_clone(&list, &copy))
+	{
+	  client_list_destroy(&copy);
+	  fail_if (1);
+	}
+      sum += now() - start;
+      sink = (size_t)(copy.clients[0]);
+      client_list_destroy(&copy);
+    }
+  elapsed = sum;
+  
+ fail:
+  client_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling, or unmarshalling, of the list
+ * 
+ * @param   size       The number of clients in the list
+ * @param   rounds     The number of times to perform the operation on each client
+ * @param   unmarshal  Whether unmarshalling is measured
+ * @return             The time spent, in nanoseconds, negative on error
+ */
+static double marshal(size_t size, size_t rounds, int unmarshal)
+{
+  client_list_t list, copy;
+  char* data = NULL;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  fail_if (fill(&list, size));
+  fail_if (xmalloc(data, client_list_marshal_size(&list), char));
+  
+  if (unmarshal)
+    client_list_marshal(&list, data);
+  for (r = 0; r < rounds; r++)
+    if (unmarshal)
+      {
+	copy.clients = NULL;
+	start = now();
+	if (client_list_unmarshal(&copy, data))
+	  {
+	    client_list_destroy(&copy);
+	    fail_if (1);
+	  }
+	sum += now() - start;
+	client_list_destroy(&copy);
+      }
+    else
+      {
+	start = now();
+	client_list_marshal(&list, data);
+	sum += now() - start;
+      }
+  elapsed = sum;
+  
+ fail:
+  free(data);
+  client_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_marshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 0);
+}
+
+
+/**
+ * Measure unmarshalling
+ * 
+ * @param   size    The number of clients in the list
+ * @param   rounds  The number of times to perform the operation on each client
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_unmarshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 1);
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sizes[] = { 4, 16, 64, 256 };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "add",            op_add },
+      { "remove",         op_remove },
+      { "remove-reverse", op_remove_reverse },
+      { "clone",          op_clone },
+      { "marshal",        op_marshal },
+      { "unmarshal",      op_unmarshal },
+    };
+  size_t i, j, rounds;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+    for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+      {
+	rounds = OPERATIONS / sizes[j];
+	fail_if ((elapsed = operations[i].run(sizes[j], rounds)) < 0);
+	printf("{\"benchmark\": \"client-list\", \"operation\": \"%s\", \"size\": %zu, "
+	       "\"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+	       operations[i].name, sizes[j], rounds * sizes[j], elapsed / (double)(rounds * sizes[j]));
+	fflush(stdout);
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  return rc;
+}
+
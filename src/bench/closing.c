@@ -0,0 +1,403 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of how the display server copes with interceptors that
+ * close while multicasts wait for room in their outbound queues.
+ * A few senders flood a spawned mds-server with messages that a few
+ * interceptors, with small receive buffers, intercept but do not
+ * read, so the senders' multicasts wait for them, and then the
+ * interceptors close, or stay frozen until the server evicts them
+ * under the stall policy `close`. The server must let the senders
+ * continue, and not use the interceptors after it has freed them, so
+ * the benchmark fails if the senders cannot send the rest of their
+ * messages, if the server does not answer them afterwards, or if it
+ * does not disconnect the frozen interceptors. This is done with and
+ * without the reactor, and interceptors that close are also tested
+ * with and without a stall timeout. The results are printed as one
+ * JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+
+
+/**
+ * The number of clients that flood the server
+ */
+#define SENDERS  4
+
+/**
+ * The number of clients that intercept the messages and close
+ */
+#define INTERCEPTORS  3
+
+/**
+ * The number of messages each sender sends in each round
+ */
+#define MESSAGE_COUNT  (1 << 12)
+
+/**
+ * The size of the payload of each message
+ */
+#define PAYLOAD_SIZE  1024
+
+/**
+ * The size of the interceptors' receive buffers
+ */
+#define RECEIVE_BUFFER  4096
+
+/**
+ * The number of microseconds the interceptors
+ * let the senders flood them before they close
+ */
+#define CLOSE_DELAY  50000
+
+/**
+ * The number of milliseconds the server lets a client
+ * stall before it evicts it, when interceptors are evicted
+ */
+#define EVICT_TIMEOUT  200
+
+/**
+ * The number of rounds for each configuration
+ */
+#define ROUNDS  4
+
+/**
+ * The number of seconds a sender may be blocked before
+ * it considers the server to have stopped serving it
+ */
+#define SEND_TIMEOUT  10
+
+
+
+/**
+ * A client that floods the server
+ */
+typedef struct sender
+{
+  /**
+   * The client
+   */
+  libmds_connection_t connection;
+  
+  /**
+   * Message slot for the client
+   */
+  libmds_message_t message;
+  
+  /**
+   * The message to send
+   */
+  const char* stream;
+  
+  /**
+   * The length of `stream`
+   */
+  size_t length;
+  
+  /**
+   * Zero on success, -1 on error
+   */
+  int rc;
+  
+} sender_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+
+
+/**
+ * Send the flood, run as a thread
+ * 
+ * @param   data:sender_t*  The sender
+ * @return                  `NULL`
+ */
+static void* send_flood(void* data)
+{
+  sender_t* sender = data;
+  size_t i;
+  
+  sender->rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_connection_send(&(sender->connection), sender->stream, sender->length) < sender->length)
+      {
+	sender->rc = -1;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Connect a client that intercepts the flood, but does not read it
+ * 
+ * @param   connection  Initialised connection descriptor
+ * @param   message     Message slot to read into
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int connect_interceptor(libmds_connection_t* connection, libmds_message_t* message)
+{
+  int size = RECEIVE_BUFFER;
+  
+  fail_if (connect_client(connection, message));
+  fail_if (send_simple(connection, "Command: intercept", "Command: bench\n"));
+  fail_if (sync_client(connection, message));
+  fail_if (setsockopt(connection->socket_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Check whether the display server has disconnected a client,
+ * without waiting, what has already been sent to it is discarded
+ * 
+ * @param   connection  The client
+ * @return              1 if the client has been disconnected, 0 otherwise
+ */
+__attribute__((nonnull))
+static int is_disconnected(libmds_connection_t* connection)
+{
+  char buf[4096];
+  ssize_t r;
+  
+  while ((r = recv(connection->socket_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0);
+  return r == 0;
+}
+
+
+/**
+ * Run one round: flood the interceptors, close them, or let the
+ * server evict them, while the senders wait for them, and check
+ * that the senders can finish and are still served afterwards
+ * 
+ * @param   senders  The senders, connected
+ * @param   evict    Whether the server evicts the interceptors, rather than they close
+ * @param   elapsed  Output parameter for the number of nanoseconds it took the
+ *                   senders to finish after the interceptors closed, or after
+ *                   they would have closed if they are evicted
+ * @return           Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int round_(sender_t* senders, int evict, double* elapsed)
+{
+  libmds_connection_t interceptors[INTERCEPTORS];
+  libmds_message_t message;
+  pthread_t threads[SENDERS];
+  size_t i, started = 0, initialised = 0;
+  double closed;
+  int rc = -1;
+  
+  memset(&message, 0, sizeof(message));
+  fail_if (libmds_message_initialise(&message));
+  for (; initialised < INTERCEPTORS; initialised++)
+    fail_if (libmds_connection_initialise(interceptors + initialised));
+  for (i = 0; i < INTERCEPTORS; i++)
+    fail_if (connect_interceptor(interceptors + i, &message));
+  
+  for (; started < SENDERS; started++)
+    fail_if ((errno = pthread_create(threads + started, NULL, send_flood, senders + started)));
+  usleep(CLOSE_DELAY);
+  closed = now();
+  while ((evict == 0) && (initialised > 0))
+    libmds_connection_destroy(interceptors + --initialised);
+  
+  while (started > 0)
+    {
+      pthread_join(threads[--started], NULL);
+      if (senders[started].rc)
+	{
+	  fprintf(stderr, "%s: a sender could not finish after the interceptors %s\n",
+		  program_name, evict ? "stalled" : "closed");
+	  goto fail;
+	}
+    }
+  *elapsed = now() - closed;
+  
+  for (i = 0; i < initialised; i++)
+    if (!is_disconnected(interceptors + i))
+      {
+	fprintf(stderr, "%s: the server did not evict a stalled interceptor\n", program_name);
+	goto fail;
+      }
+  
+  for (i = 0; i < SENDERS; i++)
+    if (sync_client(&(senders[i].connection), &(senders[i].message)))
+      {
+	fprintf(stderr, "%s: the server stopped serving a sender after the interceptors %s\n",
+		program_name, evict ? "were evicted" : "closed");
+	goto fail;
+      }
+  
+  rc = 0;
+ fail:
+  while (started > 0)
+    {
+      pthread_cancel(threads[--started]);
+      pthread_join(threads[started], NULL);
+    }
+  while (initialised > 0)
+    libmds_connection_destroy(interceptors + --initialised);
+  libmds_message_destroy(&message);
+  return rc;
+}
+
+
+/**
+ * Measure how long it takes the senders to finish after the
+ * interceptors close, or are evicted, in one configuration of the server
+ * 
+ * @param   server         The pathname of the mds-server binary
+ * @param   reactor        Whether the server uses the reactor
+ * @param   stall_timeout  The stall timeout of the server, in milliseconds, zero for none
+ * @param   evict          Whether the server evicts the interceptors, rather than they close
+ * @return                 Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int measure(const char* server, int reactor, int stall_timeout, int evict)
+{
+  sender_t senders[SENDERS];
+  struct timeval timeout;
+  char* stream = NULL;
+  char* payload = NULL;
+  static char reactor_arg[] = "--reactor";
+  static char outbound_limit[] = "--outbound-limit=16384";
+  char stall_arg[sizeof("--stall-timeout=") + 3 * sizeof(int)];
+  char* args[4];
+  size_t i, n = 0, initialised = 0, stream_size = 0, length;
+  double elapsed, total = 0;
+  int rc = -1;
+  
+  args[n++] = outbound_limit;
+  if (reactor)
+    args[n++] = reactor_arg;
+  if (stall_timeout > 0)
+    {
+      snprintf(stall_arg, sizeof(stall_arg), "--stall-timeout=%i", stall_timeout);
+      args[n++] = stall_arg;
+    }
+  args[n] = NULL;
+  
+  for (; initialised < SENDERS; initialised++)
+    {
+      fail_if (libmds_connection_initialise(&(senders[initialised].connection)));
+      fail_if (libmds_message_initialise(&(senders[initialised].message)));
+    }
+  
+  fail_if (xmalloc(payload, PAYLOAD_SIZE + 1, char));
+  memset(payload, 'x', PAYLOAD_SIZE - 1);
+  payload[PAYLOAD_SIZE - 1] = '\n';
+  payload[PAYLOAD_SIZE] = '\0';
+  fail_if (libmds_compose(&stream, &stream_size, &length, payload, NULL,
+			  "Command: bench", "Message ID: 0", NULL));
+  
+  fail_if (spawn_server(server, args));
+  
+  /* A sender that is never let to continue fails the benchmark rather than hanging it. */
+  timeout.tv_sec = SEND_TIMEOUT;
+  timeout.tv_usec = 0;
+  for (i = 0; i < SENDERS; i++)
+    {
+      fail_if (connect_client(&(senders[i].connection), &(senders[i].message)));
+      fail_if (setsockopt(senders[i].connection.socket_fd, SOL_SOCKET, SO_SNDTIMEO,
+			  &timeout, sizeof(timeout)) < 0);
+      fail_if (setsockopt(senders[i].connection.socket_fd, SOL_SOCKET, SO_RCVTIMEO,
+			  &timeout, sizeof(timeout)) < 0);
+      senders[i].stream = stream;
+      senders[i].length = length;
+    }
+  
+  for (i = 0; i < ROUNDS; i++)
+    {
+      fail_if (round_(senders, evict, &elapsed));
+      total += elapsed;
+    }
+  
+  printf("{\"benchmark\": \"closing\", \"reactor\": %s, \"stall_timeout\": %i, "
+	 "\"interceptors_evicted\": %s, \"senders\": %i, \"interceptors\": %i, "
+	 "\"messages\": %i, \"rounds\": %i, \"ms_to_finish_after_close\": %.2f}\n",
+	 reactor ? "true" : "false", stall_timeout, evict ? "true" : "false",
+	 SENDERS, INTERCEPTORS, MESSAGE_COUNT, ROUNDS, total / ROUNDS / 1000000);
+  fflush(stdout);
+  
+  rc = 0;
+ fail:
+  kill_server();
+  free(stream);
+  free(payload);
+  for (i = 0; i < initialised; i++)
+    {
+      libmds_message_destroy(&(senders[i].message));
+      libmds_connection_destroy(&(senders[i].connection));
+    }
+  return rc;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  const char* server = argc_ > 1 ? argv_[1] : "bin/mds-server";
+  
+  program_name = *argv_;
+  
+  fail_if (measure(server, 0, 0, 0));
+  fail_if (measure(server, 0, 5000, 0));
+  fail_if (measure(server, 0, EVICT_TIMEOUT, 1));
+  fail_if (measure(server, 1, 0, 0));
+  fail_if (measure(server, 1, 5000, 0));
+  fail_if (measure(server, 1, EVICT_TIMEOUT, 1));
+  
+  return 0;
+ fail:
+  if (errno)
+    perror(program_name);
+  return 1;
+}
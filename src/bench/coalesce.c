@@ -0,0 +1,257 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of coalescing of state notifications. A producer multicasts
+ * a burst of updates of a state to a consumer, of a spawned mds-server,
+ * that spends some time on each message, once without and once with a
+ * `Coalesce` header. The number of messages that the consumer reads
+ * before it has the last update, and how long after the last update was
+ * sent that it has it, are printed as one JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+
+
+/**
+ * The number of updates the producer sends in each measurement
+ */
+#define UPDATE_COUNT  (1 << 14)
+
+/**
+ * The size of the payload of each message
+ */
+#define PAYLOAD_SIZE  512
+
+/**
+ * The number of nanoseconds the consumer spends on each message
+ */
+#define CONSUME_TIME  10000
+
+/**
+ * The number of seconds the consumer waits for a message
+ * before it considers the stream to have stopped
+ */
+#define RECEIVE_TIMEOUT  10
+
+
+
+/**
+ * The producer
+ */
+typedef struct producer
+{
+  /**
+   * The client
+   */
+  libmds_connection_t connection;
+  
+  /**
+   * Whether the updates have a `Coalesce` header
+   */
+  int coalesce;
+  
+  /**
+   * When the last update was sent
+   */
+  double finished;
+  
+  /**
+   * Zero if the producer has sent all updates, -1 on error
+   */
+  int rc;
+  
+} producer_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+
+
+/**
+ * Send the updates, run as a thread
+ * 
+ * @param   data:producer_t*  The producer
+ * @return                    `NULL`
+ */
+static void* produce(void* data)
+{
+  producer_t* producer = data;
+  char* buffer = NULL;
+  char* payload = NULL;
+  size_t i, buffer_size = 0, length;
+  
+  producer->rc = -1;
+  fail_if (xmalloc(payload, PAYLOAD_SIZE + 1, char));
+  memset(payload, 'x', PAYLOAD_SIZE - 1);
+  payload[PAYLOAD_SIZE - 1] = '\n';
+  payload[PAYLOAD_SIZE] = '\0';
+  
+  for (i = 0; i < UPDATE_COUNT; i++)
+    {
+      fail_if (libmds_compose(&buffer, &buffer_size, &length, payload, NULL,
+			      "Command: bench", "?Coalesce: state", producer->coalesce,
+			      "Value: %zu", i, "Message ID: 0", NULL));
+      fail_if (libmds_connection_send(&(producer->connection), buffer, length) < length);
+    }
+  producer->finished = now();
+  
+  producer->rc = 0;
+ fail:
+  free(buffer);
+  free(payload);
+  return NULL;
+}
+
+
+/**
+ * Spend time on a message
+ */
+static void consume(void)
+{
+  double end = now() + CONSUME_TIME;
+  while (now() < end);
+}
+
+
+/**
+ * Measure how many updates a slow consumer reads, and how
+ * long it takes it to catch up, with or without coalescing
+ * 
+ * @param   server    The pathname of the mds-server binary
+ * @param   coalesce  Whether the updates have a `Coalesce` header
+ * @return            Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int measure(const char* server, int coalesce)
+{
+  producer_t producer;
+  libmds_connection_t consumer;
+  libmds_message_t message;
+  struct timeval timeout;
+  pthread_t thread;
+  char last[3 * sizeof(size_t) + sizeof("Value: ")];
+  size_t i, received = 0;
+  int rc = -1, started = 0, done = 0;
+  double caught_up;
+  
+  memset(&producer, 0, sizeof(producer));
+  memset(&consumer, 0, sizeof(consumer));
+  memset(&message, 0, sizeof(message));
+  fail_if (libmds_connection_initialise(&(producer.connection)));
+  fail_if (libmds_connection_initialise(&consumer));
+  fail_if (libmds_message_initialise(&message));
+  producer.coalesce = coalesce;
+  sprintf(last, "Value: %zu", (size_t)(UPDATE_COUNT - 1));
+  
+  fail_if (spawn_server(server, NULL));
+  fail_if (connect_client(&(producer.connection), &message));
+  fail_if (connect_client(&consumer, &message));
+  fail_if (send_simple(&consumer, "Command: intercept", "Command: bench\n"));
+  fail_if (sync_client(&consumer, &message));
+  
+  /* A stream that has stopped fails the benchmark rather than hanging it. */
+  timeout.tv_sec = RECEIVE_TIMEOUT;
+  timeout.tv_usec = 0;
+  fail_if (setsockopt(consumer.socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0);
+  
+  fail_if ((errno = pthread_create(&thread, NULL, produce, &producer)));
+  started = 1;
+  
+  while (!done)
+    {
+      fail_if (libmds_message_read(&message, consumer.socket_fd));
+      received++;
+      consume();
+      for (i = 0; i < message.header_count; i++)
+	if (!strcmp(message.headers[i], last))
+	  done = 1;
+    }
+  caught_up = now();
+  pthread_join(thread, NULL);
+  started = 0;
+  if (producer.rc)
+    {
+      fprintf(stderr, "%s: the producer failed\n", program_name);
+      goto fail;
+    }
+  
+  printf("{\"benchmark\": \"coalesce\", \"coalesce\": %s, \"updates\": %i, "
+	 "\"messages_received\": %zu, \"catch_up_ms\": %.3f}\n",
+	 coalesce ? "true" : "false", UPDATE_COUNT, received,
+	 (caught_up - producer.finished) / 1000000);
+  fflush(stdout);
+  
+  rc = 0;
+ fail:
+  if (started)
+    {
+      pthread_cancel(thread);
+      pthread_join(thread, NULL);
+    }
+  kill_server();
+  libmds_message_destroy(&message);
+  libmds_connection_destroy(&(producer.connection));
+  libmds_connection_destroy(&consumer);
+  return rc;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  const char* server = argc_ > 1 ? argv_[1] : "bin/mds-server";
+  
+  program_name = *argv_;
+  
+  fail_if (measure(server, 0));
+  fail_if (measure(server, 1));
+  
+  return 0;
+ fail:
+  if (errno)
+    perror(program_name);
+  return 1;
+}
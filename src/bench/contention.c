@@ -0,0 +1,283 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of contention in the display server. Pairs of clients
+ * of a spawned mds-server exchange streams of messages concurrently,
+ * each sender with its own receiver, so the only thing the streams
+ * share is the server's registry of clients and interception
+ * conditions. The results are printed as one JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+
+/**
+ * The number of messages each sender sends in each measurement
+ */
+#define MESSAGE_COUNT  (1 << 12)
+
+/**
+ * The highest number of concurrent senders
+ */
+#define MAX_SENDERS  16
+
+
+
+/**
+ * A sender and the receiver of its messages
+ */
+typedef struct pair
+{
+  /**
+   * The sending client
+   */
+  libmds_connection_t sender;
+  
+  /**
+   * The receiving client
+   */
+  libmds_connection_t receiver;
+  
+  /**
+   * Message slot for the sender
+   */
+  libmds_message_t sender_message;
+  
+  /**
+   * Message slot for the receiver
+   */
+  libmds_message_t receiver_message;
+  
+  /**
+   * The message to send repeatedly
+   */
+  char* stream;
+  
+  /**
+   * The allocation size of `stream`
+   */
+  size_t stream_size;
+  
+  /**
+   * The length of `stream`
+   */
+  size_t length;
+  
+  /**
+   * Zero on success, -1 on error, for the sender
+   */
+  int send_rc;
+  
+  /**
+   * Zero on success, -1 on error, for the receiver
+   */
+  int receive_rc;
+  
+} pair_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+
+
+/**
+ * Send a stream of messages, run as a thread
+ * 
+ * @param   data:pair_t*  The sender and receiver
+ * @return                `NULL`
+ */
+static void* send_stream(void* data)
+{
+  pair_t* pair = data;
+  size_t i;
+  
+  pair->send_rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_connection_send(&(pair->sender), pair->stream, pair->length) < pair->length)
+      {
+	pair->send_rc = -1;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Receive a stream of messages, run as a thread
+ * 
+ * @param   data:pair_t*  The sender and receiver
+ * @return                `NULL`
+ */
+static void* receive_stream(void* data)
+{
+  pair_t* pair = data;
+  size_t i;
+  
+  pair->receive_rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_message_read(&(pair->receiver_message), pair->receiver.socket_fd))
+      {
+	pair->receive_rc = -1;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Measure the throughput of concurrent streams of messages
+ * 
+ * @param   pairs  The senders and receivers
+ * @param   count  The number of pairs to use
+ * @return         The total number of messages per second, negative on error
+ */
+__attribute__((nonnull))
+static double measure(pair_t* pairs, size_t count)
+{
+  pthread_t senders[MAX_SENDERS];
+  pthread_t receivers[MAX_SENDERS];
+  size_t i, started = 0;
+  double start, elapsed;
+  int rc = 0;
+  
+  start = now();
+  for (; started < count; started++)
+    {
+      if ((errno = pthread_create(receivers + started, NULL, receive_stream, pairs + started)))
+	break;
+      if ((errno = pthread_create(senders + started, NULL, send_stream, pairs + started)))
+	{
+	  /* The receiver will not get any messages. */
+	  pthread_cancel(receivers[started]);
+	  pthread_join(receivers[started], NULL);
+	  break;
+	}
+    }
+  for (i = 0; i < started; i++)
+    {
+      pthread_join(senders[i], NULL);
+      pthread_join(receivers[i], NULL);
+      if (pairs[i].send_rc || pairs[i].receive_rc)
+	rc = -1;
+    }
+  elapsed = now() - start;
+  
+  if ((started < count) || rc)
+    return -1;
+  return (double)(count * MESSAGE_COUNT) * 1000000000 / elapsed;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sender_counts[] = { 1, 2, 4, 8, MAX_SENDERS };
+  static const char payload[] = "contention\n";
+  pair_t pairs[MAX_SENDERS];
+  char* header = NULL;
+  size_t i, initialised = 0;
+  double rate, single = 0;
+  int rc = 1;
+  
+  program_name = *argv_;
+  
+  memset(pairs, 0, sizeof(pairs));
+  for (; initialised < MAX_SENDERS; initialised++)
+    {
+      fail_if (libmds_connection_initialise(&(pairs[initialised].sender)));
+      fail_if (libmds_connection_initialise(&(pairs[initialised].receiver)));
+      fail_if (libmds_message_initialise(&(pairs[initialised].sender_message)));
+      fail_if (libmds_message_initialise(&(pairs[initialised].receiver_message)));
+    }
+  
+  fail_if (spawn_server(argc_ > 1 ? argv_[1] : "bin/mds-server", NULL));
+  
+  /* Connect all clients up front, and let each receiver get the messages
+     addressed to it, so that every measurement routes against the same
+     registry. Connections are queued by the listening socket until the
+     server accepts them. */
+  for (i = 0; i < MAX_SENDERS; i++)
+    {
+      pair_t* pair = pairs + i;
+      fail_if (connect_client(&(pair->sender), &(pair->sender_message)));
+      fail_if (connect_client(&(pair->receiver), &(pair->receiver_message)));
+      fail_if (xasprintf(header, "To: %s\n", pair->receiver.client_id) < 0);
+      fail_if (send_simple(&(pair->receiver), "Command: intercept", header));
+      fail_if (sync_client(&(pair->receiver), &(pair->receiver_message)));
+      free(header), header = NULL;
+      fail_if (xasprintf(header, "To: %s", pair->receiver.client_id) < 0);
+      fail_if (libmds_compose(&(pair->stream), &(pair->stream_size), &(pair->length), payload, NULL,
+			      "Command: bench", header, "Message ID: 0", NULL));
+      free(header), header = NULL;
+    }
+  
+  for (i = 0; i < sizeof(sender_counts) / sizeof(*sender_counts); i++)
+    {
+      fail_if ((rate = measure(pairs, sender_counts[i])) < 0);
+      if (i == 0)
+	single = rate;
+      printf("{\"benchmark\": \"contention\", \"senders\": %zu, \"messages_per_sender\": %i, "
+	     "\"messages_per_second\": %.0f, \"scaling\": %.2f}\n",
+	     sender_counts[i], MESSAGE_COUNT, rate, rate / single);
+      fflush(stdout);
+    }
+  
+  rc = 0;
+ fail:
+  if (rc && errno)
+    perror(program_name);
+  kill_server();
+  free(header);
+  for (i = 0; i < initialised; i++)
+    {
+      free(pairs[i].stream);
+      libmds_message_destroy(&(pairs[i].sender_message));
+      libmds_message_destroy(&(pairs[i].receiver_message));
+      libmds_connection_destroy(&(pairs[i].sender));
+      libmds_connection_destroy(&(pairs[i].receiver));
+    }
+  return rc;
+}
@@ -0,0 +1,308 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of credit-based flow control. A producer multicasts a
+ * burst of messages to a consumer, of a spawned mds-server, that
+ * spends some time on each message, once without flow control, and
+ * once with the producer sending with a window of send credit and
+ * the consumer granting the display server credit as it consumes
+ * the messages. The number of messages that have been sent but not
+ * yet consumed, which are buffered by the display server or by the
+ * sockets, is sampled as the consumer reads, and is printed with the
+ * throughput as one JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+#include <libmdsclient/credit.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+
+
+/**
+ * The number of messages the producer sends in each measurement
+ */
+#define MESSAGE_COUNT  (1 << 15)
+
+/**
+ * The size of the payload of each message
+ */
+#define PAYLOAD_SIZE  256
+
+/**
+ * The number of nanoseconds the consumer spends on each message
+ */
+#define CONSUME_TIME  4000
+
+/**
+ * The number of messages the producer may send ahead of the routing
+ */
+#define SEND_WINDOW  64
+
+/**
+ * The number of messages the consumer lets the display
+ * server deliver ahead of the consumption
+ */
+#define RECEIVE_CREDIT  128
+
+/**
+ * The number of seconds the consumer waits for a message
+ * before it considers the stream to have stopped
+ */
+#define RECEIVE_TIMEOUT  10
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The message the producer sends
+ */
+static const char* stream_message;
+
+/**
+ * The length of `stream_message`
+ */
+static size_t stream_length;
+
+/**
+ * The number of messages the producer has sent
+ */
+static size_t produced;
+
+/**
+ * Zero if the producer has sent all messages, -1 on error
+ */
+static int produce_rc;
+
+
+
+/**
+ * Read the credit that the display server grants
+ * the producer, run as a thread
+ * 
+ * @param   data:libmds_connection_t*  The producer
+ * @return                             `NULL`
+ */
+static void* read_grants(void* data)
+{
+  libmds_connection_t* connection = data;
+  libmds_message_t message;
+  
+  if (libmds_message_initialise(&message))
+    return NULL;
+  while (libmds_message_read(&message, connection->socket_fd) == 0)
+    if (libmds_credit_received(connection, &message) < 0)
+      break;
+  libmds_message_destroy(&message);
+  return NULL;
+}
+
+
+/**
+ * Send the burst, run as a thread
+ * 
+ * @param   data:libmds_connection_t*  The producer
+ * @return                             `NULL`
+ */
+static void* produce(void* data)
+{
+  libmds_connection_t* connection = data;
+  size_t i;
+  
+  produce_rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    {
+      /* Without send credit, this is the same as `libmds_connection_send`. */
+      if (libmds_credit_send(connection, stream_message, stream_length, 0) < stream_length)
+	{
+	  produce_rc = -1;
+	  break;
+	}
+      __atomic_store_n(&produced, i + 1, __ATOMIC_RELAXED);
+    }
+  
+  return NULL;
+}
+
+
+/**
+ * Spend time on a message
+ */
+static void consume(void)
+{
+  double end = now() + CONSUME_TIME;
+  while (now() < end);
+}
+
+
+/**
+ * Measure the throughput of a burst, and how much of it is
+ * buffered, with or without flow control
+ * 
+ * @param   server  The pathname of the mds-server binary
+ * @param   credit  Whether to use credit
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int measure(const char* server, int credit)
+{
+  libmds_connection_t producer;
+  libmds_connection_t consumer;
+  libmds_message_t message;
+  struct timeval timeout;
+  pthread_t thread;
+  pthread_t producer_thread;
+  char* stream = NULL;
+  char* payload = NULL;
+  size_t i, stream_size = 0, length, in_flight, max_in_flight = 0, granted;
+  double start, elapsed;
+  int rc = -1, started = 0, producing = 0;
+  
+  memset(&producer, 0, sizeof(producer));
+  memset(&consumer, 0, sizeof(consumer));
+  memset(&message, 0, sizeof(message));
+  fail_if (libmds_connection_initialise(&producer));
+  fail_if (libmds_connection_initialise(&consumer));
+  fail_if (libmds_message_initialise(&message));
+  __atomic_store_n(&produced, 0, __ATOMIC_RELAXED);
+  
+  fail_if (spawn_server(server, NULL));
+  fail_if (connect_client(&producer, &message));
+  fail_if (connect_client(&consumer, &message));
+  fail_if (send_simple(&consumer, "Command: intercept", "Command: bench\n"));
+  if (credit)
+    fail_if (libmds_credit_grant(&consumer, RECEIVE_CREDIT, 0));
+  fail_if (sync_client(&consumer, &message));
+  
+  /* A stream that has stopped fails the benchmark rather than hanging it. */
+  timeout.tv_sec = RECEIVE_TIMEOUT;
+  timeout.tv_usec = 0;
+  fail_if (setsockopt(consumer.socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0);
+  
+  /* The grants are read by another thread, the first grant is the whole window. */
+  if (credit)
+    {
+      fail_if (libmds_credit_request(&producer, SEND_WINDOW));
+      fail_if ((errno = pthread_create(&thread, NULL, read_grants, &producer)));
+      started = 1;
+    }
+  
+  fail_if (xmalloc(payload, PAYLOAD_SIZE + 1, char));
+  memset(payload, 'x', PAYLOAD_SIZE - 1);
+  payload[PAYLOAD_SIZE - 1] = '\n';
+  payload[PAYLOAD_SIZE] = '\0';
+  fail_if (libmds_compose(&stream, &stream_size, &length, payload, NULL,
+			  "Command: bench", "Message ID: 0", NULL));
+  stream_message = stream;
+  stream_length = length;
+  
+  start = now();
+  fail_if ((errno = pthread_create(&producer_thread, NULL, produce, &producer)));
+  producing = 1;
+  
+  for (i = 0, granted = 0; i < MESSAGE_COUNT; i++)
+    {
+      fail_if (libmds_message_read(&message, consumer.socket_fd));
+      in_flight = __atomic_load_n(&produced, __ATOMIC_RELAXED) - i;
+      max_in_flight = max(max_in_flight, in_flight);
+      consume();
+      if (credit && (++granted == RECEIVE_CREDIT / 2))
+	{
+	  fail_if (libmds_credit_grant(&consumer, granted, 0));
+	  granted = 0;
+	}
+    }
+  elapsed = now() - start;
+  pthread_join(producer_thread, NULL);
+  producing = 0;
+  if (produce_rc)
+    {
+      fprintf(stderr, "%s: the producer failed\n", program_name);
+      goto fail;
+    }
+  
+  printf("{\"benchmark\": \"credit\", \"credit\": %s, \"messages\": %i, "
+	 "\"messages_per_second\": %.0f, \"max_in_flight\": %zu}\n",
+	 credit ? "true" : "false", MESSAGE_COUNT,
+	 (double)MESSAGE_COUNT * 1000000000 / elapsed, max_in_flight);
+  fflush(stdout);
+  
+  rc = 0;
+ fail:
+  if (producing)
+    {
+      pthread_cancel(producer_thread);
+      pthread_join(producer_thread, NULL);
+    }
+  if (started)
+    {
+      pthread_cancel(thread);
+      pthread_join(thread, NULL);
+    }
+  kill_server();
+  free(stream);
+  free(payload);
+  libmds_message_destroy(&message);
+  libmds_connection_destroy(&producer);
+  libmds_connection_destroy(&consumer);
+  return rc;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  const char* server = argc_ > 1 ? argv_[1] : "bin/mds-server";
+  
+  program_name = *argv_;
+  
+  fail_if (measure(server, 0));
+  fail_if (measure(server, 1));
+  
+  return 0;
+ fail:
+  if (errno)
+    perror(program_name);
+  return 1;
+}
+
@@ -0,0 +1,393 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of fast lanes. Two clients of a spawned mds-server
+ * exchange a stream of messages, first routed through the server,
+ * then over a fast lane that the server has opened between them.
+ * The results are printed as one JSON object per line. Beforehand,
+ * it checks that the server refuses lanes whose messages a third
+ * client intercepts, by the `To` header with or without a value or
+ * wildcard, in either direction, or by intercepting all messages,
+ * and that it opens lanes despite interceptions of other headers,
+ * and does not close lanes when clients start intercepting, as the
+ * lanes' messages bypass the server; the benchmark fails otherwise.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/lane.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+
+
+/**
+ * The number of messages sent in each measurement
+ */
+#define MESSAGE_COUNT  (1 << 14)
+
+
+
+/**
+ * A stream of messages to send
+ */
+typedef struct stream
+{
+  /**
+   * The connection to send the messages over
+   */
+  libmds_connection_t* connection;
+  
+  /**
+   * The message to send repeatedly
+   */
+  const char* message;
+  
+  /**
+   * The length of `message`
+   */
+  size_t length;
+  
+  /**
+   * Zero on success, -1 on error
+   */
+  int rc;
+  
+} stream_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+
+
+/**
+ * Send a stream of messages, run as a thread
+ * 
+ * @param   data:stream_t*  The stream
+ * @return                  `NULL`
+ */
+static void* send_stream(void* data)
+{
+  stream_t* stream = data;
+  size_t i;
+  
+  stream->rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_connection_send(stream->connection, stream->message, stream->length) < stream->length)
+      {
+	stream->rc = -1;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Measure the throughput of sending a stream of messages
+ * 
+ * @param   sender    The connection to send the messages over
+ * @param   receiver  The connection to read the messages from
+ * @param   message   Message slot to read into
+ * @param   stream    The message to send repeatedly
+ * @param   length    The length of `stream`
+ * @return            The number of messages per second, negative on error
+ */
+__attribute__((nonnull))
+static double measure(libmds_connection_t* sender, libmds_connection_t* receiver,
+		      libmds_message_t* message, const char* stream, size_t length)
+{
+  stream_t data = { .connection = sender, .message = stream, .length = length, .rc = 0 };
+  pthread_t thread;
+  double start, elapsed;
+  size_t i;
+  
+  start = now();
+  if ((errno = pthread_create(&thread, NULL, send_stream, &data)))
+    return -1;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_message_read(message, receiver->socket_fd))
+      break;
+  pthread_join(thread, NULL);
+  elapsed = now() - start;
+  
+  if ((i < MESSAGE_COUNT) || data.rc)
+    return -1;
+  return (double)MESSAGE_COUNT * 1000000000 / elapsed;
+}
+
+
+/**
+ * Start or stop intercepting messages
+ * 
+ * @param   connection  The intercepting client
+ * @param   message     Message slot to read into
+ * @param   condition   The interception condition, empty for all messages
+ * @param   stop        Whether to stop intercepting rather than start
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int intercept(libmds_connection_t* connection, libmds_message_t* message,
+		     const char* condition, int stop)
+{
+  char* payload = NULL;
+  
+  /* All messages are intercepted with an empty payload. */
+  if (*condition)
+    fail_if (xasprintf(payload, "%s\n", condition) < 0);
+  fail_if (send_simple(connection, stop ? "Command: intercept\nStop: yes" : "Command: intercept", payload));
+  free(payload), payload = NULL;
+  /* The server has updated the interceptions when it answers. */
+  fail_if (sync_client(connection, message));
+  return 0;
+ fail:
+  free(payload);
+  return -1;
+}
+
+
+/**
+ * Request a fast lane, and establish it if it is opened
+ * 
+ * @param   a          The client that requests the lane
+ * @param   message_a  Message slot to read into for `a`
+ * @param   b          The client at the other end of the lane
+ * @param   message_b  Message slot to read into for `b`
+ * @param   lane_a     Initialised, but not established, connection descriptor for `a`'s end
+ * @param   lane_b     Initialised, but not established, connection descriptor for `b`'s end
+ * @return             Zero if the lane was opened, the error number the server
+ *                     responded with if it refused the lane, -1 on error
+ */
+__attribute__((nonnull))
+static int request_lane(libmds_connection_t* a, libmds_message_t* message_a,
+			libmds_connection_t* b, libmds_message_t* message_b,
+			libmds_connection_t* lane_a, libmds_connection_t* lane_b)
+{
+  size_t i;
+  
+  fail_if (libmds_lane_open(a, b->client_id, NULL));
+  for (;;)
+    {
+      fail_if (libmds_message_read(message_a, a->socket_fd));
+      for (i = 0; i < message_a->header_count; i++)
+	if (!strncmp(message_a->headers[i], "Error: ", sizeof("Error: ") - 1))
+	  return atoi(message_a->headers[i] + sizeof("Error: ") - 1);
+	else if (!strncmp(message_a->headers[i], "Lane: ", sizeof("Lane: ") - 1))
+	  goto opened;
+    }
+ opened:
+  fail_if (libmds_lane_establish(lane_a, message_a));
+  fail_if (read_until(b, message_b, "Lane: ") == NULL);
+  fail_if (libmds_lane_establish(lane_b, message_b));
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Check which interceptions by a third client make the server refuse
+ * a fast lane, and that the lane is not closed by later interceptions
+ * 
+ * @param   a          Client that requests the lanes
+ * @param   message_a  Message slot to read into for `a`
+ * @param   b          Client that accepts fast lanes, and intercepts messages addressed to it
+ * @param   message_b  Message slot to read into for `b`
+ * @return             Zero on success, -1 on error or if the server did not behave as documented
+ */
+__attribute__((nonnull))
+static int check_policy(libmds_connection_t* a, libmds_message_t* message_a,
+			libmds_connection_t* b, libmds_message_t* message_b)
+{
+  libmds_connection_t c, lane_a, lane_b;
+  libmds_message_t message_c;
+  char* conditions[5] = { NULL, NULL, NULL, NULL, NULL };
+  char* header = NULL;
+  char* stream = NULL;
+  size_t i, stream_size = 0, length;
+  int r, rc = -1;
+  
+  fail_if (libmds_connection_initialise(&c));
+  fail_if (libmds_connection_initialise(&lane_a));
+  fail_if (libmds_connection_initialise(&lane_b));
+  fail_if (libmds_message_initialise(&message_c));
+  fail_if (connect_client(&c, &message_c));
+  
+  /* Each of these is refused, the last one because it is addressed to the requesting client. */
+  fail_if (xasprintf(conditions[0], "To: %s", b->client_id) < 0);
+  fail_if (xasprintf(conditions[1], "To: %.*s*", (int)(strchr(b->client_id, ':') - b->client_id), b->client_id) < 0);
+  fail_if (xstrdup(conditions[2], "To"));
+  fail_if (xstrdup(conditions[3], ""));
+  fail_if (xasprintf(conditions[4], "To: %s", a->client_id) < 0);
+  for (i = 0; i < sizeof(conditions) / sizeof(*conditions); i++)
+    {
+      fail_if (intercept(&c, &message_c, conditions[i], 0));
+      fail_if ((r = request_lane(a, message_a, b, message_b, &lane_a, &lane_b)) < 0);
+      if (r != EACCES)
+	{
+	  fprintf(stderr, "%s: a lane was not refused when another client intercepted `%s'\n",
+		  program_name, conditions[i]);
+	  goto fail;
+	}
+      fail_if (intercept(&c, &message_c, conditions[i], 1));
+    }
+  
+  /* The lane is opened, and stays open, as the server does not see its messages. */
+  fail_if (intercept(&c, &message_c, "Command: bench", 0));
+  fail_if ((r = request_lane(a, message_a, b, message_b, &lane_a, &lane_b)) < 0);
+  if (r != 0)
+    {
+      fprintf(stderr, "%s: a lane was refused when another client intercepted other headers\n",
+	      program_name);
+      goto fail;
+    }
+  fail_if (intercept(&c, &message_c, conditions[0], 0));
+  fail_if (xasprintf(header, "To: %s", b->client_id) < 0);
+  fail_if (libmds_compose(&stream, &stream_size, &length, NULL, NULL,
+			  "Command: bench", header, "Message ID: 0", NULL));
+  if ((libmds_connection_send(&lane_a, stream, length) < length) ||
+      libmds_message_read(message_b, lane_b.socket_fd))
+    {
+      fprintf(stderr, "%s: a lane was closed when another client started intercepting\n",
+	      program_name);
+      goto fail;
+    }
+  /* Otherwise the interceptions would hold up the routed messages that are measured. */
+  fail_if (intercept(&c, &message_c, conditions[0], 1));
+  fail_if (intercept(&c, &message_c, "Command: bench", 1));
+  
+  rc = 0;
+ fail:
+  free(stream);
+  free(header);
+  for (i = 0; i < sizeof(conditions) / sizeof(*conditions); i++)
+    free(conditions[i]);
+  libmds_message_destroy(&message_c);
+  libmds_connection_destroy(&c);
+  libmds_connection_destroy(&lane_a);
+  libmds_connection_destroy(&lane_b);
+  return rc;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t payload_sizes[] = { 64, 4096 };
+  libmds_connection_t a, b, lane_a, lane_b;
+  libmds_message_t message_a, message_b;
+  char* payload = NULL;
+  char* stream = NULL;
+  char* header = NULL;
+  size_t i, stream_size = 0, length;
+  double routed, laned;
+  int rc = 1;
+  
+  program_name = *argv_;
+  
+  fail_if (libmds_connection_initialise(&a));
+  fail_if (libmds_connection_initialise(&b));
+  fail_if (libmds_connection_initialise(&lane_a));
+  fail_if (libmds_connection_initialise(&lane_b));
+  fail_if (libmds_message_initialise(&message_a));
+  fail_if (libmds_message_initialise(&message_b));
+  
+  fail_if (spawn_server(argc_ > 1 ? argv_[1] : "bin/mds-server", NULL));
+  /* Connections are queued by the listening socket until the server accepts them. */
+  fail_if (connect_client(&a, &message_a));
+  fail_if (connect_client(&b, &message_b));
+  
+  /* Let b receive messages addressed to it, and accept fast lanes. */
+  fail_if (xasprintf(header, "To: %s\n", b.client_id) < 0);
+  fail_if (send_simple(&b, "Command: intercept", header));
+  fail_if (libmds_lane_accept(&b, 1));
+  fail_if (sync_client(&b, &message_b));
+  free(header), header = NULL;
+  
+  fail_if (check_policy(&a, &message_a, &b, &message_b));
+  
+  /* Measure routed messages, and open the fast lane afterwards so that
+     the routed messages are not competing with the lane's messages. */
+  fail_if (xasprintf(header, "To: %s", b.client_id) < 0);
+  for (i = 0; i < sizeof(payload_sizes) / sizeof(*payload_sizes); i++)
+    {
+      fail_if (xrealloc(payload, payload_sizes[i] + 1, char));
+      memset(payload, 'x', payload_sizes[i] - 1);
+      payload[payload_sizes[i] - 1] = '\n';
+      payload[payload_sizes[i]] = '\0';
+      fail_if (libmds_compose(&stream, &stream_size, &length, payload, NULL,
+			      "Command: bench", header, "Message ID: 0", NULL));
+      fail_if ((routed = measure(&a, &b, &message_b, stream, length)) < 0);
+      
+      if (i == 0)
+	{
+	  fail_if (libmds_lane_open(&a, b.client_id, NULL));
+	  fail_if (read_until(&a, &message_a, "Lane: ") == NULL);
+	  fail_if (libmds_lane_establish(&lane_a, &message_a));
+	  fail_if (read_until(&b, &message_b, "Lane: ") == NULL);
+	  fail_if (libmds_lane_establish(&lane_b, &message_b));
+	}
+      /* The lane is measured with the same messages, because it
+	 is not for the server to decide what goes over it. */
+      fail_if ((laned = measure(&lane_a, &lane_b, &message_b, stream, length)) < 0);
+      
+      printf("{\"benchmark\": \"fast-lane\", \"payload_bytes\": %zu, \"messages\": %i, "
+	     "\"routed_messages_per_second\": %.0f, \"lane_messages_per_second\": %.0f, "
+	     "\"speedup\": %.2f}\n",
+	     payload_sizes[i], MESSAGE_COUNT, routed, laned, laned / routed);
+      fflush(stdout);
+    }
+  
+  rc = 0;
+ fail:
+  if (rc && errno)
+    perror(program_name);
+  kill_server();
+  free(payload);
+  free(stream);
+  free(header);
+  libmds_message_destroy(&message_a);
+  libmds_message_destroy(&message_b);
+  libmds_connection_destroy(&a);
+  libmds_connection_destroy(&b);
+  libmds_connection_destroy(&lane_a);
+  libmds_connection_destroy(&lane_b);
+  return rc;
+}
+
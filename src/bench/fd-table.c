@@ -0,0 +1,351 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of libmdsserver's file descriptor table, which
+ * mds-server uses to find the client of a socket. The results are
+ * printed as one JSON object per line, with the fields `benchmark`,
+ * `operation`, `size`, `operations` and `ns_per_operation`, where an
+ * operation is done on one entry in a table with `size` entries.
+ */
+
+#include <libmdsserver/fd-table.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+
+/**
+ * The number of operations in each measurement,
+ * for each table size
+ */
+#define OPERATIONS  (1 << 20)
+
+/**
+ * The size of the largest table
+ */
+#define MAX_SIZE  (1 << 16)
+
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(size_t size, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Translate a value when a table is unmarshalled, by keeping it
+ * 
+ * @param   value  The value
+ * @return         The value
+ */
+__attribute__((const))
+static size_t remap(size_t value)
+{
+  return value;
+}
+
+
+/**
+ * Create a table and fill it, file descriptors
+ * are allocated densely, so the keys are too
+ * 
+ * @param   table  Memory slot in which to store the table
+ * @param   size   The number of entries
+ * @return         Zero on success, -1 on error, destroy the table on error
+ */
+__attribute__((nonnull))
+static int fill(fd_table_t* table, size_t size)
+{
+  size_t i;
+  fail_if (fd_table_create(table));
+  for (i = 0; i < size; i++)
+    if ((fd_table_put(table, (int)i, i + 1) == 0) && errno)
+      fail_if (1);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Release a table, it may be partially created
+ * 
+ * @param  table  The table
+ */
+__attribute__((nonnull))
+static void destroy(fd_table_t* table)
+{
+  if (table->values != NULL)
+    fd_table_destroy(table, NULL, NULL);
+  table->values = NULL;
+  table->used = NULL;
+}
+
+
+/**
+ * Measure insertions into an empty table
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_insert(size_t size, size_t rounds)
+{
+  fd_table_t table;
+  double start, elapsed = 0;
+  size_t r;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      table.values = NULL;
+      table.used = NULL;
+      start = now();
+      if (fill(&table, size))
+	{
+	  destroy(&table);
+	  return -1;
+	}
+      elapsed += now() - start;
+      destroy(&table);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure lookups
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_lookup(size_t size, size_t rounds)
+{
+  fd_table_t table;
+  double start, elapsed = -1;
+  size_t r, i, sum = 0;
+  
+  table.values = NULL;
+  table.used = NULL;
+  fail_if (fill(&table, size));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < size; i++)
+      sum += fd_table_get(&table, (int)i);
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  destroy(&table);
+  return elapsed;
+}
+
+
+/**
+ * Measure removals of all entries
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_remove(size_t size, size_t rounds)
+{
+  fd_table_t table;
+  double start, elapsed = 0;
+  size_t r, i;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      table.values = NULL;
+      table.used = NULL;
+      if (fill(&table, size))
+	{
+	  destroy(&table);
+	  return -1;
+	}
+      start = now();
+      for (i = 0; i < size; i++)
+	fd_table_remove(&table, (int)i);
+      elapsed += now() - start;
+      destroy(&table);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling, or unmarshalling, of the table
+ * 
+ * @param   size       The number of entries in the table
+ * @param   rounds     The number of times to perform the operation on each entry
+ * @param   unmarshal  Whether unmarshalling is measured
+ * @return             The time spent, in nanoseconds, negative on error
+ */
+static double marshal(size_t size, size_t rounds, int unmarshal)
+{
+  fd_table_t table, copy;
+  char* data = NULL;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  table.values = NULL;
+  table.used = NULL;
+  fail_if (fill(&table, size));
+  fail_if (xmalloc(data, fd_table_marshal_size(&table), char));
+  
+  if (unmarshal)
+    fd_table_marshal(&table, data);
+  for (r = 0; r < rounds; r++)
+    if (unmarshal)
+      {
+	copy.values = NULL;
+	copy.used = NULL;
+	start = now();
+	if (fd_table_unmarshal(&copy, data, remap))
+	  {
+	    destroy(&copy);
+	    fail_if (1);
+	  }
+	sum += now() - start;
+	destroy(&copy);
+      }
+    else
+      {
+	start = now();
+	fd_table_marshal(&table, data);
+	sum += now() - start;
+      }
+  elapsed = sum;
+  
+ fail:
+  free(data);
+  destroy(&table);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_marshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 0);
+}
+
+
+/**
+ * Measure unmarshalling
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_unmarshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 1);
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sizes[] = { 16, 256, 4096, MAX_SIZE };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "insert",    op_insert },
+      { "lookup",    op_lookup },
+      { "remove",    op_remove },
+      { "marshal",   op_marshal },
+      { "unmarshal", op_unmarshal },
+    };
+  size_t i, j, rounds;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+    for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+      {
+	rounds = OPERATIONS / sizes[j];
+	fail_if ((elapsed = operations[i].run(sizes[j], rounds)) < 0);
+	printf("{\"benchmark\": \"fd-table\", \"operation\": \"%s\", \"size\": %zu, "
+	       "\"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+	       operations[i].name, sizes[j], rounds * sizes[j], elapsed / (double)(rounds * sizes[j]));
+	fflush(stdout);
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  return rc;
+}
+
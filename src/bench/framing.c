@@ -0,0 +1,234 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of the binary framing. Two clients of a spawned mds-server
+ * exchange a stream of messages routed through the server, first both
+ * in the text framing, then with the receiver in the binary framing,
+ * so that the server translates, and then both in the binary framing.
+ * The results are printed as one JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/framing.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+
+/**
+ * The number of messages sent in each measurement
+ */
+#define MESSAGE_COUNT  (1 << 14)
+
+
+
+/**
+ * A stream of messages to send
+ */
+typedef struct stream
+{
+  /**
+   * The connection to send the messages over
+   */
+  libmds_connection_t* connection;
+  
+  /**
+   * The message to send repeatedly
+   */
+  const char* message;
+  
+  /**
+   * The length of `message`
+   */
+  size_t length;
+  
+  /**
+   * Zero on success, -1 on error
+   */
+  int rc;
+  
+} stream_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+
+
+/**
+ * Send a stream of messages, run as a thread
+ * 
+ * @param   data:stream_t*  The stream
+ * @return                  `NULL`
+ */
+static void* send_stream(void* data)
+{
+  stream_t* stream = data;
+  size_t i;
+  
+  stream->rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_connection_send(stream->connection, stream->message, stream->length) < stream->length)
+      {
+	stream->rc = -1;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Measure the throughput of sending a stream of messages
+ * 
+ * @param   sender    The connection to send the messages over
+ * @param   receiver  The connection to read the messages from
+ * @param   message   Message slot to read into
+ * @param   stream    The message to send repeatedly
+ * @param   length    The length of `stream`
+ * @return            The number of messages per second, negative on error
+ */
+__attribute__((nonnull))
+static double measure(libmds_connection_t* sender, libmds_connection_t* receiver,
+		      libmds_message_t* message, const char* stream, size_t length)
+{
+  stream_t data = { .connection = sender, .message = stream, .length = length, .rc = 0 };
+  pthread_t thread;
+  double start, elapsed;
+  size_t i;
+  
+  start = now();
+  if ((errno = pthread_create(&thread, NULL, send_stream, &data)))
+    return -1;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_message_read(message, receiver->socket_fd))
+      break;
+  pthread_join(thread, NULL);
+  elapsed = now() - start;
+  
+  if ((i < MESSAGE_COUNT) || data.rc)
+    return -1;
+  return (double)MESSAGE_COUNT * 1000000000 / elapsed;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t payload_sizes[] = { 0, 64, 4096 };
+  static const char* const framings[] = { "text-to-text", "text-to-binary", "binary-to-binary" };
+  libmds_connection_t a, b;
+  libmds_message_t message_a, message_b;
+  char* payload = NULL;
+  char* stream = NULL;
+  char* header = NULL;
+  size_t i, j, stream_size = 0, length;
+  double rate;
+  int rc = 1;
+  
+  program_name = *argv_;
+  
+  fail_if (libmds_connection_initialise(&a));
+  fail_if (libmds_connection_initialise(&b));
+  fail_if (libmds_message_initialise(&message_a));
+  fail_if (libmds_message_initialise(&message_b));
+  
+  fail_if (spawn_server(argc_ > 1 ? argv_[1] : "bin/mds-server", NULL));
+  /* Connections are queued by the listening socket until the server accepts them. */
+  fail_if (connect_client(&a, &message_a));
+  fail_if (connect_client(&b, &message_b));
+  
+  /* Let b receive messages addressed to it. */
+  fail_if (xasprintf(header, "To: %s\n", b.client_id) < 0);
+  fail_if (send_simple(&b, "Command: intercept", header));
+  fail_if (sync_client(&b, &message_b));
+  free(header), header = NULL;
+  
+  fail_if (xasprintf(header, "To: %s", b.client_id) < 0);
+  for (j = 0; j < sizeof(framings) / sizeof(*framings); j++)
+    {
+      /* Switch the receiver first, so that the server translates. */
+      if (j == 1)
+	{
+	  fail_if (libmds_framing_set(&b, 1));
+	  fail_if (sync_client(&b, &message_b));
+	}
+      else if (j == 2)
+	{
+	  fail_if (libmds_framing_set(&a, 1));
+	  fail_if (sync_client(&a, &message_a));
+	}
+      
+      for (i = 0; i < sizeof(payload_sizes) / sizeof(*payload_sizes); i++)
+	{
+	  fail_if (xrealloc(payload, payload_sizes[i] + 1, char));
+	  if (payload_sizes[i] > 0)
+	    {
+	      memset(payload, 'x', payload_sizes[i] - 1);
+	      payload[payload_sizes[i] - 1] = '\n';
+	    }
+	  payload[payload_sizes[i]] = '\0';
+	  fail_if ((a.binary ? libmds_compose_binary : libmds_compose)
+		   (&stream, &stream_size, &length, payload_sizes[i] ? payload : NULL, NULL,
+		    "Command: bench", header, "Message ID: 0", NULL));
+	  fail_if ((rate = measure(&a, &b, &message_b, stream, length)) < 0);
+	  
+	  printf("{\"benchmark\": \"framing\", \"framing\": \"%s\", \"payload_bytes\": %zu, "
+		 "\"messages\": %i, \"message_bytes\": %zu, \"messages_per_second\": %.0f}\n",
+		 framings[j], payload_sizes[i], MESSAGE_COUNT, length, rate);
+	  fflush(stdout);
+	}
+    }
+  
+  rc = 0;
+ fail:
+  if (rc && errno)
+    perror(program_name);
+  kill_server();
+  free(payload);
+  free(stream);
+  free(header);
+  libmds_message_destroy(&message_a);
+  libmds_message_destroy(&message_b);
+  libmds_connection_destroy(&a);
+  libmds_connection_destroy(&b);
+  return rc;
+}
+
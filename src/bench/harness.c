@@ -0,0 +1,248 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "harness.h"
+
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+
+/**
+ * The directory of the display socket
+ */
+static char directory[] = "/tmp/mds-bench-XXXXXX";
+
+/**
+ * The pathname of the display socket
+ */
+static char socket_path[sizeof(directory) + sizeof("/socket")];
+
+/**
+ * The process ID of the display server, zero if not spawned
+ */
+pid_t server_pid = 0;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Spawn a display server, listening on a socket in a new temporary
+ * directory, it may be spawned again after `kill_server`
+ * 
+ * @param   server  The pathname of the mds-server binary, it is
+ *                  searched for in PATH if it has no slash
+ * @param   args    Additional command line arguments for the display
+ *                  server, terminated by `NULL`, `NULL` if none
+ * @return          Zero on success, -1 on error
+ */
+int spawn_server(const char* server, char* const* args)
+{
+  static char initial_spawn[] = "--initial-spawn";
+  struct sockaddr_un address;
+  char arg[sizeof("--socket-fd=") + 3 * sizeof(int)];
+  char* server_ = NULL;
+  char** argv_ = NULL;
+  size_t n = 0, i;
+  int fd = -1, null_fd, saved_errno;
+  
+  fail_if ((server_ = strdup(server)) == NULL);
+  for (; args && args[n]; n++);
+  fail_if (xmalloc(argv_, n + 4, char*));
+  
+  /* mkdtemp replaces the template, it is restored so that the server can be spawned again. */
+  memcpy(directory + sizeof(directory) - 7, "XXXXXX", 6);
+  fail_if (mkdtemp(directory) == NULL);
+  sprintf(socket_path, "%s/socket", directory);
+  
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  fail_if ((fd = socket(PF_UNIX, SOCK_STREAM, 0)) < 0);
+  fail_if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0);
+  fail_if (listen(fd, SOMAXCONN) < 0);
+  
+  fail_if ((server_pid = fork()) < 0);
+  if (server_pid == 0)
+    {
+      /* The server complains about the missing mdsinitrc, which is not of interest. */
+      if ((null_fd = open("/dev/null", O_WRONLY)) >= 0)
+	dup2(null_fd, STDERR_FILENO);
+      sprintf(arg, "--socket-fd=%i", fd);
+      argv_[0] = server_;
+      argv_[1] = initial_spawn;
+      argv_[2] = arg;
+      for (i = 0; i < n; i++)
+	argv_[i + 3] = args[i];
+      argv_[n + 3] = NULL;
+      execvp(server_, argv_);
+      _exit(1);
+    }
+  
+  close(fd);
+  free(server_);
+  free(argv_);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  free(server_);
+  free(argv_);
+  server_pid = 0;
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Terminate the display server and remove its socket
+ */
+void kill_server(void)
+{
+  if (server_pid > 0)
+    {
+      kill(server_pid, SIGTERM);
+      waitpid(server_pid, NULL, 0);
+    }
+  unlink(socket_path);
+  rmdir(directory);
+  server_pid = 0;
+}
+
+
+/**
+ * Send a message with a message ID, in the framing of the connection
+ * 
+ * @param   connection  The connection to send the message over
+ * @param   header      The header, other than `Message ID`, of the message
+ * @param   payload     The payload of the message, `NULL` if none
+ * @return              Zero on success, -1 on error
+ */
+int send_simple(libmds_connection_t* connection, const char* header, const char* payload)
+{
+  char* buffer = NULL;
+  size_t buffer_size = 0, length;
+  
+  fail_if (libmds_next_message_id(&(connection->message_id), NULL, NULL));
+  fail_if ((connection->binary ? libmds_compose_binary : libmds_compose)
+	   (&buffer, &buffer_size, &length, payload, NULL,
+	    "%s", header, LIBMDS_HEADER_MESSAGE_ID(connection), NULL));
+  fail_if (libmds_connection_send(connection, buffer, length) < length);
+  free(buffer);
+  return 0;
+ fail:
+  free(buffer);
+  return -1;
+}
+
+
+/**
+ * Read a message that has a specific header
+ * 
+ * @param   connection  The connection to read from
+ * @param   message     Message slot to read into
+ * @param   header      The beginning of a header the message must have,
+ *                      other messages are skipped
+ * @return              The value of the header, `NULL` on error
+ */
+const char* read_until(libmds_connection_t* connection, libmds_message_t* message,
+		       const char* header)
+{
+  size_t i, n = strlen(header);
+  for (;;)
+    {
+      fail_if (libmds_message_read(message, connection->socket_fd));
+      for (i = 0; i < message->header_count; i++)
+	if (!strncmp(message->headers[i], header, n))
+	  return message->headers[i] + n;
+    }
+ fail:
+  return NULL;
+}
+
+
+/**
+ * Connect a client to the display server and get its client ID
+ * 
+ * @param   connection  Initialised connection descriptor
+ * @param   message     Message slot to read into
+ * @return              Zero on success, -1 on error
+ */
+int connect_client(libmds_connection_t* connection, libmds_message_t* message)
+{
+  char display[sizeof(":file:") + sizeof(socket_path)];
+  const char* display_ = display;
+  const char* id;
+  
+  sprintf(display, ":file:%s", socket_path);
+  fail_if (libmds_connection_establish(connection, &display_));
+  fail_if (send_simple(connection, "Command: assign-id", NULL));
+  fail_if ((id = read_until(connection, message, "ID assignment: ")) == NULL);
+  fail_if (xstrdup(connection->client_id, id));
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Wait until the display server has processed all
+ * messages that a client has sent so far
+ * 
+ * The display server processes a client's messages in order,
+ * so it has processed the earlier messages once it has replied
+ * to a repeated ID assignment request
+ * 
+ * @param   connection  The client
+ * @param   message     Message slot to read into
+ * @return              Zero on success, -1 on error
+ */
+int sync_client(libmds_connection_t* connection, libmds_message_t* message)
+{
+  fail_if (send_simple(connection, "Command: assign-id", NULL));
+  fail_if (read_until(connection, message, "ID assignment: ") == NULL);
+  return 0;
+ fail:
+  return -1;
+}
+
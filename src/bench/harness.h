@@ -0,0 +1,112 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_BENCH_HARNESS_H
+#define MDS_BENCH_HARNESS_H
+
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+
+#include <sys/types.h>
+
+
+
+/**
+ * The process ID of the display server, zero if not spawned
+ */
+extern pid_t server_pid;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+double now(void);
+
+/**
+ * Spawn a display server, listening on a socket in a new temporary
+ * directory, it may be spawned again after `kill_server`
+ * 
+ * @param   server  The pathname of the mds-server binary, it is
+ *                  searched for in PATH if it has no slash
+ * @param   args    Additional command line arguments for the display
+ *                  server, terminated by `NULL`, `NULL` if none
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull(1)))
+int spawn_server(const char* server, char* const* args);
+
+/**
+ * Terminate the display server and remove its socket
+ */
+void kill_server(void);
+
+/**
+ * Send a message with a message ID, in the framing of the connection
+ * 
+ * @param   connection  The connection to send the message over
+ * @param   header      The header, other than `Message ID`, of the message
+ * @param   payload     The payload of the message, `NULL` if none
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull(1, 2)))
+int send_simple(libmds_connection_t* connection, const char* header, const char* payload);
+
+/**
+ * Read a message that has a specific header
+ * 
+ * @param   connection  The connection to read from
+ * @param   message     Message slot to read into
+ * @param   header      The beginning of a header the message must have,
+ *                      other messages are skipped
+ * @return              The value of the header, `NULL` on error
+ */
+__attribute__((nonnull))
+const char* read_until(libmds_connection_t* connection, libmds_message_t* message,
+		       const char* header);
+
+/**
+ * Connect a client to the display server and get its client ID
+ * 
+ * @param   connection  Initialised connection descriptor
+ * @param   message     Message slot to read into
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int connect_client(libmds_connection_t* connection, libmds_message_t* message);
+
+/**
+ * Wait until the display server has processed all
+ * messages that a client has sent so far
+ * 
+ * The display server processes a client's messages in order,
+ * so it has processed the earlier messages once it has replied
+ * to a repeated ID assignment request
+ * 
+ * @param   connection  The client
+ * @param   message     Message slot to read into
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int sync_client(libmds_connection_t* connection, libmds_message_t* message);
+
+
+#endif
+
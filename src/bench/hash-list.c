@@ -0,0 +1,490 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the lists that are created with libmdsserver's
+ * `CREATE_HASH_LIST_SUBCLASS`, as mds-colour keeps its colours in.
+ * The lists are searched linearly, so they are measured with few
+ * entries. The results are printed as one JSON object per line, with
+ * the fields `benchmark`, `operation`, `size`, `operations` and
+ * `ns_per_operation`, where an operation is done on one entry in a
+ * list with `size` entries.
+ */
+
+#include <libmdsserver/hash-list.h>
+#include <libmdsserver/hash-help.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+
+/**
+ * The number of operations in each measurement,
+ * for each list size
+ */
+#define OPERATIONS  (1 << 20)
+
+/**
+ * The size of the largest list
+ */
+#define MAX_SIZE  256
+
+
+
+CREATE_HASH_LIST_SUBCLASS(bench_list, char* restrict, const char* restrict, size_t)
+
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(size_t size, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The keys
+ */
+static char* keys[MAX_SIZE];
+
+/**
+ * Keys that are not in the lists
+ */
+static char* missing_keys[MAX_SIZE];
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Comparing keys
+ * 
+ * @param   key_a  The first key, will never be `NULL`
+ * @param   key_b  The second key, will never be `NULL`
+ * @return         Whether the keys are equal
+ */
+static int bench_list_key_comparer(const char* key_a, const char* key_b)
+{
+  return !strcmp(key_a, key_b);
+}
+
+
+/**
+ * Determine the marshal-size of an entry's key and value
+ * 
+ * @param   entry  The entry, will never be `NULL`, any only used entries will be passed
+ * @return         The marshal-size of the entry's key and value
+ */
+static size_t bench_list_submarshal_size(const bench_list_entry_t* entry)
+{
+  return sizeof(size_t) + (strlen(entry->key) + 1) * sizeof(char);
+}
+
+
+/**
+ * Marshal an entry's key and value
+ * 
+ * @param   entry  The entry, will never be `NULL`, any only used entries will be passed
+ * @param   data   The buffer where the entry's key and value will be stored
+ * @return         The marshal-size of the entry's key and value
+ */
+static size_t bench_list_submarshal(const bench_list_entry_t* entry, char* restrict data)
+{
+  size_t n = (strlen(entry->key) + 1) * sizeof(char);
+  memcpy(data, &(entry->value), sizeof(size_t));
+  data += sizeof(size_t) / sizeof(char);
+  memcpy(data, entry->key, n);
+  return sizeof(size_t) + n;
+}
+
+
+/**
+ * Unmarshal an entry's key and value
+ * 
+ * @param   entry  The entry, will never be `NULL`, any only used entries will be passed
+ * @param   data   The buffer where the entry's key and value is stored
+ * @return         The number of read bytes, zero on error
+ */
+static size_t bench_list_subunmarshal(bench_list_entry_t* entry, char* restrict data)
+{
+  size_t n = 0;
+  memcpy(&(entry->value), data, sizeof(size_t));
+  data += sizeof(size_t) / sizeof(char);
+  while (data[n++]);
+  n *= sizeof(char);
+  fail_if (xbmalloc(entry->key, n));
+  memcpy(entry->key, data, n);
+  return sizeof(size_t) + n;
+ fail:
+  return 0;
+}
+
+
+/**
+ * Free the key of an unmarshalled entry
+ * 
+ * @param  entry  The entry
+ */
+static void free_key(bench_list_entry_t* entry)
+{
+  free(entry->key);
+}
+
+
+/**
+ * Create a list and fill it
+ * 
+ * @param   list  Memory slot in which to store the list
+ * @param   size  The number of entries
+ * @return        Zero on success, -1 on error, destroy the list on error
+ */
+__attribute__((nonnull))
+static int fill(bench_list_t* list, size_t size)
+{
+  size_t i, value;
+  memset(list, 0, sizeof(*list));
+  fail_if (bench_list_create(list, 0));
+  list->hasher = string_hash;
+  for (i = 0; i < size; i++)
+    {
+      value = i + 1;
+      fail_if (bench_list_put(list, keys[i], &value));
+    }
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Measure insertions into an empty list
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_put(size_t size, size_t rounds)
+{
+  bench_list_t list;
+  double start, elapsed = 0;
+  size_t r;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      start = now();
+      if (fill(&list, size))
+	{
+	  bench_list_destroy(&list);
+	  return -1;
+	}
+      elapsed += now() - start;
+      bench_list_destroy(&list);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure lookups of keys that are in the list, or that are not
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @param   miss    Whether the keys are not in the list
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double get(size_t size, size_t rounds, int miss)
+{
+  bench_list_t list;
+  double start, elapsed = -1;
+  size_t r, i, sum = 0, value = 0;
+  
+  fail_if (fill(&list, size));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < size; i++)
+      {
+	bench_list_get(&list, miss ? missing_keys[i] : keys[i], &value);
+	sum += value;
+      }
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  bench_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure lookups of keys that are in the list
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_get(size_t size, size_t rounds)
+{
+  return get(size, rounds, 0);
+}
+
+
+/**
+ * Measure lookups of keys that are not in the list
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_get_miss(size_t size, size_t rounds)
+{
+  return get(size, rounds, 1);
+}
+
+
+/**
+ * Measure removals of all entries, each after looking
+ * it up, as the hash list is meant to be used
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_remove(size_t size, size_t rounds)
+{
+  bench_list_t list;
+  double start, elapsed = 0;
+  size_t r, i, value;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      if (fill(&list, size))
+	{
+	  bench_list_destroy(&list);
+	  return -1;
+	}
+      start = now();
+      for (i = 0; i < size; i++)
+	{
+	  bench_list_get(&list, keys[i], &value);
+	  bench_list_remove(&list, keys[i]);
+	}
+      elapsed += now() - start;
+      bench_list_destroy(&list);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure cloning of the list
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_clone(size_t size, size_t rounds)
+{
+  bench_list_t list, copy;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  fail_if (fill(&list, size));
+  for (r = 0; r < rounds; r++)
+    {
+      memset(&copy, 0, sizeof(copy));
+      start = now();
+      if (bench_list_clone(&list, &copy))
+	{
+	  bench_list_destroy(&copy);
+	  fail_if (1);
+	}
+      sum += now() - start;
+      bench_list_destroy(&copy);
+    }
+  elapsed = sum;
+  
+ fail:
+  bench_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling, or unmarshalling, of the list
+ * 
+ * @param   size       The number of entries in the list
+ * @param   rounds     The number of times to perform the operation on each entry
+ * @param   unmarshal  Whether unmarshalling is measured
+ * @return             The time spent, in nanoseconds, negative on error
+ */
+static double marshal(size_t size, size_t rounds, int unmarshal)
+{
+  bench_list_t list, copy;
+  char* data = NULL;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  int failed;
+  
+  fail_if (fill(&list, size));
+  fail_if (xmalloc(data, bench_list_marshal_size(&list), char));
+  
+  if (unmarshal)
+    bench_list_marshal(&list, data);
+  for (r = 0; r < rounds; r++)
+    if (unmarshal)
+      {
+	memset(&copy, 0, sizeof(copy));
+	start = now();
+	failed = bench_list_unmarshal(&copy, data);
+	sum += now() - start;
+	copy.freer = free_key;
+	bench_list_destroy(&copy);
+	fail_if (failed);
+      }
+    else
+      {
+	start = now();
+	bench_list_marshal(&list, data);
+	sum += now() - start;
+      }
+  elapsed = sum;
+  
+ fail:
+  free(data);
+  bench_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_marshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 0);
+}
+
+
+/**
+ * Measure unmarshalling
+ * 
+ * @param   size    The number of entries in the list
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_unmarshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 1);
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sizes[] = { 4, 16, 64, MAX_SIZE };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "put",       op_put },
+      { "get",       op_get },
+      { "get-miss",  op_get_miss },
+      { "remove",    op_remove },
+      { "clone",     op_clone },
+      { "marshal",   op_marshal },
+      { "unmarshal", op_unmarshal },
+    };
+  size_t i, j, rounds, created = 0;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  for (; created < MAX_SIZE; created++)
+    {
+      missing_keys[created] = NULL;
+      fail_if (xasprintf(keys[created], "colour-%zu", created) < 0);
+      fail_if (xasprintf(missing_keys[created], "missing-%zu", created) < 0);
+    }
+  
+  for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+    for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+      {
+	rounds = OPERATIONS / sizes[j];
+	fail_if ((elapsed = operations[i].run(sizes[j], rounds)) < 0);
+	printf("{\"benchmark\": \"hash-list\", \"operation\": \"%s\", \"size\": %zu, "
+	       "\"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+	       operations[i].name, sizes[j], rounds * sizes[j], elapsed / (double)(rounds * sizes[j]));
+	fflush(stdout);
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  for (i = 0; i <= created && i < MAX_SIZE; i++)
+    {
+      free(keys[i]);
+      free(missing_keys[i]);
+    }
+  return rc;
+}
+
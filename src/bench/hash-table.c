@@ -0,0 +1,485 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of libmdsserver's hash table, with integer keys, and
+ * with string keys, as the interception index uses. The results are
+ * printed as one JSON object per line, with the fields `benchmark`,
+ * `operation`, `size`, `operations` and `ns_per_operation`, where an
+ * operation is done on one entry in a table with `size` entries.
+ */
+
+#include <libmdsserver/hash-table.h>
+#include <libmdsserver/hash-help.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+
+/**
+ * The number of operations in each measurement,
+ * for each table size
+ */
+#define OPERATIONS  (1 << 20)
+
+/**
+ * The size of the largest table
+ */
+#define MAX_SIZE  (1 << 16)
+
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(size_t size, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The integer keys
+ */
+static size_t int_keys[MAX_SIZE];
+
+/**
+ * The string keys
+ */
+static char* string_keys[MAX_SIZE];
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Calculate the hash of a string key
+ * 
+ * @param   key:const char*  The key
+ * @return                   The hash of the key
+ */
+__attribute__((pure))
+static size_t key_hash(size_t key)
+{
+  return string_hash((const char*)(void*)key);
+}
+
+
+/**
+ * Check whether two string keys are equal
+ * 
+ * @param   a:char*  One of the keys
+ * @param   b:char*  The other of the two keys
+ * @return           Whether the keys are equal
+ */
+__attribute__((pure))
+static int key_comparator(size_t a, size_t b)
+{
+  return !strcmp((const char*)(void*)a, (const char*)(void*)b);
+}
+
+
+/**
+ * Translate a value when a table is unmarshalled, by keeping it
+ * 
+ * @param   value  The value
+ * @return         The value
+ */
+__attribute__((const))
+static size_t remap(size_t value)
+{
+  return value;
+}
+
+
+/**
+ * Create a table and fill it
+ * 
+ * @param   table    Memory slot in which to store the table
+ * @param   size     The number of entries
+ * @param   strings  Whether the keys are strings
+ * @return           Zero on success, -1 on error, destroy the table on error
+ */
+__attribute__((nonnull))
+static int fill(hash_table_t* table, size_t size, int strings)
+{
+  size_t i;
+  fail_if (hash_table_create(table));
+  if (strings)
+    {
+      table->hasher = key_hash;
+      table->key_comparator = key_comparator;
+    }
+  for (i = 0; i < size; i++)
+    if ((hash_table_put(table, strings ? (size_t)(void*)(string_keys[i]) : int_keys[i], i + 1) == 0) && errno)
+      fail_if (1);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Measure insertions into an empty table
+ * 
+ * @param   size     The number of entries in the table
+ * @param   rounds   The number of times to perform the operation on each entry
+ * @param   strings  Whether the keys are strings
+ * @return           The time spent, in nanoseconds, negative on error
+ */
+static double insert(size_t size, size_t rounds, int strings)
+{
+  hash_table_t table;
+  double start, elapsed = 0;
+  size_t r;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      table.buckets = NULL;
+      start = now();
+      if (fill(&table, size, strings))
+	{
+	  hash_table_destroy(&table, NULL, NULL);
+	  return -1;
+	}
+      elapsed += now() - start;
+      hash_table_destroy(&table, NULL, NULL);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure lookups of keys that are in the table, or that are not
+ * 
+ * @param   size     The number of entries in the table
+ * @param   rounds   The number of times to perform the operation on each entry
+ * @param   strings  Whether the keys are strings
+ * @param   miss     Whether the keys are not in the table
+ * @return           The time spent, in nanoseconds, negative on error
+ */
+static double lookup(size_t size, size_t rounds, int strings, int miss)
+{
+  hash_table_t table;
+  double start, elapsed = -1;
+  size_t r, i, sum = 0;
+  
+  table.buckets = NULL;
+  fail_if (fill(&table, size, strings));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < size; i++)
+      sum += hash_table_get(&table, strings ? (size_t)(void*)(string_keys[i]) : int_keys[i] + (size_t)miss);
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  hash_table_destroy(&table, NULL, NULL);
+  return elapsed;
+}
+
+
+/**
+ * Measure removals of all entries
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_remove(size_t size, size_t rounds)
+{
+  hash_table_t table;
+  double start, elapsed = 0;
+  size_t r, i;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      table.buckets = NULL;
+      if (fill(&table, size, 0))
+	{
+	  hash_table_destroy(&table, NULL, NULL);
+	  return -1;
+	}
+      start = now();
+      for (i = 0; i < size; i++)
+	hash_table_remove(&table, int_keys[i]);
+      elapsed += now() - start;
+      hash_table_destroy(&table, NULL, NULL);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure iteration over all entries
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_iterate(size_t size, size_t rounds)
+{
+  hash_table_t table;
+  hash_entry_t* entry;
+  double start, elapsed = -1;
+  size_t r, i, sum = 0;
+  
+  table.buckets = NULL;
+  fail_if (fill(&table, size, 0));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    foreach_hash_table_entry (table, i, entry)
+      sum += entry->value;
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  hash_table_destroy(&table, NULL, NULL);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling, or unmarshalling, of the table
+ * 
+ * @param   size       The number of entries in the table
+ * @param   rounds     The number of times to perform the operation on each entry
+ * @param   unmarshal  Whether unmarshalling is measured
+ * @return             The time spent, in nanoseconds, negative on error
+ */
+static double marshal(size_t size, size_t rounds, int unmarshal)
+{
+  hash_table_t table, copy;
+  char* data = NULL;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  table.buckets = NULL;
+  fail_if (fill(&table, size, 0));
+  fail_if (xmalloc(data, hash_table_marshal_size(&table), char));
+  
+  if (unmarshal)
+    hash_table_marshal(&table, data);
+  for (r = 0; r < rounds; r++)
+    if (unmarshal)
+      {
+	copy.buckets = NULL;
+	start = now();
+	if (hash_table_unmarshal(&copy, data, remap))
+	  {
+	    hash_table_destroy(&copy, NULL, NULL);
+	    fail_if (1);
+	  }
+	sum += now() - start;
+	hash_table_destroy(&copy, NULL, NULL);
+      }
+    else
+      {
+	start = now();
+	hash_table_marshal(&table, data);
+	sum += now() - start;
+      }
+  elapsed = sum;
+  
+ fail:
+  free(data);
+  hash_table_destroy(&table, NULL, NULL);
+  return elapsed;
+}
+
+
+/**
+ * Measure insertions with integer keys
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_insert(size_t size, size_t rounds)
+{
+  return insert(size, rounds, 0);
+}
+
+
+/**
+ * Measure insertions with string keys
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_insert_string(size_t size, size_t rounds)
+{
+  return insert(size, rounds, 1);
+}
+
+
+/**
+ * Measure lookups with integer keys
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_lookup(size_t size, size_t rounds)
+{
+  return lookup(size, rounds, 0, 0);
+}
+
+
+/**
+ * Measure lookups of missing integer keys
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_lookup_miss(size_t size, size_t rounds)
+{
+  return lookup(size, rounds, 0, 1);
+}
+
+
+/**
+ * Measure lookups with string keys
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_lookup_string(size_t size, size_t rounds)
+{
+  return lookup(size, rounds, 1, 0);
+}
+
+
+/**
+ * Measure marshalling
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_marshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 0);
+}
+
+
+/**
+ * Measure unmarshalling
+ * 
+ * @param   size    The number of entries in the table
+ * @param   rounds  The number of times to perform the operation on each entry
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_unmarshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 1);
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sizes[] = { 16, 256, 4096, MAX_SIZE };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "insert",        op_insert },
+      { "insert-string", op_insert_string },
+      { "lookup",        op_lookup },
+      { "lookup-miss",   op_lookup_miss },
+      { "lookup-string", op_lookup_string },
+      { "remove",        op_remove },
+      { "iterate",       op_iterate },
+      { "marshal",       op_marshal },
+      { "unmarshal",     op_unmarshal },
+    };
+  size_t i, j, rounds, created = 0;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  /* The integer keys are spread like the addresses of allocations. */
+  for (; created < MAX_SIZE; created++)
+    {
+      int_keys[created] = (created + 1) << 6;
+      fail_if (xasprintf(string_keys[created], "Header-%zu", created) < 0);
+    }
+  
+  for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+    for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+      {
+	rounds = OPERATIONS / sizes[j];
+	fail_if ((elapsed = operations[i].run(sizes[j], rounds)) < 0);
+	printf("{\"benchmark\": \"hash-table\", \"operation\": \"%s\", \"size\": %zu, "
+	       "\"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+	       operations[i].name, sizes[j], rounds * sizes[j], elapsed / (double)(rounds * sizes[j]));
+	fflush(stdout);
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  for (i = 0; i < created; i++)
+    free(string_keys[i]);
+  return rc;
+}
+
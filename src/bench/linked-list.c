@@ -0,0 +1,420 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of libmdsserver's linked list, which mds-server
+ * keeps its clients in. The results are printed as one JSON object
+ * per line, with the fields `benchmark`, `operation`, `size`,
+ * `operations` and `ns_per_operation`, where an operation is done
+ * on one node in a list with `size` nodes.
+ */
+
+#include <libmdsserver/linked-list.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+
+
+/**
+ * The number of operations in each measurement,
+ * for each list size
+ */
+#define OPERATIONS  (1 << 20)
+
+/**
+ * The size of the largest list
+ */
+#define MAX_SIZE  (1 << 16)
+
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(size_t size, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The nodes of the list, in the order they were inserted
+ */
+static ssize_t nodes[MAX_SIZE];
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Create a list and fill it, the nodes are stored in `nodes`
+ * 
+ * @param   list  Memory slot in which to store the list
+ * @param   size  The number of nodes
+ * @return        Zero on success, -1 on error, destroy the list on error
+ */
+__attribute__((nonnull))
+static int fill(linked_list_t* list, size_t size)
+{
+  size_t i;
+  memset(list, 0, sizeof(*list));
+  fail_if (linked_list_create(list, 0));
+  for (i = 0; i < size; i++)
+    fail_if ((nodes[i] = linked_list_insert_end(list, i + 1)) == LINKED_LIST_UNUSED);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Measure insertions at the end of an empty list
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_insert(size_t size, size_t rounds)
+{
+  linked_list_t list;
+  double start, elapsed = 0;
+  size_t r;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      start = now();
+      if (fill(&list, size))
+	{
+	  linked_list_destroy(&list);
+	  return -1;
+	}
+      elapsed += now() - start;
+      linked_list_destroy(&list);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure iteration over all nodes
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_iterate(size_t size, size_t rounds)
+{
+  linked_list_t list;
+  double start, elapsed = -1;
+  size_t r, sum = 0;
+  ssize_t node;
+  
+  fail_if (fill(&list, size));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    foreach_linked_list_node (list, node)
+      sum += list.values[node];
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  linked_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure removals of all nodes, in the order they were inserted
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_remove(size_t size, size_t rounds)
+{
+  linked_list_t list;
+  double start, elapsed = 0;
+  size_t r, i;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      if (fill(&list, size))
+	{
+	  linked_list_destroy(&list);
+	  return -1;
+	}
+      start = now();
+      for (i = 0; i < size; i++)
+	linked_list_remove(&list, nodes[i]);
+      elapsed += now() - start;
+      linked_list_destroy(&list);
+    }
+  
+  return elapsed;
+}
+
+
+/**
+ * Measure insertions into a list that has had all of its nodes removed,
+ * so that the positions of the removed nodes are reused
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_reinsert(size_t size, size_t rounds)
+{
+  linked_list_t list;
+  double start, elapsed = -1, sum = 0;
+  size_t r, i;
+  
+  fail_if (fill(&list, size));
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = 0; i < size; i++)
+	linked_list_remove(&list, nodes[i]);
+      start = now();
+      for (i = 0; i < size; i++)
+	fail_if ((nodes[i] = linked_list_insert_end(&list, i + 1)) == LINKED_LIST_UNUSED);
+      sum += now() - start;
+    }
+  elapsed = sum;
+  
+ fail:
+  linked_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure packing of a list that has had every other node removed
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_pack(size_t size, size_t rounds)
+{
+  linked_list_t list;
+  double start, elapsed = 0;
+  size_t r, i;
+  
+  for (r = 0; r < rounds; r++)
+    {
+      if (fill(&list, size))
+	goto fail;
+      for (i = 0; i < size; i += 2)
+	linked_list_remove(&list, nodes[i]);
+      start = now();
+      fail_if (linked_list_pack(&list));
+      elapsed += now() - start;
+      linked_list_destroy(&list);
+    }
+  
+  return elapsed;
+ fail:
+  linked_list_destroy(&list);
+  return -1;
+}
+
+
+/**
+ * Measure cloning of the list
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_clone(size_t size, size_t rounds)
+{
+  linked_list_t list, copy;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  fail_if (fill(&list, size));
+  for (r = 0; r < rounds; r++)
+    {
+      memset(&copy, 0, sizeof(copy));
+      start = now();
+      if (linked_list_clone(&list, &copy))
+	{
+	  linked_list_destroy(&copy);
+	  fail_if (1);
+	}
+      sum += now() - start;
+      linked_list_destroy(&copy);
+    }
+  elapsed = sum;
+  
+ fail:
+  linked_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling, or unmarshalling, of the list
+ * 
+ * @param   size       The number of nodes in the list
+ * @param   rounds     The number of times to perform the operation on each node
+ * @param   unmarshal  Whether unmarshalling is measured
+ * @return             The time spent, in nanoseconds, negative on error
+ */
+static double marshal(size_t size, size_t rounds, int unmarshal)
+{
+  linked_list_t list, copy;
+  char* data = NULL;
+  double start, elapsed = -1, sum = 0;
+  size_t r;
+  
+  fail_if (fill(&list, size));
+  fail_if (xmalloc(data, linked_list_marshal_size(&list), char));
+  
+  if (unmarshal)
+    linked_list_marshal(&list, data);
+  for (r = 0; r < rounds; r++)
+    if (unmarshal)
+      {
+	memset(&copy, 0, sizeof(copy));
+	start = now();
+	if (linked_list_unmarshal(&copy, data))
+	  {
+	    linked_list_destroy(&copy);
+	    fail_if (1);
+	  }
+	sum += now() - start;
+	linked_list_destroy(&copy);
+      }
+    else
+      {
+	start = now();
+	linked_list_marshal(&list, data);
+	sum += now() - start;
+      }
+  elapsed = sum;
+  
+ fail:
+  free(data);
+  linked_list_destroy(&list);
+  return elapsed;
+}
+
+
+/**
+ * Measure marshalling
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_marshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 0);
+}
+
+
+/**
+ * Measure unmarshalling
+ * 
+ * @param   size    The number of nodes in the list
+ * @param   rounds  The number of times to perform the operation on each node
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_unmarshal(size_t size, size_t rounds)
+{
+  return marshal(size, rounds, 1);
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sizes[] = { 16, 256, 4096, MAX_SIZE };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "insert",    op_insert },
+      { "iterate",   op_iterate },
+      { "remove",    op_remove },
+      { "reinsert",  op_reinsert },
+      { "pack",      op_pack },
+      { "clone",     op_clone },
+      { "marshal",   op_marshal },
+      { "unmarshal", op_unmarshal },
+    };
+  size_t i, j, rounds;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+    for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+      {
+	rounds = OPERATIONS / sizes[j];
+	fail_if ((elapsed = operations[i].run(sizes[j], rounds)) < 0);
+	printf("{\"benchmark\": \"linked-list\", \"operation\": \"%s\", \"size\": %zu, "
+	       "\"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+	       operations[i].name, sizes[j], rounds * sizes[j], elapsed / (double)(rounds * sizes[j]));
+	fflush(stdout);
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  return rc;
+}
+
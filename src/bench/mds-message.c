@@ -0,0 +1,561 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of libmdsserver's message parsing, that is
+ * `mds_message_read_from`, in both framings, and of composing,
+ * marshalling and unmarshalling messages, with different numbers of
+ * headers and sizes of payloads. The results are printed as one JSON
+ * object per line, with the fields `benchmark`, `operation`, `size`,
+ * `payload`, `operations`, `ns_per_operation` and
+ * `allocations_per_operation`, where an operation is done on one
+ * message with `size` headers and a payload of `payload` bytes.
+ * Allocations are counted by replacing `malloc`, `calloc` and
+ * `realloc` with functions that count the calls.
+ */
+
+#include <libmdsserver/mds-message.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+
+/**
+ * The number of bytes to parse in each measurement,
+ * the number of messages is limited by `MAX_ROUNDS`
+ */
+#define BYTES  (1 << 26)
+
+/**
+ * The highest number of messages in each measurement
+ */
+#define MAX_ROUNDS  (1 << 16)
+
+/**
+ * The lowest number of messages in each measurement
+ */
+#define MIN_ROUNDS  (1 << 4)
+
+
+
+/**
+ * A message that is read over and over again
+ */
+typedef struct stream
+{
+  /**
+   * The message
+   */
+  char* message;
+  
+  /**
+   * The length of `message`
+   */
+  size_t length;
+  
+  /**
+   * How much of the message has been read
+   */
+  size_t offset;
+  
+} stream_t;
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(char* text, size_t length, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+/**
+ * The number of calls to `malloc`, `calloc` and `realloc`
+ */
+static size_t allocations = 0;
+
+/**
+ * The number of allocations made by the measured operations
+ */
+static size_t measured_allocations;
+
+
+
+/**
+ * The allocation functions of the C library
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t elements, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+
+/**
+ * Count an allocation and allocate memory
+ * 
+ * @param   size  The number of bytes to allocate
+ * @return        See malloc(3)
+ */
+void* malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+
+/**
+ * Count an allocation and allocate zero-initialised memory
+ * 
+ * @param   elements  The number of elements to allocate
+ * @param   size      The size of each element
+ * @return            See calloc(3)
+ */
+void* calloc(size_t elements, size_t size)
+{
+  allocations++;
+  return __libc_calloc(elements, size);
+}
+
+
+/**
+ * Count an allocation and reallocate memory
+ * 
+ * @param   ptr   The memory to reallocate
+ * @param   size  The number of bytes to allocate
+ * @return        See realloc(3)
+ */
+void* realloc(void* ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Read from a stream that repeats a message for ever,
+ * as much as is asked for is read, like a socket that
+ * always has many messages waiting
+ * 
+ * @param   data:stream_t*  The stream
+ * @param   buffer          Output buffer for the read data
+ * @param   size            The size of `buffer`
+ * @return                  The number of read bytes
+ */
+static ssize_t read_stream(void* data, char* buffer, size_t size)
+{
+  stream_t* stream = data;
+  size_t n, got = 0;
+  
+  while (got < size)
+    {
+      n = min(size - got, stream->length - stream->offset);
+      memcpy(buffer + got, stream->message + stream->offset, n);
+      got += n;
+      stream->offset = (stream->offset + n) % stream->length;
+    }
+  
+  return (ssize_t)got;
+}
+
+
+/**
+ * Compose a message in the text framing
+ * 
+ * @param   headers  The number of headers, at least 2
+ * @param   payload  The size of the payload
+ * @param   length   Output parameter for the length of the message
+ * @return           The message, `NULL` on error
+ */
+static char* make_message(size_t headers, size_t payload, size_t* length)
+{
+  char* message = NULL;
+  size_t i, n = 0, size = 64 * headers + payload + 1;
+  int r;
+  
+  fail_if (xmalloc(message, size, char));
+  
+#define APPEND(...)							\
+  fail_if ((r = snprintf(message + n, size - n, __VA_ARGS__)) < 0);	\
+  n += (size_t)r
+  
+  APPEND("Command: bench\nMessage ID: 0\n");
+  for (i = 2 + (payload > 0); i < headers; i++)
+    {
+      APPEND("X-Header-%zu: value %zu\n", i, i);
+    }
+  if (payload > 0)
+    {
+      APPEND("Length: %zu\n", payload);
+    }
+  APPEND("\n");
+  
+#undef APPEND
+  
+  memset(message + n, 'x', payload);
+  *length = n + payload;
+  return message;
+ fail:
+  free(message);
+  return NULL;
+}
+
+
+/**
+ * Measure parsing of messages, in either framing
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @param   binary  Whether the binary framing is measured
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double parse(char* text, size_t length, size_t rounds, int binary)
+{
+  mds_message_t message;
+  stream_t stream;
+  double start, elapsed = -1;
+  size_t r, sum = 0;
+  
+  mds_message_zero_initialise(&message);
+  stream.message = text;
+  stream.length = length;
+  stream.offset = 0;
+  
+  if (binary)
+    {
+      fail_if ((stream.length = mds_message_binary_size(text, length)) == 0);
+      fail_if (xmalloc(stream.message, stream.length, char));
+      fail_if (mds_message_to_binary(text, length, stream.message));
+    }
+  
+  fail_if (mds_message_initialise(&message));
+  message.binary = binary;
+  
+  measured_allocations = allocations;
+  start = now();
+  for (r = 0; r < rounds; r++)
+    {
+      fail_if (mds_message_read_from(&message, read_stream, &stream));
+      sum += message.header_count + message.payload_size;
+    }
+  elapsed = now() - start;
+  measured_allocations = allocations - measured_allocations;
+  sink = sum;
+  
+ fail:
+  mds_message_destroy(&message);
+  if (binary)
+    free(stream.message);
+  return elapsed;
+}
+
+
+/**
+ * Measure parsing of messages in the text framing
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_parse(char* text, size_t length, size_t rounds)
+{
+  return parse(text, length, rounds, 0);
+}
+
+
+/**
+ * Measure parsing of messages in the binary framing
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_parse_binary(char* text, size_t length, size_t rounds)
+{
+  return parse(text, length, rounds, 1);
+}
+
+
+/**
+ * Measure composing, marshalling, or unmarshalling, of a message
+ * 
+ * @param   text       The message, in the text framing
+ * @param   length     The length of `text`
+ * @param   rounds     The number of times to perform the operation
+ * @param   operation  0 for composing, 1 for marshalling, 2 for unmarshalling
+ * @return             The time spent, in nanoseconds, negative on error
+ */
+static double serialise(char* text, size_t length, size_t rounds, int operation)
+{
+  mds_message_t message, copy;
+  stream_t stream;
+  char* data = NULL;
+  double start, elapsed = -1, sum = 0;
+  size_t r, counted = 0;
+  int failed;
+  
+  mds_message_zero_initialise(&message);
+  stream.message = text;
+  stream.length = length;
+  stream.offset = 0;
+  fail_if (mds_message_initialise(&message));
+  fail_if (mds_message_read_from(&message, read_stream, &stream));
+  
+  if (operation == 0)
+    fail_if (xmalloc(data, mds_message_compose_size(&message), char));
+  else
+    {
+      fail_if (xmalloc(data, mds_message_marshal_size(&message), char));
+      mds_message_marshal(&message, data);
+    }
+  
+  for (r = 0; r < rounds; r++)
+    if (operation == 0)
+      {
+	counted -= allocations;
+	start = now();
+	mds_message_compose(&message, data);
+	sum += now() - start;
+	counted += allocations;
+      }
+    else if (operation == 1)
+      {
+	counted -= allocations;
+	start = now();
+	mds_message_marshal(&message, data);
+	sum += now() - start;
+	counted += allocations;
+      }
+    else
+      {
+	mds_message_zero_initialise(&copy);
+	counted -= allocations;
+	start = now();
+	failed = mds_message_unmarshal(&copy, data);
+	sum += now() - start;
+	counted += allocations;
+	mds_message_destroy(&copy);
+	fail_if (failed);
+      }
+  elapsed = sum;
+  measured_allocations = counted;
+  
+ fail:
+  free(data);
+  mds_message_destroy(&message);
+  return elapsed;
+}
+
+
+/**
+ * Measure composing of a message
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_compose(char* text, size_t length, size_t rounds)
+{
+  return serialise(text, length, rounds, 0);
+}
+
+
+/**
+ * Measure marshalling of a message
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_marshal(char* text, size_t length, size_t rounds)
+{
+  return serialise(text, length, rounds, 1);
+}
+
+
+/**
+ * Measure unmarshalling of a message
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_unmarshal(char* text, size_t length, size_t rounds)
+{
+  return serialise(text, length, rounds, 2);
+}
+
+
+/**
+ * Check that a header name that does not fit its field in the binary
+ * framing is refused by the translation and by the parser, and that
+ * one that just fits is accepted
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int check_field_limits(void)
+{
+  mds_message_t message;
+  stream_t stream;
+  char* text = NULL;
+  char* data = NULL;
+  size_t length, size, name_length;
+  int r;
+  
+  mds_message_zero_initialise(&message);
+  
+  for (name_length = UINT16_MAX; name_length <= (size_t)UINT16_MAX + 1; name_length++)
+    {
+      length = name_length + sizeof(": x\n\n") - 1;
+      fail_if (xmalloc(text, length, char));
+      memset(text, 'n', name_length);
+      memcpy(text + name_length, ": x\n\n", length - name_length);
+      
+      errno = 0;
+      size = mds_message_binary_size(text, length);
+      if ((size == 0) != (name_length > UINT16_MAX))
+	fail_if ((errno = EMSGSIZE));
+      if (size == 0)
+	{
+	  fail_if (errno != EMSGSIZE);
+	  fail_if (xmalloc(data, MDS_MESSAGE_BINARY_PREFIX + 1 + sizeof(uint16_t) + length, char));
+	  if (mds_message_to_binary(text, length, data) == 0)
+	    fail_if ((errno = EMSGSIZE));
+	  fail_if (errno != EMSGSIZE);
+	  free(data), data = NULL;
+	}
+      
+      /* A complete message either parses, or is malformated, and must
+	 then make the parser return -2, rather than block for more. */
+      stream.message = text;
+      stream.length = length;
+      stream.offset = 0;
+      fail_if (mds_message_initialise(&message));
+      r = mds_message_read_from(&message, read_stream, &stream);
+      fail_if (r == -1);
+      if ((r == -2) != (name_length > UINT16_MAX))
+	fail_if ((errno = EMSGSIZE));
+      mds_message_destroy(&message);
+      mds_message_zero_initialise(&message);
+      free(text), text = NULL;
+    }
+  
+  return 0;
+ fail:
+  mds_message_destroy(&message);
+  free(text);
+  free(data);
+  return -1;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t header_counts[] = { 4, 16, 64 };
+  static const size_t payload_sizes[] = { 0, 4096, 1 << 20 };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "parse",        op_parse },
+      { "parse-binary", op_parse_binary },
+      { "compose",      op_compose },
+      { "marshal",      op_marshal },
+      { "unmarshal",    op_unmarshal },
+    };
+  char* text = NULL;
+  size_t i, j, k, length, rounds;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  fail_if (check_field_limits());
+  
+  for (j = 0; j < sizeof(header_counts) / sizeof(*header_counts); j++)
+    for (k = 0; k < sizeof(payload_sizes) / sizeof(*payload_sizes); k++)
+      {
+	fail_if ((text = make_message(header_counts[j], payload_sizes[k], &length)) == NULL);
+	rounds = BYTES / length;
+	rounds = rounds < MIN_ROUNDS ? MIN_ROUNDS : rounds > MAX_ROUNDS ? MAX_ROUNDS : rounds;
+	for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+	  {
+	    fail_if ((elapsed = operations[i].run(text, length, rounds)) < 0);
+	    printf("{\"benchmark\": \"mds-message\", \"operation\": \"%s\", \"size\": %zu, "
+		   "\"payload\": %zu, \"operations\": %zu, \"ns_per_operation\": %.2f, "
+		   "\"allocations_per_operation\": %.2f}\n",
+		   operations[i].name, header_counts[j], payload_sizes[k], rounds,
+		   elapsed / (double)rounds, (double)measured_allocations / (double)rounds);
+	    fflush(stdout);
+	  }
+	free(text), text = NULL;
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  free(text);
+  return rc;
+}
+
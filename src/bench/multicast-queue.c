@@ -0,0 +1,359 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the queue that mds-server keeps each client's
+ * pending multicasts in, a list linked through the multicasts, against
+ * the array that grew with `realloc` and was emptied from the front
+ * with `memmove` under the client's mutex that it replaced. Only the
+ * thread that serves a client queues and sends its multicasts, so
+ * the list is not locked. The backlogs are deep, as when a client
+ * multicasts faster than its messages can be delivered. The results
+ * are printed as one JSON object per line, with the fields `benchmark`,
+ * `operation`, `size`, `operations` and `ns_per_operation`, where an
+ * operation is one element queued and dequeued with a backlog of
+ * `size` elements.
+ */
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+
+
+/**
+ * The number of operations in each measurement,
+ * for each backlog size
+ */
+#define OPERATIONS  (1 << 16)
+
+
+
+/**
+ * A queued element, about as large as a multicast
+ */
+typedef struct element
+{
+  /**
+   * The next element in the list, unused by the array
+   */
+  struct element* next;
+  
+  /**
+   * The element's contents
+   */
+  char payload[80];
+  
+} element_t;
+
+
+/**
+ * The array that the list replaced
+ */
+typedef struct array
+{
+  /**
+   * The elements
+   */
+  element_t* elements;
+  
+  /**
+   * The number of elements in `elements`
+   */
+  size_t count;
+  
+  /**
+   * Lock for the array
+   */
+  pthread_mutex_t mutex;
+  
+} array_t;
+
+
+/**
+ * The list, as in `client_t`
+ */
+typedef struct list
+{
+  /**
+   * The first element, `NULL` if empty
+   */
+  element_t* first;
+  
+  /**
+   * The last element, `NULL` if empty
+   */
+  element_t* last;
+  
+  /**
+   * The number of elements in the list
+   */
+  size_t count;
+  
+} list_t;
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   size    The number of elements in the backlog
+ * @param   rounds  The number of times to fill and empty the backlog
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(size_t size, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Add an element to the end of the array, as a client queued a multicast
+ * 
+ * @param   array  The array
+ * @param   index  The element's index, stored in the element
+ * @return         Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int array_append(array_t* array, size_t index)
+{
+  element_t* new_buf;
+  int r = 0;
+  pthread_mutex_lock(&(array->mutex));
+  new_buf = array->elements;
+  if (xrealloc(new_buf, array->count + 1, element_t))
+    r = -1;
+  else
+    {
+      array->elements = new_buf;
+      memset(new_buf + array->count, 0, sizeof(element_t));
+      *(size_t*)(void*)(new_buf[array->count++].payload) = index;
+    }
+  pthread_mutex_unlock(&(array->mutex));
+  return r;
+}
+
+
+/**
+ * Remove the first element from the array, as a client sent a multicast
+ * 
+ * @param   array  The array
+ * @param   index  Output parameter for the element's index
+ * @return         Whether an element was removed
+ */
+__attribute__((nonnull))
+static int array_remove(array_t* array, size_t* index)
+{
+  int r = 0;
+  pthread_mutex_lock(&(array->mutex));
+  if (array->count > 0)
+    {
+      size_t c = (array->count -= 1) * sizeof(element_t);
+      *index = *(size_t*)(void*)(array->elements->payload);
+      memmove(array->elements, array->elements + 1, c);
+      if (c == 0)
+	{
+	  free(array->elements);
+	  array->elements = NULL;
+	}
+      r = 1;
+    }
+  pthread_mutex_unlock(&(array->mutex));
+  return r;
+}
+
+
+/**
+ * Add a new element to the end of the list, as a client queues a multicast
+ * 
+ * @param   list   The list
+ * @param   index  The element's index, stored in the element
+ * @return         Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int list_append(list_t* list, size_t index)
+{
+  element_t* element;
+  if (xcalloc(element, 1, element_t))
+    return -1;
+  *(size_t*)(void*)(element->payload) = index;
+  if (list->last == NULL)
+    list->first = element;
+  else
+    list->last->next = element;
+  list->last = element;
+  list->count++;
+  return 0;
+}
+
+
+/**
+ * Remove and free the first element from the list, as a client sends a multicast
+ * 
+ * @param   list   The list
+ * @param   index  Output parameter for the element's index
+ * @return         Whether an element was removed
+ */
+__attribute__((nonnull))
+static int list_remove(list_t* list, size_t* index)
+{
+  element_t* element = list->first;
+  if (element == NULL)
+    return 0;
+  if ((list->first = element->next) == NULL)
+    list->last = NULL;
+  list->count--;
+  *index = *(size_t*)(void*)(element->payload);
+  free(element);
+  return 1;
+}
+
+
+/**
+ * Measure filling a backlog and then emptying it
+ * 
+ * @param   size    The number of elements in the backlog
+ * @param   rounds  The number of times to fill and empty the backlog
+ * @param   linked  Whether the list, rather than the array, is measured
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double fill_and_drain(size_t size, size_t rounds, int linked)
+{
+  list_t list;
+  array_t array;
+  double start, elapsed = -1;
+  size_t r, i, index, sum = 0;
+  
+  memset(&list, 0, sizeof(list));
+  array.elements = NULL;
+  array.count = 0;
+  fail_if ((errno = pthread_mutex_init(&(array.mutex), NULL)));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = 0; i < size; i++)
+	fail_if (linked ? list_append(&list, i) : array_append(&array, i));
+      while (linked ? list_remove(&list, &index) : array_remove(&array, &index))
+	sum += index;
+    }
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  while (list_remove(&list, &index));
+  free(array.elements);
+  pthread_mutex_destroy(&(array.mutex));
+  return elapsed;
+}
+
+
+/**
+ * Measure the array
+ * 
+ * @param   size    The number of elements in the backlog
+ * @param   rounds  The number of times to fill and empty the backlog
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_array(size_t size, size_t rounds)
+{
+  return fill_and_drain(size, rounds, 0);
+}
+
+
+/**
+ * Measure the list
+ * 
+ * @param   size    The number of elements in the backlog
+ * @param   rounds  The number of times to fill and empty the backlog
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_list(size_t size, size_t rounds)
+{
+  return fill_and_drain(size, rounds, 1);
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t sizes[] = { 16, 256, 4096, 16384 };
+  static const struct { const char* name; operation_func* run; } operations[] =
+    {
+      { "array", op_array },
+      { "list",  op_list  },
+    };
+  size_t i, j, rounds;
+  double elapsed;
+  int rc = 1;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  for (i = 0; i < sizeof(operations) / sizeof(*operations); i++)
+    for (j = 0; j < sizeof(sizes) / sizeof(*sizes); j++)
+      {
+	rounds = OPERATIONS / sizes[j];
+	fail_if ((elapsed = operations[i].run(sizes[j], rounds)) < 0);
+	printf("{\"benchmark\": \"multicast-queue\", \"operation\": \"%s\", \"size\": %zu, "
+	       "\"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+	       operations[i].name, sizes[j], rounds * sizes[j], elapsed / (double)(rounds * sizes[j]));
+	fflush(stdout);
+      }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  return rc;
+}
+
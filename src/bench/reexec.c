@@ -0,0 +1,213 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of how long a re-exec pauses the display server. The
+ * display server is spawned with a number of clients that have
+ * interception conditions, and is signalled to re-exec a few times.
+ * The pause that the display server measures and reports is printed,
+ * together with the time from the signal until a client got a reply
+ * from the new image, as one JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+
+
+/**
+ * The largest number of clients
+ */
+#define MAX_CLIENTS  1024
+
+/**
+ * The number of interception conditions of each client
+ */
+#define CONDITIONS  8
+
+/**
+ * The number of re-execs that are measured for each number of clients
+ */
+#define ROUNDS  5
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+
+
+/**
+ * Ask the display server how long its last re-exec paused it
+ * 
+ * @param   connection  The client
+ * @param   message     Message slot to read into
+ * @param   pause       Output parameter for the pause, in nanoseconds
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int get_pause(libmds_connection_t* connection, libmds_message_t* message, uint64_t* pause)
+{
+  static const char figure[] = "last re-exec pause: ";
+  char* report = NULL;
+  const char* p;
+  
+  fail_if (send_simple(connection, "Command: server-stats", NULL));
+  fail_if (read_until(connection, message, "Command: server-stats") == NULL);
+  fail_if (xmalloc(report, message->payload_size + 1, char));
+  memcpy(report, message->payload, message->payload_size * sizeof(char));
+  report[message->payload_size] = '\0';
+  fail_if ((p = strstr(report, figure)) == NULL);
+  *pause = (uint64_t)strtoull(p + strlen(figure), NULL, 10);
+  free(report);
+  return 0;
+ fail:
+  free(report);
+  return -1;
+}
+
+
+/**
+ * Compare two measurements
+ * 
+ * @param   a:const double*  One of the measurements
+ * @param   b:const double*  The other measurement
+ * @return                   Negative if `a` is smaller, positive if `b` is smaller, otherwise zero
+ */
+static int cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Measure a few re-execs and print the median pause
+ * 
+ * @param   probe    The client that asks for the pause
+ * @param   message  Message slot to read into
+ * @param   clients  The number of connected clients
+ * @return           Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int measure(libmds_connection_t* probe, libmds_message_t* message, size_t clients)
+{
+  double pauses[ROUNDS], observed[ROUNDS];
+  uint64_t before, after;
+  double start;
+  size_t i;
+  
+  for (i = 0; i < ROUNDS; i++)
+    {
+      fail_if (get_pause(probe, message, &before));
+      start = now();
+      fail_if (kill(server_pid, SIGUPDATE) < 0);
+      /* The old image may reply before it notices the signal, and
+	 the new image replies with zero until it has unmarshalled. */
+      do
+	fail_if (get_pause(probe, message, &after));
+      while ((after == before) || (after == 0));
+      observed[i] = now() - start;
+      pauses[i] = (double)after;
+    }
+  
+  qsort(pauses, ROUNDS, sizeof(double), cmp_double);
+  qsort(observed, ROUNDS, sizeof(double), cmp_double);
+  printf("{\"benchmark\": \"reexec\", \"clients\": %zu, \"conditions_per_client\": %i, "
+	 "\"pause_ns\": %.0f, \"observed_ns\": %.0f}\n",
+	 clients, CONDITIONS, pauses[ROUNDS / 2], observed[ROUNDS / 2]);
+  fflush(stdout);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t client_counts[] = {16, 256, MAX_CLIENTS};
+  static libmds_connection_t clients[MAX_CLIENTS];
+  libmds_connection_t probe;
+  libmds_message_t message;
+  char conditions[CONDITIONS * sizeof("X-Bench-Condition-: \n") + 3 * CONDITIONS * sizeof(int)];
+  size_t i, j, connected = 0, initialised = 0;
+  char* p;
+  int rc = 1;
+  
+  program_name = *argv_;
+  
+  memset(&probe, 0, sizeof(probe));
+  memset(&message, 0, sizeof(message));
+  fail_if (libmds_connection_initialise(&probe));
+  fail_if (libmds_message_initialise(&message));
+  for (; initialised < MAX_CLIENTS; initialised++)
+    fail_if (libmds_connection_initialise(clients + initialised));
+  
+  fail_if (spawn_server(argc_ > 1 ? argv_[1] : "bin/mds-server", NULL));
+  fail_if (connect_client(&probe, &message));
+  
+  for (i = 0; i < sizeof(client_counts) / sizeof(*client_counts); i++)
+    {
+      /* Add clients, each with its own interception conditions. */
+      for (; connected < client_counts[i]; connected++)
+	{
+	  fail_if (connect_client(clients + connected, &message));
+	  for (p = conditions, j = 0; j < CONDITIONS; j++)
+	    p += sprintf(p, "X-Bench-Condition-%zu: %zu\n", j, connected);
+	  fail_if (send_simple(clients + connected, "Command: intercept", conditions));
+	}
+      fail_if (connected && sync_client(clients + connected - 1, &message));
+      
+      fail_if (measure(&probe, &message, connected));
+    }
+  
+  rc = 0;
+ fail:
+  if (rc && errno)
+    perror(program_name);
+  kill_server();
+  libmds_message_destroy(&message);
+  libmds_connection_destroy(&probe);
+  for (i = 0; i < initialised; i++)
+    libmds_connection_destroy(clients + i);
+  return rc;
+}
+
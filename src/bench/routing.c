@@ -0,0 +1,515 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of mds-server's message routing, that is, finding the
+ * interceptors of a message. The indexed lookup that mds-server uses
+ * is compared against the linear scan over all clients' conditions
+ * that mds-server used before the index was added. The results are
+ * printed as one JSON object per line.
+ */
+
+#include "../mds-server/interception-index.h"
+
+#include <libmdsserver/macros.h>
+#include <libmdsserver/hash-help.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+
+
+/**
+ * The number of headers in the routed messages
+ */
+#define HEADER_COUNT  4
+
+/**
+ * The number of different commands that the clients intercept
+ */
+#define COMMAND_COUNT  16
+
+/**
+ * The number of message routings done with
+ * the linear scan for each client count is
+ * this divided by the number of clients
+ */
+#define LINEAR_WORK  (1 << 22)
+
+/**
+ * The number of message routings done with
+ * the index for each client count
+ */
+#define INDEXED_ROUTINGS  (1 << 16)
+
+
+
+/**
+ * A message, split into headers, to route
+ */
+typedef struct routed_message
+{
+  /**
+   * The hashes of the header names
+   */
+  size_t hashes[HEADER_COUNT];
+  
+  /**
+   * The header names
+   */
+  char* keys[HEADER_COUNT];
+  
+  /**
+   * The header name–value pairs
+   */
+  char* headers[HEADER_COUNT];
+  
+} routed_message_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The simulated clients
+ */
+static client_t* clients = NULL;
+
+/**
+ * The number of elements in `clients`
+ */
+static size_t client_count = 0;
+
+/**
+ * The interception index over `clients`
+ */
+static interception_index_t index_;
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Add a reference to a simulated client, as the interception index does
+ * for each interceptor that it finds, the simulated clients are freed
+ * when the benchmark ends, so the references are only counted
+ * 
+ * @param   this  The client information
+ * @return        `this`
+ */
+client_t* client_ref(client_t* restrict this)
+{
+  __atomic_add_fetch(&(this->references), 1, __ATOMIC_RELAXED);
+  return this;
+}
+
+
+/**
+ * Check if a condition matches any of a set of accepted patterns,
+ * as mds-server did before it had an interception index
+ * 
+ * @param   cond     The condition
+ * @param   hashes   The hashes of the accepted header names
+ * @param   keys     The header names
+ * @param   headers  The header name–value pairs
+ * @param   count    The number of accepted patterns
+ * @return           Evaluates to true if and only if a matching pattern was found
+ */
+__attribute__((pure, nonnull))
+static int is_condition_matching(interception_condition_t* cond, size_t* hashes,
+				 char** keys, char** headers, size_t count)
+{
+  size_t i;
+  for (i = 0; i < count; i++)
+    if (*(cond->condition) == '\0')
+      return 1;
+    else if ((cond->header_hash == hashes[i]) &&
+	     (strequals(cond->condition, keys[i]) ||
+	      strequals(cond->condition, headers[i])))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Get all interceptors of a message by testing every condition
+ * of every client, as mds-server did before it had an interception index
+ * 
+ * @param   sender                   The original sender of the message
+ * @param   msg                      The message
+ * @param   interceptions_count_out  Slot at where to store the number of found interceptors
+ * @return                           The found interceptors, `NULL` on error
+ */
+__attribute__((nonnull))
+static queued_interception_t* linear_get_interceptors(client_t* sender, routed_message_t* msg,
+						      size_t* interceptions_count_out)
+{
+  queued_interception_t* interceptions = NULL;
+  size_t i, j, n = 0;
+  
+  fail_if (xmalloc(interceptions, client_count, queued_interception_t));
+  
+  for (i = 0; i < client_count; i++)
+    {
+      client_t* client = clients + i;
+      interception_condition_t* conds = client->interception_conditions;
+      if ((client->open == 0) || (client == sender))
+	continue;
+      pthread_mutex_lock(&(client->mutex));
+      for (j = 0; j < client->interception_conditions_count; j++)
+	if (is_condition_matching(conds + j, msg->hashes, msg->keys, msg->headers, HEADER_COUNT))
+	  {
+	    interceptions[n].client    = client;
+	    interceptions[n].priority  = conds[j].priority;
+	    interceptions[n].modifying = conds[j].modifying;
+	    n++;
+	    break;
+	  }
+      pthread_mutex_unlock(&(client->mutex));
+    }
+  
+  *interceptions_count_out = n;
+  return interceptions;
+ fail:
+  return NULL;
+}
+
+
+/**
+ * Add an interception condition to a simulated client
+ * 
+ * @param   client     The client
+ * @param   condition  The condition
+ * @param   priority   Interception priority
+ * @param   modifying  Whether the client may modify the messages
+ * @return             Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int add_condition(client_t* client, const char* condition, int64_t priority, int modifying)
+{
+  interception_condition_t* conds = client->interception_conditions;
+  size_t n = client->interception_conditions_count;
+  char* colon;
+  
+  fail_if (xrealloc(conds, n + 1, interception_condition_t));
+  client->interception_conditions = conds;
+  fail_if ((conds[n].condition = strdup(condition)) == NULL);
+  client->interception_conditions_count++;
+  conds[n].priority = priority;
+  conds[n].modifying = modifying;
+  
+  /* The hash is only of the header name. */
+  if ((colon = strchr(conds[n].condition, ':')) != NULL)
+    *colon = '\0';
+  conds[n].header_hash = string_hash(conds[n].condition);
+  if (colon != NULL)
+    *colon = ':';
+  
+  return interception_index_put(&index_, client, condition, priority, modifying);
+ fail:
+  return -1;
+}
+
+
+/**
+ * Release the simulated clients
+ */
+static void destroy_clients(void)
+{
+  size_t i, j;
+  interception_index_destroy(&index_);
+  for (i = 0; i < client_count; i++)
+    {
+      for (j = 0; j < clients[i].interception_conditions_count; j++)
+	free(clients[i].interception_conditions[j].condition);
+      free(clients[i].interception_conditions);
+      pthread_mutex_destroy(&(clients[i].mutex));
+    }
+  free(clients);
+  clients = NULL;
+  client_count = 0;
+}
+
+
+/**
+ * Create simulated clients, with conditions like those of
+ * a typical display: all clients receive broadcasts and messages
+ * addressed to them, some clients implement a protocol and
+ * intercept its command, and a few clients intercept everything
+ * 
+ * @param   n  The number of clients
+ * @return     Zero on success, -1 on error
+ */
+static int create_clients(size_t n)
+{
+  char buf[64];
+  size_t i;
+  
+  fail_if (interception_index_create(&index_));
+  fail_if (xcalloc(clients, n, client_t));
+  for (i = 0; i < n; i++)
+    {
+      client_t* client = clients + i;
+      client_count++;
+      client->open = 1;
+      fail_if ((errno = pthread_mutex_init(&(client->mutex), NULL)));
+      client->mutex_created = 1;
+      
+      fail_if (add_condition(client, "To: all", 0, 0));
+      xsnprintf(buf, "To: 0:%zu", i + 1);
+      fail_if (add_condition(client, buf, 0, 0));
+      if ((i % 4) == 0)
+	{
+	  xsnprintf(buf, "Command: command-%zu", (i / 4) % COMMAND_COUNT);
+	  fail_if (add_condition(client, buf, (int64_t)i, (i % 16) == 0));
+	}
+      if ((i % 64) == 63)
+	fail_if (add_condition(client, "", -1, 0));
+    }
+  
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Split a message into the form used by routing
+ * 
+ * @param  msg    Output parameter for the message
+ * @param  lines  The header lines of the message
+ */
+__attribute__((nonnull))
+static void make_message(routed_message_t* msg, char lines[HEADER_COUNT][64])
+{
+  size_t i;
+  for (i = 0; i < HEADER_COUNT; i++)
+    {
+      char* colon = strchr(lines[i], ':');
+      msg->headers[i] = lines[i];
+      msg->keys[i] = strndup(lines[i], (size_t)(colon - lines[i]));
+      msg->hashes[i] = string_hash(msg->keys[i]);
+    }
+}
+
+
+/**
+ * Check that the two routing implementations find the same interceptors
+ * 
+ * @param   sender  The original sender of the message
+ * @param   msg     The message
+ * @return          Zero if they agree, -1 on error or if they disagree
+ */
+__attribute__((nonnull))
+static int verify(client_t* sender, routed_message_t* msg)
+{
+  queued_interception_t* linear = NULL;
+  queued_interception_t* indexed = NULL;
+  size_t i, j, linear_count, indexed_count;
+  int rc = -1;
+  
+  fail_if ((linear = linear_get_interceptors(sender, msg, &linear_count)) == NULL);
+  fail_if ((indexed = interception_index_find(&index_, sender, msg->keys, msg->headers,
+					      HEADER_COUNT, &indexed_count)) == NULL);
+  
+  if (linear_count != indexed_count)
+    goto done;
+  for (i = 0; i < linear_count; i++)
+    {
+      for (j = 0; j < indexed_count; j++)
+	if (indexed[j].client == linear[i].client)
+	  break;
+      if (j == indexed_count)
+	goto done;
+    }
+  
+  rc = 0;
+ done:
+ fail:
+  free(linear);
+  free(indexed);
+  return rc;
+}
+
+
+/**
+ * Measure the routing of a message with both implementations,
+ * and print the result
+ * 
+ * @param   workload  The name of the workload
+ * @param   msgs      The messages, they are routed in turn
+ * @param   count     The number of elements in `msgs`
+ * @return            Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int measure(const char* workload, routed_message_t* msgs, size_t count)
+{
+  size_t linear_n = LINEAR_WORK / client_count;
+  size_t indexed_n = INDEXED_ROUTINGS;
+  queued_interception_t* interceptions;
+  double start, linear_ns, indexed_ns;
+  size_t i, n;
+  
+  if (linear_n < 64)
+    linear_n = 64;
+  
+  for (i = 0; i < count; i++)
+    if (verify(clients, msgs + i))
+      {
+	fprintf(stderr, "%s: %s: indexed and linear routing disagree\n", program_name, workload);
+	return -1;
+      }
+  
+  start = now();
+  for (i = 0; i < linear_n; i++)
+    {
+      fail_if ((interceptions = linear_get_interceptors(clients, msgs + i % count, &n)) == NULL);
+      sink += n;
+      free(interceptions);
+    }
+  linear_ns = (now() - start) / (double)linear_n;
+  
+  start = now();
+  for (i = 0; i < indexed_n; i++)
+    {
+      routed_message_t* msg = msgs + i % count;
+      fail_if ((interceptions = interception_index_find(&index_, clients, msg->keys, msg->headers,
+							HEADER_COUNT, &n)) == NULL);
+      sink += n;
+      free(interceptions);
+    }
+  indexed_ns = (now() - start) / (double)indexed_n;
+  
+  printf("{\"benchmark\": \"routing\", \"workload\": \"%s\", \"clients\": %zu, "
+	 "\"linear_ns_per_message\": %.1f, \"indexed_ns_per_message\": %.1f, \"speedup\": %.2f}\n",
+	 workload, client_count, linear_ns, indexed_ns, linear_ns / indexed_ns);
+  fflush(stdout);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Benchmark routing with a number of clients
+ * 
+ * @param   n  The number of clients
+ * @return     Zero on success, -1 on error
+ */
+static int run(size_t n)
+{
+  char unicast_lines[COMMAND_COUNT][HEADER_COUNT][64];
+  char broadcast_lines[1][HEADER_COUNT][64];
+  routed_message_t unicast[COMMAND_COUNT];
+  routed_message_t broadcast[1];
+  size_t i, j;
+  int rc = -1;
+  
+  memset(unicast, 0, sizeof(unicast));
+  memset(broadcast, 0, sizeof(broadcast));
+  fail_if (create_clients(n));
+  
+  /* Requests to protocol implementations, addressed to a client, like most messages. */
+  for (i = 0; i < COMMAND_COUNT; i++)
+    {
+      xsnprintf(unicast_lines[i][0], "Command: command-%zu", i);
+      xsnprintf(unicast_lines[i][1], "To: 0:%zu", (i * 7919) % n + 1);
+      xsnprintf(unicast_lines[i][2], "Message ID: %zu", i);
+      xsnprintf(unicast_lines[i][3], "Length: %i", 0);
+      make_message(unicast + i, unicast_lines[i]);
+    }
+  
+  /* A message that all clients receive. */
+  xsnprintf(broadcast_lines[0][0], "Command: %s", "announcement");
+  xsnprintf(broadcast_lines[0][1], "To: %s", "all");
+  xsnprintf(broadcast_lines[0][2], "Message ID: %i", 0);
+  xsnprintf(broadcast_lines[0][3], "Length: %i", 0);
+  make_message(broadcast, broadcast_lines[0]);
+  
+  fail_if (measure("unicast", unicast, COMMAND_COUNT));
+  fail_if (measure("broadcast", broadcast, 1));
+  
+  rc = 0;
+ fail:
+  for (i = 0; i < COMMAND_COUNT; i++)
+    for (j = 0; j < HEADER_COUNT; j++)
+      free(unicast[i].keys[j]);
+  for (j = 0; j < HEADER_COUNT; j++)
+    free(broadcast[0].keys[j]);
+  destroy_clients();
+  return rc;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The client counts to benchmark, defaults are used if none are specified
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const size_t default_counts[] = { 16, 64, 256, 1024, 4096 };
+  int i;
+  
+  program_name = *argv_;
+  
+  if (argc_ > 1)
+    {
+      for (i = 1; i < argc_; i++)
+	if ((atol(argv_[i]) <= 0) || run((size_t)atol(argv_[i])))
+	  goto fail;
+    }
+  else
+    for (i = 0; i < (int)(sizeof(default_counts) / sizeof(*default_counts)); i++)
+      if (run(default_counts[i]))
+	goto fail;
+  
+  return 0;
+ fail:
+  if (errno)
+    perror(program_name);
+  return 1;
+}
+
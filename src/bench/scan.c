@@ -0,0 +1,496 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of libmdsserver's vectorised scanning of headers,
+ * with each of its implementations, against the byte-wise scanning
+ * that it replaced. `frame` splits the headers of a message into lines
+ * and validates them, as `mds_message_read` does, `split` finds the
+ * headers' names and values, as mds-server does before multicasting
+ * a message, and `read` is all of `mds_message_read`. The messages
+ * have many short headers, or a few long header values, which are
+ * either ASCII or have a two-byte character every 16 bytes. The
+ * results are printed as one JSON object per line, with the fields
+ * `benchmark`, `workload`, `operation`, `kernel`, `bytes`,
+ * `operations`, `ns_per_operation` and `mib_per_second`, where an
+ * operation is done on one message of `bytes` bytes, and `kernel` is
+ * `bytewise` for the replaced scanning.
+ */
+
+#include <libmdsserver/scan.h>
+#include <libmdsserver/mds-message.h>
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+
+/**
+ * The number of bytes to scan in each measurement
+ */
+#define BYTES  (1 << 27)
+
+/**
+ * The number of headers in the messages with short headers
+ */
+#define SHORT_HEADERS  128
+
+/**
+ * The number of headers in the messages with long header values
+ */
+#define LONG_HEADERS  4
+
+/**
+ * The length of the long header values
+ */
+#define LONG_VALUE  (16 << 10)
+
+/**
+ * The highest number of headers in the messages
+ */
+#define MAX_HEADERS  (SHORT_HEADERS + 2)
+
+
+
+/**
+ * A message that is read over and over again
+ */
+typedef struct stream
+{
+  /**
+   * The message
+   */
+  char* message;
+  
+  /**
+   * The length of `message`
+   */
+  size_t length;
+  
+  /**
+   * How much of the message has been read
+   */
+  size_t offset;
+  
+} stream_t;
+
+
+/**
+ * A measurement of an operation
+ * 
+ * @param   text    The message, in the text framing, it is
+ *                  modified during, but restored after, the measurement
+ * @param   length  The length of `text`, excluding its NUL-termination
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+typedef double operation_func(char* text, size_t length, size_t rounds);
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Check whether a NUL-terminated string is encoded in UTF-8,
+ * byte by byte, as `verify_utf8` did before it was vectorised
+ * 
+ * @param   string  The string
+ * @return          Zero if good, -1 on encoding error
+ */
+__attribute__((pure, nonnull))
+static int bytewise_verify_utf8(const char* string)
+{
+  static const long BYTES_TO_MIN_BITS[] = {0, 0,  8, 12, 17, 22, 37};
+  static const long BYTES_TO_MAX_BITS[] = {0, 7, 11, 16, 21, 26, 31};
+  long bytes = 0, read_bytes = 0, bits = 0, c, character = 0;
+  
+  while ((c = (long)(unsigned char)(*string++)))
+    if (read_bytes == 0)
+      {
+	if ((c & 0x80) == 0x00)
+	  continue;
+	if ((c & 0xC0) == 0x80)
+	  return -1;
+	while ((c & 0x80))
+	  bytes++, c <<= 1;
+	read_bytes = 1;
+	character = c & 0x7F;
+	if (bytes > 6)
+	  return -1;
+      }
+    else
+      {
+	if ((c & 0xC0) != 0x80)
+	  return -1;
+	character = (character << 6) | (c & 0x7F);
+	if (++read_bytes < bytes)
+	  continue;
+	while (character)
+	  character >>= 1, bits++;
+	if ((bits < BYTES_TO_MIN_BITS[bytes]) || (BYTES_TO_MAX_BITS[bytes] < bits))
+	  return -1;
+	read_bytes = bytes = bits = 0;
+      }
+  
+  return read_bytes == 0 ? 0 : -1;
+}
+
+
+/**
+ * Read a message from memory, over and over again,
+ * as much as is asked for is read, like a socket that
+ * always has many messages waiting
+ * 
+ * @param   data:stream_t*  The stream
+ * @param   buffer          Output buffer for the read data
+ * @param   size            The size of `buffer`
+ * @return                  The number of read bytes
+ */
+static ssize_t read_stream(void* data, char* buffer, size_t size)
+{
+  stream_t* stream = data;
+  size_t n, got = 0;
+  
+  while (got < size)
+    {
+      n = min(size - got, stream->length - stream->offset);
+      memcpy(buffer + got, stream->message + stream->offset, n);
+      got += n;
+      stream->offset = (stream->offset + n) % stream->length;
+    }
+  
+  return (ssize_t)got;
+}
+
+
+/**
+ * Compose a message in the text framing, without a payload
+ * 
+ * @param   headers  The number of headers, excluding ‘Command’ and ‘Message ID’
+ * @param   value    The length of the header values, zero for short values
+ * @param   utf8     Whether every 16th character of long values is a two-byte character
+ * @param   length   Output parameter for the length of the message
+ * @return           The message, NUL-terminated, `NULL` on error
+ */
+static char* make_message(size_t headers, size_t value, int utf8, size_t* length)
+{
+  char* message = NULL;
+  size_t i, j, n = 0, size = 64 * (headers + 2) + headers * (value + value / 15) + 2;
+  int r;
+  
+  fail_if (xmalloc(message, size, char));
+  
+#define APPEND(...)							\
+  fail_if ((r = snprintf(message + n, size - n, __VA_ARGS__)) < 0);	\
+  n += (size_t)r
+  
+  APPEND("Command: bench\nMessage ID: 0\n");
+  for (i = 0; i < headers; i++)
+    if (value == 0)
+      {
+	APPEND("X-Header-%zu: value %zu\n", i, i);
+      }
+    else
+      {
+	APPEND("X-Header-%zu: ", i);
+	for (j = 0; j < value; j++)
+	  if (utf8 && (j % 16 == 15))
+	    message[n++] = (char)0xC3, message[n++] = (char)0xA9;
+	  else
+	    message[n++] = (char)('a' + j % 26);
+	message[n++] = '\n';
+      }
+  APPEND("\n");
+  
+#undef APPEND
+  
+  *length = n;
+  return message;
+ fail:
+  free(message);
+  return NULL;
+}
+
+
+/**
+ * Measure splitting a message into headers and validating them,
+ * as `mds_message_read` does, byte by byte as it was done before
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_frame_bytewise(char* text, size_t length, size_t rounds)
+{
+  char* end = text + length;
+  char* msg;
+  char* lf;
+  char* colon;
+  double start;
+  size_t r, sum = 0;
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    for (msg = text; ((lf = memchr(msg, '\n', (size_t)(end - msg))) != NULL) && (lf != msg); msg = lf + 1)
+      {
+	*lf = '\0';
+	colon = memchr(msg, ':', (size_t)(lf - msg + 1));
+	if (bytewise_verify_utf8(msg) || (colon == NULL) || (colon[1] != ' '))
+	  return *lf = '\n', errno = EBADMSG, -1;
+	*lf = '\n';
+	sum += (size_t)(colon - msg);
+      }
+  sink = sum;
+  return now() - start;
+}
+
+
+/**
+ * Measure splitting a message into headers and validating them,
+ * as `mds_message_read` does, with the selected implementation
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_frame(char* text, size_t length, size_t rounds)
+{
+  const char* end = text + length;
+  const char* msg;
+  const char* lf;
+  const char* colon;
+  double start;
+  size_t r, sum = 0;
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    for (msg = text; ((lf = scan_line(msg, (size_t)(end - msg), &colon)) != NULL) && (lf != msg); msg = lf + 1)
+      {
+	if (scan_utf8(msg, (size_t)(lf - msg), 0) || (colon == NULL) || (colon[1] != ' '))
+	  return errno = EBADMSG, -1;
+	sum += (size_t)(colon - msg);
+      }
+  sink = sum;
+  return now() - start;
+}
+
+
+/**
+ * Measure finding the names and values of the headers in a
+ * message, as mds-server does before multicasting it, byte
+ * by byte and with `strchr` as it was done before
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_split_bytewise(char* text, size_t length, size_t rounds)
+{
+  const char* names[MAX_HEADERS];
+  const char* values[MAX_HEADERS];
+  char* msg;
+  double start;
+  size_t r, i, n = length - 1, count, sum = 0;
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = count = 0; i < n; i++)
+	if (text[i] == '\n')
+	  if (count++, text[i + 1] == '\n')
+	    break;
+      for (i = 0, msg = text; i < count; i++)
+	{
+	  char* lf = strchr(msg, '\n');
+	  char* colon = strchr(msg, ':');
+	  names[i] = msg, values[i] = colon;
+	  msg = lf + 1;
+	}
+      sum += (size_t)(values[count - 1] - names[count - 1]);
+    }
+  sink = sum;
+  return now() - start;
+}
+
+
+/**
+ * Measure finding the names and values of the headers in a message,
+ * as mds-server does before multicasting it, with the selected implementation
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_split(char* text, size_t length, size_t rounds)
+{
+  const char* names[MAX_HEADERS];
+  const char* values[MAX_HEADERS];
+  const char* end = text + length;
+  const char* msg;
+  const char* lf;
+  const char* colon;
+  double start;
+  size_t r, i, count, sum = 0;
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    {
+      for (count = 0, msg = text; ((lf = scan_line(msg, (size_t)(end - msg), &colon)) != NULL) && (lf != msg); msg = lf + 1)
+	count++;
+      for (i = 0, msg = text; i < count; i++)
+	{
+	  lf = scan_line(msg, (size_t)(end - msg), &colon);
+	  names[i] = msg, values[i] = colon;
+	  msg = lf + 1;
+	}
+      sum += (size_t)(values[count - 1] - names[count - 1]);
+    }
+  sink = sum;
+  return now() - start;
+}
+
+
+/**
+ * Measure all of `mds_message_read`, with the selected implementation
+ * 
+ * @param   text    The message, in the text framing
+ * @param   length  The length of `text`
+ * @param   rounds  The number of times to perform the operation
+ * @return          The time spent, in nanoseconds, negative on error
+ */
+static double op_read(char* text, size_t length, size_t rounds)
+{
+  mds_message_t message;
+  stream_t stream;
+  double start, elapsed = -1;
+  size_t r, sum = 0;
+  
+  stream.message = text;
+  stream.length = length;
+  stream.offset = 0;
+  
+  fail_if (mds_message_initialise(&message));
+  
+  start = now();
+  for (r = 0; r < rounds; r++)
+    {
+      fail_if (mds_message_read_from(&message, read_stream, &stream));
+      sum += message.header_count;
+    }
+  elapsed = now() - start;
+  sink = sum;
+  
+ fail:
+  mds_message_destroy(&message);
+  return elapsed;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  Unused
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  static const struct { const char* name; size_t headers; size_t value; int utf8; } workloads[] =
+    {
+      { "short-headers", SHORT_HEADERS, 0,          0 },
+      { "long-values",   LONG_HEADERS,  LONG_VALUE, 0 },
+      { "utf8-values",   LONG_HEADERS,  LONG_VALUE, 1 },
+    };
+  static const struct { const char* name; operation_func* run; int bytewise; } operations[] =
+    {
+      { "frame", op_frame_bytewise, 1 },
+      { "frame", op_frame,          0 },
+      { "split", op_split_bytewise, 1 },
+      { "split", op_split,          0 },
+      { "read",  op_read,           0 },
+    };
+  static const char* kernels[] = { "scalar", "sse2", "avx2" };
+  char* text = NULL;
+  size_t i, j, length, rounds;
+  int k, rc = 1;
+  double elapsed;
+  
+  (void) argc_;
+  program_name = *argv_;
+  
+  for (i = 0; i < sizeof(workloads) / sizeof(*workloads); i++)
+    {
+      fail_if ((text = make_message(workloads[i].headers, workloads[i].value, workloads[i].utf8, &length)) == NULL);
+      rounds = BYTES / length;
+      for (j = 0; j < sizeof(operations) / sizeof(*operations); j++)
+	for (k = SCAN_KERNEL_SCALAR; k <= (operations[j].bytewise ? SCAN_KERNEL_SCALAR : SCAN_KERNEL_AVX2); k++)
+	  {
+	    if ((operations[j].bytewise == 0) && scan_select((scan_kernel_t)k))
+	      continue;
+	    fail_if ((elapsed = operations[j].run(text, length, rounds)) < 0);
+	    printf("{\"benchmark\": \"scan\", \"workload\": \"%s\", \"operation\": \"%s\", \"kernel\": \"%s\", "
+		   "\"bytes\": %zu, \"operations\": %zu, \"ns_per_operation\": %.2f, \"mib_per_second\": %.1f}\n",
+		   workloads[i].name, operations[j].name, operations[j].bytewise ? "bytewise" : kernels[k],
+		   length, rounds, elapsed / (double)rounds,
+		   (double)(length * rounds) * 1000000000 / (1 << 20) / elapsed);
+	    fflush(stdout);
+	  }
+      free(text), text = NULL;
+    }
+  
+  rc = 0;
+ fail:
+  if (rc)
+    perror(program_name);
+  free(text);
+  return rc;
+}
+
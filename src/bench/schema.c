@@ -0,0 +1,263 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the header dispatch that is generated from
+ * mds-server's protocol schema, against the chain of `startswith`
+ * and `strequals` that it replaced. A message's headers are parsed
+ * into typed values, as mds-server does with every message it
+ * receives. The messages are an interception request, which only
+ * has headers that mds-server reads, and a message to another
+ * server, whose headers mds-server mostly ignores, and which
+ * therefore go through the whole chain. The results are printed
+ * as one JSON object per line, with the fields `benchmark`,
+ * `workload`, `parser`, `headers`, `operations`, `ns_per_operation`
+ * and `ns_per_header`, where an operation is the parsing of one
+ * message with `headers` headers, and `parser` is `chain` for the
+ * replaced dispatch and `schema` for the generated dispatch.
+ */
+
+#include "../schema/mds-server.h"
+
+#include <libmdsserver/mds-message.h>
+#include <libmdsserver/macros.h>
+#include <libmdsserver/util.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+
+/**
+ * The number of messages to parse in each measurement
+ */
+#define OPERATIONS  (1 << 21)
+
+/**
+ * The number of additional headers in the message to another server
+ */
+#define FOREIGN_HEADERS  24
+
+
+
+/**
+ * The values that mds-server reads from a message
+ */
+typedef struct parsed
+{
+  int flags;
+  int accept_lanes;
+  int64_t priority;
+  uint64_t modify_id;
+  uint64_t reply_timeout;
+  const char* message_id;
+  const char* recipient;
+  const char* framing_name;
+  const char* credit_messages;
+  const char* credit_bytes;
+  const char* credit_window;
+  
+} parsed_t;
+
+
+/**
+ * Parse the headers of a message
+ * 
+ * @param  message  The message
+ * @param  parsed   Output parameter for the parsed values
+ */
+typedef void parse_func(const mds_message_t* restrict message, parsed_t* restrict parsed);
+
+
+
+/**
+ * Sink for results, so that the work is not optimised away
+ */
+static volatile size_t sink;
+
+
+
+/**
+ * Get the current time, in nanoseconds
+ * 
+ * @return  A monotonic timestamp
+ */
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)((uint64_t)(ts.tv_sec) * 1000000000ULL + (uint64_t)(ts.tv_nsec));
+}
+
+
+/**
+ * Parse the headers of a message with the chain of `startswith`
+ * and `strequals` that mds-server used before its protocol schema
+ * 
+ * @param  message  The message
+ * @param  parsed   Output parameter for the parsed values
+ */
+static void parse_chain(const mds_message_t* restrict message, parsed_t* restrict parsed)
+{
+  size_t i;
+  
+  memset(parsed, 0, sizeof(*parsed));
+  parsed->accept_lanes = -1;
+  
+  for (i = 0; i < message->header_count; i++)
+    {
+      const char* h = message->headers[i];
+      if      (strequals(h,  "Command: assign-id"))    parsed->flags |= 1 << 0;
+      else if (strequals(h,  "Command: intercept"))    parsed->flags |= 1 << 1;
+      else if (strequals(h,  "Command: fast-lane"))    parsed->flags |= 1 << 2;
+      else if (strequals(h,  "Command: shm-ring"))     parsed->flags |= 1 << 3;
+      else if (strequals(h,  "Command: framing"))      parsed->flags |= 1 << 4;
+      else if (strequals(h,  "Command: server-stats")) parsed->flags |= 1 << 5;
+      else if (strequals(h,  "Command: credit"))       parsed->flags |= 1 << 6;
+      else if (strequals(h,  "Modifying: yes"))        parsed->flags |= 1 << 7;
+      else if (strequals(h,  "Stop: yes"))             parsed->flags |= 1 << 8;
+      else if (strequals(h,  "Attachment: fd"))        parsed->flags |= 1 << 9;
+      else if (startswith(h, "Modify: "))              parsed->flags |= 1 << 10;
+      else if (startswith(h, "Message ID: "))          parsed->message_id = strstr(h, ": ") + 2;
+      else if (startswith(h, "Priority: "))            parsed->priority = ato64(strstr(h, ": ") + 2);
+      else if (startswith(h, "Modify ID: "))           parsed->modify_id = atou64(strstr(h, ": ") + 2);
+      else if (startswith(h, "Timeout: "))             parsed->reply_timeout = atou64(strstr(h, ": ") + 2);
+      else if (startswith(h, "Accept: "))              parsed->accept_lanes = strequals(h, "Accept: yes");
+      else if (startswith(h, "To: "))                  parsed->recipient = strstr(h, ": ") + 2;
+      else if (startswith(h, "Framing: "))             parsed->framing_name = strstr(h, ": ") + 2;
+      else if (startswith(h, "Messages: "))            parsed->credit_messages = strstr(h, ": ") + 2;
+      else if (startswith(h, "Bytes: "))               parsed->credit_bytes = strstr(h, ": ") + 2;
+      else if (startswith(h, "Window: "))              parsed->credit_window = strstr(h, ": ") + 2;
+    }
+}
+
+
+/**
+ * Parse the headers of a message with the dispatch
+ * generated from mds-server's protocol schema
+ * 
+ * @param  message  The message
+ * @param  parsed   Output parameter for the parsed values
+ */
+static void parse_schema(const mds_message_t* restrict message, parsed_t* restrict parsed)
+{
+  mds_server_message_t headers;
+  
+  memset(parsed, 0, sizeof(*parsed));
+  mds_server_parse(&headers, message);
+  parsed->flags |= (int)(headers.command);
+  parsed->flags |= (headers.modifying == MDS_SERVER_MODIFYING_YES) << 7;
+  parsed->flags |= (headers.stop == MDS_SERVER_STOP_YES) << 8;
+  parsed->flags |= (headers.attachment == MDS_SERVER_ATTACHMENT_FD) << 9;
+  parsed->flags |= MDS_SERVER_GIVEN(&headers, MODIFY) << 10;
+  parsed->accept_lanes = MDS_SERVER_GIVEN(&headers, ACCEPT) ? (headers.accept == MDS_SERVER_ACCEPT_YES) : -1;
+  parsed->priority = headers.priority;
+  parsed->modify_id = headers.modify_id;
+  parsed->message_id = headers.message_id;
+  parsed->reply_timeout = headers.timeout;
+  parsed->recipient = headers.to;
+  parsed->framing_name = headers.framing;
+  parsed->credit_messages = headers.messages;
+  parsed->credit_bytes = headers.bytes;
+  parsed->credit_window = headers.window;
+}
+
+
+/**
+ * Measure a parser and print the result
+ * 
+ * @param   workload  The name of the workload
+ * @param   message   The message
+ * @param   name      The name of the parser
+ * @param   parse     The parser
+ */
+static void measure(const char* workload, const mds_message_t* message, const char* name, parse_func* parse)
+{
+  parsed_t parsed;
+  double start, ns;
+  size_t i;
+  
+  start = now();
+  for (i = 0; i < OPERATIONS; i++)
+    {
+      parse(message, &parsed);
+      sink += (size_t)(parsed.flags) + (size_t)(parsed.priority);
+    }
+  ns = now() - start;
+  
+  printf("{\"benchmark\": \"schema\", \"workload\": \"%s\", \"parser\": \"%s\", \"headers\": %zu, "
+	 "\"operations\": %i, \"ns_per_operation\": %.1lf, \"ns_per_header\": %.2lf}\n",
+	 workload, name, message->header_count, OPERATIONS,
+	 ns / OPERATIONS, ns / OPERATIONS / (double)(message->header_count));
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @return  Zero on success, 1 on error
+ */
+int main(void)
+{
+  static char intercept_headers[][32] =
+    {
+      "Command: intercept", "Message ID: 4711", "Modifying: yes", "Priority: -1024", "Stop: yes"
+    };
+  static char foreign_headers[FOREIGN_HEADERS + 4][32] =
+    {
+      "Command: set-colour", "Message ID: 4711", "To: 12:34", "Client ID: 12:35"
+    };
+  char* intercept[sizeof(intercept_headers) / sizeof(*intercept_headers)];
+  char* foreign[sizeof(foreign_headers) / sizeof(*foreign_headers)];
+  mds_message_t message;
+  parsed_t chain, schema;
+  size_t i;
+  
+  memset(&message, 0, sizeof(message));
+  for (i = 0; i < sizeof(intercept) / sizeof(*intercept); i++)
+    intercept[i] = intercept_headers[i];
+  for (i = 0; i < sizeof(foreign) / sizeof(*foreign); i++)
+    {
+      if (i >= 4)
+	sprintf(foreign_headers[i], "X-Property-%zu: value %zu", i - 4, i - 4);
+      foreign[i] = foreign_headers[i];
+    }
+  
+  message.headers = intercept;
+  message.header_count = sizeof(intercept) / sizeof(*intercept);
+  parse_chain(&message, &chain);
+  parse_schema(&message, &schema);
+  if (memcmp(&chain, &schema, sizeof(chain)))
+    {
+      fprintf(stderr, "schema: the parsers disagree\n");
+      return 1;
+    }
+  measure("intercept", &message, "chain", parse_chain);
+  measure("intercept", &message, "schema", parse_schema);
+  
+  message.headers = foreign;
+  message.header_count = sizeof(foreign) / sizeof(*foreign);
+  measure("foreign", &message, "chain", parse_chain);
+  measure("foreign", &message, "schema", parse_schema);
+  
+  return 0;
+}
+
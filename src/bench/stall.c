@@ -0,0 +1,330 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of how the display server copes with a client that stops
+ * reading. A sender multicasts a stream of messages to a few receivers
+ * of a spawned mds-server, once with only receivers that read, and
+ * then with a frozen receiver that never reads as well, under each of
+ * the policies for stalled clients. The frozen receiver must not stop
+ * the stream to the others, so the benchmark fails if the others do
+ * not get the whole stream in time, or if, apart from the time the
+ * server lets the frozen receiver stall, it takes them more than
+ * `SLOWDOWN_BOUND` times as long as without it. The results are
+ * printed as one JSON object per line.
+ */
+
+#include "harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+
+
+/**
+ * The number of messages the sender sends in each measurement
+ */
+#define MESSAGE_COUNT  (1 << 15)
+
+/**
+ * The number of receivers that read
+ */
+#define RECEIVERS  4
+
+/**
+ * The size of the payload of each message
+ */
+#define PAYLOAD_SIZE  1024
+
+/**
+ * The number of milliseconds the server lets a client stall
+ */
+#define STALL_TIMEOUT  "200"
+
+/**
+ * The number of seconds a receiver waits for a message
+ * before it considers the stream to have stopped
+ */
+#define RECEIVE_TIMEOUT  10
+
+/**
+ * How many times as long as without a frozen receiver the receivers
+ * that read may take to get the stream with one, apart from the time
+ * the server waits before it deals with the frozen receiver
+ */
+#define SLOWDOWN_BOUND  2
+
+
+
+/**
+ * A receiver that reads the stream
+ */
+typedef struct receiver
+{
+  /**
+   * The client
+   */
+  libmds_connection_t connection;
+  
+  /**
+   * Message slot for the client
+   */
+  libmds_message_t message;
+  
+  /**
+   * Zero on success, -1 on error
+   */
+  int rc;
+  
+} receiver_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The number of nanoseconds the receivers that read
+ * took to get the stream without a frozen receiver
+ */
+static double baseline;
+
+
+
+/**
+ * Connect a client that intercepts the stream
+ * 
+ * @param   connection  Initialised connection descriptor
+ * @param   message     Message slot to read into
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int connect_receiver(libmds_connection_t* connection, libmds_message_t* message)
+{
+  struct timeval timeout;
+  
+  fail_if (connect_client(connection, message));
+  fail_if (send_simple(connection, "Command: intercept", "Command: bench\n"));
+  fail_if (sync_client(connection, message));
+  
+  /* A stream that has stopped fails the benchmark rather than hanging it. */
+  timeout.tv_sec = RECEIVE_TIMEOUT;
+  timeout.tv_usec = 0;
+  fail_if (setsockopt(connection->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Receive the stream, run as a thread
+ * 
+ * @param   data:receiver_t*  The receiver
+ * @return                    `NULL`
+ */
+static void* receive_stream(void* data)
+{
+  receiver_t* receiver = data;
+  size_t i;
+  
+  receiver->rc = 0;
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    if (libmds_message_read(&(receiver->message), receiver->connection.socket_fd))
+      {
+	receiver->rc = -1;
+	break;
+      }
+  
+  return NULL;
+}
+
+
+/**
+ * Check whether the display server has disconnected a client,
+ * what has already been sent to it is discarded
+ * 
+ * @param   connection  The client
+ * @return              1 if the client has been disconnected, 0 otherwise
+ */
+__attribute__((nonnull))
+static int is_disconnected(libmds_connection_t* connection)
+{
+  char buf[4096];
+  ssize_t r;
+  
+  while ((r = recv(connection->socket_fd, buf, sizeof(buf), 0)) > 0);
+  return r == 0;
+}
+
+
+/**
+ * Measure the throughput of a stream to the receivers that read,
+ * with or without a frozen receiver, the measurement without
+ * a frozen receiver must be made first
+ * 
+ * @param   server  The pathname of the mds-server binary
+ * @param   policy  The policy for stalled clients
+ * @param   frozen  Whether there is a frozen receiver
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int measure(const char* server, const char* policy, int frozen)
+{
+  receiver_t receivers[RECEIVERS];
+  libmds_connection_t sender;
+  libmds_connection_t frozen_receiver;
+  libmds_message_t message;
+  pthread_t threads[RECEIVERS];
+  char* stream = NULL;
+  char* payload = NULL;
+  size_t i, started = 0, initialised = 0, stream_size = 0, length;
+  static char stall_timeout[] = "--stall-timeout=" STALL_TIMEOUT;
+  static char outbound_limit[] = "--outbound-limit=65536";
+  char policy_arg[sizeof("--stall-policy=") + 16];
+  char* args[4];
+  double start, elapsed;
+  int rc = -1, disconnected = 0;
+  
+  memset(&sender, 0, sizeof(sender));
+  memset(&frozen_receiver, 0, sizeof(frozen_receiver));
+  memset(&message, 0, sizeof(message));
+  fail_if (libmds_connection_initialise(&sender));
+  fail_if (libmds_connection_initialise(&frozen_receiver));
+  fail_if (libmds_message_initialise(&message));
+  for (; initialised < RECEIVERS; initialised++)
+    {
+      fail_if (libmds_connection_initialise(&(receivers[initialised].connection)));
+      fail_if (libmds_message_initialise(&(receivers[initialised].message)));
+    }
+  
+  snprintf(policy_arg, sizeof(policy_arg), "--stall-policy=%s", policy);
+  args[0] = stall_timeout;
+  args[1] = policy_arg;
+  args[2] = outbound_limit;
+  args[3] = NULL;
+  fail_if (spawn_server(server, args));
+  fail_if (connect_client(&sender, &message));
+  for (i = 0; i < RECEIVERS; i++)
+    fail_if (connect_receiver(&(receivers[i].connection), &(receivers[i].message)));
+  if (frozen)
+    fail_if (connect_receiver(&frozen_receiver, &message));
+  
+  fail_if (xmalloc(payload, PAYLOAD_SIZE + 1, char));
+  memset(payload, 'x', PAYLOAD_SIZE - 1);
+  payload[PAYLOAD_SIZE - 1] = '\n';
+  payload[PAYLOAD_SIZE] = '\0';
+  fail_if (libmds_compose(&stream, &stream_size, &length, payload, NULL,
+			  "Command: bench", "Message ID: 0", NULL));
+  
+  start = now();
+  for (; started < RECEIVERS; started++)
+    fail_if ((errno = pthread_create(threads + started, NULL, receive_stream, receivers + started)));
+  for (i = 0; i < MESSAGE_COUNT; i++)
+    fail_if (libmds_connection_send(&sender, stream, length) < length);
+  while (started > 0)
+    {
+      pthread_join(threads[--started], NULL);
+      if (receivers[started].rc)
+	{
+	  fprintf(stderr, "%s: the stream stopped for a receiver that reads\n", program_name);
+	  goto fail;
+	}
+    }
+  elapsed = now() - start;
+  
+  if (frozen)
+    disconnected = is_disconnected(&frozen_receiver);
+  else
+    baseline = elapsed;
+  
+  printf("{\"benchmark\": \"stall\", \"policy\": \"%s\", \"frozen_receivers\": %i, "
+	 "\"receivers\": %i, \"messages\": %i, \"messages_per_second\": %.0f, "
+	 "\"frozen_disconnected\": %s}\n",
+	 policy, frozen, RECEIVERS, MESSAGE_COUNT,
+	 (double)MESSAGE_COUNT * 1000000000 / elapsed, disconnected ? "true" : "false");
+  fflush(stdout);
+  
+  if (frozen && (elapsed - strtod(STALL_TIMEOUT, NULL) * 1000000 > baseline * SLOWDOWN_BOUND))
+    {
+      fprintf(stderr, "%s: the frozen receiver slowed down the receivers that read\n", program_name);
+      errno = 0;
+      goto fail;
+    }
+  
+  rc = 0;
+ fail:
+  while (started > 0)
+    {
+      pthread_cancel(threads[--started]);
+      pthread_join(threads[started], NULL);
+    }
+  kill_server();
+  free(stream);
+  free(payload);
+  libmds_message_destroy(&message);
+  libmds_connection_destroy(&sender);
+  libmds_connection_destroy(&frozen_receiver);
+  for (i = 0; i < initialised; i++)
+    {
+      libmds_message_destroy(&(receivers[i].message));
+      libmds_connection_destroy(&(receivers[i].connection));
+    }
+  return rc;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The pathname of the mds-server binary may be specified,
+ *                 bin/mds-server is used otherwise
+ * @return         Zero on success, 1 on error
+ */
+int main(int argc_, char** argv_)
+{
+  const char* server = argc_ > 1 ? argv_[1] : "bin/mds-server";
+  
+  program_name = *argv_;
+  
+  fail_if (measure(server, "close", 0));
+  fail_if (measure(server, "close", 1));
+  fail_if (measure(server, "drop", 1));
+  
+  return 0;
+ fail:
+  if (errno)
+    perror(program_name);
+  return 1;
+}
+
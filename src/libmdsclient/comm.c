@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "comm.h"
+#include "ring.h"
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -36,8 +37,8 @@
  * @return        Zero on success, -1 on error, `ernno`
  *                will have been set accordingly on error
  * 
- * @throws  EAGAIN  See pthread_mutex_init(3)
- * @throws  ENOMEM  See pthread_mutex_init(3)
+ * @throws  EAGAIN  See pthread_mutex_init(3) and pthread_cond_init(3)
+ * @throws  ENOMEM  See pthread_mutex_init(3) and pthread_cond_init(3)
  * @throws  EPERM   See pthread_mutex_init(3)
  */
 int libmds_connection_initialise(libmds_connection_t* restrict this)
@@ -46,10 +47,19 @@ int libmds_connection_initialise(libmds_connection_t* restrict this)
   this->message_id = UINT32_MAX;
   this->client_id = NULL;
   this->mutex_initialised = 0;
+  this->rings = NULL;
+  this->binary = 0;
+  this->credited = 0;
+  this->send_credit = 0;
+  this->credit_cond_initialised = 0;
   errno = pthread_mutex_init(&(this->mutex), NULL);
   if (errno)
     return -1;
   this->mutex_initialised = 1;
+  errno = pthread_cond_init(&(this->credit_cond), NULL);
+  if (errno)
+    return -1;
+  this->credit_cond_initialised = 1;
   return 0;
 }
 
@@ -84,6 +94,10 @@ void libmds_connection_destroy(libmds_connection_t* restrict this)
   if (this == NULL)
     return;
   
+  libmds_ring_close(this->rings);
+  free(this->rings);
+  this->rings = NULL;
+  
   if (this->socket_fd >= 0)
     {
       close(this->socket_fd); /* TODO Linux closes the filedescriptor on EINTR, but POSIX does not require that. */
@@ -93,6 +107,12 @@ void libmds_connection_destroy(libmds_connection_t* restrict this)
   free(this->client_id);
   this->client_id = NULL;
   
+  if (this->credit_cond_initialised)
+    {
+      this->credit_cond_initialised = 0;
+      pthread_cond_destroy(&(this->credit_cond)); /* Can return EBUSY. */
+    }
+  
   if (this->mutex_initialised)
     {
       this->mutex_initialised = 0;
@@ -283,6 +303,9 @@ size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const
   size_t sent = 0;
   ssize_t just_sent;
   
+  if (this->rings != NULL)
+    return libmds_ring_write(this->rings, message, length, continue_on_interrupt);
+  
   errno = 0;
   while (length > 0)
     if ((just_sent = send(this->socket_fd, message + sent, min(block_size, length), MSG_NOSIGNAL)) < 0)
@@ -307,3 +330,125 @@ size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const
   return sent;
 }
 
+
+/**
+ * Wrapper for `libmds_connection_send_fd_unlocked` that locks
+ * the mutex of the connection
+ * 
+ * @param   this     The connection descriptor, must not be `NULL`
+ * @param   message  The message to send, must not be `NULL`, it should
+ *                   have an `Attachment: fd` header
+ * @param   length   The length of the message, should be positive
+ * @param   fd       The file descriptor to attach to the message, it is not closed
+ * @return           The number of sent bytes. Less than `length` on error,
+ *                   `ernno` will have been set accordingly on error
+ * 
+ * @throws  EACCES        See send(2)
+ * @throws  EWOULDBLOCK   See send(2), only if the socket has been modified to nonblocking
+ * @throws  EBADF         See send(2)
+ * @throws  ECONNRESET    If connection was lost
+ * @throws  EDESTADDRREQ  See send(2)
+ * @throws  EFAULT        See send(2)
+ * @throws  EINVAL        See send(2)
+ * @throws  ENOBUFS       See send(2)
+ * @throws  ENOMEM        See send(2)
+ * @throws  ENOTCONN      See send(2)
+ * @throws  ENOTSOCK      See send(2)
+ * @throws  EPIPE         See send(2)
+ * @throws                See pthread_mutex_lock(3)
+ */
+size_t libmds_connection_send_fd(libmds_connection_t* restrict this, const char* restrict message,
+				 size_t length, int fd)
+{
+  int saved_errno;
+  size_t r;
+  
+  if (libmds_connection_lock(this))
+    return 0;
+  
+  r = libmds_connection_send_fd_unlocked(this, message, length, fd, 1);
+  
+  saved_errno = errno;
+  (void) libmds_connection_unlock(this);
+  return errno = saved_errno, r;
+}
+
+
+/**
+ * Send a message with a file descriptor attached to it to the
+ * display server, without locking the mutex of the conncetion
+ * 
+ * This lets large payloads, such as in a sealed memory file,
+ * be passed through the display server without it reading them
+ * 
+ * @param   this                   The connection descriptor, must not be `NULL`
+ * @param   message                The message to send, must not be `NULL`,
+ *                                 it should have an `Attachment: fd` header
+ * @param   length                 The length of the message, should be positive
+ * @param   fd                     The file descriptor to attach to the message,
+ *                                 it is not closed
+ * @param   continue_on_interrupt  Whether to continue sending if interrupted by a signal
+ * @return                         The number of sent bytes. Less than `length` on error,
+ *                                 `ernno` will have been set accordingly on error
+ * 
+ * @throws  EACCES        See send(2)
+ * @throws  EWOULDBLOCK   See send(2), only if the socket has been modified to nonblocking
+ * @throws  EBADF         See send(2)
+ * @throws  ECONNRESET    If connection was lost
+ * @throws  EDESTADDRREQ  See send(2)
+ * @throws  EFAULT        See send(2)
+ * @throws  EINTR         If interrupted by a signal, only if `continue_on_interrupt' is zero
+ * @throws  EINVAL        See send(2)
+ * @throws  ENOBUFS       See send(2)
+ * @throws  ENOMEM        See send(2)
+ * @throws  ENOTCONN      See send(2)
+ * @throws  ENOTSOCK      See send(2)
+ * @throws  EPIPE         See send(2)
+ */
+size_t libmds_connection_send_fd_unlocked(libmds_connection_t* restrict this, const char* restrict message,
+					  size_t length, int fd, int continue_on_interrupt)
+{
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr header;
+  struct iovec part;
+  struct cmsghdr* cmsg;
+  ssize_t just_sent;
+  
+  /* The display server receives the file descriptor
+     before it reads the message from the ring. */
+  if (this->rings != NULL)
+    {
+      if (libmds_ring_pass_fd(this->rings, fd) < 0)
+	return 0;
+      return libmds_ring_write(this->rings, message, length, continue_on_interrupt);
+    }
+  
+  /* The file descriptor is received with the first byte of the message. */
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &part;
+  header.msg_iovlen = 1;
+  header.msg_control = control.buf;
+  header.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&header);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  
+  part.iov_base = (void*)(intptr_t)message;
+  part.iov_len = length;
+  errno = 0;
+  while ((just_sent = sendmsg(this->socket_fd, &header, MSG_NOSIGNAL)) < 0)
+    if ((errno != EINTR) || !continue_on_interrupt)
+      return 0;
+  
+  /* The rest of the message is sent as any other message. */
+  return (size_t)just_sent +
+    libmds_connection_send_unlocked(this, message + just_sent, length - (size_t)just_sent,
+				    continue_on_interrupt);
+}
+
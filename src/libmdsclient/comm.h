@@ -66,6 +66,42 @@ typedef struct libmds_connection
    */
   int mutex_initialised;
   
+  /**
+   * The rings in memory shared with the display
+   * server, `NULL` if only the socket is used
+   */
+  struct libmds_rings* rings;
+  
+  /**
+   * Whether messages are sent in the binary framing,
+   * see `libmds_framing_set`
+   */
+  int binary;
+  
+  /**
+   * Whether the display server has to grant credit
+   * for the messages that are sent with
+   * `libmds_credit_send`, see `libmds_credit_request`
+   */
+  int credited;
+  
+  /**
+   * The number of messages that may be sent before the
+   * display server grants more credit, if `credited` is set
+   */
+  size_t send_credit;
+  
+  /**
+   * Condition, used with `mutex`, that is broadcasted
+   * when the display server grants credit
+   */
+  pthread_cond_t credit_cond;
+  
+  /**
+   * Whether `credit_cond` is initialised
+   */
+  int credit_cond_initialised;
+  
 } libmds_connection_t;
 
 
@@ -76,8 +112,8 @@ typedef struct libmds_connection
  * @return        Zero on success, -1 on error, `ernno`
  *                will have been set accordingly on error
  * 
- * @throws  EAGAIN  See pthread_mutex_init(3)
- * @throws  ENOMEM  See pthread_mutex_init(3)
+ * @throws  EAGAIN  See pthread_mutex_init(3) and pthread_cond_init(3)
+ * @throws  ENOMEM  See pthread_mutex_init(3) and pthread_cond_init(3)
  * @throws  EPERM   See pthread_mutex_init(3)
  */
 __attribute__((nonnull))
@@ -212,6 +248,71 @@ __attribute__((nonnull))
 size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const char* restrict message,
 				       size_t length, int continue_on_interrupt);
 
+/**
+ * Wrapper for `libmds_connection_send_fd_unlocked` that locks
+ * the mutex of the connection
+ * 
+ * @param   this     The connection descriptor, must not be `NULL`
+ * @param   message  The message to send, must not be `NULL`, it should
+ *                   have an `Attachment: fd` header
+ * @param   length   The length of the message, should be positive
+ * @param   fd       The file descriptor to attach to the message, it is not closed
+ * @return           The number of sent bytes. Less than `length` on error,
+ *                   `ernno` will have been set accordingly on error
+ * 
+ * @throws  EACCES        See send(2)
+ * @throws  EWOULDBLOCK   See send(2), only if the socket has been modified to nonblocking
+ * @throws  EBADF         See send(2)
+ * @throws  ECONNRESET    If connection was lost
+ * @throws  EDESTADDRREQ  See send(2)
+ * @throws  EFAULT        See send(2)
+ * @throws  EINVAL        See send(2)
+ * @throws  ENOBUFS       See send(2)
+ * @throws  ENOMEM        See send(2)
+ * @throws  ENOTCONN      See send(2)
+ * @throws  ENOTSOCK      See send(2)
+ * @throws  EPIPE         See send(2)
+ * @throws                See pthread_mutex_lock(3)
+ */
+__attribute__((nonnull))
+size_t libmds_connection_send_fd(libmds_connection_t* restrict this, const char* restrict message,
+				 size_t length, int fd);
+
+/**
+ * Send a message with a file descriptor attached to it to the
+ * display server, without locking the mutex of the conncetion
+ * 
+ * This lets large payloads, such as in a sealed memory file,
+ * be passed through the display server without it reading them
+ * 
+ * @param   this                   The connection descriptor, must not be `NULL`
+ * @param   message                The message to send, must not be `NULL`,
+ *                                 it should have an `Attachment: fd` header
+ * @param   length                 The length of the message, should be positive
+ * @param   fd                     The file descriptor to attach to the message,
+ *                                 it is not closed
+ * @param   continue_on_interrupt  Whether to continue sending if interrupted by a signal
+ * @return                         The number of sent bytes. Less than `length` on error,
+ *                                 `ernno` will have been set accordingly on error
+ * 
+ * @throws  EACCES        See send(2)
+ * @throws  EWOULDBLOCK   See send(2), only if the socket has been modified to nonblocking
+ * @throws  EBADF         See send(2)
+ * @throws  ECONNRESET    If connection was lost
+ * @throws  EDESTADDRREQ  See send(2)
+ * @throws  EFAULT        See send(2)
+ * @throws  EINTR         If interrupted by a signal, only if `continue_on_interrupt' is zero
+ * @throws  EINVAL        See send(2)
+ * @throws  ENOBUFS       See send(2)
+ * @throws  ENOMEM        See send(2)
+ * @throws  ENOTCONN      See send(2)
+ * @throws  ENOTSOCK      See send(2)
+ * @throws  EPIPE         See send(2)
+ */
+__attribute__((nonnull))
+size_t libmds_connection_send_fd_unlocked(libmds_connection_t* restrict this, const char* restrict message,
+					  size_t length, int fd, int continue_on_interrupt);
+
 /**
  * Lock the connection descriptor for being modified,
  * or used to send data to the display, by another thread
@@ -223,7 +324,7 @@ size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const
  * @throws  See pthread_mutex_lock(3)
  */
 #define libmds_connection_lock(this) \
-  (errno = pthread_mutex_lock(&((this)->mutex)), (errno ? 0 : -1))
+  (errno = pthread_mutex_lock(&((this)->mutex)), (errno ? -1 : 0))
 
 /**
  * Lock the connection descriptor for being modified,
@@ -236,7 +337,7 @@ size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const
  * @throws  See pthread_mutex_trylock(3)
  */
 #define libmds_connection_trylock(this) \
-  (errno = pthread_mutex_trylock(&((this)->mutex)), (errno ? 0 : -1))
+  (errno = pthread_mutex_trylock(&((this)->mutex)), (errno ? -1 : 0))
 
 /**
  * Lock the connection descriptor for being modified,
@@ -251,7 +352,7 @@ size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const
  * @throws  See pthread_mutex_timedlock(3)
  */
 #define libmds_connection_timedlock(this, deadline)  \
-  (errno = pthread_mutex_timedlock(&((this)->mutex), deadline), (errno ? 0 : -1))
+  (errno = pthread_mutex_timedlock(&((this)->mutex), deadline), (errno ? -1 : 0))
 
 /**
  * Undo the action of `libmds_connection_lock`, `libmds_connection_trylock`
@@ -264,7 +365,7 @@ size_t libmds_connection_send_unlocked(libmds_connection_t* restrict this, const
  * @throws  See pthread_mutex_unlock(3)
  */
 #define libmds_connection_unlock(this)  \
-  (errno = pthread_mutex_unlock(&((this)->mutex)), (errno ? 0 : -1))
+  (errno = pthread_mutex_unlock(&((this)->mutex)), (errno ? -1 : 0))
 
 /**
  * Arguments for `libmds_compose` to compose the `Client ID`-header
@@ -0,0 +1,239 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "credit.h"
+#include "proto-util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+
+
+/**
+ * Grant the display server credit for delivering messages
+ * 
+ * Once the connection has granted credit, the display server only
+ * delivers messages that are sent to it by other clients as long as
+ * it has credit; each message takes the credit of one message and
+ * of its length in bytes. The grants are added to the credit that
+ * is left. The display server's replies to the connection's own
+ * requests are always delivered, and messages that are withheld
+ * still count against the display server's limit on how much it
+ * queues for the connection
+ * 
+ * @param   this      The connection descriptor, must not be `NULL`
+ * @param   messages  The number of further messages that may be
+ *                    delivered, zero to grant none
+ * @param   bytes     The number of further bytes that may be
+ *                    delivered, zero to grant none
+ * @return            Zero on success, -1 on error, `errno` will
+ *                    have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+int libmds_credit_grant(libmds_connection_t* restrict this, size_t messages, size_t bytes)
+{
+  char* buffer = NULL;
+  size_t buffer_size = 0, length;
+  int saved_errno, locked = 0;
+  
+  if (libmds_connection_lock(this))
+    goto fail;
+  locked = 1;
+  
+  if (libmds_next_message_id(&(this->message_id), NULL, NULL))
+    goto fail;
+  if ((this->binary ? libmds_compose_binary : libmds_compose)
+      (&buffer, &buffer_size, &length, NULL, NULL,
+       "Command: credit",
+       "?Messages: %zu", messages > 0, messages,
+       "?Bytes: %zu", bytes > 0, bytes,
+       LIBMDS_HEADERS_STANDARD(this), NULL))
+    goto fail;
+  
+  if (libmds_connection_send_unlocked(this, buffer, length, 1) < length)
+    goto fail;
+  
+  free(buffer);
+  return libmds_connection_unlock(this);
+ fail:
+  saved_errno = errno;
+  free(buffer);
+  if (locked)
+    (void) libmds_connection_unlock(this);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Ask the display server for credit for sending messages
+ * 
+ * The display server grants the connection credit for `window`
+ * messages, and then more credit as the messages that the connection
+ * has sent have been routed. Messages sent with `libmds_credit_send`
+ * wait for the credit, so that the connection cannot send more than
+ * the display server can route. The grants must be passed to
+ * `libmds_credit_received` as they are read
+ * 
+ * @param   this    The connection descriptor, must not be `NULL`
+ * @param   window  The number of messages that may be sent ahead
+ *                  of the routing, zero to stop using send credit
+ * @return          Zero on success, -1 on error, `errno` will
+ *                  have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+int libmds_credit_request(libmds_connection_t* restrict this, size_t window)
+{
+  char* buffer = NULL;
+  size_t buffer_size = 0, length;
+  int saved_errno, locked = 0;
+  
+  if (libmds_connection_lock(this))
+    goto fail;
+  locked = 1;
+  
+  if (libmds_next_message_id(&(this->message_id), NULL, NULL))
+    goto fail;
+  if ((this->binary ? libmds_compose_binary : libmds_compose)
+      (&buffer, &buffer_size, &length, NULL, NULL,
+       "Command: credit",
+       "Window: %zu", window,
+       LIBMDS_HEADERS_STANDARD(this), NULL))
+    goto fail;
+  
+  /* The display server grants the whole window in response,
+     the credit that is left is forgotten, and not granted again. */
+  if (libmds_connection_send_unlocked(this, buffer, length, 1) < length)
+    goto fail;
+  this->credited = window > 0;
+  this->send_credit = 0;
+  if (window == 0)
+    pthread_cond_broadcast(&(this->credit_cond));
+  
+  free(buffer);
+  return libmds_connection_unlock(this);
+ fail:
+  saved_errno = errno;
+  free(buffer);
+  if (locked)
+    (void) libmds_connection_unlock(this);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Check whether a received message is a grant of send credit
+ * from the display server, and if so, take the credit
+ * 
+ * @param   this     The connection descriptor, must not be `NULL`
+ * @param   message  The received message, must not be `NULL`
+ * @return           1 if the message was a grant of send credit,
+ *                   zero if it was not, -1 on error, `errno`
+ *                   will have been set accordingly on error
+ * 
+ * @throws  See pthread_mutex_lock(3)
+ */
+int libmds_credit_received(libmds_connection_t* restrict this, const libmds_message_t* restrict message)
+{
+  const char* granted = NULL;
+  int credit = 0;
+  size_t i, n = 0;
+  
+  for (i = 0; i < message->header_count; i++)
+    {
+      const char* h = message->headers[i];
+      if (!strcmp(h, "Command: credit"))
+	credit = 1;
+      else if (!strncmp(h, "Messages: ", strlen("Messages: ")))
+	granted = h + strlen("Messages: ");
+    }
+  if ((credit == 0) || (granted == NULL))
+    return 0;
+  
+  for (; ('0' <= *granted) && (*granted <= '9'); granted++)
+    n = n > (SIZE_MAX - 9) / 10 ? SIZE_MAX : n * 10 + (size_t)(*granted & 15);
+  
+  if (libmds_connection_lock(this))
+    return -1;
+  this->send_credit = SIZE_MAX - this->send_credit < n ? SIZE_MAX : this->send_credit + n;
+  pthread_cond_broadcast(&(this->credit_cond));
+  if (libmds_connection_unlock(this))
+    return -1;
+  return 1;
+}
+
+
+/**
+ * Send a message to the display server once the connection has
+ * credit for it, if it has asked for send credit, and take the
+ * credit of one message
+ * 
+ * When the connection is out of credit, the function waits until
+ * another thread reads a grant and passes it to `libmds_credit_received`,
+ * unless `nonblocking` is set
+ * 
+ * @param   this         The connection descriptor, must not be `NULL`
+ * @param   message      The message to send, must not be `NULL`
+ * @param   length       The length of the message, should be positive
+ * @param   nonblocking  Whether to fail rather than wait for credit
+ * @return               The number of sent bytes. Less than `length` on error,
+ *                       `ernno` will have been set accordingly on error
+ * 
+ * @throws  EAGAIN  The connection is out of credit, only if `nonblocking` is set
+ * @throws          Any error specified for `libmds_connection_send`
+ * @throws          See pthread_cond_wait(3)
+ */
+size_t libmds_credit_send(libmds_connection_t* restrict this, const char* restrict message,
+			  size_t length, int nonblocking)
+{
+  size_t sent;
+  int saved_errno;
+  
+  if (libmds_connection_lock(this))
+    return 0;
+  
+  while (this->credited && (this->send_credit == 0))
+    {
+      if (nonblocking)
+	{
+	  errno = EAGAIN;
+	  goto fail;
+	}
+      if ((errno = pthread_cond_wait(&(this->credit_cond), &(this->mutex))))
+	goto fail;
+    }
+  if (this->credited)
+    this->send_credit -= 1;
+  
+  sent = libmds_connection_send_unlocked(this, message, length, 1);
+  
+  saved_errno = errno;
+  (void) libmds_connection_unlock(this);
+  return errno = saved_errno, sent;
+ fail:
+  saved_errno = errno;
+  (void) libmds_connection_unlock(this);
+  return errno = saved_errno, 0;
+}
+
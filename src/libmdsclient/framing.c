@@ -0,0 +1,84 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "framing.h"
+#include "proto-util.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+
+
+/**
+ * Switch the framing of the messages between the
+ * connection and the display server
+ * 
+ * Messages are sent in the new framing as soon as this
+ * function returns. The display server replies with a
+ * `Command: framing` message, the last message in the old
+ * framing, that `libmds_message_read` does not return, but
+ * after which it reads the new framing; or with a `Command: error`
+ * message, in which case the display server keeps the old framing,
+ * so the connection cannot be used any further
+ * 
+ * Messages must be composed with `libmds_compose_binary`
+ * while the binary framing is used
+ * 
+ * @param   this    The connection descriptor, must not be `NULL`
+ * @param   binary  Whether the binary framing should be used,
+ *                  otherwise the text framing is used
+ * @return          Zero on success, -1 on error, `errno` will
+ *                  have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+int libmds_framing_set(libmds_connection_t* restrict this, int binary)
+{
+  char* buffer = NULL;
+  size_t buffer_size = 0, length;
+  int saved_errno, locked = 0;
+  
+  if (libmds_connection_lock(this))
+    goto fail;
+  locked = 1;
+  
+  /* The request is sent in the old framing, and everything after it in the new. */
+  if (libmds_next_message_id(&(this->message_id), NULL, NULL))
+    goto fail;
+  if ((this->binary ? libmds_compose_binary : libmds_compose)
+      (&buffer, &buffer_size, &length, NULL, NULL,
+       "Command: framing",
+       "Framing: %s", binary ? "binary" : "text",
+       LIBMDS_HEADERS_STANDARD(this), NULL))
+    goto fail;
+  
+  if (libmds_connection_send_unlocked(this, buffer, length, 1) < length)
+    goto fail;
+  this->binary = !!binary;
+  
+  free(buffer);
+  return libmds_connection_unlock(this);
+ fail:
+  saved_errno = errno;
+  free(buffer);
+  if (locked)
+    (void) libmds_connection_unlock(this);
+  return errno = saved_errno, -1;
+}
+
@@ -0,0 +1,56 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_LIBMDSCLIENT_FRAMING_H
+#define MDS_LIBMDSCLIENT_FRAMING_H
+
+
+#include "comm.h"
+
+
+
+/**
+ * Switch the framing of the messages between the
+ * connection and the display server
+ * 
+ * Messages are sent in the new framing as soon as this
+ * function returns. The display server replies with a
+ * `Command: framing` message, the last message in the old
+ * framing, that `libmds_message_read` does not return, but
+ * after which it reads the new framing; or with a `Command: error`
+ * message, in which case the display server keeps the old framing,
+ * so the connection cannot be used any further
+ * 
+ * Messages must be composed with `libmds_compose_binary`
+ * while the binary framing is used
+ * 
+ * @param   this    The connection descriptor, must not be `NULL`
+ * @param   binary  Whether the binary framing should be used,
+ *                  otherwise the text framing is used
+ * @return          Zero on success, -1 on error, `errno` will
+ *                  have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+__attribute__((nonnull))
+int libmds_framing_set(libmds_connection_t* restrict this, int binary);
+
+
+#endif
+
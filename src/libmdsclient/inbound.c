@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "inbound.h"
+#include "ring.h"
+#include "proto-util.h"
 /* Some optimisations have been attempted. Verify that this implementation
  * works, then update the implementation in libmdsserver. */
 
@@ -30,6 +32,15 @@
 
 #define try(INSTRUCTION)    if ((r = INSTRUCTION) < 0)  return r
 #define static_strlen(str)  (sizeof(str) / sizeof(char) - 1)
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+
+
+/**
+ * The room that is left before the read data in the binary framing,
+ * the headers are larger than their records, and are written over
+ * them and into this room, rather than moving the data after them
+ */
+#define BINARY_HEADER_ROOM  256
 
 
 
@@ -50,9 +61,15 @@ int libmds_message_initialise(libmds_message_t* restrict this)
   this->header_count = 0;
   this->payload = NULL;
   this->payload_size = 0;
+  this->fd = -1;
+  this->fds = NULL;
+  this->fds_count = 0;
+  this->rings = NULL;
   this->buffer_size = 128;
   this->buffer_ptr = 0;
+  this->buffer_off = 0;
   this->stage = 0;
+  this->binary = 0;
   this->flattened = 0;
   this->buffer = malloc(this->buffer_size * sizeof(char));
   return this->buffer == NULL ? -1 : 0;
@@ -66,10 +83,17 @@ int libmds_message_initialise(libmds_message_t* restrict this)
  */
 void libmds_message_destroy(libmds_message_t* restrict this)
 {
+  size_t i;
   if (this->flattened == 0)
     {
       free(this->headers), this->headers = NULL;
       free(this->buffer),  this->buffer  = NULL;
+      if (this->fd >= 0)
+	close(this->fd), this->fd = -1;
+      for (i = 0; i < this->fds_count; i++)
+	close(this->fds[i]);
+      free(this->fds), this->fds = NULL;
+      this->fds_count = 0;
     }
 }
 
@@ -109,6 +133,10 @@ libmds_message_t* libmds_message_duplicate(libmds_message_t* restrict this, libm
   *rc = *this;
   rc->flattened   = reused ? reused : flattened_size;
   rc->buffer_size = this->buffer_off;
+  rc->fds         = NULL;
+  rc->fds_count   = 0;
+  rc->rings       = NULL;
+  this->fd        = -1;
   
   rc->buffer  = ((char*)rc) + sizeof(libmds_message_t) / sizeof(char);
   rc->headers = rc->header_count ? (char**)(void*)(rc->buffer + this->buffer_off)        : NULL;
@@ -246,7 +274,9 @@ static int extend_buffer(libmds_message_t* restrict this, int shift)
 }
 
 /**
- * Reset the header list and the payload
+ * Reset the header list and the payload, and move the data
+ * that has not been parsed to the beginning of the buffer,
+ * after `BINARY_HEADER_ROOM` in the binary framing
  * 
  * @param  this  The message
  */
@@ -254,11 +284,12 @@ __attribute__((nonnull))
 static void reset_message(libmds_message_t* restrict this)
 {
   size_t overrun = this->buffer_ptr - this->buffer_off;
+  size_t room = this->binary ? min(BINARY_HEADER_ROOM, this->buffer_size - overrun) : 0;
   
-  if (overrun)
-    memmove(this->buffer, this->buffer + this->buffer_off, overrun * sizeof(char));
-  this->buffer_ptr -= this->buffer_off;
-  this->buffer_off = 0;
+  if (overrun && (room != this->buffer_off))
+    memmove(this->buffer + room, this->buffer + this->buffer_off, overrun * sizeof(char));
+  this->buffer_ptr = room + overrun;
+  this->buffer_off = room;
   
   free(this->headers);
   this->headers = NULL;
@@ -266,6 +297,49 @@ static void reset_message(libmds_message_t* restrict this)
   
   this->payload = NULL;
   this->payload_size = 0;
+  
+  if (this->fd >= 0)
+    close(this->fd), this->fd = -1;
+}
+
+
+/**
+ * Give the message the file descriptor that was passed
+ * along with it, if it has an `Attachment: fd` header
+ * 
+ * The file descriptors are received with the first byte
+ * of the message they are attached to, so the message
+ * takes the oldest file descriptor that has not been taken,
+ * once the rings are used, they are received before the
+ * message, but they are not received until they are needed
+ * 
+ * @param   this  The message
+ * @return        Zero on success, -1 on error, -2 if the message has an
+ *                attachment but no file descriptor was received
+ *                (malformated message: unrecoverable state)
+ */
+__attribute__((nonnull, warn_unused_result))
+static int claim_attachment(libmds_message_t* restrict this)
+{
+  size_t i;
+  
+  for (i = 0; i < this->header_count; i++)
+    if (!strcmp(this->headers[i], "Attachment: fd"))
+      {
+	if ((this->fds_count == 0) && (this->rings != NULL))
+	  {
+	    if ((this->fd = libmds_ring_receive_fd(this->rings)) < 0)
+	      return -1;
+	    break;
+	  }
+	if (this->fds_count == 0)
+	  return -2;
+	this->fd = this->fds[0];
+	memmove(this->fds, this->fds + 1, --(this->fds_count) * sizeof(int));
+	break;
+      }
+  
+  return 0;
 }
 
 
@@ -275,7 +349,7 @@ static void reset_message(libmds_message_t* restrict this)
  * @param   this  The message
  * @return        Zero on success, negative on error (malformated message: unrecoverable state)
  */
-__attribute__((pure, nonnull, warn_unused_result))
+__attribute__((nonnull, warn_unused_result))
 static int get_payload_length(libmds_message_t* restrict this)
 {
   char* header;
@@ -382,7 +456,7 @@ static int store_header(libmds_message_t* restrict this, size_t length)
   header[length - 1] = '\0';
   
   /* Update read offset. */
-  this->buffer += length;
+  this->buffer_off += length;
   
   /* Make sure the the header syntax is correct so that
      the program does not need to care about it. */
@@ -396,6 +470,166 @@ static int store_header(libmds_message_t* restrict this, size_t length)
 }
 
 
+/**
+ * Store the headers of a message in the binary framing, when
+ * they have been read, as they would have been in the text
+ * framing, and make sure the full payload fits the buffer
+ * 
+ * @param   this  The message
+ * @return        The return value follows the rules of `mds_message_read`
+ * 
+ * @throws  ENOMEM  Out of memory. Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ */
+__attribute__((nonnull, warn_unused_result))
+static int store_binary_headers(libmds_message_t* restrict this)
+{
+  const char* p;
+  const char* end;
+  const char* name;
+  char* text = NULL;
+  char* header;
+  uint32_t count, size, payload_size, value_length;
+  uint16_t name_length16;
+  size_t name_length, text_size = 0, region, i;
+  int atom, shift = 0, saved_errno;
+  
+  /* Wait until the headers have been read. */
+  p = this->buffer + this->buffer_off;
+  if (this->buffer_ptr - this->buffer_off < LIBMDS_BINARY_PREFIX)
+    return 0;
+  memcpy(&count,        p + 0 * sizeof(uint32_t), sizeof(uint32_t));
+  memcpy(&size,         p + 1 * sizeof(uint32_t), sizeof(uint32_t));
+  memcpy(&payload_size, p + 2 * sizeof(uint32_t), sizeof(uint32_t));
+  region = LIBMDS_BINARY_PREFIX + (size_t)size;
+  if (this->buffer_ptr - this->buffer_off < region)
+    return 0;
+  
+  /* A header is at least five bytes, so this stops excessive allocations. */
+  if ((size_t)count * (1 + sizeof(uint32_t)) > (size_t)size)
+    return -2;
+  
+#define need(N)  if ((size_t)(end - p) < (size_t)(N))  goto malformated
+  /* The headers are written as they would have been in the text framing,
+     but NUL-terminated, first to a buffer of their own as they can
+     be larger than their records, and then over the records. */
+  for (;;)
+    {
+      p = this->buffer + this->buffer_off + LIBMDS_BINARY_PREFIX;
+      end = p + size;
+      header = text;
+      for (i = 0; i < count; i++)
+	{
+	  /* Get the name, by its atom if it has one. */
+	  need(1);
+	  if ((atom = (int)(unsigned char)*p++))
+	    {
+	      if ((name = libmds_header_atom_name(atom)) == NULL)
+		goto malformated;
+	      name_length = strlen(name);
+	    }
+	  else
+	    {
+	      need(sizeof(uint16_t));
+	      memcpy(&name_length16, p, sizeof(uint16_t));
+	      p += sizeof(uint16_t);
+	      name_length = (size_t)name_length16;
+	      need(name_length);
+	      name = p;
+	      p += name_length;
+	    }
+	  need(sizeof(uint32_t));
+	  memcpy(&value_length, p, sizeof(uint32_t));
+	  p += sizeof(uint32_t);
+	  need(value_length);
+	  
+	  if (text == NULL)
+	    text_size += name_length + 2 + (size_t)value_length + 1;
+	  else
+	    {
+	      memcpy(header, name, name_length * sizeof(char));
+	      memcpy(header + name_length, ": ", 2 * sizeof(char));
+	      memcpy(header + name_length + 2, p, (size_t)value_length * sizeof(char));
+	      header += name_length + 2 + (size_t)value_length;
+	      *header++ = '\0';
+	    }
+	  p += value_length;
+	}
+      if (p != end)
+	goto malformated;
+      if (text != NULL)
+	break;
+      if ((text = malloc((text_size ? text_size : 1) * sizeof(char))) == NULL)
+	return -1;
+    }
+#undef need
+  
+  /* Make room for the headers where the records were, they extend into the
+     room before the records if there is enough, which there is unless they
+     have many headers, otherwise the data after the records is moved forward. */
+  if ((text_size > region) && (this->buffer_off >= text_size - region))
+    {
+      this->buffer_off -= text_size - region;
+      region = text_size;
+    }
+  else if (text_size > region)
+    {
+      while (this->buffer_ptr + (text_size - region) > this->buffer_size << shift)
+	shift++;
+      if (shift ? (extend_buffer(this, shift) < 0) : 0)
+	goto fail;
+      memmove(this->buffer + this->buffer_off + text_size,
+	      this->buffer + this->buffer_off + region,
+	      (this->buffer_ptr - this->buffer_off - region) * sizeof(char));
+      this->buffer_ptr += text_size - region;
+      region = text_size;
+    }
+  if ((count > 0) && (extend_headers(this, count) < 0))
+    goto fail;
+  memcpy(this->buffer + this->buffer_off, text, text_size * sizeof(char));
+  free(text), text = NULL;
+  
+  /* Store the headers in the header list, make sure that
+     they could have been sent in the text framing. */
+  header = this->buffer + this->buffer_off;
+  for (i = 0; i < count; i++)
+    {
+      name_length = strlen(header);
+      if ((memchr(header, '\n', name_length) != NULL) || validate_header(header, name_length))
+	return -2;
+      this->headers[this->header_count++] = header;
+      header += name_length + 1;
+    }
+  if (header != this->buffer + this->buffer_off + text_size)
+    return -2; /* One of the headers contained a NUL byte. */
+  this->buffer_off += region;
+  
+  /* The payload must be described by the ‘Length’ header. */
+  this->payload_size = 0;
+  if ((get_payload_length(this) < 0) || (this->payload_size != (size_t)payload_size))
+    return -2;
+  
+  /* Reallocate the buffer if it is too small. */
+  for (shift = 0; this->buffer_off + this->payload_size > this->buffer_size << shift;)
+    shift++;
+  if (shift ? (extend_buffer(this, shift) < 0) : 0)
+    return -1;
+  
+  /* Set pointer to payload. */
+  this->payload = this->buffer + this->buffer_off;
+  
+  this->stage = 1;
+  return 0;
+ malformated:
+  free(text);
+  return -2;
+ fail:
+  saved_errno = errno;
+  free(text);
+  return errno = saved_errno, -1;
+}
+
+
 /**
  * Continue reading from the socket into the buffer
  * 
@@ -410,8 +644,17 @@ static int store_header(libmds_message_t* restrict this, size_t length)
 __attribute__((nonnull))
 static int continue_read(libmds_message_t* restrict this, int fd)
 {
-  size_t n;
+  union
+  {
+    char buf[CMSG_SPACE(4 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  size_t n, received;
   ssize_t got;
+  int* new_fds;
   int r;
   
   /* Figure out how much space we have left in the read buffer. */
@@ -427,12 +670,52 @@ static int continue_read(libmds_message_t* restrict this, int fd)
       n = this->buffer_size - this->buffer_ptr;
     }
   
-  /* Then read from the socket. */
+  /* Once the rings are used, the ring is read rather than the socket. */
+  if (this->rings != NULL)
+    {
+      got = libmds_ring_read(this->rings, this->buffer + this->buffer_ptr, n);
+      if (got < 0)
+	return -1;
+      if (got == 0)
+	return errno = ECONNRESET, -1;
+      this->buffer_ptr += (size_t)got;
+      return 0;
+    }
+  
+  /* Then read from the socket, along with any passed file descriptors. */
+  iov.iov_base = this->buffer + this->buffer_ptr;
+  iov.iov_len = n;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
   errno = 0;
-  got = recv(fd, this->buffer + this->buffer_ptr, n, 0);
+  got = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
   this->buffer_ptr += (size_t)(got < 0 ? 0 : got);
   if (errno)
     return -1;
+  
+  /* Queue the file descriptors until the messages they are attached to are complete. */
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+      {
+	received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	new_fds = realloc(this->fds, (this->fds_count + received) * sizeof(int));
+	if (new_fds == NULL)
+	  {
+	    for (n = 0; n < received; n++)
+	      {
+		memcpy(&r, CMSG_DATA(cmsg) + n * sizeof(int), sizeof(int));
+		close(r);
+	      }
+	    return errno = ENOMEM, -1;
+	  }
+	this->fds = new_fds;
+	memcpy(this->fds + this->fds_count, CMSG_DATA(cmsg), received * sizeof(int));
+	this->fds_count += received;
+      }
+  
   if (got == 0)
     return errno = ECONNRESET, -1;
   
@@ -440,6 +723,49 @@ static int continue_read(libmds_message_t* restrict this, int fd)
 }
 
 
+/**
+ * Check whether a message is the display server's
+ * reply to a `Command: shm-ring` message
+ * 
+ * @param   this  The message
+ * @return        Whether the message is the reply
+ */
+__attribute__((pure, nonnull))
+static int is_ring_reply(const libmds_message_t* restrict this)
+{
+  size_t i;
+  for (i = 0; i < this->header_count; i++)
+    if (!strcmp(this->headers[i], "Command: shm-ring"))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Check whether a message is the display server's
+ * reply to a `Command: framing` message, and if
+ * so, which framing the following messages are in
+ * 
+ * @param   this  The message
+ * @return        -1 if the message is not the reply, otherwise
+ *                whether the following messages are in the binary framing
+ */
+__attribute__((pure, nonnull))
+static int framing_reply(const libmds_message_t* restrict this)
+{
+  int is_reply = 0, binary = -1;
+  size_t i;
+  for (i = 0; i < this->header_count; i++)
+    if (!strcmp(this->headers[i], "Command: framing"))
+      is_reply = 1;
+    else if (!strcmp(this->headers[i], "Framing: binary"))
+      binary = 1;
+    else if (!strcmp(this->headers[i], "Framing: text"))
+      binary = 0;
+  return is_reply ? binary : -1;
+}
+
+
 /**
  * Read the next message from a file descriptor
  * 
@@ -477,8 +803,12 @@ int libmds_message_read(libmds_message_t* restrict this, int fd)
       size_t length;
       
       /* Stage 0: headers. */
+      /* In the binary framing, the headers are stored all at once. */
+      if ((this->stage == 0) && this->binary)
+	try (store_binary_headers(this));
+      
       /* Read all headers that we have stored into the read buffer. */
-      while ((this->stage == 0) &&
+      while ((this->stage == 0) && (this->binary == 0) &&
 	     ((p = memchr(this->buffer + this->buffer_off, '\n',
 			  (this->buffer_ptr - this->buffer_off) * sizeof(char))) != NULL))
 	if ((length = (size_t)(p - (this->buffer + this->buffer_off))))
@@ -519,7 +849,32 @@ int libmds_message_read(libmds_message_t* restrict this, int fd)
 	  /* Mark the end of the message. */
 	  this->buffer_off += this->payload_size;
 	  
-	  return 0;
+	  /* The reply to `Command: shm-ring` is the last message on the
+	     socket, after it, the ring is read. The reply is not returned,
+	     neither are the bytes that carry file descriptors after it. */
+	  if ((this->rings == NULL) && is_ring_reply(this) &&
+	      ((this->rings = libmds_ring_lookup(fd)) != NULL))
+	    {
+	      this->buffer_ptr = this->buffer_off;
+	      reset_message(this);
+	      this->stage = 0;
+	      header_commit_buffer = 0;
+	      continue;
+	    }
+	  
+	  /* Likewise, the reply to `Command: framing` is the last message
+	     in the old framing, and is not returned. */
+	  if ((r = framing_reply(this)) >= 0)
+	    {
+	      this->binary = r;
+	      reset_message(this);
+	      this->stage = 0;
+	      header_commit_buffer = 0;
+	      continue;
+	    }
+	  
+	  /* Take the file descriptor that was passed along with the message. */
+	  return claim_attachment(this);
 	}
       
       
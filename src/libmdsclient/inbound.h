@@ -55,6 +55,30 @@ typedef struct libmds_message
    */
   size_t payload_size;
   
+  /**
+   * The file descriptor attached to the message, `-1` if none.
+   * It is closed when the next message is read into the structure
+   * or when the message is destroyed, set it to `-1` to keep it
+   */
+  int fd;
+  
+  /**
+   * File descriptors that have been received but not yet
+   * been claimed by a message, in order of arrival (internal data)
+   */
+  int* fds;
+  
+  /**
+   * The number of elements in `fds` (internal data)
+   */
+  size_t fds_count;
+  
+  /**
+   * The rings in memory shared with the display server that the
+   * messages are read from, `NULL` if the socket is read (internal data)
+   */
+  struct libmds_rings* rings;
+  
   /**
    * Internal buffer for the reading function (internal data)
    */
@@ -89,6 +113,11 @@ typedef struct libmds_message
    */
   int stage;
   
+  /**
+   * Whether the messages are in the binary framing (internal data)
+   */
+  int binary;
+  
 } libmds_message_t;
 
 
@@ -236,6 +265,8 @@ void libmds_message_destroy(libmds_message_t* restrict this);
  *                on it before you call `free` on it. However, you cannot use
  *                this is an `libmds_message_t` array (libmds_message_t*), only
  *                in an `libmds_message_t*` array (libmds_message_t**).
+ *                The attached file descriptor, if any, is moved to the
+ *                duplicate, and must be closed by the caller.
  * 
  * @throws  ENOMEM  Out of memory. Possibly, the process hit the RLIMIT_AS or
  *                  RLIMIT_DATA limit described in getrlimit(2).
@@ -246,6 +277,9 @@ libmds_message_t* libmds_message_duplicate(libmds_message_t* restrict this, libm
 /**
  * Read the next message from a file descriptor
  * 
+ * If the message has an `Attachment: fd` header, the file
+ * descriptor that was passed along with it is stored in `fd`
+ * 
  * @param   this  Memory slot in which to store the new message
  * @param   fd    The file descriptor
  * @return        Zero on success, -1 on error or interruption, `errno`
@@ -258,7 +292,7 @@ libmds_message_t* libmds_message_duplicate(libmds_message_t* restrict this, libm
  * 
  * @throws  ENOMEM  Out of memory. Possibly, the process hit the RLIMIT_AS or
  *                  RLIMIT_DATA limit described in getrlimit(2).
- * @throws          Any error specified for recv(3)
+ * @throws          Any error specified for recvmsg(3)
  */
 __attribute__((nonnull, warn_unused_result))
 int libmds_message_read(libmds_message_t* restrict this, int fd);
@@ -0,0 +1,151 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lane.h"
+#include "proto-util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/**
+ * Send a `Command: fast-lane` message to the display server
+ * 
+ * @param   this        The connection descriptor
+ * @param   accept      Value for the `Accept`-header, `NULL` to omit it
+ * @param   peer        Value for the `To`-header, `NULL` to omit it
+ * @param   message_id  Output parameter for the message ID, may be `NULL`
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull(1)))
+static int send_lane_message(libmds_connection_t* restrict this, const char* restrict accept,
+			     const char* restrict peer, uint32_t* restrict message_id)
+{
+  char* buffer = NULL;
+  size_t buffer_size = 0, length;
+  int saved_errno, locked = 0;
+  
+  if (libmds_connection_lock(this))
+    goto fail;
+  locked = 1;
+  
+  if (libmds_next_message_id(&(this->message_id), NULL, NULL))
+    goto fail;
+  if ((this->binary ? libmds_compose_binary : libmds_compose)
+      (&buffer, &buffer_size, &length, NULL, NULL,
+       "Command: fast-lane",
+       "?Accept: %s", accept != NULL, accept,
+       "?To: %s", peer != NULL, peer,
+       LIBMDS_HEADERS_STANDARD(this), NULL))
+    goto fail;
+  
+  if (libmds_connection_send_unlocked(this, buffer, length, 1) < length)
+    goto fail;
+  if (message_id != NULL)
+    *message_id = this->message_id;
+  
+  free(buffer);
+  return libmds_connection_unlock(this);
+ fail:
+  saved_errno = errno;
+  free(buffer);
+  if (locked)
+    (void) libmds_connection_unlock(this);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Tell the display server whether other clients may
+ * open fast lanes to this client
+ * 
+ * @param   this    The connection descriptor, must not be `NULL`
+ * @param   accept  Whether fast lanes should be accepted
+ * @return          Zero on success, -1 on error, `errno` will
+ *                  have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+int libmds_lane_accept(libmds_connection_t* restrict this, int accept)
+{
+  return send_lane_message(this, accept ? "yes" : "no", NULL, NULL);
+}
+
+
+/**
+ * Ask the display server to open a fast lane, a socket
+ * that bypasses the server, to another client
+ * 
+ * The server replies with a `Command: fast-lane` message, to which
+ * the socket is attached, or with a `Command: error` message,
+ * either one in response to the returned message ID; the other
+ * client is sent a `Command: fast-lane` message with the other
+ * end of the socket
+ * 
+ * @param   this        The connection descriptor, must not be `NULL`
+ * @param   peer        The ID of the client to open the fast lane to
+ * @param   message_id  Output parameter for the ID of the request, may be `NULL`
+ * @return              Zero on success, -1 on error, `errno` will
+ *                      have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+int libmds_lane_open(libmds_connection_t* restrict this, const char* restrict peer,
+		     uint32_t* restrict message_id)
+{
+  return send_lane_message(this, NULL, peer, message_id);
+}
+
+
+/**
+ * Take the socket attached to a `Command: fast-lane` message
+ * into a connection descriptor, messages sent and read over it
+ * go directly to and from the other client
+ * 
+ * @param   lane     Initialised, but not established, connection descriptor,
+ *                   must not be `NULL`
+ * @param   message  The `Command: fast-lane` message, its attached file
+ *                   descriptor is moved to `lane`, must not be `NULL`
+ * @return           Zero on success, -1 on error, `errno` will
+ *                   have been set accordingly on error
+ * 
+ * @throws  EBADMSG  The message is not a `Command: fast-lane` message
+ *                   with an attached file descriptor
+ */
+int libmds_lane_establish(libmds_connection_t* restrict lane, libmds_message_t* restrict message)
+{
+  size_t i;
+  
+  if (message->fd < 0)
+    return errno = EBADMSG, -1;
+  for (i = 0; i < message->header_count; i++)
+    if (!strcmp(message->headers[i], "Command: fast-lane"))
+      break;
+  if (i == message->header_count)
+    return errno = EBADMSG, -1;
+  
+  lane->socket_fd = message->fd;
+  message->fd = -1;
+  return 0;
+}
+
@@ -0,0 +1,89 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_LIBMDSCLIENT_LANE_H
+#define MDS_LIBMDSCLIENT_LANE_H
+
+
+#include "comm.h"
+#include "inbound.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * Tell the display server whether other clients may
+ * open fast lanes to this client
+ * 
+ * @param   this    The connection descriptor, must not be `NULL`
+ * @param   accept  Whether fast lanes should be accepted
+ * @return          Zero on success, -1 on error, `errno` will
+ *                  have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+__attribute__((nonnull))
+int libmds_lane_accept(libmds_connection_t* restrict this, int accept);
+
+/**
+ * Ask the display server to open a fast lane, a socket
+ * that bypasses the server, to another client
+ * 
+ * The server replies with a `Command: fast-lane` message, to which
+ * the socket is attached, or with a `Command: error` message,
+ * either one in response to the returned message ID; the other
+ * client is sent a `Command: fast-lane` message with the other
+ * end of the socket
+ * 
+ * @param   this        The connection descriptor, must not be `NULL`
+ * @param   peer        The ID of the client to open the fast lane to
+ * @param   message_id  Output parameter for the ID of the request, may be `NULL`
+ * @return              Zero on success, -1 on error, `errno` will
+ *                      have been set accordingly on error
+ * 
+ * @throws  ENOMEM  Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                  RLIMIT_DATA limit described in getrlimit(2).
+ * @throws          Any error specified for `libmds_connection_send`
+ */
+__attribute__((nonnull(1, 2)))
+int libmds_lane_open(libmds_connection_t* restrict this, const char* restrict peer,
+		     uint32_t* restrict message_id);
+
+/**
+ * Take the socket attached to a `Command: fast-lane` message
+ * into a connection descriptor, messages sent and read over it
+ * go directly to and from the other client
+ * 
+ * @param   lane     Initialised, but not established, connection descriptor,
+ *                   must not be `NULL`
+ * @param   message  The `Command: fast-lane` message, its attached file
+ *                   descriptor is moved to `lane`, must not be `NULL`
+ * @return           Zero on success, -1 on error, `errno` will
+ *                   have been set accordingly on error
+ * 
+ * @throws  EBADMSG  The message is not a `Command: fast-lane` message
+ *                   with an attached file descriptor
+ */
+__attribute__((nonnull))
+int libmds_lane_establish(libmds_connection_t* restrict lane, libmds_message_t* restrict message);
+
+
+#endif
+
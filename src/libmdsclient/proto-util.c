@@ -61,6 +61,50 @@
 
 
 
+/**
+ * A header name that has an atom in the binary framing
+ */
+typedef struct header_atom
+{
+  /**
+   * The header name
+   */
+  const char* name;
+  
+  /**
+   * The length of `name`
+   */
+  size_t length;
+  
+} header_atom_t;
+
+
+#define ATOM(NAME)  { NAME, sizeof(NAME) / sizeof(char) - 1 }
+
+/**
+ * The header names that have atoms, the atom of a name is its
+ * index plus one, this is part of the protocol, so it must be
+ * the same as in libmdsserver, and names may only be added at the end
+ */
+static const header_atom_t header_atoms[] =
+  {
+    ATOM("Command"), ATOM("To"), ATOM("Message ID"), ATOM("Client ID"), ATOM("Length"),
+    ATOM("Modify ID"), ATOM("In response to"), ATOM("Origin command"), ATOM("Error"),
+    ATOM("Modify"), ATOM("Modifying"), ATOM("Priority"), ATOM("Stop"), ATOM("Timeout"),
+    ATOM("Accept"), ATOM("Attachment"), ATOM("ID assignment"), ATOM("Client closed"),
+    ATOM("Lane"), ATOM("Framing")
+  };
+
+#undef ATOM
+
+
+/**
+ * The number of header names that have atoms
+ */
+#define HEADER_ATOM_COUNT  (sizeof(header_atoms) / sizeof(*header_atoms))
+
+
+
 /**
  * Variant of `strcmp` that regards the first string as
  * ending at the first occurrence of the substring ": "
@@ -768,6 +812,257 @@ int libmds_compose_v(char** restrict buffer, size_t* restrict buffer_size, size_
 }
 
 
+/**
+ * Append a header, as a record of the binary framing, to a message
+ * 
+ * @param   buffer       Pointer to the buffer with the message, may be reallocated
+ * @param   buffer_size  Pointer to the allocation size of `*buffer`
+ * @param   length       Pointer to the length of the message, will be updated
+ * @param   header       The header line, without LF
+ * @param   header_len   The length of `header`
+ * @return               Zero on success, -1 on error, `*buffer` will still
+ *                       be valid on error
+ * 
+ * @throws  ENOMEM    Out of memory
+ * @throws  EMSGSIZE  The name or the value is too long for its field
+ */
+static int append_binary_header(char** restrict buffer, size_t* restrict buffer_size, size_t* restrict length,
+				const char* restrict header, size_t header_len)
+{
+  const char* colon = memchr(header, ':', header_len);
+  const char* value = header + header_len;
+  size_t name_len = header_len, value_len;
+  size_t bufsize = *buffer_size, need;
+  char* buf = *buffer;
+  uint16_t name_len16;
+  uint32_t value_len32;
+  int atom;
+  
+  if (colon != NULL)
+    {
+      name_len = (size_t)(colon - header);
+      value = colon + (colon + 1 < value && colon[1] == ' ' ? 2 : 1);
+    }
+  value_len = (size_t)(header + header_len - value);
+  atom = libmds_header_atom(header, name_len);
+  if ((!atom && (name_len > UINT16_MAX)) || (value_len > UINT32_MAX))
+    return errno = EMSGSIZE, -1;
+  
+  need = 1 + (atom ? 0 : sizeof(uint16_t) + name_len) + sizeof(uint32_t) + value_len;
+  if (*length + need >= bufsize)
+    {
+      do
+	bufsize <<= 1;
+      while (*length + need >= bufsize);
+      buf = realloc(buf, bufsize * sizeof(char));
+      if (buf == NULL)
+	return -1;
+      *buffer = buf;
+      *buffer_size = bufsize;
+    }
+  
+  buf += *length;
+  *buf++ = (char)atom;
+  if (atom == 0)
+    {
+      name_len16 = (uint16_t)name_len;
+      memcpy(buf, &name_len16, sizeof(uint16_t)), buf += sizeof(uint16_t);
+      memcpy(buf, header, name_len), buf += name_len;
+    }
+  value_len32 = (uint32_t)value_len;
+  memcpy(buf, &value_len32, sizeof(uint32_t)), buf += sizeof(uint32_t);
+  memcpy(buf, value, value_len);
+  *length += need;
+  return 0;
+}
+
+
+/**
+ * Compose a message in the binary framing, for
+ * connections that have switched to it
+ * 
+ * @param   buffer          See `libmds_compose`
+ * @param   buffer_size     See `libmds_compose`
+ * @param   length          See `libmds_compose`
+ * @param   payload         See `libmds_compose`
+ * @param   payload_length  See `libmds_compose`
+ * @param   ...             See `libmds_compose`
+ * @return                  Zero on success, -1 on error, `errno` will have been set
+ *                          accordingly on error.
+ * 
+ * @throws  ENOMEM          Out of memory. Possibly, the process hit the RLIMIT_AS or
+ *                          RLIMIT_DATA limit described in getrlimit(2).
+ * @throws  EMSGSIZE        A header name is longer than 65535 bytes, or a header
+ *                          value, all headers together, or the payload, is longer
+ *                          than 4294967295 bytes, and cannot be sent in the framing.
+ */
+int libmds_compose_binary(char** restrict buffer, size_t* restrict buffer_size, size_t* restrict length,
+			  const char* restrict payload, const size_t* restrict payload_length, ...)
+{
+  va_list args;
+  int r, saved_errno;
+  va_start(args, payload_length);
+  r = libmds_compose_binary_v(buffer, buffer_size, length, payload, payload_length, args);
+  saved_errno = errno;
+  va_end(args);
+  errno = saved_errno;
+  return r;
+}
+
+
+/**
+ * Compose a message in the binary framing, for
+ * connections that have switched to it
+ * 
+ * @param   buffer          See `libmds_compose_v`
+ * @param   buffer_size     See `libmds_compose_v`
+ * @param   length          See `libmds_compose_v`
+ * @param   payload         See `libmds_compose_v`
+ * @param   payload_length  See `libmds_compose_v`
+ * @param   args            See `libmds_compose_v`
+ * @return                  Zero on success, -1 on error, `errno` will have been set
+ *                          accordingly on error.
+ * 
+ * @throws  ENOMEM          Out of memory. Possibly, the process hit the RLIMIT_AS or
+ *                          RLIMIT_DATA limit described in getrlimit(2).
+ * @throws  EMSGSIZE        A header name is longer than 65535 bytes, or a header
+ *                          value, all headers together, or the payload, is longer
+ *                          than 4294967295 bytes, and cannot be sent in the framing.
+ */
+int libmds_compose_binary_v(char** restrict buffer, size_t* restrict buffer_size, size_t* restrict length,
+			    const char* restrict payload, const size_t* restrict payload_length, va_list args)
+{
+  char length_header[sizeof("Length: ") / sizeof(char) + 3 * sizeof(size_t)];
+  char* buf = *buffer;
+  size_t bufsize = *buffer_size;
+  size_t len = LIBMDS_BINARY_PREFIX;
+  uint32_t prefix[3] = { 0, 0, 0 };
+  int part_len;
+  char* part_msg;
+  size_t payload_len = 0;
+  const char* format;
+  int include;
+  int saved_errno;
+  
+  *length = 0;
+  
+  if (payload != NULL)
+    payload_len = payload_length == NULL ? strlen(payload) : *payload_length;
+  if (payload_len > UINT32_MAX)
+    return errno = EMSGSIZE, -1;
+  
+  if (bufsize == 0)
+    {
+      bufsize = 128;
+      buf = realloc(buf, bufsize * sizeof(char));
+      if (buf == NULL)
+	return -1;
+      *buffer = buf;
+      *buffer_size = bufsize;
+    }
+  
+  for (;;)
+    {
+      format = va_arg(args, const char*);
+      if (format == NULL)
+	break;
+      
+      include = 1;
+      if (*format == '?')
+	{
+	  include = va_arg(args, int);
+	  format++;
+	}
+      
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wformat-nonliteral"
+# pragma GCC diagnostic ignored "-Wsuggest-attribute=format"
+      part_len = vasprintf(&part_msg, format, args);
+# pragma GCC diagnostic pop
+      
+      if (include == 0)
+	{
+	  if (part_len >= 0)
+	    free(part_msg);
+	  continue;
+	}
+      
+      if (part_len < 0)
+	return -1;
+      
+      if (append_binary_header(buffer, buffer_size, &len, part_msg, (size_t)part_len) < 0)
+	return saved_errno = errno, free(part_msg), errno = saved_errno, -1;
+      free(part_msg);
+      prefix[0]++;
+    }
+  
+  if (payload_len > 0)
+    {
+      part_len = sprintf(length_header, "Length: %zu", payload_len);
+      if (append_binary_header(buffer, buffer_size, &len, length_header, (size_t)part_len) < 0)
+	return -1;
+      prefix[0]++;
+    }
+  
+  if (len - LIBMDS_BINARY_PREFIX > UINT32_MAX)
+    return errno = EMSGSIZE, -1;
+  
+  buf = *buffer;
+  bufsize = *buffer_size;
+  if (len + payload_len + 1 > bufsize)
+    {
+      bufsize = len + payload_len + 1;
+      buf = realloc(buf, bufsize * sizeof(char));
+      if (buf == NULL)
+	return -1;
+      *buffer = buf;
+      *buffer_size = bufsize;
+    }
+  
+  prefix[1] = (uint32_t)(len - LIBMDS_BINARY_PREFIX);
+  prefix[2] = (uint32_t)payload_len;
+  memcpy(buf, prefix, LIBMDS_BINARY_PREFIX);
+  if (payload_len > 0)
+    memcpy(buf + len, payload, payload_len * sizeof(char)),
+      len += payload_len;
+  
+  *length = len;
+  return 0;
+}
+
+
+/**
+ * Get the atom of a header name, the small integer that
+ * the name is sent as in the binary framing
+ * 
+ * @param   name    The header name, it need not be NUL-terminated
+ * @param   length  The length of `name`
+ * @return          The atom, zero if the name has none
+ */
+int libmds_header_atom(const char* restrict name, size_t length)
+{
+  size_t i;
+  for (i = 0; i < HEADER_ATOM_COUNT; i++)
+    if ((header_atoms[i].length == length) && !memcmp(header_atoms[i].name, name, length))
+      return (int)i + 1;
+  return 0;
+}
+
+
+/**
+ * Get the header name of an atom
+ * 
+ * @param   atom  The atom
+ * @return        The header name, `NULL` if `atom` is not an atom
+ */
+const char* libmds_header_atom_name(int atom)
+{
+  if ((atom < 1) || ((size_t)atom > HEADER_ATOM_COUNT))
+    return NULL;
+  return header_atoms[atom - 1].name;
+}
+
+
 /**
  * Increase the message ID counter
  * 
@@ -813,4 +1108,3 @@ int libmds_next_message_id(uint32_t* restrict message_id,
   *message_id = id;
   return 0;
 }
-
@@ -26,6 +26,21 @@
 
 
 
+/**
+ * The size of the prefix of a message in the binary framing
+ * 
+ * In the binary framing, a message begins with three `uint32_t`,
+ * in the byte order of the host: the number of headers, the size
+ * of the headers, and the size of the payload. The headers follow,
+ * each beginning with a byte that is the atom of its name, or zero
+ * if the name has no atom and is spelled out after a `uint16_t`
+ * with its length, followed by a `uint32_t` with the length of the
+ * value, and the value. The payload follows the headers. The headers
+ * are those of the text framing, including the ‘Length’ header.
+ */
+#define LIBMDS_BINARY_PREFIX  (3 * sizeof(uint32_t))
+
+
 /**
  * Optimisations `libmds_headers_cherrypick` MAY use
  */
@@ -420,6 +435,72 @@ __attribute__((nonnull(1, 2, 3)))
 int libmds_compose_v(char** restrict buffer, size_t* restrict buffer_size, size_t* restrict length,
 		     const char* restrict payload, const size_t* restrict payload_length, va_list args);
 
+/**
+ * Compose a message in the binary framing, for
+ * connections that have switched to it
+ * 
+ * @param   buffer          See `libmds_compose`
+ * @param   buffer_size     See `libmds_compose`
+ * @param   length          See `libmds_compose`
+ * @param   payload         See `libmds_compose`
+ * @param   payload_length  See `libmds_compose`
+ * @param   ...             See `libmds_compose`
+ * @return                  Zero on success, -1 on error, `errno` will have been set
+ *                          accordingly on error.
+ * 
+ * @throws  ENOMEM          Out of memory. Possibly, the process hit the RLIMIT_AS or
+ *                          RLIMIT_DATA limit described in getrlimit(2).
+ * @throws  EMSGSIZE        A header name is longer than 65535 bytes, or a header
+ *                          value, all headers together, or the payload, is longer
+ *                          than 4294967295 bytes, and cannot be sent in the framing.
+ */
+__attribute__((nonnull(1, 2, 3), sentinel))
+int libmds_compose_binary(char** restrict buffer, size_t* restrict buffer_size, size_t* restrict length,
+			  const char* restrict payload, const size_t* restrict payload_length, ...);
+
+/**
+ * Compose a message in the binary framing, for
+ * connections that have switched to it
+ * 
+ * @param   buffer          See `libmds_compose_v`
+ * @param   buffer_size     See `libmds_compose_v`
+ * @param   length          See `libmds_compose_v`
+ * @param   payload         See `libmds_compose_v`
+ * @param   payload_length  See `libmds_compose_v`
+ * @param   args            See `libmds_compose_v`
+ * @return                  Zero on success, -1 on error, `errno` will have been set
+ *                          accordingly on error.
+ * 
+ * @throws  ENOMEM          Out of memory. Possibly, the process hit the RLIMIT_AS or
+ *                          RLIMIT_DATA limit described in getrlimit(2).
+ * @throws  EMSGSIZE        A header name is longer than 65535 bytes, or a header
+ *                          value, all headers together, or the payload, is longer
+ *                          than 4294967295 bytes, and cannot be sent in the framing.
+ */
+__attribute__((nonnull(1, 2, 3)))
+int libmds_compose_binary_v(char** restrict buffer, size_t* restrict buffer_size, size_t* restrict length,
+			    const char* restrict payload, const size_t* restrict payload_length, va_list args);
+
+/**
+ * Get the atom of a header name, the small integer that
+ * the name is sent as in the binary framing
+ * 
+ * @param   name    The header name, it need not be NUL-terminated
+ * @param   length  The length of `name`
+ * @return          The atom, zero if the name has none
+ */
+__attribute__((pure, nonnull))
+int libmds_header_atom(const char* restrict name, size_t length);
+
+/**
+ * Get the header name of an atom
+ * 
+ * @param   atom  The atom
+ * @return        The header name, `NULL` if `atom` is not an atom
+ */
+__attribute__((const))
+const char* libmds_header_atom_name(int atom);
+
 /**
  * Increase the message ID counter
  * 
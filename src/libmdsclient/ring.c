@@ -0,0 +1,665 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ring.h"
+#include "proto-util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+
+
+#define min(a, b)  ((a) < (b) ? (a) : (b))
+
+
+
+/**
+ * The rings that are in use, the message reading functions
+ * only know the socket, so they look up the rings by it
+ */
+static libmds_rings_t** registry = NULL;
+
+/**
+ * The number of elements in `registry`
+ */
+static size_t registry_count = 0;
+
+/**
+ * Mutex for `registry`
+ */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * Write as much as there is room for to a ring
+ * 
+ * @param   this    The ring
+ * @param   data    The data to write
+ * @param   length  The length of `data`
+ * @return          The number of bytes that were written
+ */
+__attribute__((nonnull))
+static size_t ring_write(libmds_ring_t* restrict this, const char* restrict data, size_t length)
+{
+  uint64_t head = this->control->head;
+  uint64_t tail = __atomic_load_n(&(this->control->tail), __ATOMIC_ACQUIRE);
+  size_t offset = (size_t)head & (this->capacity - 1);
+  size_t n = min(length, this->capacity - (size_t)(head - tail));
+  size_t first = min(n, this->capacity - offset);
+  
+  memcpy(this->data + offset, data, first);
+  memcpy(this->data, data + first, n - first);
+  
+  /* Publish the data only when it has been written. */
+  __atomic_store_n(&(this->control->head), head + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+
+/**
+ * Read as much as is available from a ring
+ * 
+ * @param   this    The ring
+ * @param   buffer  Output buffer for the data
+ * @param   size    The size of `buffer`
+ * @return          The number of bytes that were read
+ */
+__attribute__((nonnull))
+static size_t ring_read(libmds_ring_t* restrict this, char* restrict buffer, size_t size)
+{
+  uint64_t tail = this->control->tail;
+  uint64_t head = __atomic_load_n(&(this->control->head), __ATOMIC_ACQUIRE);
+  size_t offset = (size_t)tail & (this->capacity - 1);
+  size_t n = min(size, (size_t)(head - tail));
+  size_t first = min(n, this->capacity - offset);
+  
+  memcpy(buffer, this->data + offset, first);
+  memcpy(buffer + first, this->data, n - first);
+  
+  /* Release the room only when the data has been copied. */
+  __atomic_store_n(&(this->control->tail), tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+
+/**
+ * Tell the display server that this process is about
+ * to wait for data in a ring, or for room in it
+ * 
+ * @param   flag   `reader_waiting` or `writer_waiting` of the ring
+ * @param   index  The counter that the other end updates, `head` or `tail`
+ * @param   value  The value of `index` that means that this process must wait
+ * @return         Zero if this process may wait for its doorbell,
+ *                 1 if the ring has changed and it must not wait
+ */
+__attribute__((nonnull))
+static int ring_await(uint32_t* restrict flag, uint64_t* restrict index, uint64_t value)
+{
+  /* The flag must be visible before the ring is checked again, otherwise
+     the server could update the ring without seeing it, and we would not wake. */
+  __atomic_store_n(flag, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(index, __ATOMIC_SEQ_CST) == value)
+    return 0;
+  __atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+  return 1;
+}
+
+
+/**
+ * Check, after updating a ring, whether the display server
+ * is waiting for the update and must have its doorbell rung
+ * 
+ * @param   flag  `reader_waiting` or `writer_waiting` of the ring
+ * @return        Whether the doorbell must be rung
+ */
+__attribute__((nonnull))
+static int ring_waiting(uint32_t* restrict flag)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(flag, __ATOMIC_RELAXED) == 0)
+    return 0;
+  return __atomic_exchange_n(flag, 0, __ATOMIC_SEQ_CST) != 0;
+}
+
+
+/**
+ * Ring the display server's doorbell, which is a byte on the socket
+ * 
+ * @param   this  The rings
+ * @return        Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int ring_server(libmds_rings_t* restrict this)
+{
+  char byte = '\0';
+  while (send(this->socket_fd, &byte, sizeof(byte), MSG_NOSIGNAL) < 0)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+
+/**
+ * Wait until the display server rings a doorbell,
+ * or closes the connection
+ * 
+ * @param   this  The rings
+ * @param   bell  The doorbell
+ * @return        Zero if the doorbell was rung, 1 if the display
+ *                server has closed, -1 on error or interruption
+ */
+__attribute__((nonnull))
+static int await_bell(libmds_rings_t* restrict this, int bell)
+{
+  struct pollfd pfds[2];
+  uint64_t value;
+  int flags;
+  
+  /* Do not wait if the socket is nonblocking. */
+  if (((flags = fcntl(this->socket_fd, F_GETFL)) < 0) || (flags & O_NONBLOCK))
+    return errno = flags < 0 ? errno : EWOULDBLOCK, -1;
+  
+  /* The socket is not read, file descriptors that are passed over it are
+     received with the messages, so only the closing of it is watched. */
+  pfds[0].fd = bell;
+  pfds[0].events = POLLIN;
+  pfds[0].revents = 0;
+  pfds[1].fd = this->socket_fd;
+  pfds[1].events = POLLRDHUP;
+  pfds[1].revents = 0;
+  
+  if (poll(pfds, 2, -1) < 0)
+    return -1;
+  if ((pfds[0].revents & POLLIN))
+    if ((read(bell, &value, sizeof(value)) < 0) && (errno != EAGAIN))
+      return -1;
+  if ((pfds[1].revents & (POLLRDHUP | POLLHUP | POLLERR)))
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Add rings to the registry
+ * 
+ * @param   this  The rings
+ * @return        Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int register_rings(libmds_rings_t* restrict this)
+{
+  libmds_rings_t** new_registry;
+  int rc = -1;
+  
+  pthread_mutex_lock(&registry_mutex);
+  new_registry = realloc(registry, (registry_count + 1) * sizeof(libmds_rings_t*));
+  if (new_registry != NULL)
+    {
+      registry = new_registry;
+      registry[registry_count++] = this;
+      rc = 0;
+    }
+  pthread_mutex_unlock(&registry_mutex);
+  
+  return rc;
+}
+
+
+/**
+ * Find the rings that are used with a socket (internal function)
+ * 
+ * @param   socket_fd  The file descriptor of the socket
+ * @return             The rings, `NULL` if none
+ */
+libmds_rings_t* libmds_ring_lookup(int socket_fd)
+{
+  libmds_rings_t* rc = NULL;
+  size_t i;
+  
+  pthread_mutex_lock(&registry_mutex);
+  for (i = 0; i < registry_count; i++)
+    if (registry[i]->socket_fd == socket_fd)
+      {
+	rc = registry[i];
+	break;
+      }
+  pthread_mutex_unlock(&registry_mutex);
+  
+  return rc;
+}
+
+
+/**
+ * Create the shared memory and the doorbells
+ * 
+ * @param   this      Output parameter for the rings
+ * @param   capacity  The size of each ring, a power of two
+ * @return            The file descriptor of the shared memory, -1 on error
+ */
+__attribute__((nonnull))
+static int create_rings(libmds_rings_t* restrict this, size_t capacity)
+{
+  libmds_ring_header_t* header;
+  int fd, saved_errno;
+  
+  this->map = NULL;
+  this->data_bell = this->room_bell = -1;
+  this->map_size = LIBMDS_RING_DATA_OFFSET + 2 * capacity;
+  
+  if ((fd = memfd_create("mds-ring", MFD_CLOEXEC)) < 0)
+    return -1;
+  if (ftruncate(fd, (off_t)(this->map_size)) < 0)
+    goto fail;
+  this->map = mmap(NULL, this->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (this->map == MAP_FAILED)
+    {
+      this->map = NULL;
+      goto fail;
+    }
+  if ((this->data_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    goto fail;
+  if ((this->room_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    goto fail;
+  
+  header = this->map;
+  header->magic = LIBMDS_RING_MAGIC;
+  header->version = LIBMDS_RING_VERSION;
+  header->capacity = capacity;
+  this->to_server.control = &(header->to_server);
+  this->to_server.data = (char*)(this->map) + LIBMDS_RING_DATA_OFFSET;
+  this->to_server.capacity = capacity;
+  this->to_client.control = &(header->to_client);
+  this->to_client.data = (char*)(this->map) + LIBMDS_RING_DATA_OFFSET + capacity;
+  this->to_client.capacity = capacity;
+  
+  return fd;
+ fail:
+  saved_errno = errno;
+  close(fd);
+  libmds_ring_close(this);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Send a message with file descriptors attached to it
+ * 
+ * @param   socket_fd  The file descriptor of the socket
+ * @param   message    The message
+ * @param   length     The length of the message
+ * @param   fds        The file descriptors
+ * @param   count      The number of elements in `fds`
+ * @return             Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int send_with_fds(int socket_fd, char* restrict message, size_t length,
+			 const int* restrict fds, size_t count)
+{
+  union
+  {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr header;
+  struct iovec part;
+  struct cmsghdr* cmsg;
+  ssize_t sent;
+  
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &part;
+  header.msg_iovlen = 1;
+  header.msg_control = control.buf;
+  header.msg_controllen = CMSG_SPACE(count * sizeof(int));
+  cmsg = CMSG_FIRSTHDR(&header);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+  
+  /* The file descriptors are passed with the first byte. */
+  while (length > 0)
+    {
+      part.iov_base = message;
+      part.iov_len = length;
+      if ((sent = sendmsg(socket_fd, &header, MSG_NOSIGNAL)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      message += sent;
+      length -= (size_t)sent;
+      header.msg_control = NULL;
+      header.msg_controllen = 0;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Start sending and receiving messages through rings in memory
+ * shared with the display server, rather than through the socket,
+ * this should be done directly after the connection is established
+ * 
+ * The messages that are sent after this function has returned are
+ * written to the ring to the server, and the messages that the
+ * server sends after its reply, a `Command: shm-ring` message that
+ * `libmds_message_read` does not return, are read from the ring to
+ * the client, the socket remains open as doorbell and to tell when
+ * the other end has closed
+ * 
+ * If the function fails the socket is still used, if the display server
+ * cannot use the rings, it closes the connection; this function fails
+ * if the system does not support memory file descriptors
+ * 
+ * @param   this      The connection descriptor, must not be `NULL`
+ * @param   capacity  The size of each ring, a power of two, zero
+ *                    for `LIBMDS_RING_CAPACITY`
+ * @return            Zero on success, -1 on error, `errno` will
+ *                    have been set accordingly on error
+ * 
+ * @throws  EALREADY  The connection already uses rings
+ * @throws  EINVAL    `capacity` is not a power of two
+ * @throws  ENOMEM    Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                    RLIMIT_DATA limit described in getrlimit(2).
+ * @throws            Any error specified for memfd_create(2), ftruncate(2),
+ *                    mmap(2), or eventfd(2)
+ * @throws            Any error specified for `libmds_connection_send`
+ */
+int libmds_ring_open(libmds_connection_t* restrict this, size_t capacity)
+{
+  libmds_rings_t* rings = NULL;
+  char* buffer = NULL;
+  size_t buffer_size = 0, length;
+  int fds[3] = { -1, -1, -1 };
+  int saved_errno, locked = 0;
+  
+  if (capacity == 0)
+    capacity = LIBMDS_RING_CAPACITY;
+  if (capacity & (capacity - 1))
+    return errno = EINVAL, -1;
+  
+  if (libmds_connection_lock(this))
+    goto fail;
+  locked = 1;
+  if (this->rings != NULL)
+    {
+      errno = EALREADY;
+      goto fail;
+    }
+  
+  if ((rings = malloc(sizeof(libmds_rings_t))) == NULL)
+    goto fail;
+  if ((fds[0] = create_rings(rings, capacity)) < 0)
+    {
+      free(rings), rings = NULL;
+      goto fail;
+    }
+  rings->socket_fd = this->socket_fd;
+  fds[1] = rings->data_bell;
+  fds[2] = rings->room_bell;
+  
+  if (libmds_next_message_id(&(this->message_id), NULL, NULL))
+    goto fail;
+  if ((this->binary ? libmds_compose_binary : libmds_compose)
+      (&buffer, &buffer_size, &length, NULL, NULL,
+       "Command: shm-ring",
+       "Attachment: fd fd fd",
+       LIBMDS_HEADERS_STANDARD(this), NULL))
+    goto fail;
+  if (register_rings(rings) < 0)
+    goto fail;
+  
+  /* Everything that is sent after the request is written to the ring, the
+     server reads the ring as soon as it has received the request. */
+  if (send_with_fds(this->socket_fd, buffer, length, fds, 3) < 0)
+    goto fail;
+  this->rings = rings;
+  
+  close(fds[0]);
+  free(buffer);
+  return libmds_connection_unlock(this);
+ fail:
+  saved_errno = errno;
+  if (fds[0] >= 0)
+    close(fds[0]);
+  libmds_ring_close(rings);
+  free(rings);
+  free(buffer);
+  if (locked)
+    (void) libmds_connection_unlock(this);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Stop using rings, this is done when the connection descriptor
+ * is destroyed, and should not be done by anyone else
+ * 
+ * @param  this  The rings, may be `NULL`
+ */
+void libmds_ring_close(libmds_rings_t* restrict this)
+{
+  size_t i;
+  
+  if (this == NULL)
+    return;
+  
+  pthread_mutex_lock(&registry_mutex);
+  for (i = 0; i < registry_count; i++)
+    if (registry[i] == this)
+      {
+	registry[i] = registry[--registry_count];
+	break;
+      }
+  if (registry_count == 0)
+    {
+      free(registry);
+      registry = NULL;
+    }
+  pthread_mutex_unlock(&registry_mutex);
+  
+  if (this->map != NULL)
+    munmap(this->map, this->map_size), this->map = NULL;
+  if (this->data_bell >= 0)
+    close(this->data_bell), this->data_bell = -1;
+  if (this->room_bell >= 0)
+    close(this->room_bell), this->room_bell = -1;
+}
+
+
+/**
+ * Write to the ring to the display server, waiting for room
+ * if the ring is full (internal function)
+ * 
+ * @param   this                   The rings
+ * @param   message                The data to write
+ * @param   length                 The length of `message`
+ * @param   continue_on_interrupt  Whether to continue writing if interrupted by a signal
+ * @return                         The number of written bytes, less than `length`
+ *                                 on error, `errno` will have been set accordingly
+ * 
+ * @throws  ECONNRESET   If the connection was lost
+ * @throws  EWOULDBLOCK  If the socket is nonblocking and the ring is full
+ * @throws  EINTR        If interrupted by a signal, only if `continue_on_interrupt` is zero
+ * @throws               Any error specified for poll(2) or send(2)
+ */
+size_t libmds_ring_write(libmds_rings_t* restrict this, const char* restrict message,
+			 size_t length, int continue_on_interrupt)
+{
+  libmds_ring_t* ring = &(this->to_server);
+  size_t sent = 0, n;
+  int r;
+  
+  errno = 0;
+  while (sent < length)
+    {
+      n = ring_write(ring, message + sent, length - sent);
+      if (n > 0)
+	{
+	  /* Ring for every part, so that the server can start reading a full ring. */
+	  sent += n;
+	  if (ring_waiting(&(ring->control->reader_waiting)))
+	    if (ring_server(this) < 0)
+	      return sent;
+	  continue;
+	}
+      
+      /* The server rings our doorbell if it reads after this. */
+      if (ring_await(&(ring->control->writer_waiting), &(ring->control->tail),
+		     ring->control->head - ring->capacity) == 0)
+	{
+	  r = await_bell(this, this->room_bell);
+	  if (r > 0)
+	    return errno = ECONNRESET, sent;
+	  if ((r < 0) && ((errno != EINTR) || !continue_on_interrupt))
+	    return sent;
+	}
+    }
+  
+  return sent;
+}
+
+
+/**
+ * Read from the ring from the display server, waiting
+ * for data if the ring is empty (internal function)
+ * 
+ * @param   this    The rings
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          The number of read bytes, zero if the display server
+ *                  has closed, -1 on error, `errno` will have been set
+ *                  accordingly on error
+ * 
+ * @throws  EWOULDBLOCK  If the socket is nonblocking and the ring is empty
+ * @throws               Any error specified for poll(2)
+ */
+ssize_t libmds_ring_read(libmds_rings_t* restrict this, char* restrict buffer, size_t size)
+{
+  libmds_ring_t* ring = &(this->to_client);
+  size_t n;
+  int r;
+  
+  for (;;)
+    {
+      n = ring_read(ring, buffer, size);
+      if (n > 0)
+	{
+	  if (ring_waiting(&(ring->control->writer_waiting)))
+	    (void) ring_server(this);
+	  return (ssize_t)n;
+	}
+      
+      /* The server rings our doorbell if it writes after this. */
+      if (ring_await(&(ring->control->reader_waiting), &(ring->control->head), ring->control->tail))
+	continue;
+      
+      r = await_bell(this, this->data_bell);
+      if (r < 0)
+	return -1;
+      /* The server may have written before it closed. */
+      if (r > 0)
+	return (ssize_t)ring_read(ring, buffer, size);
+    }
+}
+
+
+/**
+ * Pass a file descriptor to the display server over the socket,
+ * this must be done before the message that it is attached to
+ * is written to the ring (internal function)
+ * 
+ * @param   this  The rings
+ * @param   fd    The file descriptor, it is not closed
+ * @return        Zero on success, -1 on error, `errno` will
+ *                have been set accordingly on error
+ * 
+ * @throws  Any error specified for sendmsg(2)
+ */
+int libmds_ring_pass_fd(libmds_rings_t* restrict this, int fd)
+{
+  char byte = '\0';
+  
+  /* The byte that carries the file descriptor is also a doorbell, which is harmless. */
+  return send_with_fds(this->socket_fd, &byte, sizeof(byte), &fd, 1);
+}
+
+
+/**
+ * Receive a file descriptor that the display server passes over the
+ * socket before the message that it is attached to is written to
+ * the ring (internal function)
+ * 
+ * @param   this  The rings
+ * @return        The file descriptor, -1 on error, `errno` will
+ *                have been set accordingly on error
+ * 
+ * @throws  ECONNRESET  If the connection was lost
+ * @throws              Any error specified for recvmsg(2)
+ */
+int libmds_ring_receive_fd(libmds_rings_t* restrict this)
+{
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr header;
+  struct iovec part;
+  struct cmsghdr* cmsg;
+  ssize_t got;
+  char byte;
+  int fd;
+  
+  /* Each file descriptor is passed with one byte. */
+  for (;;)
+    {
+      part.iov_base = &byte;
+      part.iov_len = sizeof(byte);
+      memset(&header, 0, sizeof(header));
+      header.msg_iov = &part;
+      header.msg_iovlen = 1;
+      header.msg_control = control.buf;
+      header.msg_controllen = sizeof(control.buf);
+      
+      if ((got = recvmsg(this->socket_fd, &header, MSG_CMSG_CLOEXEC)) < 0)
+	return -1;
+      if (got == 0)
+	return errno = ECONNRESET, -1;
+      
+      cmsg = CMSG_FIRSTHDR(&header);
+      if ((cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) &&
+	  (cmsg->cmsg_len >= CMSG_LEN(sizeof(int))))
+	{
+	  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	  return fd;
+	}
+    }
+}
+
@@ -0,0 +1,332 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_LIBMDSCLIENT_RING_H
+#define MDS_LIBMDSCLIENT_RING_H
+/* The memory layout is the same as in <libmdsserver/shm-ring.h>,
+ * the display server maps the same memory. */
+
+
+#include "comm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+
+/**
+ * The value of `magic` in `libmds_ring_header_t`
+ */
+#define LIBMDS_RING_MAGIC  UINT32_C(0x6D647372)
+
+/**
+ * The version of the memory layout
+ */
+#define LIBMDS_RING_VERSION  UINT32_C(1)
+
+/**
+ * The offset of the data of the rings in the shared memory,
+ * the data of the ring to the server comes first, and the
+ * data of the ring to the client follows directly after it
+ */
+#define LIBMDS_RING_DATA_OFFSET  4096
+
+/**
+ * The size of each ring if none is specified
+ */
+#define LIBMDS_RING_CAPACITY  65536
+
+
+
+/**
+ * The control block of a ring in one direction
+ */
+typedef struct libmds_ring_control
+{
+  /**
+   * The number of bytes that have been written
+   * to the ring, only written by the producer
+   */
+  uint64_t head;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char head_padding[64 - sizeof(uint64_t)];
+  
+  /**
+   * The number of bytes that have been read
+   * from the ring, only written by the consumer
+   */
+  uint64_t tail;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char tail_padding[64 - sizeof(uint64_t)];
+  
+  /**
+   * Set by the consumer when it is about to wait for data,
+   * cleared by whoever rings the consumer's doorbell
+   */
+  uint32_t reader_waiting;
+  
+  /**
+   * Set by the producer when it is about to wait for room,
+   * cleared by whoever rings the producer's doorbell
+   */
+  uint32_t writer_waiting;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char waiting_padding[64 - 2 * sizeof(uint32_t)];
+  
+} libmds_ring_control_t;
+
+
+/**
+ * The beginning of the shared memory
+ */
+typedef struct libmds_ring_header
+{
+  /**
+   * `LIBMDS_RING_MAGIC`
+   */
+  uint32_t magic;
+  
+  /**
+   * `LIBMDS_RING_VERSION`
+   */
+  uint32_t version;
+  
+  /**
+   * The size of the data of each ring, a power of two
+   */
+  uint64_t capacity;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char padding[64 - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+  
+  /**
+   * The ring from the client to the server
+   */
+  libmds_ring_control_t to_server;
+  
+  /**
+   * The ring from the server to the client
+   */
+  libmds_ring_control_t to_client;
+  
+} libmds_ring_header_t;
+
+
+/**
+ * A ring in one direction, as mapped by this process
+ */
+typedef struct libmds_ring
+{
+  /**
+   * The ring's control block
+   */
+  libmds_ring_control_t* control;
+  
+  /**
+   * The ring's data
+   */
+  char* data;
+  
+  /**
+   * The size of `data`, a power of two
+   */
+  size_t capacity;
+  
+} libmds_ring_t;
+
+
+/**
+ * The rings in memory shared with the display server
+ */
+typedef struct libmds_rings
+{
+  /**
+   * The shared memory
+   */
+  void* map;
+  
+  /**
+   * The size of `map`
+   */
+  size_t map_size;
+  
+  /**
+   * The ring to the server
+   */
+  libmds_ring_t to_server;
+  
+  /**
+   * The ring from the server
+   */
+  libmds_ring_t to_client;
+  
+  /**
+   * The file descriptor of the socket connected to the
+   * display server, the server's doorbell is rung, by
+   * sending a byte, over it, and the server passes file
+   * descriptors over it, it is also closed when the
+   * server closes
+   */
+  int socket_fd;
+  
+  /**
+   * Event file descriptor that the display
+   * server writes to when there are messages
+   */
+  int data_bell;
+  
+  /**
+   * Event file descriptor that the display server
+   * writes to when there is room for messages
+   */
+  int room_bell;
+  
+} libmds_rings_t;
+
+
+
+/**
+ * Start sending and receiving messages through rings in memory
+ * shared with the display server, rather than through the socket,
+ * this should be done directly after the connection is established
+ * 
+ * The messages that are sent after this function has returned are
+ * written to the ring to the server, and the messages that the
+ * server sends after its reply, a `Command: shm-ring` message that
+ * `libmds_message_read` does not return, are read from the ring to
+ * the client, the socket remains open as doorbell and to tell when
+ * the other end has closed
+ * 
+ * If the function fails the socket is still used, if the display server
+ * cannot use the rings, it closes the connection; this function fails
+ * if the system does not support memory file descriptors
+ * 
+ * @param   this      The connection descriptor, must not be `NULL`
+ * @param   capacity  The size of each ring, a power of two, zero
+ *                    for `LIBMDS_RING_CAPACITY`
+ * @return            Zero on success, -1 on error, `errno` will
+ *                    have been set accordingly on error
+ * 
+ * @throws  EALREADY  The connection already uses rings
+ * @throws  EINVAL    `capacity` is not a power of two
+ * @throws  ENOMEM    Out of memory, Possibly, the process hit the RLIMIT_AS or
+ *                    RLIMIT_DATA limit described in getrlimit(2).
+ * @throws            Any error specified for memfd_create(2), ftruncate(2),
+ *                    mmap(2), or eventfd(2)
+ * @throws            Any error specified for `libmds_connection_send`
+ */
+__attribute__((nonnull))
+int libmds_ring_open(libmds_connection_t* restrict this, size_t capacity);
+
+/**
+ * Stop using rings, this is done when the connection descriptor
+ * is destroyed, and should not be done by anyone else
+ * 
+ * @param  this  The rings, may be `NULL`
+ */
+void libmds_ring_close(libmds_rings_t* restrict this);
+
+/**
+ * Find the rings that are used with a socket (internal function)
+ * 
+ * @param   socket_fd  The file descriptor of the socket
+ * @return             The rings, `NULL` if none
+ */
+libmds_rings_t* libmds_ring_lookup(int socket_fd);
+
+/**
+ * Write to the ring to the display server, waiting for room
+ * if the ring is full (internal function)
+ * 
+ * @param   this                   The rings
+ * @param   message                The data to write
+ * @param   length                 The length of `message`
+ * @param   continue_on_interrupt  Whether to continue writing if interrupted by a signal
+ * @return                         The number of written bytes, less than `length`
+ *                                 on error, `errno` will have been set accordingly
+ * 
+ * @throws  ECONNRESET   If the connection was lost
+ * @throws  EWOULDBLOCK  If the socket is nonblocking and the ring is full
+ * @throws  EINTR        If interrupted by a signal, only if `continue_on_interrupt` is zero
+ * @throws               Any error specified for poll(2) or send(2)
+ */
+__attribute__((nonnull))
+size_t libmds_ring_write(libmds_rings_t* restrict this, const char* restrict message,
+			 size_t length, int continue_on_interrupt);
+
+/**
+ * Read from the ring from the display server, waiting
+ * for data if the ring is empty (internal function)
+ * 
+ * @param   this    The rings
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          The number of read bytes, zero if the display server
+ *                  has closed, -1 on error, `errno` will have been set
+ *                  accordingly on error
+ * 
+ * @throws  EWOULDBLOCK  If the socket is nonblocking and the ring is empty
+ * @throws               Any error specified for poll(2)
+ */
+__attribute__((nonnull))
+ssize_t libmds_ring_read(libmds_rings_t* restrict this, char* restrict buffer, size_t size);
+
+/**
+ * Pass a file descriptor to the display server over the socket,
+ * this must be done before the message that it is attached to
+ * is written to the ring (internal function)
+ * 
+ * @param   this  The rings
+ * @param   fd    The file descriptor, it is not closed
+ * @return        Zero on success, -1 on error, `errno` will
+ *                have been set accordingly on error
+ * 
+ * @throws  Any error specified for sendmsg(2)
+ */
+__attribute__((nonnull))
+int libmds_ring_pass_fd(libmds_rings_t* restrict this, int fd);
+
+/**
+ * Receive a file descriptor that the display server passes over the
+ * socket before the message that it is attached to is written to
+ * the ring (internal function)
+ * 
+ * @param   this  The rings
+ * @return        The file descriptor, -1 on error, `errno` will
+ *                have been set accordingly on error
+ * 
+ * @throws  ECONNRESET  If the connection was lost
+ * @throws              Any error specified for recvmsg(2)
+ */
+__attribute__((nonnull))
+int libmds_ring_receive_fd(libmds_rings_t* restrict this);
+
+
+#endif
+
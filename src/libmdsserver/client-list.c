@@ -124,13 +124,10 @@ int client_list_add(client_list_t* restrict this, uint64_t client)
 {
   if (this->size == this->capacity)
     {
-      uint64_t* old = this->clients;
-      if (xrealloc(old, this->capacity <<= 1, uint64_t))
-	{
-	  this->capacity >>= 1;
-	  this->clients = old;
-	  fail_if (1);
-	}
+      uint64_t* new = this->clients;
+      fail_if (xrealloc(new, this->capacity << 1, uint64_t));
+      this->clients = new;
+      this->capacity <<= 1;
     }
   
   this->clients[this->size++] = client;
@@ -156,13 +153,14 @@ void client_list_remove(client_list_t* restrict this, uint64_t client)
 	  size_t n = (--(this->size) - i) * sizeof(uint64_t);
 	  memmove(this->clients + i, this->clients + i + 1, n);
 	  
-	  if (this->size << 1 <= this->capacity)
+	  /* Keeping the larger allocation is fine if it cannot be shrunk. */
+	  if ((this->size << 1 <= this->capacity) && (this->capacity > CLIENT_LIST_DEFAULT_INITIAL_CAPACITY))
 	    {
-	      uint64_t* old = this->clients;
-	      if (xrealloc(old, this->capacity >>= 1, uint64_t))
+	      uint64_t* new = this->clients;
+	      if (!xrealloc(new, this->capacity >> 1, uint64_t))
 		{
-		  this->capacity <<= 1;
-		  this->clients = old;
+		  this->clients = new;
+		  this->capacity >>= 1;
 		}
 	    }
 	  
@@ -125,7 +125,7 @@ typedef size_t T##_key_hash_func(CKEY_T key);\
  * @return         Whether the keys are equal
  */\
 __attribute__((pure, nonnull))\
-static inline int T##_key_comparer(CKEY_T key_a, CKEY_T key_b);\
+static int T##_key_comparer(CKEY_T key_a, CKEY_T key_b);\
 \
 /**
  * Determine the marshal-size of an entry's key and value
@@ -134,7 +134,7 @@ static inline int T##_key_comparer(CKEY_T key_a, CKEY_T key_b);\
  * @return         The marshal-size of the entry's key and value
  */\
 __attribute__((pure, nonnull))\
-static inline size_t T##_submarshal_size(const struct T##_entry* entry);\
+static size_t T##_submarshal_size(const struct T##_entry* entry);\
 \
 /**
  * Marshal an entry's key and value
@@ -144,7 +144,7 @@ static inline size_t T##_submarshal_size(const struct T##_entry* entry);\
  * @return         The marshal-size of the entry's key and value
  */\
 __attribute__((pure, nonnull))\
-static inline size_t T##_submarshal(const struct T##_entry* entry, char* restrict data);\
+static size_t T##_submarshal(const struct T##_entry* entry, char* restrict data);\
 \
 /**
  * Unmarshal an entry's key and value
@@ -154,7 +154,7 @@ static inline size_t T##_submarshal(const struct T##_entry* entry, char* restric
  * @return         The number of read bytes, zero on error
  */\
 __attribute__((pure, nonnull))\
-static inline size_t T##_subunmarshal(struct T##_entry* entry, char* restrict data);\
+static size_t T##_subunmarshal(struct T##_entry* entry, char* restrict data);\
 \
 \
 \
@@ -246,7 +246,7 @@ typedef struct T\
  * @param   capacity  The minimum initial capacity of the hash list, 0 for default
  * @return            Non-zero on error, `errno` will have been set accordingly
  */\
-static inline int __attribute__((unused, nonnull))\
+static int __attribute__((unused, nonnull))\
 T##_create(T##_t* restrict this, size_t capacity)\
 {\
   if (capacity == 0)\
@@ -273,7 +273,7 @@ T##_create(T##_t* restrict this, size_t capacity)\
  * 
  * @param  this  The hash list
  */\
-static inline void __attribute__((unused, nonnull))\
+static void __attribute__((unused, nonnull))\
 T##_destroy(T##_t* restrict this)\
 {\
   size_t i, n;\
@@ -297,7 +297,7 @@ T##_destroy(T##_t* restrict this)\
  * @param   out   Memory slot in which to store the new hash list
  * @return        Non-zero on error, `errno` will have been set accordingly
  */\
-static inline int __attribute__((unused, nonnull))\
+static int __attribute__((unused, nonnull))\
 T##_clone(const T##_t* restrict this, T##_t* restrict out)\
 {\
   if (T##_create(out, this->allocated) < 0)\
@@ -306,6 +306,7 @@ T##_clone(const T##_t* restrict this, T##_t* restrict out)\
   out->unused = this->unused;\
   out->last = this->last;\
   memcpy(out->slots, this->slots, this->used * sizeof(T##_entry_t));\
+  return 0;\
 }\
 \
 \
@@ -320,7 +321,7 @@ T##_clone(const T##_t* restrict this, T##_t* restrict out)\
  * @return        Non-zero on error, `errno` will have
  *                been set accordingly. Errors are non-fatal.
  */\
-static inline int __attribute__((unused, nonnull))\
+static int __attribute__((unused, nonnull))\
 T##_pack(T##_t* restrict this)\
 {\
   size_t i, j, n;\
@@ -337,13 +338,15 @@ T##_pack(T##_t* restrict this)\
       this->last = 0;\
     }\
   \
-  if (this->used < this->allocated)\
+  /* Keep one slot, so that the allocation can be grown by doubling it. */\
+  if ((this->used < this->allocated) && (this->allocated > 1))\
     {\
-      slots = realloc(slots, this->used * sizeof(T##_entry_t));\
+      n = this->used ? this->used : 1;\
+      slots = realloc(slots, n * sizeof(T##_entry_t));\
       if (slots == NULL)\
 	return -1;\
       this->slots = slots;\
-      this->allocated = this->used;\
+      this->allocated = n;\
     }\
   \
   return 0;\
@@ -358,7 +361,7 @@ T##_pack(T##_t* restrict this)\
  * @param   value  Output parameter for the value
  * @return         Whether the key was found, error is impossible
  */\
-static inline int __attribute__((unused, nonnull))\
+static int __attribute__((unused, nonnull))\
 T##_get(T##_t* restrict this, CKEY_T key, T##_value_t* restrict value)\
 {\
   size_t i, n, hash = HASH_LIST_HASH(key);\
@@ -376,7 +379,7 @@ T##_get(T##_t* restrict this, CKEY_T key, T##_value_t* restrict value)\
  * @param  this  The hash list
  * @param  key   The key of the entry to remove, must not be `NULL`
  */\
-static inline void __attribute__((unused, nonnull))\
+static void __attribute__((unused, nonnull))\
 T##_remove(T##_t* restrict this, CKEY_T key)\
 {\
   size_t i = this->last, n, hash = HASH_LIST_HASH(key);\
@@ -422,7 +425,7 @@ T##_remove(T##_t* restrict this, CKEY_T key)\
  *                 `NULL` if the entry should be removed instead
  * @return         Non-zero on error, `errno` will have been set accordingly
  */\
-static inline int __attribute__((unused, nonnull(1, 2)))\
+static int __attribute__((unused, nonnull(1, 2)))\
 T##_put(T##_t* restrict this, KEY_T key, const T##_value_t* restrict value)\
 {\
   size_t i = this->last, n, empty = this->used, hash;\
@@ -479,6 +482,10 @@ T##_put(T##_t* restrict this, KEY_T key, const T##_value_t* restrict value)\
   if (this->freer != NULL)\
     this->freer(slots + i);\
  put_no_free:\
+  if (i == this->used)\
+    this->used++;\
+  else if (slots[i].key == NULL)\
+    this->unused--;\
   slots[i].key = key;\
   slots[i].key_hash = hash;\
   slots[i].value = *value;\
@@ -492,7 +499,7 @@ T##_put(T##_t* restrict this, KEY_T key, const T##_value_t* restrict value)\
  * @param   this  The hash table
  * @return        The number of bytes to allocate to the output buffer
  */\
-static inline size_t __attribute__((unused, pure, nonnull))\
+static size_t __attribute__((unused, pure, nonnull))\
 T##_marshal_size(const T##_t* restrict this)\
 {\
   size_t i, n = this->used;\
@@ -510,7 +517,7 @@ T##_marshal_size(const T##_t* restrict this)\
  * @param  this  The hash list
  * @param  data  Output buffer for the marshalled data
  */\
-static inline void __attribute__((unused, nonnull))\
+static void __attribute__((unused, nonnull))\
 T##_marshal(const T##_t* restrict this, char* restrict data)\
 {\
   size_t wrote, i, n = this->used;\
@@ -542,7 +549,7 @@ T##_marshal(const T##_t* restrict this, char* restrict data)\
  * @return            Non-zero on error, `errno` will be set accordingly.
  *                    Destroy the table on error.
  */\
-static inline int __attribute__((unused, nonnull))\
+static int __attribute__((unused, nonnull))\
 T##_unmarshal(T##_t* restrict this, char* restrict data)\
 {\
   size_t i, n, got;\
@@ -568,7 +575,7 @@ T##_unmarshal(T##_t* restrict this, char* restrict data)\
       buf_get_next(data, char, used);\
       if (used == 0)\
 	continue;\
-      buf_set_next(data, size_t, this->slots[i].key_hash);\
+      buf_get_next(data, size_t, this->slots[i].key_hash);\
       got = T##_subunmarshal(this->slots + i, data);\
       if (got == 0)\
 	return -1;\
@@ -85,7 +85,7 @@ static int rehash(hash_table_t* restrict this)
   
   while (i)
     {
-      bucket = this->buckets[--i];
+      bucket = old_buckets[--i];
       while (bucket)
 	{
 	  index = truncate_hash(this, bucket->hash);
@@ -482,22 +482,21 @@ int hash_table_unmarshal(hash_table_t* restrict this, char* restrict data, remap
   for (i = 0; i < n; i++)
     {
       size_t m;
-      hash_entry_t* restrict bucket;
+      hash_entry_t** restrict slot = this->buckets + i;
       buf_get_next(data, size_t, m);
       
-      fail_if (xmalloc(this->buckets[i] = bucket, 1, hash_entry_t));
-      
+      /* Each entry is linked in as soon as it is allocated,
+	 so that the table can be destroyed on failure. */
       while (m--)
 	{
-	  if (m == 0)
-	    bucket->next = NULL;
-	  else
-	    fail_if (xmalloc(bucket->next, 1, hash_entry_t));
-	  buf_get_next(data, size_t, bucket->key);
-	  buf_get_next(data, size_t, bucket->value);
+	  fail_if (xmalloc(*slot, 1, hash_entry_t));
+	  (*slot)->next = NULL;
+	  buf_get_next(data, size_t, (*slot)->key);
+	  buf_get_next(data, size_t, (*slot)->value);
 	  if (remapper != NULL)
-	    bucket->value = remapper(bucket->value);
-	  buf_get_next(data, size_t, bucket->hash);
+	    (*slot)->value = remapper((*slot)->value);
+	  buf_get_next(data, size_t, (*slot)->hash);
+	  slot = &((*slot)->next);
 	}
     }
   
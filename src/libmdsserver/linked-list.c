@@ -191,7 +191,9 @@ int linked_list_pack(linked_list_t* restrict this)
     this->previous[i] = (ssize_t)(i - 1);
   this->previous[0] = (ssize_t)(size - 1);
   
+  free(this->values);
   this->values = vals;
+  this->capacity = cap;
   this->end = size;
   this->reuse_head = 0;
   
@@ -202,6 +204,7 @@ int linked_list_pack(linked_list_t* restrict this)
   free(vals);
   free(new_next);
   free(new_previous);
+  free(new_reusable);
   return errno = saved_errno, -1;
 }
 
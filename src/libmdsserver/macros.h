@@ -232,6 +232,44 @@
     }							\
   while (0)
 
+/**
+ * Wrapper for `pthread_rwlock_rdlock` and `pthread_rwlock_unlock`
+ * 
+ * @param  lock:pthread_rwlock_t  The read–write lock
+ * @param  instructions           The instructions to run while the lock is held for reading
+ */
+#define with_rdlock(lock, instructions)		\
+  do						\
+    {						\
+      errno = pthread_rwlock_rdlock(&(lock));	\
+      do					\
+	{					\
+	  instructions ;			\
+	}					\
+      while (0);				\
+      errno = pthread_rwlock_unlock(&(lock));	\
+    }						\
+  while (0)
+
+/**
+ * Wrapper for `pthread_rwlock_wrlock` and `pthread_rwlock_unlock`
+ * 
+ * @param  lock:pthread_rwlock_t  The read–write lock
+ * @param  instructions           The instructions to run while the lock is held for writing
+ */
+#define with_wrlock(lock, instructions)		\
+  do						\
+    {						\
+      errno = pthread_rwlock_wrlock(&(lock));	\
+      do					\
+	{					\
+	  instructions ;			\
+	}					\
+      while (0);				\
+      errno = pthread_rwlock_unlock(&(lock));	\
+    }						\
+  while (0)
+
 
 /**
  * Return the maximum value of two values
@@ -717,7 +755,8 @@
     if (__VA_ARGS__)								\
       {										\
 	int _fail_if_saved_errno = errno;					\
-	if ((errno != EMSGSIZE) && (errno != ECONNRESET) && (errno != EINTR))	\
+	if ((errno != EMSGSIZE) && (errno != ECONNRESET) &&			\
+	    (errno != EINTR) && (errno != EAGAIN))				\
 	  fprintf(stderr, "failure at %s:%i\n", __FILE__, __LINE__);		\
 	errno = _fail_if_saved_errno;						\
 	goto fail;					       			\
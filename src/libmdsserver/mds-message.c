@@ -19,17 +19,264 @@
 
 #include "macros.h"
 #include "util.h"
+#include "scan.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/socket.h>
 
 
 #define try(INSTRUCTION)   if ((r = INSTRUCTION) < 0)  return r
 
 
+/**
+ * A header name that has an atom in the binary framing
+ */
+typedef struct header_atom
+{
+  /**
+   * The header name
+   */
+  const char* name;
+  
+  /**
+   * The length of `name`
+   */
+  size_t length;
+  
+} header_atom_t;
+
+
+#define ATOM(NAME)  { NAME, sizeof(NAME) / sizeof(char) - 1 }
+
+/**
+ * The header names that have atoms, the atom of a
+ * name is its index plus one, this is part of the
+ * protocol, so names may only be added at the end
+ */
+static const header_atom_t header_atoms[] =
+  {
+    ATOM("Command"), ATOM("To"), ATOM("Message ID"), ATOM("Client ID"), ATOM("Length"),
+    ATOM("Modify ID"), ATOM("In response to"), ATOM("Origin command"), ATOM("Error"),
+    ATOM("Modify"), ATOM("Modifying"), ATOM("Priority"), ATOM("Stop"), ATOM("Timeout"),
+    ATOM("Accept"), ATOM("Attachment"), ATOM("ID assignment"), ATOM("Client closed"),
+    ATOM("Lane"), ATOM("Framing")
+  };
+
+#undef ATOM
+
+
+/**
+ * The number of header names that have atoms
+ */
+#define HEADER_ATOM_COUNT  (sizeof(header_atoms) / sizeof(*header_atoms))
+
+
+/**
+ * The size of a new read buffer, large enough for most messages
+ */
+#define MDS_MESSAGE_BUFFER_SIZE  4096
+
+/**
+ * The room that is left before a message in the binary framing,
+ * the headers are larger than their records, and are written over
+ * them and into this room, rather than moving the data after them
+ */
+#define MDS_MESSAGE_BINARY_HEADER_ROOM  256
+
+/**
+ * The largest read buffer that is kept in the pool, a buffer that
+ * has grown larger than this for a large message is shrunk once
+ * the message has been read
+ */
+#define MDS_MESSAGE_POOL_MAX_BUFFER  (64 << 10)
+
+/**
+ * The number of read buffers that can be kept in the pool
+ */
+#define MDS_MESSAGE_POOL_SIZE  64
+
+
+
+/**
+ * A read buffer, and a header list, kept for reuse
+ */
+typedef struct pooled_buffer
+{
+  /**
+   * The read buffer
+   */
+  char* buffer;
+  
+  /**
+   * The size of `buffer`
+   */
+  size_t buffer_size;
+  
+  /**
+   * The header list, may be `NULL`
+   */
+  char** headers;
+  
+  /**
+   * The number of elements allocated to `headers`
+   */
+  size_t headers_size;
+  
+} pooled_buffer_t;
+
+
+/**
+ * The read buffers of destroyed messages, they are taken by
+ * new messages, so that connections do not allocate them
+ */
+static pooled_buffer_t pool[MDS_MESSAGE_POOL_SIZE];
+
+/**
+ * The number of elements in `pool`
+ */
+static size_t pool_count = 0;
+
+/**
+ * Spinlock for `pool` and `pool_count`, libmdsserver does not
+ * require pthread, and the lock is only held for a few instructions.
+ * A waiter yields the CPU rather than spinning on it, otherwise a
+ * preempted holder would keep the waiter busy for its whole time slice
+ */
+static char pool_locked = 0;
+
+
+
+/**
+ * Lock the pool of read buffers
+ */
+static void pool_lock(void)
+{
+  while (__atomic_test_and_set(&pool_locked, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(&pool_locked, __ATOMIC_RELAXED))
+      sched_yield();
+}
+
+
+/**
+ * Unlock the pool of read buffers
+ */
+static void pool_unlock(void)
+{
+  __atomic_clear(&pool_locked, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * Get the atom of a header name, the small integer that
+ * the name is sent as in the binary framing
+ * 
+ * @param   name    The header name, it need not be NUL-terminated
+ * @param   length  The length of `name`
+ * @return          The atom, zero if the name has none
+ */
+int mds_header_atom(const char* restrict name, size_t length)
+{
+  size_t i;
+  for (i = 0; i < HEADER_ATOM_COUNT; i++)
+    if ((header_atoms[i].length == length) && !memcmp(header_atoms[i].name, name, length * sizeof(char)))
+      return (int)i + 1;
+  return 0;
+}
+
+
+/**
+ * Get the header name of an atom
+ * 
+ * @param   atom  The atom
+ * @return        The header name, `NULL` if `atom` is not an atom
+ */
+const char* mds_header_atom_name(int atom)
+{
+  if ((atom <= 0) || ((size_t)atom > HEADER_ATOM_COUNT))
+    return NULL;
+  return header_atoms[atom - 1].name;
+}
+
+
+/**
+ * Take a read buffer and a header list from the pool,
+ * or allocate a read buffer if the pool is empty
+ * 
+ * @param   this  The message, its buffer and header list must be unset
+ * @return        Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int take_buffer(mds_message_t* restrict this)
+{
+  pooled_buffer_t* pooled = NULL;
+  
+  pool_lock();
+  if (pool_count > 0)
+    pooled = pool + --pool_count;
+  if (pooled != NULL)
+    {
+      this->buffer       = pooled->buffer;
+      this->buffer_size  = pooled->buffer_size;
+      this->headers      = pooled->headers;
+      this->headers_size = pooled->headers_size;
+    }
+  pool_unlock();
+  
+  if (pooled == NULL)
+    {
+      this->buffer_size = MDS_MESSAGE_BUFFER_SIZE;
+      fail_if (xmalloc(this->buffer, this->buffer_size, char));
+    }
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Return a message's read buffer and header list to
+ * the pool, or free them if they are not pooled
+ * 
+ * @param  this  The message, the header list must not own any headers
+ */
+__attribute__((nonnull))
+static void give_buffer(mds_message_t* restrict this)
+{
+  int pooled = 0;
+  
+  if ((this->buffer != NULL) && (this->buffer_size <= MDS_MESSAGE_POOL_MAX_BUFFER))
+    {
+      pool_lock();
+      if (pool_count < MDS_MESSAGE_POOL_SIZE)
+	{
+	  pool[pool_count].buffer       = this->buffer;
+	  pool[pool_count].buffer_size  = this->buffer_size;
+	  pool[pool_count].headers      = this->headers;
+	  pool[pool_count].headers_size = this->headers_size;
+	  pool_count++;
+	  pooled = 1;
+	}
+      pool_unlock();
+    }
+  
+  if (pooled == 0)
+    {
+      free(this->buffer);
+      free(this->headers);
+    }
+  this->buffer = NULL;
+  this->buffer_size = 0;
+  this->headers = NULL;
+  this->headers_size = 0;
+}
+
+
 /**
  * Initialise a message slot so that it can
  * be used by `mds_message_read`
@@ -40,18 +287,8 @@
  */
 int mds_message_initialise(mds_message_t* restrict this)
 {
-  this->headers = NULL;
-  this->header_count = 0;
-  this->payload = NULL;
-  this->payload_size = 0;
-  this->payload_ptr = 0;
-  this->buffer_size = 128;
-  this->buffer_ptr = 0;
-  this->stage = 0;
-  fail_if (xmalloc(this->buffer, this->buffer_size, char));
-  return 0;
- fail:
-  return -1;
+  mds_message_zero_initialise(this);
+  return take_buffer(this);
 }
 
 
@@ -64,13 +301,36 @@ void mds_message_zero_initialise(mds_message_t* restrict this)
 {
   this->headers = NULL;
   this->header_count = 0;
+  this->headers_size = 0;
   this->payload = NULL;
   this->payload_size = 0;
   this->payload_ptr = 0;
   this->buffer = NULL;
   this->buffer_size = 0;
   this->buffer_ptr = 0;
+  this->buffer_off = 0;
+  this->in_place = 0;
   this->stage = 0;
+  this->binary = 0;
+}
+
+
+/**
+ * Free the headers and the payload of a message
+ * if they are not stored in its read buffer
+ * 
+ * @param  this  The message
+ */
+__attribute__((nonnull))
+static void free_owned(mds_message_t* restrict this)
+{
+  size_t i;
+  if (this->in_place)
+    return;
+  if (this->headers != NULL)
+    for (i = 0; i < this->header_count; i++)
+      free(this->headers[i]);
+  free(this->payload);
 }
 
 
@@ -82,12 +342,10 @@ void mds_message_zero_initialise(mds_message_t* restrict this)
  */
 void mds_message_destroy(mds_message_t* restrict this)
 {
-  size_t i;
-  if (this->headers != NULL)
-    xfree(this->headers, this->header_count);
-  
-  free(this->payload), this->payload = NULL;
-  free(this->buffer),  this->buffer  = NULL;
+  free_owned(this);
+  this->header_count = 0;
+  this->payload = NULL;
+  give_buffer(this);
 }
 
 
@@ -103,6 +361,7 @@ int mds_message_extend_headers(mds_message_t* restrict this, size_t extent)
   char** new_headers = this->headers;
   fail_if (xrealloc(new_headers, this->header_count + extent, char*));
   this->headers = new_headers;
+  this->headers_size = this->header_count + extent;
   return 0;
  fail:
   return -1;
@@ -110,18 +369,70 @@ int mds_message_extend_headers(mds_message_t* restrict this, size_t extent)
 
 
 /**
- * Extend the read buffer by way of doubling
+ * Move the message that is being read, and the data read after
+ * it, to the beginning of the read buffer, the messages before
+ * it have been read, so the beginning of the buffer is unused,
+ * `MDS_MESSAGE_BINARY_HEADER_ROOM` is left before it if it is
+ * in the binary framing and its headers have not been stored
+ * 
+ * @param  this  The message
+ */
+__attribute__((nonnull))
+static void compact_buffer(mds_message_t* restrict this)
+{
+  size_t i, start = this->header_count ? (size_t)(this->headers[0] - this->buffer) : this->buffer_off;
+  
+  if ((this->header_count == 0) && this->binary)
+    start = start > MDS_MESSAGE_BINARY_HEADER_ROOM ? start - MDS_MESSAGE_BINARY_HEADER_ROOM : 0;
+  if (start == 0)
+    return;
+  memmove(this->buffer, this->buffer + start, (this->buffer_ptr - start) * sizeof(char));
+  for (i = 0; i < this->header_count; i++)
+    this->headers[i] -= start;
+  if (this->payload != NULL)
+    this->payload -= start;
+  this->buffer_off -= start;
+  this->buffer_ptr -= start;
+}
+
+
+/**
+ * Make sure that the read buffer can hold a number of bytes from
+ * where the parsing is, the buffer is compacted first, and then
+ * extended by way of doubling, the headers and the payload are
+ * moved along with it
  * 
  * @param   this  The message
+ * @param   size  The number of bytes the buffer must be able to hold from `this->buffer_off`
  * @return        Zero on success, -1 on error
  */
 __attribute__((nonnull))
-static int mds_message_extend_buffer(mds_message_t* restrict this)
+static int reserve_buffer(mds_message_t* restrict this, size_t size)
 {
-  char* new_buf = this->buffer;
-  fail_if (xrealloc(new_buf, this->buffer_size << 1, char));
+  char* new_buf;
+  size_t i, new_size;
+  
+  if (this->buffer_off + size <= this->buffer_size)
+    return 0;
+  compact_buffer(this);
+  if (this->buffer_off + size <= this->buffer_size)
+    return 0;
+  
+  new_buf = this->buffer;
+  new_size = this->buffer_size ? this->buffer_size : MDS_MESSAGE_BUFFER_SIZE;
+  while (new_size < this->buffer_off + size)
+    new_size <<= 1;
+  fail_if (xrealloc(new_buf, new_size, char));
+  
+  if ((new_buf != this->buffer) && (this->buffer != NULL))
+    {
+      for (i = 0; i < this->header_count; i++)
+	this->headers[i] = new_buf + (size_t)(this->headers[i] - this->buffer);
+      if (this->payload != NULL)
+	this->payload = new_buf + (size_t)(this->payload - this->buffer);
+    }
   this->buffer = new_buf;
-  this->buffer_size <<= 1;
+  this->buffer_size = new_size;
   return 0;
  fail:
   return -1;
@@ -129,22 +440,60 @@ static int mds_message_extend_buffer(mds_message_t* restrict this)
 
 
 /**
- * Reset the header list and the payload
+ * Make room for another header in the header list
+ * 
+ * @param   this  The message
+ * @param   need  The number of headers the list must be able to hold
+ * @return        Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int reserve_headers(mds_message_t* restrict this, size_t need)
+{
+  size_t extent = this->headers_size < 8 ? 8 : this->headers_size;
+  if (need <= this->headers_size)
+    return 0;
+  if (extent < need - this->header_count)
+    extent = need - this->header_count;
+  return mds_message_extend_headers(this, extent);
+}
+
+
+/**
+ * Reset the header list and the payload, the data that has been
+ * read after the previous message is left where it is, and is
+ * only moved when the read buffer runs out of room
  * 
  * @param  this  The message
  */
 __attribute__((nonnull))
 static void reset_message(mds_message_t* restrict this)
 {
-  size_t i;
-  if (this->headers != NULL)
-    xfree(this->headers, this->header_count);
+  size_t overrun = this->buffer_ptr - this->buffer_off;
+  char* new_buf;
+  
+  free_owned(this);
+  this->in_place = 1;
   this->header_count = 0;
   
-  free(this->payload);
   this->payload = NULL;
   this->payload_size = 0;
   this->payload_ptr = 0;
+  
+  if (overrun == 0)
+    this->buffer_ptr = this->buffer_off = this->binary ? min(MDS_MESSAGE_BINARY_HEADER_ROOM, this->buffer_size) : 0;
+  
+  /* A buffer that grew for a large message is shrunk when it is
+     no longer needed, if this fails, the buffer is simply kept. */
+  if ((this->buffer_size > MDS_MESSAGE_POOL_MAX_BUFFER) && (overrun <= MDS_MESSAGE_BUFFER_SIZE / 2))
+    {
+      compact_buffer(this);
+      new_buf = realloc(this->buffer, MDS_MESSAGE_BUFFER_SIZE * sizeof(char));
+      if (new_buf != NULL)
+	{
+	  this->buffer = new_buf;
+	  this->buffer_size = MDS_MESSAGE_BUFFER_SIZE;
+	}
+    }
 }
 
 
@@ -154,7 +503,7 @@ static void reset_message(mds_message_t* restrict this)
  * @param   this  The message
  * @return        Zero on success, negative on error (malformated message: unrecoverable state)
  */
-__attribute__((pure, nonnull))
+__attribute__((nonnull))
 static int get_payload_length(mds_message_t* restrict this)
 {
   char* header;
@@ -184,21 +533,25 @@ static int get_payload_length(mds_message_t* restrict this)
  * Verify that a header is correctly formatted
  * 
  * @param   header  The header, must be NUL-terminated
- * @param   length  The length of the header
+ * @param   length  The length of the header, excluding the NUL-termination
+ * @param   colon   The first ':' in the header, `NULL` if there is none
  * @return          Zero if valid, negative if invalid (malformated message: unrecoverable state)
  */
-__attribute__((pure, nonnull))
-static int validate_header(const char* header, size_t length)
+__attribute__((pure, nonnull(1)))
+static int validate_header(const char* header, size_t length, const char* colon)
 {
-  char* p = memchr(header, ':', length * sizeof(char));
-  
-  if (verify_utf8(header, 0) < 0)
+  if (scan_utf8(header, length, 0) < 0)
     /* Either the string is not UTF-8, or your are under an UTF-8 attack,
        lets just call this unrecoverable because the client will not correct. */
     return -2;
   
-  if ((p == NULL) || /* Buck you, rawmemchr should not segfault the program. */
-      (p[1] != ' ')) /* Also an invalid format. ' ' is mandated after the ':'. */
+  if ((colon == NULL) ||  /* A ":" must separate the name and the value. */
+      (colon[1] != ' '))  /* Also an invalid format. ' ' is mandated after the ':'. */
+    return -2;
+  
+  /* The header must fit its record in the binary framing, so
+     that it can be passed on to clients that use the framing. */
+  if (((size_t)(colon - header) > UINT16_MAX) || (length - (size_t)(colon - header) - 2 > UINT32_MAX))
     return -2;
   
   return 0;
@@ -206,24 +559,26 @@ static int validate_header(const char* header, size_t length)
 
 
 /**
- * Remove the beginning of the read buffer
+ * Make room for the payload in the read buffer, directly
+ * after the headers, so that it is read into place
  * 
- * @param  this        The message
- * @param  length      The number of characters to remove  
- * @param  update_ptr  Whether to update the buffer pointer
+ * @param   this  The message, `this->buffer_off` must be where the payload begins
+ * @return        Zero on success, -1 on error
  */
 __attribute__((nonnull))
-static void unbuffer_beginning(mds_message_t* restrict this, size_t length, int update_ptr)
+static int place_payload(mds_message_t* restrict this)
 {
-  memmove(this->buffer, this->buffer + length, (this->buffer_ptr - length) * sizeof(char));
-  if (update_ptr)
-    this->buffer_ptr -= length;
+  fail_if (reserve_buffer(this, this->payload_size));
+  this->payload = this->payload_size > 0 ? this->buffer + this->buffer_off : NULL;
+  return 0;
+ fail:
+  return -1;
 }
 
 
 /**
- * Remove the header–payload delimiter from the buffer,
- * get the payload's size and allocate the payload
+ * Skip the header–payload delimiter in the buffer,
+ * get the payload's size and make room for the payload
  * 
  * @param   this  The message
  * @return        The return value follows the rules of `mds_message_read`
@@ -231,54 +586,41 @@ static void unbuffer_beginning(mds_message_t* restrict this, size_t length, int
 __attribute__((nonnull))
 static int initialise_payload(mds_message_t* restrict this)
 {
-  /* Remove the \n (end of empty line) we found from the buffer. */
-  unbuffer_beginning(this, 1, 1);
+  /* Skip over the \n (end of empty line) we found in the buffer. */
+  this->buffer_off++;
   
   /* Get the length of the payload. */
   if (get_payload_length(this) < 0)
     return -2; /* Malformated value, enters unrecoverable state. */
   
-  /* Allocate the payload buffer. */
-  if (this->payload_size > 0)
-    fail_if (xmalloc(this->payload, this->payload_size, char));
-  
-  return 0;
- fail:
-  return -1;
+  return place_payload(this);
 }
 
 
 /**
- * Create a header from the buffer and store it
+ * Store a header that is in the buffer, in place
  * 
  * @param   this    The message
  * @param   length  The length of the header, including LF-termination
+ * @param   colon   The first ':' in the header, `NULL` if there is none
  * @return          The return value follows the rules of `mds_message_read`
  */
-__attribute__((nonnull))
-static int store_header(mds_message_t* restrict this, size_t length)
+__attribute__((nonnull(1)))
+static int store_header(mds_message_t* restrict this, size_t length, const char* colon)
 {
-  char* header;
+  char* header = this->buffer + this->buffer_off;
   
-  /* Allocate the header. */
-  fail_if (xmalloc(header, length, char)); /* Last char is a LF, which is substituted with NUL. */
-  /* Copy the header data into the allocated header, */
-  memcpy(header, this->buffer, length * sizeof(char));
-  /* and NUL-terminate it. */
+  /* The LF is substituted with NUL, and the header is left in the read buffer. */
   header[length - 1] = '\0';
-  
-  /* Remove the header data from the read buffer. */
-  unbuffer_beginning(this, length, 1);
+  this->buffer_off += length;
   
   /* Make sure the the header syntax is correct so that
      the program does not need to care about it. */
-  if (validate_header(header, length))
-    {
-      free(header);
-      return -2;
-    }
+  if (validate_header(header, length - 1, colon))
+    return -2;
   
   /* Store the header in the header list. */
+  fail_if (reserve_headers(this, this->header_count + 1));
   this->headers[this->header_count++] = header;
   
   return 0;
@@ -288,37 +630,207 @@ static int store_header(mds_message_t* restrict this, size_t length)
 
 
 /**
- * Continue reading from the socket into the buffer
+ * Store the headers of a message in the binary framing, when they
+ * have been read, as they would have been in the text framing, in
+ * place of their records in the buffer, and make room for the payload
  * 
  * @param   this  The message
- * @param   fd    The file descriptor of the socket
- * @return        The return value follows the rules of `mds_message_read`
+ * @return        The return value follows the rules of `mds_message_read`,
+ *                the headers are not stored until they are in the buffer,
+ *                `this->stage` is set to 1 when they have been stored
  */
 __attribute__((nonnull))
-static int continue_read(mds_message_t* restrict this, int fd)
+static int store_binary_headers(mds_message_t* restrict this)
+{
+  const char* p;
+  const char* end;
+  const char* name;
+  const char* colon;
+  char* text = NULL;
+  char* allocated = NULL;
+  char* header;
+  uint32_t count, size, payload_size, value_length;
+  uint16_t name_length16;
+  size_t name_length, text_size = 0, region, growth, i;
+  int atom, saved_errno;
+  
+  /* Wait until the headers have been read. */
+  p = this->buffer + this->buffer_off;
+  if (this->buffer_ptr - this->buffer_off < MDS_MESSAGE_BINARY_PREFIX)
+    return 0;
+  memcpy(&count,        p + 0 * sizeof(uint32_t), sizeof(uint32_t));
+  memcpy(&size,         p + 1 * sizeof(uint32_t), sizeof(uint32_t));
+  memcpy(&payload_size, p + 2 * sizeof(uint32_t), sizeof(uint32_t));
+  region = MDS_MESSAGE_BINARY_PREFIX + (size_t)size;
+  if (this->buffer_ptr - this->buffer_off < region)
+    return 0;
+  
+  /* A header is at least five bytes, so this stops excessive allocations. */
+  if ((size_t)count * (1 + sizeof(uint32_t)) > (size_t)size)
+    return -2;
+  
+#define need(N)  if ((size_t)(end - p) < (size_t)(N))  goto malformated
+  /* The headers are written as they would have been in the text framing, but
+     NUL-terminated, first elsewhere, as they can be larger than their records,
+     and then over the records. The records are measured first. */
+  for (;;)
+    {
+      p = this->buffer + this->buffer_off + MDS_MESSAGE_BINARY_PREFIX;
+      end = p + size;
+      header = text;
+      for (i = 0; i < count; i++)
+	{
+	  /* Get the name, by its atom if it has one. */
+	  need(1);
+	  if ((atom = (int)(unsigned char)*p++))
+	    {
+	      if ((name = mds_header_atom_name(atom)) == NULL)
+		goto malformated;
+	      name_length = strlen(name);
+	    }
+	  else
+	    {
+	      need(sizeof(uint16_t));
+	      memcpy(&name_length16, p, sizeof(uint16_t));
+	      p += sizeof(uint16_t);
+	      name_length = (size_t)name_length16;
+	      need(name_length);
+	      name = p;
+	      p += name_length;
+	    }
+	  need(sizeof(uint32_t));
+	  memcpy(&value_length, p, sizeof(uint32_t));
+	  p += sizeof(uint32_t);
+	  need(value_length);
+	  
+	  if (text == NULL)
+	    text_size += name_length + 2 + (size_t)value_length + 1;
+	  else
+	    {
+	      memcpy(header, name, name_length * sizeof(char));
+	      memcpy(header + name_length, ": ", 2 * sizeof(char));
+	      memcpy(header + name_length + 2, p, (size_t)value_length * sizeof(char));
+	      header += name_length + 2 + (size_t)value_length;
+	      *header++ = '\0';
+	    }
+	  p += value_length;
+	}
+      if (p != end)
+	goto malformated;
+      if (text != NULL)
+	break;
+      
+      /* The headers are written after the read data, with room for it to be
+	 moved forward, if the buffer has room for them without being compacted
+	 or grown, which would move the data, otherwise to an allocation. */
+      growth = text_size > region ? text_size - region : 0;
+      if (this->buffer_size - this->buffer_ptr >= growth + text_size)
+	text = this->buffer + this->buffer_ptr + growth;
+      else
+	{
+	  fail_if (xmalloc(allocated, text_size ? text_size : 1, char));
+	  text = allocated;
+	}
+    }
+#undef need
+  
+  /* Write the headers over the records. If they are larger than the records,
+     they extend into the unused room before the records if there is enough,
+     otherwise the data after the records is moved forward. */
+  if ((growth > 0) && (this->buffer_off >= growth))
+    {
+      this->buffer_off -= growth;
+      region = text_size;
+    }
+  else if (growth > 0)
+    {
+      fail_if (reserve_buffer(this, this->buffer_ptr - this->buffer_off + growth));
+      memmove(this->buffer + this->buffer_off + text_size,
+	      this->buffer + this->buffer_off + region,
+	      (this->buffer_ptr - this->buffer_off - region) * sizeof(char));
+      this->buffer_ptr += growth;
+      region = text_size;
+    }
+  memcpy(this->buffer + this->buffer_off, text, text_size * sizeof(char));
+  free(allocated), allocated = NULL;
+  
+  /* Store the headers in the header list, make sure that
+     they could have been sent in the text framing. */
+  fail_if (reserve_headers(this, (size_t)count));
+  header = this->buffer + this->buffer_off;
+  for (i = 0; i < count; i++)
+    {
+      name_length = strlen(header);
+      if ((scan_line(header, name_length, &colon) != NULL) || validate_header(header, name_length, colon))
+	return -2;
+      this->headers[this->header_count++] = header;
+      header += name_length + 1;
+    }
+  if (header != this->buffer + this->buffer_off + text_size)
+    return -2; /* One of the headers contained a NUL byte. */
+  this->buffer_off += region;
+  
+  /* The payload must be described by the ‘Length’ header, so that the
+     message can be passed on in the text framing, and make room for it. */
+  this->payload_size = 0;
+  if ((get_payload_length(this) < 0) || (this->payload_size != (size_t)payload_size))
+    return -2;
+  fail_if (place_payload(this));
+  
+  this->stage = 1;
+  return 0;
+ malformated:
+  free(allocated);
+  return -2;
+ fail:
+  saved_errno = errno;
+  free(allocated);
+  errno = saved_errno;
+  return -1;
+}
+
+
+/**
+ * Read from a socket, this is the source of `mds_message_read`
+ * 
+ * @param   data    The file descriptor of the socket, cast to a pointer
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          See recv(3)
+ */
+static ssize_t socket_source(void* data, char* buffer, size_t size)
+{
+  return recv((int)(intptr_t)data, buffer, size, 0);
+}
+
+
+/**
+ * Continue reading from the source into the buffer
+ * 
+ * @param   this         The message
+ * @param   source       The function that reads from the source
+ * @param   source_data  The first argument to `source`
+ * @return               The return value follows the rules of `mds_message_read`
+ */
+__attribute__((nonnull(1, 2)))
+static int continue_read(mds_message_t* restrict this, mds_message_source_t* source, void* source_data)
 {
   size_t n;
   ssize_t got;
   int r;
   
+  /* If we do not have too much space left in the read buffer, make room. */
+  if (this->buffer_size - this->buffer_ptr < 128)
+    try (reserve_buffer(this, this->buffer_ptr - this->buffer_off + 128));
+  
   /* Figure out how much space we have left in the read buffer. */
   n = this->buffer_size - this->buffer_ptr;
   
-  /* If we do not have too much left, */
-  if (n < 128)
-    {
-      /* grow the buffer, */
-      try (mds_message_extend_buffer(this));
-      
-      /* and recalculate how much space we have left. */
-      n = this->buffer_size - this->buffer_ptr;
-    }
-  
-  /* Then read from the socket. */
+  /* Then read from the source. */
   errno = 0;
-  got = recv(fd, this->buffer + this->buffer_ptr, n, 0);
+  got = source(source_data, this->buffer + this->buffer_ptr, n);
   this->buffer_ptr += (size_t)(got < 0 ? 0 : got);
-  fail_if (errno);
+  fail_if (got < 0);
   if (got == 0)
     fail_if ((errno = ECONNRESET));
   
@@ -343,12 +855,26 @@ static int continue_read(mds_message_t* restrict this, int fd)
  */
 int mds_message_read(mds_message_t* restrict this, int fd)
 {
-  size_t header_commit_buffer = 0;
+  return mds_message_read_from(this, socket_source, (void*)(intptr_t)fd);
+}
+
+
+/**
+ * Read the next message from a source other than a socket
+ * 
+ * @param   this         Memory slot in which to store the new message
+ * @param   source       The function that reads from the source, it follows
+ *                       the rules of recv(3), returning zero at end of file
+ * @param   source_data  The first argument to `source`
+ * @return               See `mds_message_read`
+ */
+int mds_message_read_from(mds_message_t* restrict this, mds_message_source_t* source, void* source_data)
+{
   int r;
   
   /* If we are at stage 2, we are done and it is time to start over.
      This is important because the function could have been interrupted. */
-  if (this->stage == 2)
+  if ((this->stage == 2) || (this->in_place == 0))
     {
       reset_message(this);
       this->stage = 0;
@@ -357,33 +883,30 @@ int mds_message_read(mds_message_t* restrict this, int fd)
   /* Read from file descriptor until we have a full message. */
   for (;;)
     {
-      char* p;
+      const char* p;
+      const char* colon;
       size_t length;
       
       /* Stage 0: headers. */
+      /* In the binary framing, the headers are stored all at once. */
+      if ((this->stage == 0) && this->binary)
+	try (store_binary_headers(this));
+      
       /* Read all headers that we have stored into the read buffer. */
-      while ((this->stage == 0) &&
-	     ((p = memchr(this->buffer, '\n', this->buffer_ptr * sizeof(char))) != NULL))
-	if ((length = (size_t)(p - this->buffer)))
+      while ((this->stage == 0) && (this->binary == 0) &&
+	     ((p = scan_line(this->buffer + this->buffer_off,
+			     this->buffer_ptr - this->buffer_off, &colon)) != NULL))
+	if ((length = (size_t)(p - (this->buffer + this->buffer_off))))
 	  {
-	    /* We have found a header. */
-	    
-	    /* On every eighth header found with this function call,
-	       we prepare the header list for eight more headers so
-	       that it does not need to be reallocated again and again. */
-	    if (header_commit_buffer == 0)
-	      try (mds_message_extend_headers(this, header_commit_buffer = 8));
-	    
-	    /* Create and store header. */
-	    try (store_header(this, length + 1));
-	    header_commit_buffer -= 1;
+	    /* We have found a header, it is stored in place. */
+	    try (store_header(this, length + 1, colon));
 	  }
 	else
 	  {
 	    /* We have found an empty line, i.e. the end of the headers. */
 	    
-	    /* Remove the header–payload delimiter from the buffer,
-	       get the payload's size and allocate the payload. */
+	    /* Skip over the header–payload delimiter, get
+	       the payload's size and make room for it. */
 	    try (initialise_payload(this));
 	    
 	    /* Mark end of stage, next stage is getting the payload. */
@@ -397,11 +920,10 @@ int mds_message_read(mds_message_t* restrict this, int fd)
 	  /* How much of the payload that has not yet been filled. */
 	  size_t need = this->payload_size - this->payload_ptr;
 	  /* How much we have of that what is needed. */
-	  size_t move = min(this->buffer_ptr, need);
+	  size_t move = min(this->buffer_ptr - this->buffer_off, need);
 	  
-	  /* Copy what we have, and remove it from the the read buffer. */
-	  memcpy(this->payload + this->payload_ptr, this->buffer, move * sizeof(char));
-	  unbuffer_beginning(this, move, 1);
+	  /* The payload is read into place, so it is just skipped over. */
+	  this->buffer_off += move;
 	  
 	  /* Keep track of how much we have read. */
 	  this->payload_ptr += move;
@@ -418,8 +940,8 @@ int mds_message_read(mds_message_t* restrict this, int fd)
       
       /* If stage 1 was not completed. */
       
-      /* Continue reading from the socket into the buffer. */
-      try (continue_read(this, fd));
+      /* Continue reading from the source into the buffer. */
+      try (continue_read(this, source, source_data));
     }
 }
 
@@ -433,12 +955,12 @@ int mds_message_read(mds_message_t* restrict this, int fd)
  */
 size_t mds_message_marshal_size(const mds_message_t* restrict this)
 {
-  size_t rc = this->header_count + this->payload_size;
+  size_t rc = this->header_count + this->payload_size + (this->buffer_ptr - this->buffer_off);
   size_t i;
   for (i = 0; i < this->header_count; i++)
     rc += strlen(this->headers[i]);
   rc *= sizeof(char);
-  rc += 4 * sizeof(size_t) + 2 * sizeof(int);
+  rc += 4 * sizeof(size_t) + 3 * sizeof(int);
   return rc;
 }
 
@@ -458,8 +980,9 @@ void mds_message_marshal(const mds_message_t* restrict this, char* restrict data
   buf_set_next(data, size_t, this->header_count);
   buf_set_next(data, size_t, this->payload_size);
   buf_set_next(data, size_t, this->payload_ptr);
-  buf_set_next(data, size_t, this->buffer_ptr);
+  buf_set_next(data, size_t, this->buffer_ptr - this->buffer_off);
   buf_set_next(data, int, this->stage);
+  buf_set_next(data, int, this->binary);
   
   for (i = 0; i < this->header_count; i++)
     {
@@ -471,13 +994,16 @@ void mds_message_marshal(const mds_message_t* restrict this, char* restrict data
   memcpy(data, this->payload, this->payload_size * sizeof(char));
   
   buf_next(data, char, this->payload_size);
-  memcpy(data, this->buffer, this->buffer_ptr * sizeof(char));
+  memcpy(data, this->buffer + this->buffer_off, (this->buffer_ptr - this->buffer_off) * sizeof(char));
 }
 
 
 /**
  * Unmarshal a message for state deserialisation
  * 
+ * The headers, the payload and the data read after them
+ * are laid out in the read buffer as if they were read
+ * 
  * @param  this  Memory slot in which to store the new message
  * @param  data  In buffer with the marshalled data
  * @return       Non-zero on error, `errno` will be set accordingly.
@@ -485,68 +1011,61 @@ void mds_message_marshal(const mds_message_t* restrict this, char* restrict data
  */
 int mds_message_unmarshal(mds_message_t* restrict this, char* restrict data)
 {
-  size_t i, n, header_count;
+  size_t i, n, header_count, overrun, headers_length = 0;
+  const char* p;
+  int version;
   
-  /* buf_get(data, int, 0, MDS_MESSAGE_T_VERSION); */
-  buf_next(data, int, 1);
+  buf_get_next(data, int, version);
+  
+  /* Make sure that the pointers are NULL so that they are
+     not freed without being allocated when the message is
+     destroyed if this function fails. */
+  mds_message_zero_initialise(this);
+  this->in_place = 1;
   
-  this->header_count = 0;
   buf_get_next(data, size_t, header_count);
   buf_get_next(data, size_t, this->payload_size);
   buf_get_next(data, size_t, this->payload_ptr);
-  buf_get_next(data, size_t, this->buffer_size = this->buffer_ptr);
+  buf_get_next(data, size_t, overrun);
   buf_get_next(data, int, this->stage);
+  /* Messages marshalled before version 1 are in the text framing. */
+  if (version >= 1)
+    buf_get_next(data, int, this->binary);
   
-  /* Make sure that the pointers are NULL so that they are
-     not freed without being allocated when the message is
-     destroyed if this function fails. */
-  this->headers = NULL;
-  this->payload = NULL;
-  this->buffer  = NULL;
-  
-  /* To 2-power-multiple of 128 bytes. */
-  this->buffer_size >>= 7;
-  if (this->buffer_size == 0)
-    this->buffer_size = 1;
-  else
+  for (i = 0, p = data; i < header_count; i++)
     {
-      this->buffer_size -= 1;
-      this->buffer_size |= this->buffer_size >> 1;
-      this->buffer_size |= this->buffer_size >> 2;
-      this->buffer_size |= this->buffer_size >> 4;
-      this->buffer_size |= this->buffer_size >> 8;
-      this->buffer_size |= this->buffer_size >> 16;
-#if __WORDSIZE == 64
-      this->buffer_size |= this->buffer_size >> 32;
-#endif
-      this->buffer_size += 1;
+      n = strlen(p) + 1;
+      headers_length += n;
+      p += n;
     }
-  this->buffer_size <<= 7;
-  
-  /* Allocate header list, payload and read buffer. */
   
+  /* Allocate the header list and the read buffer, the data that was read after the
+     received part of the payload is placed directly after it, as it would have been. */
   if (header_count > 0)
-    fail_if (xmalloc(this->headers, header_count, char*));
-  
-  if (this->payload_size > 0)
-    fail_if (xmalloc(this->payload, this->payload_size, char));
-  
-  fail_if (xmalloc(this->buffer, this->buffer_size, char));
+    fail_if (reserve_headers(this, header_count));
+  fail_if (reserve_buffer(this, max(headers_length + this->payload_size + overrun, (size_t)1)));
   
   /* Fill the header list, payload and read buffer. */
   
-  for (i = 0; i < this->header_count; i++)
+  for (i = 0; i < header_count; i++)
     {
       n = strlen(data) + 1;
-      fail_if (xmemdup(this->headers[i], data, n, char));
+      this->headers[this->header_count++] = this->buffer + this->buffer_off;
+      memcpy(this->buffer + this->buffer_off, data, n * sizeof(char));
+      this->buffer_off += n;
       buf_next(data, char, n);
-      this->header_count++;
     }
   
-  memcpy(this->payload, data, this->payload_size * sizeof(char));
+  if (this->payload_size > 0)
+    {
+      this->payload = this->buffer + this->buffer_off;
+      memcpy(this->payload, data, this->payload_size * sizeof(char));
+      this->buffer_off += this->payload_ptr;
+    }
   buf_next(data, char, this->payload_size);
   
-  memcpy(this->buffer, data, this->buffer_ptr * sizeof(char));
+  memcpy(this->buffer + this->buffer_off, data, overrun * sizeof(char));
+  this->buffer_ptr = this->buffer_off + overrun;
   
   return 0;
   
@@ -595,6 +1114,137 @@ void mds_message_compose(const mds_message_t* restrict this, char* restrict data
     memcpy(data, this->payload, this->payload_size * sizeof(char));
 }
 
+
+/**
+ * Find the end of the name and the beginning of the value of a header,
+ * a header without a colon is taken as a header with an empty value
+ * 
+ * @param  eol        The end of the header
+ * @param  colon      The first ':' in the header, `NULL` if there is none
+ * @param  colon_out  Output parameter for the end of the name
+ * @param  value_out  Output parameter for the beginning of the value
+ */
+__attribute__((nonnull(1, 3, 4)))
+static void split_header(const char* eol, const char* colon, const char** colon_out, const char** value_out)
+{
+  if (colon == NULL)
+    *colon_out = *value_out = eol;
+  else
+    *colon_out = colon, *value_out = eol - colon < 2 ? eol : colon + 2;
+}
+
+
+/**
+ * Get the size of a message, composed in the text framing,
+ * once it is translated to the binary framing
+ * 
+ * @param   message  The message, in the text framing
+ * @param   length   The length of `message`
+ * @return           The size of the message in the binary framing, zero on error
+ * 
+ * @throws  EMSGSIZE  A header name, a header value, all headers together,
+ *                    or the payload, is too large for its field
+ */
+size_t mds_message_binary_size(const char* restrict message, size_t length)
+{
+  const char* end = message + length;
+  const char* eol;
+  const char* colon;
+  const char* value;
+  size_t rc = MDS_MESSAGE_BINARY_PREFIX;
+  
+  for (; (eol = scan_line(message, (size_t)(end - message), &colon)) != NULL; message = eol + 1)
+    {
+      if (eol == message)
+	{
+	  fail_if ((size_t)(end - eol - 1) > UINT32_MAX);
+	  break;
+	}
+      split_header(eol, colon, &colon, &value);
+      fail_if ((size_t)(eol - value) > UINT32_MAX);
+      rc += 1 + sizeof(uint32_t) + (size_t)(eol - value);
+      if (mds_header_atom(message, (size_t)(colon - message)) == 0)
+	{
+	  fail_if ((size_t)(colon - message) > UINT16_MAX);
+	  rc += sizeof(uint16_t) + (size_t)(colon - message);
+	}
+    }
+  fail_if (rc - MDS_MESSAGE_BINARY_PREFIX > UINT32_MAX);
+  
+  return eol == NULL ? rc : rc + (size_t)(end - eol - 1);
+ fail:
+  errno = EMSGSIZE;
+  return 0;
+}
+
+
+/**
+ * Translate a message, composed in the text framing, to the binary framing
+ * 
+ * @param   message  The message, in the text framing
+ * @param   length   The length of `message`
+ * @param   data     Output buffer for the translated message, the size
+ *                   of the message is given by `mds_message_binary_size`
+ * @return           Zero on success, -1 on error, `errno` will have been
+ *                   set accordingly on error, the message cannot fail if
+ *                   `mds_message_binary_size` has accepted it
+ * 
+ * @throws  EMSGSIZE  See `mds_message_binary_size`
+ */
+int mds_message_to_binary(const char* restrict message, size_t length, char* restrict data)
+{
+  const char* end = message + length;
+  const char* eol;
+  const char* colon;
+  const char* value;
+  char* prefix = data;
+  uint32_t count = 0, size, payload_size = 0, value_length;
+  uint16_t name_length;
+  int atom;
+  
+  data += MDS_MESSAGE_BINARY_PREFIX;
+  for (; (eol = scan_line(message, (size_t)(end - message), &colon)) != NULL; message = eol + 1)
+    {
+      if (eol == message)
+	{
+	  fail_if ((size_t)(end - eol - 1) > UINT32_MAX);
+	  payload_size = (uint32_t)(end - eol - 1);
+	  break;
+	}
+      
+      split_header(eol, colon, &colon, &value);
+      fail_if ((size_t)(eol - value) > UINT32_MAX);
+      if ((atom = mds_header_atom(message, (size_t)(colon - message))))
+	buf_set_next(data, char, (char)atom);
+      else
+	{
+	  fail_if ((size_t)(colon - message) > UINT16_MAX);
+	  name_length = (uint16_t)(colon - message);
+	  buf_set_next(data, char, 0);
+	  memcpy(data, &name_length, sizeof(uint16_t)), data += sizeof(uint16_t);
+	  memcpy(data, message, (size_t)name_length * sizeof(char)), data += name_length;
+	}
+      value_length = (uint32_t)(eol - value);
+      memcpy(data, &value_length, sizeof(uint32_t)), data += sizeof(uint32_t);
+      memcpy(data, value, (size_t)value_length * sizeof(char)), data += value_length;
+      count++;
+    }
+  
+  /* The prefix is written last, when the size of the headers is known. */
+  fail_if ((size_t)(data - prefix) - MDS_MESSAGE_BINARY_PREFIX > UINT32_MAX);
+  size = (uint32_t)(data - prefix - (ptrdiff_t)MDS_MESSAGE_BINARY_PREFIX);
+  memcpy(prefix + 0 * sizeof(uint32_t), &count,        sizeof(uint32_t));
+  memcpy(prefix + 1 * sizeof(uint32_t), &size,         sizeof(uint32_t));
+  memcpy(prefix + 2 * sizeof(uint32_t), &payload_size, sizeof(uint32_t));
+  
+  if (payload_size > 0)
+    memcpy(data, eol + 1, (size_t)payload_size * sizeof(char));
+  return 0;
+ fail:
+  errno = EMSGSIZE;
+  return -1;
+}
+
   
 #undef try
 
@@ -20,9 +20,37 @@
 
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 
-#define MDS_MESSAGE_T_VERSION  0
+#define MDS_MESSAGE_T_VERSION  1
+
+/**
+ * The size of the prefix of a message in the binary framing
+ * 
+ * In the binary framing, a message begins with three `uint32_t`,
+ * in the byte order of the host: the number of headers, the size
+ * of the headers, and the size of the payload. The headers follow,
+ * each beginning with a byte that is the atom of its name, or zero
+ * if the name has no atom and is spelled out after a `uint16_t`
+ * with its length, followed by a `uint32_t` with the length of the
+ * value, and the value. The payload follows the headers. The headers
+ * are those of the text framing, including the ‘Length’ header.
+ */
+#define MDS_MESSAGE_BINARY_PREFIX  (3 * sizeof(uint32_t))
+
+/**
+ * A function that reads into a buffer, with the same
+ * return value as recv(3), for `mds_message_read_from`
+ * 
+ * @param   data    User data
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          The number of read bytes, zero at end of
+ *                  file, -1 on error, with `errno` set
+ */
+typedef ssize_t mds_message_source_t(void* data, char* buffer, size_t size);
 
 /**
  * Message passed between a server and a client or between two of either
@@ -34,8 +62,10 @@ typedef struct mds_message
    * as an unparsed header, it consists of both the header
    * name and its associated value, joined by ": ". A header
    * cannot be `NULL` (unless its memory allocation failed,)
-   * but `headers` itself is `NULL` if there are no headers.
+   * but `headers` itself may be `NULL` if there are no headers.
    * The "Length" header should be included in this list.
+   * When the message has been read, the headers are stored
+   * in `buffer`, and are valid until the next message is read.
    */
   char** headers;
   
@@ -45,7 +75,13 @@ typedef struct mds_message
   size_t header_count;
   
   /**
-   * The payload of the message, `NULL` if none (of zero-length)
+   * The number of elements allocated to `headers` (internal data)
+   */
+  size_t headers_size;
+  
+  /**
+   * The payload of the message, `NULL` if none (of zero-length),
+   * when the message has been read, it is stored in `buffer`
    */
   char* payload;
   
@@ -74,14 +110,53 @@ typedef struct mds_message
    */
   size_t buffer_ptr;
   
+  /**
+   * The number of bytes at the beginning of `buffer` that has
+   * been parsed, these hold the headers and the payload (internal data)
+   */
+  size_t buffer_off;
+  
+  /**
+   * Whether `headers` and `payload` point into `buffer`, as they do when
+   * the message has been read, rather than being allocated separately,
+   * as they are when the message has been zero initialised (internal data)
+   */
+  int in_place;
+  
   /**
    * 0 while reading headers, 1 while reading payload, and 2 when done (internal data)
    */
   int stage;
   
+  /**
+   * Whether the messages are read in the binary framing
+   * rather than in the text framing, which is the default
+   */
+  int binary;
+  
 } mds_message_t;
 
 
+/**
+ * Get the atom of a header name, the small integer that
+ * the name is sent as in the binary framing
+ * 
+ * @param   name    The header name, it need not be NUL-terminated
+ * @param   length  The length of `name`
+ * @return          The atom, zero if the name has none
+ */
+__attribute__((pure, nonnull))
+int mds_header_atom(const char* restrict name, size_t length);
+
+/**
+ * Get the header name of an atom
+ * 
+ * @param   atom  The atom
+ * @return        The header name, `NULL` if `atom` is not an atom
+ */
+__attribute__((const))
+const char* mds_header_atom_name(int atom);
+
 /**
  * Initialise a message slot so that it can
  * be used by `mds_message_read`
@@ -136,6 +211,18 @@ int mds_message_extend_headers(mds_message_t* restrict this, size_t extent);
 __attribute__((nonnull))
 int mds_message_read(mds_message_t* restrict this, int fd);
 
+/**
+ * Read the next message from a source other than a socket
+ * 
+ * @param   this         Memory slot in which to store the new message
+ * @param   source       The function that reads from the source, it follows
+ *                       the rules of recv(3), returning zero at end of file
+ * @param   source_data  The first argument to `source`
+ * @return               See `mds_message_read`
+ */
+__attribute__((nonnull(1, 2)))
+int mds_message_read_from(mds_message_t* restrict this, mds_message_source_t* source, void* source_data);
+
 /**
  * Get the required allocation size for `data` of the
  * function `mds_message_marshal`
@@ -185,6 +272,36 @@ size_t mds_message_compose_size(const mds_message_t* restrict this);
 __attribute__((nonnull))
 void mds_message_compose(const mds_message_t* restrict this, char* restrict data);
 
+/**
+ * Get the size of a message, composed in the text framing,
+ * once it is translated to the binary framing
+ * 
+ * @param   message  The message, in the text framing
+ * @param   length   The length of `message`
+ * @return           The size of the message in the binary framing, zero on error
+ * 
+ * @throws  EMSGSIZE  A header name, a header value, all headers together,
+ *                    or the payload, is too large for its field
+ */
+__attribute__((nonnull))
+size_t mds_message_binary_size(const char* restrict message, size_t length);
+
+/**
+ * Translate a message, composed in the text framing, to the binary framing
+ * 
+ * @param   message  The message, in the text framing
+ * @param   length   The length of `message`
+ * @param   data     Output buffer for the translated message, the size
+ *                   of the message is given by `mds_message_binary_size`
+ * @return           Zero on success, -1 on error, `errno` will have been
+ *                   set accordingly on error, the message cannot fail if
+ *                   `mds_message_binary_size` has accepted it
+ * 
+ * @throws  EMSGSIZE  See `mds_message_binary_size`
+ */
+__attribute__((nonnull))
+int mds_message_to_binary(const char* restrict message, size_t length, char* restrict data);
+
 
 #endif
 
@@ -0,0 +1,486 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "scan.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define SCAN_X86
+# include <immintrin.h>
+#endif
+
+
+
+/**
+ * The functions of an implementation
+ */
+typedef struct scan_kernels
+{
+  /**
+   * Implementation of `scan_line`
+   */
+  const char* (*line)(const char* restrict string, size_t length, const char** restrict colon_out);
+  
+  /**
+   * Implementation of `scan_utf8`
+   */
+  int (*utf8)(const char* string, size_t length, int allow_modified_nul);
+  
+} scan_kernels_t;
+
+
+
+/**
+ * Mask of the most significant bit of each byte in a word, a
+ * word without any of them set only contains ASCII characters
+ */
+#define HIGH_BITS  0x8080808080808080ULL
+
+
+
+/**
+ * Check the encoding of the characters that begin in a part of a string,
+ * this is `verify_utf8` with the length of the string given, ASCII text
+ * is skipped over a word at a time
+ * 
+ * @param   string              The string
+ * @param   i                   The index of the first byte of a character, it is updated
+ *                              to the index of the first byte after the last checked character
+ * @param   end                 The index at which to stop, characters that begin before it
+ *                              are checked in full, even if they end after it
+ * @param   length              The length of `string`
+ * @param   allow_modified_nul  Whether Modified UTF-8 is allowed, which allows a two-byte encoding for NUL
+ * @return                      Zero if good, -1 on encoding error
+ */
+__attribute__((nonnull))
+static int utf8_characters(const char* string, size_t* restrict i, size_t end,
+			   size_t length, int allow_modified_nul)
+{
+  static const long BYTES_TO_MIN_BITS[] = {0, 0,  8, 12, 17, 22, 37};
+  static const long BYTES_TO_MAX_BITS[] = {0, 7, 11, 16, 21, 26, 31};
+  size_t j = *i;
+  long bytes, read_bytes, bits, c, character;
+  uint64_t word;
+  
+  while (j < end)
+    {
+      if (end - j >= sizeof(word))
+	{
+	  /* `memcpy` is used because the word may be unaligned, the builtin
+	     is used explicitly because it must be inlined to be worthwhile. */
+	  __builtin_memcpy(&word, string + j, sizeof(word));
+	  if ((word & HIGH_BITS) == 0)
+	    {
+	      j += sizeof(word);
+	      continue;
+	    }
+	  /* Skip to the first non-ASCII byte. */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	  j += (size_t)__builtin_clzll(word & HIGH_BITS) / 8;
+#else
+	  j += (size_t)__builtin_ctzll(word & HIGH_BITS) / 8;
+#endif
+	}
+      
+      c = (long)(unsigned char)(string[j++]);
+      
+      if ((c & 0x80) == 0x00)
+	/* Single-byte character. */
+	continue;
+      
+      if ((c & 0xC0) == 0x80)
+	/* Single-byte character marked as multibyte, or
+	   a non-first byte in a multibyte character. */
+	return -1;
+      
+      /* Multibyte character. */
+      for (bytes = 0; (c & 0x80); bytes++)
+	c <<= 1;
+      if (bytes > 6)
+	/* 31-bit characters can be encoded with 6-bytes,
+	   and UTF-8 does not cover higher code points. */
+	return -1;
+      if ((size_t)(bytes - 1) > length - j)
+	/* The string ends in the middle of the character. */
+	return -1;
+      
+      character = c & 0x7F;
+      for (read_bytes = 1; read_bytes < bytes; read_bytes++)
+	{
+	  c = (long)(unsigned char)(string[j++]);
+	  if ((c & 0xC0) != 0x80)
+	    /* Beginning of new character before a
+	       multibyte character has ended. */
+	    return -1;
+	  character = (character << 6) | (c & 0x7F);
+	}
+      
+      /* Check that the character is not unnecessarily long. */
+      bits = character ? (long)(8 * sizeof(long)) - __builtin_clzl((unsigned long)character) : 0;
+      bits = ((bits == 0) && (bytes == 2) && allow_modified_nul) ? 8 : bits;
+      if ((bits < BYTES_TO_MIN_BITS[bytes]) || (BYTES_TO_MAX_BITS[bytes] < bits))
+	return -1;
+    }
+  
+  *i = j;
+  return 0;
+}
+
+
+/**
+ * Find the end of the rest of a line with `memchr`, which the
+ * C library vectorises, and the first colon, unless it has been found
+ * 
+ * @param   string     The text to scan
+ * @param   length     The length of `string`
+ * @param   colon      The first colon found before `string` on the line, `NULL` if none
+ * @param   colon_out  Output parameter for the first colon on the line
+ * @return             The first LF in `string`, `NULL` if there is none
+ */
+__attribute__((nonnull(1, 4)))
+static const char* line_rest(const char* restrict string, size_t length,
+			     const char* colon, const char** restrict colon_out)
+{
+  const char* lf = memchr(string, '\n', length * sizeof(char));
+  if (colon == NULL)
+    colon = memchr(string, ':', (lf == NULL ? length : (size_t)(lf - string)) * sizeof(char));
+  *colon_out = colon;
+  return lf;
+}
+
+
+/**
+ * Portable implementation of `scan_line`
+ * 
+ * @param   string     The text to scan
+ * @param   length     The length of `string`
+ * @param   colon_out  Output parameter for the first colon on the line
+ * @return             The first LF in `string`, `NULL` if there is none
+ */
+__attribute__((nonnull))
+static const char* line_scalar(const char* restrict string, size_t length, const char** restrict colon_out)
+{
+  return line_rest(string, length, NULL, colon_out);
+}
+
+
+/**
+ * Portable implementation of `scan_utf8`
+ * 
+ * @param   string              The string
+ * @param   length              The length of `string`
+ * @param   allow_modified_nul  Whether Modified UTF-8 is allowed
+ * @return                      Zero if good, -1 on encoding error
+ */
+__attribute__((pure, nonnull))
+static int utf8_scalar(const char* string, size_t length, int allow_modified_nul)
+{
+  size_t i = 0;
+  return utf8_characters(string, &i, length, length, allow_modified_nul);
+}
+
+
+#ifdef SCAN_X86
+
+/**
+ * SSE2 implementation of `scan_line`
+ * 
+ * @param   string     The text to scan
+ * @param   length     The length of `string`
+ * @param   colon_out  Output parameter for the first colon on the line
+ * @return             The first LF in `string`, `NULL` if there is none
+ */
+__attribute__((nonnull, target("sse2")))
+static const char* line_sse2(const char* restrict string, size_t length, const char** restrict colon_out)
+{
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i co = _mm_set1_epi8(':');
+  const char* colon = NULL;
+  __m128i block;
+  unsigned lfs, colons;
+  size_t i;
+  
+  /* Both characters are looked for until the colon has been found. */
+  for (i = 0; (colon == NULL) && (length - i >= 16); i += 16)
+    {
+      block = _mm_loadu_si128((const __m128i*)(const void*)(string + i));
+      lfs = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf));
+      colons = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, co));
+      if (lfs)
+	/* Only colons before the LF are on the line. */
+	colons &= (lfs & -lfs) - 1;
+      if (colons)
+	colon = string + i + __builtin_ctz(colons);
+      if (lfs)
+	return *colon_out = colon, string + i + __builtin_ctz(lfs);
+    }
+  
+  /* Then only the LF is looked for, it is often far away after a long
+     value, `memchr` is vectorised by the C library, and is faster at
+     this than a loop of unaligned loads, so it is used for this. */
+  return line_rest(string + i, length - i, colon, colon_out);
+}
+
+
+/**
+ * SSE2 implementation of `scan_utf8`
+ * 
+ * @param   string              The string
+ * @param   length              The length of `string`
+ * @param   allow_modified_nul  Whether Modified UTF-8 is allowed
+ * @return                      Zero if good, -1 on encoding error
+ */
+__attribute__((pure, nonnull, target("sse2")))
+static int utf8_sse2(const char* string, size_t length, int allow_modified_nul)
+{
+#define LOAD(OFFSET)  _mm_loadu_si128((const __m128i*)(const void*)(string + i + (OFFSET)))
+  size_t i = 0;
+  
+  /* Runs of four blocks of only ASCII, which is always valid, are
+     skipped, other runs are decoded, the rest is tested block by block. */
+  while (length - i >= 4 * 16)
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(LOAD(0 * 16), LOAD(1 * 16)),
+				       _mm_or_si128(LOAD(2 * 16), LOAD(3 * 16)))) == 0)
+      i += 4 * 16;
+    else if (utf8_characters(string, &i, i + 4 * 16, length, allow_modified_nul))
+      return -1;
+  while (length - i >= 16)
+    if (_mm_movemask_epi8(LOAD(0)) == 0)
+      i += 16;
+    else if (utf8_characters(string, &i, i + 16, length, allow_modified_nul))
+      return -1;
+  
+  return utf8_characters(string, &i, length, length, allow_modified_nul);
+#undef LOAD
+}
+
+
+/**
+ * AVX2 implementation of `scan_line`
+ * 
+ * @param   string     The text to scan
+ * @param   length     The length of `string`
+ * @param   colon_out  Output parameter for the first colon on the line
+ * @return             The first LF in `string`, `NULL` if there is none
+ */
+__attribute__((nonnull, target("avx2")))
+static const char* line_avx2(const char* restrict string, size_t length, const char** restrict colon_out)
+{
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i co = _mm256_set1_epi8(':');
+  const char* colon = NULL;
+  __m256i block;
+  uint32_t lfs, colons;
+  size_t i;
+  
+  /* Both characters are looked for until the colon has been found. */
+  for (i = 0; (colon == NULL) && (length - i >= 32); i += 32)
+    {
+      block = _mm256_loadu_si256((const __m256i*)(const void*)(string + i));
+      lfs = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf));
+      colons = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, co));
+      if (lfs)
+	/* Only colons before the LF are on the line. */
+	colons &= (lfs & -lfs) - 1;
+      if (colons)
+	colon = string + i + __builtin_ctz(colons);
+      if (lfs)
+	goto found;
+    }
+  
+  /* Then only the LF is looked for, as in `line_sse2`. The upper halves
+     of the registers are cleared whenever AVX2 code is left, SSE code
+     is slow otherwise, the compiler does not do it unless it optimises. */
+  _mm256_zeroupper();
+  return line_rest(string + i, length - i, colon, colon_out);
+  
+ found:
+  _mm256_zeroupper();
+  *colon_out = colon;
+  return string + i + __builtin_ctz(lfs);
+}
+
+
+/**
+ * AVX2 implementation of `scan_utf8`
+ * 
+ * @param   string              The string
+ * @param   length              The length of `string`
+ * @param   allow_modified_nul  Whether Modified UTF-8 is allowed
+ * @return                      Zero if good, -1 on encoding error
+ */
+__attribute__((pure, nonnull, target("avx2")))
+static int utf8_avx2(const char* string, size_t length, int allow_modified_nul)
+{
+#define LOAD(OFFSET)  _mm256_loadu_si256((const __m256i*)(const void*)(string + i + (OFFSET)))
+  size_t i = 0;
+  int rc = 0;
+  
+  /* Runs of four blocks of only ASCII, which is always valid, are
+     skipped, other runs are decoded, the rest is tested block by block. */
+  while ((rc == 0) && (length - i >= 4 * 32))
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(LOAD(0 * 32), LOAD(1 * 32)),
+					     _mm256_or_si256(LOAD(2 * 32), LOAD(3 * 32)))) == 0)
+      i += 4 * 32;
+    else
+      rc = utf8_characters(string, &i, i + 4 * 32, length, allow_modified_nul);
+  while ((rc == 0) && (length - i >= 32))
+    if (_mm256_movemask_epi8(LOAD(0)) == 0)
+      i += 32;
+    else
+      rc = utf8_characters(string, &i, i + 32, length, allow_modified_nul);
+  
+  /* The rest is shorter than a block, but may be longer than a half. */
+  _mm256_zeroupper();
+  return rc ? -1 : utf8_sse2(string + i, length - i, allow_modified_nul);
+#undef LOAD
+}
+
+#endif
+
+
+/**
+ * The implementations, indexed by `scan_kernel_t`
+ */
+static const scan_kernels_t KERNELS[] =
+  {
+    [SCAN_KERNEL_SCALAR] = { line_scalar, utf8_scalar },
+#ifdef SCAN_X86
+    [SCAN_KERNEL_SSE2]   = { line_sse2,   utf8_sse2   },
+    [SCAN_KERNEL_AVX2]   = { line_avx2,   utf8_avx2   },
+#endif
+  };
+
+/**
+ * The selected implementation, `NULL` until it is selected
+ */
+static const scan_kernels_t* kernels = NULL;
+
+
+
+/**
+ * Check whether the CPU supports an implementation
+ * 
+ * @param   kernel  The implementation
+ * @return          Whether the implementation can be used
+ */
+static int supported(scan_kernel_t kernel)
+{
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (kernel == SCAN_KERNEL_AVX2)
+    return __builtin_cpu_supports("avx2");
+  if (kernel == SCAN_KERNEL_SSE2)
+    return __builtin_cpu_supports("sse2");
+#endif
+  return kernel == SCAN_KERNEL_SCALAR;
+}
+
+
+/**
+ * Get the selected implementation, and select
+ * the fastest one if none has been selected
+ * 
+ * @return  The selected implementation
+ */
+static const scan_kernels_t* get_kernels(void)
+{
+  const scan_kernels_t* k = __atomic_load_n(&kernels, __ATOMIC_RELAXED);
+  scan_kernel_t kernel = SCAN_KERNEL_AVX2;
+  
+  if (__builtin_expect(k != NULL, 1))
+    return k;
+  
+  /* The implementations are in order of speed. Threads may race
+     to select one, but they will all select the same one. */
+  while (supported(kernel) == 0)
+    kernel = (scan_kernel_t)(kernel - 1);
+  k = KERNELS + kernel;
+  __atomic_store_n(&kernels, k, __ATOMIC_RELAXED);
+  return k;
+}
+
+
+/**
+ * Find the end of a line, and the first colon on it
+ * 
+ * This is how headers are split, it is done in one
+ * pass rather than with one scan per character
+ * 
+ * @param   string     The text to scan, it does not have to be NUL-terminated
+ * @param   length     The length of `string`
+ * @param   colon_out  Output parameter for the first ':' before the returned LF,
+ *                     or in `string` if there is no LF, `NULL` if there is none
+ * @return             The first LF in `string`, `NULL` if there is none
+ */
+const char* scan_line(const char* restrict string, size_t length, const char** restrict colon_out)
+{
+  return get_kernels()->line(string, length, colon_out);
+}
+
+
+/**
+ * Check whether a string is encoded in UTF-8,
+ * by the same rules as `verify_utf8`
+ * 
+ * ASCII text is checked with vector instructions, multibyte
+ * characters are decoded one at a time, headers are mostly
+ * ASCII so this is where nearly all of the time is spent
+ * 
+ * @param   string              The string, NUL bytes in it are characters
+ * @param   length              The length of `string`
+ * @param   allow_modified_nul  Whether Modified UTF-8 is allowed, which allows a two-byte encoding for NUL
+ * @return                      Zero if good, -1 on encoding error
+ */
+int scan_utf8(const char* string, size_t length, int allow_modified_nul)
+{
+  return get_kernels()->utf8(string, length, allow_modified_nul);
+}
+
+
+/**
+ * Select the implementation of the scanning functions, by default
+ * the fastest one that the CPU supports is selected when a function
+ * is first used, there is no need to call this function except to
+ * compare the implementations
+ * 
+ * @param   kernel  The implementation
+ * @return          Zero on success, -1 on error, `errno` is set to `ENOTSUP`
+ *                  if the implementation is not supported by the CPU
+ */
+int scan_select(scan_kernel_t kernel)
+{
+  if ((kernel < SCAN_KERNEL_SCALAR) || (kernel > SCAN_KERNEL_AVX2) || (supported(kernel) == 0))
+    return errno = ENOTSUP, -1;
+  __atomic_store_n(&kernels, KERNELS + kernel, __ATOMIC_RELAXED);
+  return 0;
+}
+
+
+/**
+ * Get the selected implementation of the scanning functions
+ * 
+ * @return  The implementation that is used
+ */
+scan_kernel_t scan_selected(void)
+{
+  return (scan_kernel_t)(get_kernels() - KERNELS);
+}
+
@@ -0,0 +1,102 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_LIBMDSSERVER_SCAN_H
+#define MDS_LIBMDSSERVER_SCAN_H
+
+
+#include <stddef.h>
+
+
+
+/**
+ * The implementations of the scanning functions
+ */
+typedef enum scan_kernel
+{
+  /**
+   * Portable implementation, available everywhere
+   */
+  SCAN_KERNEL_SCALAR = 0,
+  
+  /**
+   * SSE2 implementation, 16 bytes at a time
+   */
+  SCAN_KERNEL_SSE2 = 1,
+  
+  /**
+   * AVX2 implementation, 32 bytes at a time
+   */
+  SCAN_KERNEL_AVX2 = 2
+  
+} scan_kernel_t;
+
+
+
+/**
+ * Find the end of a line, and the first colon on it
+ * 
+ * This is how headers are split, it is done in one
+ * pass rather than with one scan per character
+ * 
+ * @param   string     The text to scan, it does not have to be NUL-terminated
+ * @param   length     The length of `string`
+ * @param   colon_out  Output parameter for the first ':' before the returned LF,
+ *                     or in `string` if there is no LF, `NULL` if there is none
+ * @return             The first LF in `string`, `NULL` if there is none
+ */
+__attribute__((nonnull))
+const char* scan_line(const char* restrict string, size_t length, const char** restrict colon_out);
+
+/**
+ * Check whether a string is encoded in UTF-8,
+ * by the same rules as `verify_utf8`
+ * 
+ * ASCII text is checked with vector instructions, multibyte
+ * characters are decoded one at a time, headers are mostly
+ * ASCII so this is where nearly all of the time is spent
+ * 
+ * @param   string              The string, NUL bytes in it are characters
+ * @param   length              The length of `string`
+ * @param   allow_modified_nul  Whether Modified UTF-8 is allowed, which allows a two-byte encoding for NUL
+ * @return                      Zero if good, -1 on encoding error
+ */
+__attribute__((pure, nonnull))
+int scan_utf8(const char* string, size_t length, int allow_modified_nul);
+
+/**
+ * Select the implementation of the scanning functions, by default
+ * the fastest one that the CPU supports is selected when a function
+ * is first used, there is no need to call this function except to
+ * compare the implementations
+ * 
+ * @param   kernel  The implementation
+ * @return          Zero on success, -1 on error, `errno` is set to `ENOTSUP`
+ *                  if the implementation is not supported by the CPU
+ */
+int scan_select(scan_kernel_t kernel);
+
+/**
+ * Get the selected implementation of the scanning functions
+ * 
+ * @return  The implementation that is used
+ */
+scan_kernel_t scan_selected(void);
+
+
+#endif
+
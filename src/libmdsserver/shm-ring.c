@@ -0,0 +1,252 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "shm-ring.h"
+
+#include "macros.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * Create the shared memory for a pair of rings
+ * 
+ * The file descriptor is not closed on exec,
+ * so that the rings survive a re-exec
+ * 
+ * @param   capacity  The size of the data of each ring, a power of two
+ * @return            The file descriptor of the shared memory, -1 on error
+ */
+int shm_rings_create(size_t capacity)
+{
+  shm_ring_header_t* header = NULL;
+  int fd = -1, saved_errno;
+  
+  fail_if ((fd = memfd_create("mds-ring", 0)) < 0);
+  fail_if (ftruncate(fd, (off_t)(SHM_RING_DATA_OFFSET + 2 * capacity)) < 0);
+  
+  header = mmap(NULL, sizeof(shm_ring_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  fail_if (header == MAP_FAILED);
+  header->magic = SHM_RING_MAGIC;
+  header->version = SHM_RING_VERSION;
+  header->capacity = capacity;
+  munmap(header, sizeof(shm_ring_header_t));
+  
+  return fd;
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Map the shared memory of a pair of rings
+ * 
+ * @param   this  Memory slot in which to store the mapped rings
+ * @param   fd    The file descriptor of the shared memory
+ * @return        Zero on success, -1 on error, `errno` is set to
+ *                `EPROTO` if the memory is not a pair of rings
+ */
+int shm_rings_map(shm_rings_t* restrict this, int fd)
+{
+  shm_ring_header_t* header;
+  struct stat attr;
+  size_t capacity;
+  
+  this->map = NULL;
+  this->map_size = 0;
+  
+  fail_if (fstat(fd, &attr) < 0);
+  if ((size_t)(attr.st_size) < SHM_RING_DATA_OFFSET)
+    fail_if ((errno = EPROTO));
+  
+  this->map = mmap(NULL, (size_t)(attr.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (this->map == MAP_FAILED)
+    fail_if ((this->map = NULL, 1));
+  this->map_size = (size_t)(attr.st_size);
+  
+  /* Do not trust the memory to be sane. */
+  header = this->map;
+  capacity = (size_t)(header->capacity);
+  if ((header->magic != SHM_RING_MAGIC) || (header->version != SHM_RING_VERSION) ||
+      (capacity == 0) || (capacity & (capacity - 1)) ||
+      (SHM_RING_DATA_OFFSET + 2 * capacity != this->map_size))
+    {
+      shm_rings_unmap(this);
+      fail_if ((errno = EPROTO));
+    }
+  
+  this->inbound.control = &(header->to_server);
+  this->inbound.data = (char*)(this->map) + SHM_RING_DATA_OFFSET;
+  this->inbound.capacity = capacity;
+  this->outbound.control = &(header->to_client);
+  this->outbound.data = (char*)(this->map) + SHM_RING_DATA_OFFSET + capacity;
+  this->outbound.capacity = capacity;
+  
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Unmap the shared memory of a pair of rings
+ * 
+ * @param  this  The rings, may be unmapped
+ */
+void shm_rings_unmap(shm_rings_t* restrict this)
+{
+  if (this->map != NULL)
+    munmap(this->map, this->map_size);
+  this->map = NULL;
+  this->map_size = 0;
+}
+
+
+/**
+ * Write as much as there is room for to a ring
+ * 
+ * @param   this   The ring
+ * @param   parts  The data to write
+ * @param   count  The number of elements in `parts`
+ * @return         The number of bytes that were written
+ */
+size_t shm_ring_writev(shm_ring_t* restrict this, const struct iovec* restrict parts, size_t count)
+{
+  uint64_t head = this->control->head;
+  uint64_t tail = __atomic_load_n(&(this->control->tail), __ATOMIC_ACQUIRE);
+  size_t room = this->capacity - (size_t)(head - tail);
+  size_t i, n, offset, first, written = 0;
+  
+  for (i = 0; (i < count) && (room > 0); i++)
+    {
+      n = parts[i].iov_len < room ? parts[i].iov_len : room;
+      offset = (size_t)head & (this->capacity - 1);
+      first = n < this->capacity - offset ? n : this->capacity - offset;
+      memcpy(this->data + offset, parts[i].iov_base, first);
+      memcpy(this->data, (const char*)(parts[i].iov_base) + first, n - first);
+      head += n, room -= n, written += n;
+    }
+  
+  /* Publish the data only when it has been written. */
+  __atomic_store_n(&(this->control->head), head, __ATOMIC_RELEASE);
+  return written;
+}
+
+
+/**
+ * Read as much as is available from a ring
+ * 
+ * @param   this    The ring
+ * @param   buffer  Output buffer for the data
+ * @param   size    The size of `buffer`
+ * @return          The number of bytes that were read
+ */
+size_t shm_ring_read(shm_ring_t* restrict this, char* restrict buffer, size_t size)
+{
+  uint64_t tail = this->control->tail;
+  uint64_t head = __atomic_load_n(&(this->control->head), __ATOMIC_ACQUIRE);
+  size_t n = (size_t)(head - tail);
+  size_t offset = (size_t)tail & (this->capacity - 1);
+  size_t first;
+  
+  n = n < size ? n : size;
+  first = n < this->capacity - offset ? n : this->capacity - offset;
+  memcpy(buffer, this->data + offset, first);
+  memcpy(buffer + first, this->data, n - first);
+  
+  /* Release the room only when the data has been copied. */
+  __atomic_store_n(&(this->control->tail), tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+
+/**
+ * Announce that the consumer of a ring is about to wait for data
+ * 
+ * @param   this  The ring
+ * @return        Zero if the consumer may wait for its doorbell,
+ *                1 if data has arrived and it must not wait
+ */
+int shm_ring_await_data(shm_ring_t* restrict this)
+{
+  /* The flag must be visible before the head is checked again, otherwise
+     the producer could write without seeing it, and we would not wake. */
+  __atomic_store_n(&(this->control->reader_waiting), 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(this->control->head), __ATOMIC_SEQ_CST) == this->control->tail)
+    return 0;
+  __atomic_store_n(&(this->control->reader_waiting), 0, __ATOMIC_RELAXED);
+  return 1;
+}
+
+
+/**
+ * Announce that the producer of a ring is about to wait for room
+ * 
+ * @param   this  The ring
+ * @return        Zero if the producer may wait for its doorbell,
+ *                1 if room has been made and it must not wait
+ */
+int shm_ring_await_room(shm_ring_t* restrict this)
+{
+  __atomic_store_n(&(this->control->writer_waiting), 1, __ATOMIC_SEQ_CST);
+  if (this->control->head - __atomic_load_n(&(this->control->tail), __ATOMIC_SEQ_CST) == this->capacity)
+    return 0;
+  __atomic_store_n(&(this->control->writer_waiting), 0, __ATOMIC_RELAXED);
+  return 1;
+}
+
+
+/**
+ * Check, after writing to a ring, whether the consumer's
+ * doorbell must be rung because it is waiting for data
+ * 
+ * @param   this  The ring
+ * @return        Whether the doorbell must be rung
+ */
+int shm_ring_reader_waiting(shm_ring_t* restrict this)
+{
+  /* Only one of the writes that the consumer has not seen yet rings. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(this->control->reader_waiting), __ATOMIC_RELAXED) == 0)
+    return 0;
+  return __atomic_exchange_n(&(this->control->reader_waiting), 0, __ATOMIC_SEQ_CST) != 0;
+}
+
+
+/**
+ * Check, after reading from a ring, whether the producer's
+ * doorbell must be rung because it is waiting for room
+ * 
+ * @param   this  The ring
+ * @return        Whether the doorbell must be rung
+ */
+int shm_ring_writer_waiting(shm_ring_t* restrict this)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(this->control->writer_waiting), __ATOMIC_RELAXED) == 0)
+    return 0;
+  return __atomic_exchange_n(&(this->control->writer_waiting), 0, __ATOMIC_SEQ_CST) != 0;
+}
+
@@ -0,0 +1,283 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_LIBMDSSERVER_SHM_RING_H
+#define MDS_LIBMDSSERVER_SHM_RING_H
+/* <libmdsclient/ring.h> maps the same memory, the layout
+ * must be kept the same in both of them. */
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+
+
+/**
+ * The value of `magic` in `shm_ring_header_t`
+ */
+#define SHM_RING_MAGIC  UINT32_C(0x6D647372)
+
+/**
+ * The version of the memory layout
+ */
+#define SHM_RING_VERSION  UINT32_C(1)
+
+/**
+ * The offset of the data of the rings in the shared memory,
+ * the data of the ring to the server comes first, and the
+ * data of the ring to the client follows directly after it
+ */
+#define SHM_RING_DATA_OFFSET  4096
+
+
+
+/**
+ * The control block of a ring in one direction
+ * 
+ * The producer and the consumer write different
+ * cache lines, so that they do not contend
+ */
+typedef struct shm_ring_control
+{
+  /**
+   * The number of bytes that have been written
+   * to the ring, only written by the producer
+   */
+  uint64_t head;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char head_padding[64 - sizeof(uint64_t)];
+  
+  /**
+   * The number of bytes that have been read
+   * from the ring, only written by the consumer
+   */
+  uint64_t tail;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char tail_padding[64 - sizeof(uint64_t)];
+  
+  /**
+   * Set by the consumer when it is about to wait for data,
+   * cleared by whoever rings the consumer's doorbell
+   */
+  uint32_t reader_waiting;
+  
+  /**
+   * Set by the producer when it is about to wait for room,
+   * cleared by whoever rings the producer's doorbell
+   */
+  uint32_t writer_waiting;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char waiting_padding[64 - 2 * sizeof(uint32_t)];
+  
+} shm_ring_control_t;
+
+
+/**
+ * The beginning of the shared memory
+ */
+typedef struct shm_ring_header
+{
+  /**
+   * `SHM_RING_MAGIC`
+   */
+  uint32_t magic;
+  
+  /**
+   * `SHM_RING_VERSION`
+   */
+  uint32_t version;
+  
+  /**
+   * The size of the data of each ring, a power of two
+   */
+  uint64_t capacity;
+  
+  /**
+   * Padding to the next cache line
+   */
+  char padding[64 - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+  
+  /**
+   * The ring from the client to the server
+   */
+  shm_ring_control_t to_server;
+  
+  /**
+   * The ring from the server to the client
+   */
+  shm_ring_control_t to_client;
+  
+} shm_ring_header_t;
+
+
+/**
+ * A ring in one direction, as mapped by this process
+ */
+typedef struct shm_ring
+{
+  /**
+   * The ring's control block
+   */
+  shm_ring_control_t* control;
+  
+  /**
+   * The ring's data
+   */
+  char* data;
+  
+  /**
+   * The size of `data`, a power of two
+   */
+  size_t capacity;
+  
+} shm_ring_t;
+
+
+/**
+ * A pair of rings, shared with a client
+ */
+typedef struct shm_rings
+{
+  /**
+   * The shared memory
+   */
+  void* map;
+  
+  /**
+   * The size of `map`
+   */
+  size_t map_size;
+  
+  /**
+   * The ring from the client
+   */
+  shm_ring_t inbound;
+  
+  /**
+   * The ring to the client
+   */
+  shm_ring_t outbound;
+  
+} shm_rings_t;
+
+
+
+/**
+ * Create the shared memory for a pair of rings
+ * 
+ * The file descriptor is not closed on exec,
+ * so that the rings survive a re-exec
+ * 
+ * @param   capacity  The size of the data of each ring, a power of two
+ * @return            The file descriptor of the shared memory, -1 on error
+ */
+int shm_rings_create(size_t capacity);
+
+/**
+ * Map the shared memory of a pair of rings
+ * 
+ * @param   this  Memory slot in which to store the mapped rings
+ * @param   fd    The file descriptor of the shared memory
+ * @return        Zero on success, -1 on error, `errno` is set to
+ *                `EPROTO` if the memory is not a pair of rings
+ */
+__attribute__((nonnull))
+int shm_rings_map(shm_rings_t* restrict this, int fd);
+
+/**
+ * Unmap the shared memory of a pair of rings
+ * 
+ * @param  this  The rings, may be unmapped
+ */
+__attribute__((nonnull))
+void shm_rings_unmap(shm_rings_t* restrict this);
+
+/**
+ * Write as much as there is room for to a ring
+ * 
+ * @param   this   The ring
+ * @param   parts  The data to write
+ * @param   count  The number of elements in `parts`
+ * @return         The number of bytes that were written
+ */
+__attribute__((nonnull))
+size_t shm_ring_writev(shm_ring_t* restrict this, const struct iovec* restrict parts, size_t count);
+
+/**
+ * Read as much as is available from a ring
+ * 
+ * @param   this    The ring
+ * @param   buffer  Output buffer for the data
+ * @param   size    The size of `buffer`
+ * @return          The number of bytes that were read
+ */
+__attribute__((nonnull))
+size_t shm_ring_read(shm_ring_t* restrict this, char* restrict buffer, size_t size);
+
+/**
+ * Announce that the consumer of a ring is about to wait for data
+ * 
+ * @param   this  The ring
+ * @return        Zero if the consumer may wait for its doorbell,
+ *                1 if data has arrived and it must not wait
+ */
+__attribute__((nonnull))
+int shm_ring_await_data(shm_ring_t* restrict this);
+
+/**
+ * Announce that the producer of a ring is about to wait for room
+ * 
+ * @param   this  The ring
+ * @return        Zero if the producer may wait for its doorbell,
+ *                1 if room has been made and it must not wait
+ */
+__attribute__((nonnull))
+int shm_ring_await_room(shm_ring_t* restrict this);
+
+/**
+ * Check, after writing to a ring, whether the consumer's
+ * doorbell must be rung because it is waiting for data
+ * 
+ * @param   this  The ring
+ * @return        Whether the doorbell must be rung
+ */
+__attribute__((nonnull))
+int shm_ring_reader_waiting(shm_ring_t* restrict this);
+
+/**
+ * Check, after reading from a ring, whether the producer's
+ * doorbell must be rung because it is waiting for room
+ * 
+ * @param   this  The ring
+ * @return        Whether the doorbell must be rung
+ */
+__attribute__((nonnull))
+int shm_ring_writer_waiting(shm_ring_t* restrict this);
+
+
+#endif
+
@@ -18,6 +18,7 @@
 #include "util.h"
 #include "config.h"
 #include "macros.h"
+#include "scan.h"
 
 #include <alloca.h>
 #include <stdlib.h>
@@ -260,7 +261,7 @@ int strict_atoj(const char* str, intmax_t* value, intmax_t min, intmax_t max)
   if (*str == '-')
     {
       if (*minstr == '\0')
-	sprintf(minstr, "%j", INTMAX_MIN);
+	sprintf(minstr, "%jd", INTMAX_MIN);
       if (!strcmp(str, minstr))
 	{
 	  r = INTMAX_MIN;
@@ -272,7 +273,7 @@ int strict_atoj(const char* str, intmax_t* value, intmax_t min, intmax_t max)
   if (*str == '\0')
     return -1;
   
-  while ((c = *str))
+  while ((c = *str++))
     if (('0' <= c) && (c <= '9'))
       {
 	if (r > INTMAX_MAX / 10)
@@ -315,15 +316,15 @@ int strict_atouj(const char* str, uintmax_t* value, uintmax_t min, uintmax_t max
   if (*str == '\0')
     return -1;
   
-  while ((c = *str))
+  while ((c = *str++))
     if (('0' <= c) && (c <= '9'))
       {
-	if (r > INTMAX_MAX / 10)
+	if (r > UINTMAX_MAX / 10)
 	  return -1;
-	else if (r == INTMAX_MAX / 10)
-	  if ((c & 15) > INTMAX_MAX % 10)
+	else if (r == UINTMAX_MAX / 10)
+	  if ((uintmax_t)(c & 15) > UINTMAX_MAX % 10)
 	    return -1;
-	r = r * 10 + (c & 15);
+	r = r * 10 + (uintmax_t)(c & 15);
       }
     else
       return -1;
@@ -724,70 +725,7 @@ pid_t uninterruptable_waitpid(pid_t pid, int* restrict status, int options)
  */
 int verify_utf8(const char* string, int allow_modified_nul)
 {
-  static long BYTES_TO_MIN_BITS[] = {0, 0,  8, 12, 17, 22, 37};
-  static long BYTES_TO_MAX_BITS[] = {0, 7, 11, 16, 21, 26, 31};
-  long bytes = 0, read_bytes = 0, bits = 0, c, character;
-  
-  /*                                                      min bits  max bits
-    0.......                                                 0         7
-    110..... 10......                                        8        11
-    1110.... 10...... 10......                              12        16
-    11110... 10...... 10...... 10......                     17        21
-    111110.. 10...... 10...... 10...... 10......            22        26
-    1111110. 10...... 10...... 10...... 10...... 10......   27        31
-   */
-  
-  while ((c = (long)(*string++)))
-    if (read_bytes == 0)
-      {
-	/* First byte of the character. */
-	
-	if ((c & 0x80) == 0x00)
-	  /* Single-byte character. */
-	  continue;
-	
-	if ((c & 0xC0) == 0x80)
-	  /* Single-byte character marked as multibyte, or
-	     a non-first byte in a multibyte character. */
-	  return -1;
-	
-	/* Multibyte character. */
-	while ((c & 0x80))
-	  bytes++, c <<= 1;
-	read_bytes = 1;
-	character = c & 0x7F;
-	if (bytes > 6)
-	  /* 31-bit characters can be encoded with 6-bytes,
-	     and UTF-8 does not cover higher code points. */
-	  return -1;
-      }
-    else
-      {
-	/* Not first byte of the character. */
-	
-	if ((c & 0xC0) != 0x80)
-	  /* Beginning of new character before a
-	     multibyte character has ended. */
-	  return -1;
-	
-	character = (character << 6) | (c & 0x7F);
-	
-	if (++read_bytes < bytes)
-	  /* Not at last byte yet. */
-	  continue;
-	
-	/* Check that the character is not unnecessarily long. */
-	while (character)
-	  character >>= 1, bits++;
-	bits = ((bits == 0) && (bytes == 2) && allow_modified_nul) ? 8 : bits;
-	if ((bits < BYTES_TO_MIN_BITS[bytes]) || (BYTES_TO_MAX_BITS[bytes] < bits))
-	  return -1;
-	
-	read_bytes = bytes = bits = 0;
-      }
-  
-  /* Make sure we did not stop at the middle of a multibyte character. */
-  return read_bytes == 0 ? 0 : -1;
+  return scan_utf8(string, strlen(string), allow_modified_nul);
 }
 
 
@@ -879,7 +817,7 @@ size_t construct_error_message(const char* restrict recv_client_id, const char*
   if (message != NULL)
     sprintf((*send_buffer) + length, "Length: %zu\n%zn",
 	    strlen(message) + 1, &part_length),
-      length += (size_t)part_length + strlen(message) + 1;
+      length += (size_t)part_length;
   
   /* Add an empty line to mark the end of headers. */
   (*send_buffer)[length++] = '\n';
@@ -30,7 +30,9 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
 #include <signal.h>
 #include <pthread.h>
 #include <fcntl.h>
@@ -105,6 +107,12 @@ volatile sig_atomic_t danger = 0;
  */
 int socket_fd = -1;
 
+/**
+ * The number of nanoseconds the server was paused
+ * by its last re-exec, zero if it has not re-exec:ed
+ */
+uint64_t reexec_pause = 0;
+
 
 
 /**
@@ -406,44 +414,95 @@ void __attribute__((weak)) received_info(int signo)
 # pragma GCC diagnostic pop
 
 
+/**
+ * Get the current time on the monotonic clock, it
+ * is not reset when the server re-exec:s
+ * 
+ * @return  The time, in nanoseconds
+ */
+static uint64_t monotonic_time(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec) * 1000000000 + (uint64_t)(now.tv_nsec);
+}
+
+
 /**
  * Unmarshal the server's saved state
  * 
+ * The state is mapped from the memory file that the old image passed
+ * in the environment, if it did not, because it predates that,
+ * the state is read from a shared object named after the process
+ * 
  * @return  Non-zero on error
  */
 static int base_unmarshal(void)
 {
   pid_t pid = getpid();
-  int reexec_fd, r;
+  int reexec_fd, r, version;
   char shm_path[NAME_MAX + 1];
+  const char* fd_str;
+  struct stat attr;
+  size_t state_n = 0;
+  uint64_t pause_start = 0;
   char* state_buf;
   char* state_buf_;
   
   /* Acquire access to marshalled data. */
-  xsnprintf(shm_path, SHM_PATH_PATTERN, (intmax_t)pid);
-  reexec_fd = shm_open(shm_path, O_RDONLY, S_IRWXU);
-  fail_if (reexec_fd < 0); /* Critical. */
-  
-  /* Read the state file. */
-  fail_if ((state_buf = state_buf_ = full_read(reexec_fd, NULL)) == NULL);
-  
-  /* Release resources. */
-  xclose(reexec_fd);
-  shm_unlink(shm_path);
+  if ((fd_str = getenv(REEXEC_FD_ENV)) != NULL)
+    {
+      reexec_fd = atoi(fd_str);
+      /* Do not let the servers that we spawn believe that they are re-exec:ing. */
+      unsetenv(REEXEC_FD_ENV);
+      fail_if (fstat(reexec_fd, &attr) < 0); /* Critical. */
+      state_n = (size_t)(attr.st_size);
+      
+      /* Map the state, it is unmarshalled where it lies. */
+      state_buf = mmap(NULL, state_n, PROT_READ | PROT_WRITE, MAP_PRIVATE, reexec_fd, 0);
+      fail_if (state_buf == MAP_FAILED); /* Critical. */
+      state_buf_ = state_buf;
+      xclose(reexec_fd);
+    }
+  else
+    {
+      xsnprintf(shm_path, SHM_PATH_PATTERN, (intmax_t)pid);
+      reexec_fd = shm_open(shm_path, O_RDONLY, S_IRWXU);
+      fail_if (reexec_fd < 0); /* Critical. */
+      
+      /* Read the state file. */
+      fail_if ((state_buf = state_buf_ = full_read(reexec_fd, NULL)) == NULL);
+      
+      /* Release resources. */
+      xclose(reexec_fd);
+      shm_unlink(shm_path);
+    }
   
   
   /* Unmarshal state. */
   
-  /* Get the marshal protocal version. Not needed, there is only the one version right now. */
-  /* buf_get(state_buf_, int, 0, MDS_BASE_VARS_VERSION); */
-  buf_next(state_buf_, int, 1);
+  /* Get the marshal protocal version. */
+  buf_get_next(state_buf_, int, version);
+  
+  /* Get the time the old image was paused, it is not stored by version 0. */
+  if (version >= 1)
+    buf_get_next(state_buf_, uint64_t, pause_start);
   
   buf_get_next(state_buf_, int, socket_fd);
   r = unmarshal_server(state_buf_);
   
+  if (pause_start)
+    {
+      reexec_pause = monotonic_time() - pause_start;
+      eprintf("re-exec paused the server for %.3f milliseconds.", (double)reexec_pause / 1000000);
+    }
+  
   
   /* Release resources. */
-  free(state_buf);
+  if (state_n)
+    munmap(state_buf, state_n);
+  else
+    free(state_buf);
   
   /* Recover after failure. */
   fail_if (r && reexec_failure_recover());
@@ -458,21 +517,27 @@ static int base_unmarshal(void)
 /**
  * Marshal the server's state
  * 
- * @param   reexec_fd  The file descriptor of the file into which the state shall be saved
+ * The state is marshalled directly into a mapping of the memory file
+ * 
+ * @param   reexec_fd  The file descriptor of the memory file into which the state shall be saved
  * @return             Non-zero on error
  */
 static int base_marshal(int reexec_fd)
 {
+  uint64_t pause_start = monotonic_time();
   size_t state_n;
-  char* state_buf;
+  char* state_buf = MAP_FAILED;
   char* state_buf_;
   
   /* Calculate the size of the state data when it is marshalled. */
-  state_n = 2 * sizeof(int);
+  state_n = 2 * sizeof(int) + sizeof(uint64_t);
   state_n += marshal_server_size();
   
-  /* Allocate a buffer for all data. */
-  fail_if (xbmalloc(state_buf = state_buf_, state_n));
+  /* Size the memory file and map it. */
+  fail_if (ftruncate(reexec_fd, (off_t)state_n) < 0);
+  state_buf = mmap(NULL, state_n, PROT_READ | PROT_WRITE, MAP_SHARED, reexec_fd, 0);
+  fail_if (state_buf == MAP_FAILED);
+  state_buf_ = state_buf;
   
   
   /* Marshal the state of the server. */
@@ -480,20 +545,20 @@ static int base_marshal(int reexec_fd)
   /* Tell the new version of the program what version of the program it is marshalling. */
   buf_set_next(state_buf_, int, MDS_BASE_VARS_VERSION);
   
+  /* Tell the new image when the server was paused, so that it can report the pause. */
+  buf_set_next(state_buf_, uint64_t, pause_start);
+  
   /* Store the state. */
   buf_set_next(state_buf_, int, socket_fd);
   fail_if (marshal_server(state_buf_));
   
-  
-  /* Send the marshalled data into the file. */
-  fail_if (full_write(reexec_fd, state_buf, state_n) < 0);
-  
-  free(state_buf);
+  munmap(state_buf, state_n);
   return 0;
   
  fail:
   xperror(*argv);
-  free(state_buf);
+  if (state_buf != MAP_FAILED)
+    munmap(state_buf, state_n);
   return 1;
 }
 
@@ -501,33 +566,32 @@ static int base_marshal(int reexec_fd)
 /**
  * Marshal and re-execute the server
  * 
+ * The state is marshalled into a memory file, whose file descriptor
+ * is inherited by the new image and passed to it in the environment
+ * 
  * This function only returns on error,
  * in which case the error will have been printed.
  */
 static void perform_reexec(void)
 {
-  pid_t pid = getpid();
+  char fd_str[3 * sizeof(int) + 2];
   int reexec_fd;
-  char shm_path[NAME_MAX + 1];
   
   /* Marshal the state of the server. */
-  xsnprintf(shm_path, SHM_PATH_PATTERN, (unsigned long int)pid);
-  reexec_fd = shm_open(shm_path, O_RDWR | O_CREAT | O_EXCL, S_IRWXU);
+  reexec_fd = memfd_create("mds-reexec", 0);
   fail_if (reexec_fd < 0);
   fail_if (base_marshal(reexec_fd) < 0);
-  xclose(reexec_fd);
-  reexec_fd = -1;
   
   /* Re-exec the server. */
+  xsnprintf(fd_str, "%i", reexec_fd);
+  fail_if (setenv(REEXEC_FD_ENV, fd_str, 1) < 0);
   reexec_server(argc, argv, is_reexec);
   
  fail:
   xperror(*argv);
+  unsetenv(REEXEC_FD_ENV);
   if (reexec_fd >= 0)
-    {
-      xclose(reexec_fd);
-      shm_unlink(shm_path);
-    }
+    xclose(reexec_fd);
 }
 
 
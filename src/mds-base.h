@@ -21,9 +21,10 @@
 
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 
 
-#define MDS_BASE_VARS_VERSION  0
+#define MDS_BASE_VARS_VERSION  1
 
 
 
@@ -161,6 +162,12 @@ extern volatile sig_atomic_t danger;
  */
 extern int socket_fd;
 
+/**
+ * The number of nanoseconds the server was paused
+ * by its last re-exec, zero if it has not re-exec:ed
+ */
+extern uint64_t reexec_pause;
+
 
 
 /**
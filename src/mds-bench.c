@@ -0,0 +1,780 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * End-to-end load generator for the display server. A private
+ * mds-server is spawned, synthetic clients are connected to it,
+ * some of which send a mix of messages and some of which intercept
+ * them, and the throughput and the delivery latency is measured.
+ * The display server is spawned on a socket of its own, so no
+ * virtual terminal or privileges are needed. The result is
+ * printed as one JSON object.
+ */
+
+#include "bench/harness.h"
+
+#include <libmdsclient/comm.h>
+#include <libmdsclient/inbound.h>
+#include <libmdsclient/proto-util.h>
+
+#include <libmdsserver/macros.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+
+/**
+ * The highest number of entries in each of the
+ * lists that can be specified in the command line
+ */
+#define LIST_MAX  64
+
+
+
+/**
+ * A kind of message in the message mix
+ */
+typedef struct mix_entry
+{
+  /**
+   * The value of the `Command` header
+   */
+  const char* command;
+  
+  /**
+   * How often the message is sent relative to the other messages
+   */
+  uint64_t weight;
+  
+} mix_entry_t;
+
+
+/**
+ * A synthetic client
+ */
+typedef struct bench_client
+{
+  /**
+   * The connection to the display server
+   */
+  libmds_connection_t connection;
+  
+  /**
+   * Message slot for received messages
+   */
+  libmds_message_t message;
+  
+  /**
+   * The thread that drives the client
+   */
+  pthread_t thread;
+  
+  /**
+   * The index of the client among the senders or among the receivers
+   */
+  size_t index;
+  
+  /**
+   * Whether the client is a modifying interceptor
+   */
+  int modifying;
+  
+  /**
+   * The number of bytes sent by the client, for senders
+   */
+  uint64_t sent_bytes;
+  
+  /**
+   * The delivery latencies, in nanoseconds, of the received messages, for receivers
+   */
+  uint64_t* latencies;
+  
+  /**
+   * The number of elements in `latencies`
+   */
+  size_t latencies_count;
+  
+  /**
+   * The allocation size of `latencies`
+   */
+  size_t latencies_size;
+  
+  /**
+   * The time the client got its last message, or finished sending
+   */
+  double finished;
+  
+  /**
+   * Zero on success, -1 on error
+   */
+  int rc;
+  
+} bench_client_t;
+
+
+
+/**
+ * The name of the process
+ */
+static const char* program_name;
+
+/**
+ * The pathname of the mds-server binary, `NULL` for the one next to this program
+ */
+static const char* server_path = NULL;
+
+/**
+ * Additional arguments for the display server, `NULL` terminated
+ */
+static char** server_args = NULL;
+
+/**
+ * The number of clients that send messages
+ */
+static size_t sender_count = 1;
+
+/**
+ * The number of clients that intercept the messages
+ */
+static size_t receiver_count = 1;
+
+/**
+ * The number of receivers that are modifying interceptors
+ */
+static size_t modifying_count = 0;
+
+/**
+ * The number of messages each sender sends
+ */
+static size_t message_count = 10000;
+
+/**
+ * The number of messages each sender sends per second, zero for as many as possible
+ */
+static double send_rate = 0;
+
+/**
+ * The interception conditions of the receivers, receiver
+ * number i uses condition number i modulo the number of conditions
+ */
+static const char* conditions[LIST_MAX];
+
+/**
+ * The number of elements in `conditions`
+ */
+static size_t condition_count = 0;
+
+/**
+ * The interception priorities of the receivers, assigned like `conditions`
+ */
+static int64_t priorities[LIST_MAX];
+
+/**
+ * The number of elements in `priorities`
+ */
+static size_t priority_count = 0;
+
+/**
+ * The kinds of messages to send
+ */
+static mix_entry_t mix[LIST_MAX];
+
+/**
+ * The number of elements in `mix`
+ */
+static size_t mix_count = 0;
+
+/**
+ * The sum of the weights in `mix`
+ */
+static uint64_t mix_total = 0;
+
+/**
+ * The payload sizes of the messages, the senders cycle through them
+ */
+static size_t payload_sizes[LIST_MAX];
+
+/**
+ * The number of elements in `payload_sizes`
+ */
+static size_t payload_size_count = 0;
+
+/**
+ * The payload of the messages, large enough for the largest payload size
+ */
+static char* payload = NULL;
+
+/**
+ * The time the senders started
+ */
+static double start_time;
+
+
+
+/**
+ * Parse a non-negative integer
+ * 
+ * @param   str    The string to parse
+ * @param   value  Output parameter for the value
+ * @return         Zero on success, -1 if the string is not a non-negative integer
+ */
+__attribute__((nonnull))
+static int parse_size(const char* str, size_t* value)
+{
+  char* end;
+  if ((*str < '0') || (*str > '9'))
+    return -1;
+  errno = 0;
+  *value = (size_t)strtoull(str, &end, 10);
+  return (errno || *end) ? (errno = 0, -1) : 0;
+}
+
+
+/**
+ * Parse command line arguments
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, -1 on usage error, an error message will have been printed
+ */
+__attribute__((nonnull))
+static int parse_cmdline(int argc_, char** argv_)
+{
+  const char* arg;
+  char* colon;
+  size_t value;
+  int i;
+  
+#define LIST_ADD(LIST, COUNT)					\
+  if ((COUNT) == LIST_MAX)					\
+    {								\
+      fprintf(stderr, "%s: too many %s options\n", program_name, arg);	\
+      return -1;						\
+    }								\
+  else								\
+    (LIST)[(COUNT)++]
+  
+  for (i = 1; i < argc_; i++)
+    {
+      arg = argv_[i];
+      if (strequals(arg, "--"))
+	{
+	  server_args = argv_ + i + 1;
+	  break;
+	}
+      else if (startswith(arg, "--server="))
+	server_path = arg + strlen("--server=");
+      else if (startswith(arg, "--senders="))
+	{
+	  if (parse_size(arg + strlen("--senders="), &sender_count) || (sender_count == 0))
+	    goto usage;
+	}
+      else if (startswith(arg, "--receivers="))
+	{
+	  if (parse_size(arg + strlen("--receivers="), &receiver_count))
+	    goto usage;
+	}
+      else if (startswith(arg, "--modifying="))
+	{
+	  if (parse_size(arg + strlen("--modifying="), &modifying_count))
+	    goto usage;
+	}
+      else if (startswith(arg, "--messages="))
+	{
+	  if (parse_size(arg + strlen("--messages="), &message_count))
+	    goto usage;
+	}
+      else if (startswith(arg, "--rate="))
+	{
+	  if (parse_size(arg + strlen("--rate="), &value))
+	    goto usage;
+	  send_rate = (double)value;
+	}
+      else if (startswith(arg, "--condition="))
+	{
+	  LIST_ADD(conditions, condition_count) = arg + strlen("--condition=");
+	}
+      else if (startswith(arg, "--priority="))
+	{
+	  LIST_ADD(priorities, priority_count) = (int64_t)strtoll(arg + strlen("--priority="), NULL, 10);
+	}
+      else if (startswith(arg, "--payload="))
+	{
+	  if (parse_size(arg + strlen("--payload="), &value))
+	    goto usage;
+	  LIST_ADD(payload_sizes, payload_size_count) = value;
+	}
+      else if (startswith(arg, "--mix="))
+	{
+	  /* --mix=COMMAND or --mix=COMMAND:WEIGHT */
+	  arg += strlen("--mix=");
+	  value = 1;
+	  if ((colon = strrchr(arg, ':')) != NULL)
+	    {
+	      *colon = '\0';
+	      if (parse_size(colon + 1, &value) || (value == 0))
+		goto usage;
+	    }
+	  if (*arg == '\0')
+	    goto usage;
+	  LIST_ADD(mix, mix_count).command = arg;
+	  mix[mix_count - 1].weight = (uint64_t)value;
+	  mix_total += (uint64_t)value;
+	}
+      else
+	goto usage;
+    }
+  
+#undef LIST_ADD
+  
+  if (modifying_count > receiver_count)
+    {
+      fprintf(stderr, "%s: there cannot be more modifying interceptors than receivers\n", program_name);
+      return -1;
+    }
+  
+  if (condition_count == 0)
+    conditions[condition_count++] = "Command";
+  if (priority_count == 0)
+    priorities[priority_count++] = 0;
+  if (payload_size_count == 0)
+    payload_sizes[payload_size_count++] = 0;
+  if (mix_count == 0)
+    {
+      mix[mix_count].command = "bench";
+      mix[mix_count++].weight = 1;
+      mix_total = 1;
+    }
+  
+  return 0;
+ usage:
+  fprintf(stderr, "%s: invalid option: %s\n", program_name, argv_[i]);
+  return -1;
+}
+
+
+/**
+ * Spawn the display server
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int start_server(void)
+{
+  char* server = NULL;
+  const char* slash;
+  int saved_errno;
+  
+  /* Use the display server that was built with this program, unless told otherwise. */
+  if (server_path != NULL)
+    fail_if (xstrdup(server, server_path));
+  else if ((slash = strrchr(program_name, '/')) == NULL)
+    fail_if (xstrdup(server, "mds-server"));
+  else
+    fail_if (xasprintf(server, "%.*s/mds-server", (int)(slash - program_name), program_name) < 0);
+  
+  fail_if (spawn_server(server, server_args));
+  free(server);
+  return 0;
+ fail:
+  saved_errno = errno;
+  free(server);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Make a receiver intercept messages
+ * 
+ * @param   client  The receiver
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int start_intercepting(bench_client_t* client)
+{
+  const char* condition = conditions[client->index % condition_count];
+  int64_t priority = priorities[client->index % priority_count];
+  char* buffer = NULL;
+  char* condition_line = NULL;
+  size_t buffer_size = 0, length;
+  libmds_connection_t* connection = &(client->connection);
+  
+  fail_if (xasprintf(condition_line, "%s\n", condition) < 0);
+  fail_if (libmds_next_message_id(&(connection->message_id), NULL, NULL));
+  /* All messages are intercepted if the request has no payload. */
+  fail_if (libmds_compose(&buffer, &buffer_size, &length, *condition ? condition_line : NULL, NULL,
+			  "Command: intercept", "Priority: %" PRIi64, priority,
+			  "?Modifying: yes", client->modifying,
+			  LIBMDS_HEADER_MESSAGE_ID(connection), NULL));
+  fail_if (libmds_connection_send(connection, buffer, length) < length);
+  free(buffer);
+  free(condition_line);
+  return sync_client(&(client->connection), &(client->message));
+ fail:
+  free(buffer);
+  free(condition_line);
+  return -1;
+}
+
+
+/**
+ * Send messages, run as a thread
+ * 
+ * @param   data:bench_client_t*  The sender
+ * @return                        `NULL`
+ */
+static void* run_sender(void* data)
+{
+  bench_client_t* client = data;
+  libmds_connection_t* connection = &(client->connection);
+  char* buffer = NULL;
+  size_t buffer_size = 0, length, payload_size, i, j;
+  uint64_t state = 0x9E3779B97F4A7C15ULL * (client->index + 1), pick;
+  struct timespec deadline;
+  double due;
+  
+  for (i = 0; i < message_count; i++)
+    {
+      /* Pace the messages, the schedule is absolute so that delays are caught up with. */
+      if (send_rate > 0)
+	{
+	  due = start_time + (double)i * 1000000000 / send_rate;
+	  deadline.tv_sec = (time_t)(due / 1000000000);
+	  deadline.tv_nsec = (long)(due - (double)(deadline.tv_sec) * 1000000000);
+	  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+	}
+      
+      /* Pick the kind of message, from a sequence that is the same in every run. */
+      state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+      for (pick = state % mix_total, j = 0; pick >= mix[j].weight; pick -= mix[j++].weight);
+      payload_size = payload_sizes[i % payload_size_count];
+      
+      fail_if (libmds_next_message_id(&(connection->message_id), NULL, NULL));
+      fail_if (libmds_compose(&buffer, &buffer_size, &length,
+			      payload_size ? payload : NULL, &payload_size,
+			      "Command: %s", mix[j].command,
+			      "Bench-Sent: %.0f", now(),
+			      LIBMDS_HEADER_MESSAGE_ID(connection), NULL));
+      fail_if (libmds_connection_send(connection, buffer, length) < length);
+      client->sent_bytes += (uint64_t)length;
+    }
+  
+  /* The messages have been delivered, or queued for delivery, once this returns. */
+  fail_if (sync_client(&(client->connection), &(client->message)));
+  client->finished = now();
+  
+  free(buffer);
+  client->rc = 0;
+  return NULL;
+ fail:
+  free(buffer);
+  client->rc = -1;
+  return NULL;
+}
+
+
+/**
+ * Receive messages, run as a thread
+ * 
+ * @param   data:bench_client_t*  The receiver
+ * @return                        `NULL`
+ */
+static void* run_receiver(void* data)
+{
+  bench_client_t* client = data;
+  libmds_connection_t* connection = &(client->connection);
+  libmds_message_t* message = &(client->message);
+  const char* modify_id;
+  const char* sent;
+  const char* h;
+  char* buffer = NULL;
+  size_t buffer_size = 0, length, i;
+  uint64_t* latencies;
+  double received;
+  int end, to_self;
+  
+  for (;;)
+    {
+      fail_if (libmds_message_read(message, connection->socket_fd));
+      received = now();
+      
+      modify_id = sent = NULL;
+      end = to_self = 0;
+      for (i = 0; i < message->header_count; i++)
+	{
+	  h = message->headers[i];
+	  if      (startswith(h, "Bench-Sent: "))  sent = h + strlen("Bench-Sent: ");
+	  else if (startswith(h, "Modify ID: "))   modify_id = h + strlen("Modify ID: ");
+	  else if (strequals(h, "Bench-End: yes")) end = 1;
+	  else if (startswith(h, "To: "))
+	    to_self = strequals(h + strlen("To: "), connection->client_id);
+	}
+      
+      /* Let the message pass on unmodified, the sender is waiting for this. */
+      if (modify_id != NULL)
+	{
+	  fail_if (libmds_next_message_id(&(connection->message_id), NULL, NULL));
+	  fail_if (libmds_compose(&buffer, &buffer_size, &length, NULL, NULL,
+				  "Modify ID: %s", modify_id, "Modify: no",
+				  LIBMDS_HEADER_MESSAGE_ID(connection), NULL));
+	  fail_if (libmds_connection_send(connection, buffer, length) < length);
+	}
+      
+      if (end && to_self)
+	break;
+      if (sent == NULL)
+	continue;
+      
+      if (client->latencies_count == client->latencies_size)
+	{
+	  latencies = client->latencies;
+	  fail_if (xrealloc(latencies, client->latencies_size ? client->latencies_size << 1 : 1024, uint64_t));
+	  client->latencies = latencies;
+	  client->latencies_size = client->latencies_size ? client->latencies_size << 1 : 1024;
+	}
+      client->latencies[client->latencies_count++] = (uint64_t)(received - strtod(sent, NULL));
+      client->finished = received;
+    }
+  
+  free(buffer);
+  client->rc = 0;
+  return NULL;
+ fail:
+  free(buffer);
+  client->rc = -1;
+  return NULL;
+}
+
+
+/**
+ * Compare two latencies, for `qsort`
+ * 
+ * @param   a:const uint64_t*  One of the latencies
+ * @param   b:const uint64_t*  The other latency
+ * @return                     Negative if `a` is lower, positive if `b` is lower, otherwise zero
+ */
+static int compare_latencies(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Get a percentile of sorted latencies
+ * 
+ * @param   latencies  The latencies, sorted in ascending order
+ * @param   count      The number of latencies, must not be zero
+ * @param   permille   The number of thousandths of the latencies that may be at most the percentile
+ * @return             The percentile, by the nearest-rank method
+ */
+__attribute__((pure, nonnull))
+static uint64_t percentile(const uint64_t* latencies, size_t count, size_t permille)
+{
+  size_t rank = (count * permille + 999) / 1000;
+  return latencies[rank ? rank - 1 : 0];
+}
+
+
+/**
+ * Print the result of the benchmark
+ * 
+ * @param   senders    The senders
+ * @param   receivers  The receivers
+ * @return             Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int report(bench_client_t* senders, bench_client_t* receivers)
+{
+  uint64_t* latencies = NULL;
+  uint64_t bytes = 0;
+  size_t i, count = 0, messages = sender_count * message_count;
+  double finished = start_time, seconds;
+  
+  for (i = 0; i < sender_count; i++)
+    {
+      bytes += senders[i].sent_bytes;
+      if (senders[i].finished > finished)
+	finished = senders[i].finished;
+    }
+  for (i = 0; i < receiver_count; i++)
+    {
+      count += receivers[i].latencies_count;
+      if (receivers[i].finished > finished)
+	finished = receivers[i].finished;
+    }
+  seconds = (finished - start_time) / 1000000000;
+  
+  fail_if (xmalloc(latencies, count + 1, uint64_t));
+  for (count = 0, i = 0; i < receiver_count; i++)
+    {
+      memcpy(latencies + count, receivers[i].latencies, receivers[i].latencies_count * sizeof(uint64_t));
+      count += receivers[i].latencies_count;
+    }
+  qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+  
+  printf("{\"benchmark\": \"mds-bench\", \"senders\": %zu, \"receivers\": %zu, \"modifying\": %zu, "
+	 "\"conditions\": %zu, \"mix\": %zu, \"payload_sizes\": %zu, \"rate\": %.0f, "
+	 "\"messages\": %zu, \"deliveries\": %zu, \"bytes\": %" PRIu64 ", \"seconds\": %.6f, "
+	 "\"messages_per_second\": %.0f, \"bytes_per_second\": %.0f, \"deliveries_per_second\": %.0f",
+	 sender_count, receiver_count, modifying_count, condition_count, mix_count, payload_size_count,
+	 send_rate, messages, count, bytes, seconds,
+	 (double)messages / seconds, (double)bytes / seconds, (double)count / seconds);
+  if (count > 0)
+    printf(", \"latency_ns\": {\"p50\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"p999\": %" PRIu64
+	   ", \"max\": %" PRIu64 "}",
+	   percentile(latencies, count, 500), percentile(latencies, count, 990),
+	   percentile(latencies, count, 999), latencies[count - 1]);
+  printf("}\n");
+  fflush(stdout);
+  
+  free(latencies);
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Run the benchmark
+ * 
+ * @param   argc_  The number of elements in `argv_`
+ * @param   argv_  The command line arguments
+ * @return         Zero on success, 1 on error, 2 on usage error
+ */
+int main(int argc_, char** argv_)
+{
+  bench_client_t* senders = NULL;
+  bench_client_t* receivers = NULL;
+  bench_client_t control;
+  size_t i, max_payload = 0, initialised = 0, started_senders = 0, started_receivers = 0;
+  char* header = NULL;
+  int control_initialised = 0, rc = 1;
+  
+  program_name = *argv_;
+  if (parse_cmdline(argc_, argv_))
+    return 2;
+  
+  for (i = 0; i < payload_size_count; i++)
+    if (payload_sizes[i] > max_payload)
+      max_payload = payload_sizes[i];
+  fail_if (xmalloc(payload, max_payload + 1, char));
+  memset(payload, 'x', max_payload);
+  if (max_payload > 0)
+    payload[max_payload - 1] = '\n';
+  
+  fail_if (xcalloc(senders, sender_count, bench_client_t));
+  fail_if (xcalloc(receivers, receiver_count + 1, bench_client_t));
+  memset(&control, 0, sizeof(control));
+  for (; initialised < sender_count + receiver_count; initialised++)
+    {
+      bench_client_t* client = initialised < sender_count ? senders + initialised
+	: receivers + (initialised - sender_count);
+      client->index = initialised < sender_count ? initialised : initialised - sender_count;
+      client->modifying = (initialised >= sender_count) && (client->index < modifying_count);
+      fail_if (libmds_connection_initialise(&(client->connection)));
+      fail_if (libmds_message_initialise(&(client->message)));
+    }
+  fail_if (libmds_connection_initialise(&(control.connection)));
+  control_initialised = 1;
+  fail_if (libmds_message_initialise(&(control.message)));
+  control_initialised = 2;
+  
+  fail_if (start_server());
+  
+  /* Connect all clients, and let the receivers start intercepting,
+     before anything is sent. Connections are queued by the listening
+     socket until the server accepts them. Each receiver is started as
+     soon as it intercepts, a modifying interceptor may intercept the
+     requests of the clients that connect after it, and the display
+     server waits for it to reply. */
+  fail_if (connect_client(&(control.connection), &(control.message)));
+  for (; started_receivers < receiver_count; started_receivers++)
+    {
+      fail_if (connect_client(&(receivers[started_receivers].connection),
+			      &(receivers[started_receivers].message)));
+      fail_if (start_intercepting(receivers + started_receivers));
+      fail_if ((errno = pthread_create(&(receivers[started_receivers].thread), NULL,
+				       run_receiver, receivers + started_receivers)));
+    }
+  for (i = 0; i < sender_count; i++)
+    fail_if (connect_client(&(senders[i].connection), &(senders[i].message)));
+  
+  start_time = now();
+  for (; started_senders < sender_count; started_senders++)
+    fail_if ((errno = pthread_create(&(senders[started_senders].thread), NULL,
+				     run_sender, senders + started_senders)));
+  
+  while (started_senders > 0)
+    {
+      pthread_join(senders[--started_senders].thread, NULL);
+      fail_if (senders[started_senders].rc);
+    }
+  
+  /* All messages have been queued for the receivers, and the
+     display server sends each receiver its messages in order,
+     so the receivers have got all of them when they get this. */
+  for (i = 0; i < receiver_count; i++)
+    {
+      fail_if (xasprintf(header, "Bench-End: yes\nTo: %s", receivers[i].connection.client_id) < 0);
+      fail_if (send_simple(&(control.connection), header, NULL));
+      free(header), header = NULL;
+    }
+  while (started_receivers > 0)
+    {
+      pthread_join(receivers[--started_receivers].thread, NULL);
+      fail_if (receivers[started_receivers].rc);
+    }
+  
+  fail_if (report(senders, receivers));
+  
+  rc = 0;
+ fail:
+  if (rc && errno)
+    perror(program_name);
+  /* Threads that are still running are blocked on the display
+     server, and are released when it is killed. */
+  kill_server();
+  for (i = 0; i < started_senders; i++)
+    pthread_join(senders[i].thread, NULL);
+  for (i = 0; i < started_receivers; i++)
+    pthread_join(receivers[i].thread, NULL);
+  for (i = 0; i < initialised; i++)
+    {
+      bench_client_t* client = i < sender_count ? senders + i : receivers + (i - sender_count);
+      free(client->latencies);
+      libmds_message_destroy(&(client->message));
+      libmds_connection_destroy(&(client->connection));
+    }
+  if (control_initialised > 1)
+    libmds_message_destroy(&(control.message));
+  if (control_initialised)
+    libmds_connection_destroy(&(control.connection));
+  free(senders);
+  free(receivers);
+  free(payload);
+  free(header);
+  return rc;
+}
+
@@ -17,6 +17,8 @@
  */
 #include "mds-clipboard.h"
 
+#include "schema/mds-clipboard.h"
+
 #include <libmdsserver/macros.h>
 #include <libmdsserver/util.h>
 #include <libmdsserver/mds-message.h>
@@ -417,86 +419,62 @@ int handle_message(void)
 {
   /* Fetch message headers. */
   
-  const char* recv_client_id = "0:0";
-  const char* recv_message_id = NULL;
-  const char* recv_length = NULL;
-  const char* recv_level = NULL;
-  const char* recv_action = NULL;
-  const char* recv_size = NULL;
-  const char* recv_index = "0";
-  const char* recv_time_to_live = "forever";
-  const char* recv_client_closed = NULL;
-  size_t i;
-  int level;
-  
-#define __get_header(storage, header)			\
-  (startswith(received.headers[i], header))		\
-    storage = received.headers[i] + strlen(header)
-  
-  for (i = 0; i < received.header_count; i++)
-    {
-      if      __get_header(recv_client_id,     "Client ID: ");
-      else if __get_header(recv_message_id,    "Message ID: ");
-      else if __get_header(recv_length,        "Length: ");
-      else if __get_header(recv_action,        "Action: ");
-      else if __get_header(recv_level,         "Level: ");
-      else if __get_header(recv_size,          "Size: ");
-      else if __get_header(recv_index,         "Index: ");
-      else if __get_header(recv_time_to_live,  "Time to live: ");
-      else if __get_header(recv_client_closed, "Client closed: ");
-    }
+  mds_clipboard_message_t recv;
   
-#undef __get_header
+  mds_clipboard_parse(&recv, &received);
   
   
   /* Validate headers and take appropriate action. */
   
-  if (recv_message_id == NULL)
+  if (recv.message_id == NULL)
     return eprint("received message without ID, ignoring, master server is misbehaving."), 0;
   
-  if (recv_client_closed)
+  if (recv.client_closed)
     {
-      if (strequals(recv_client_closed, "0:0"))
+      if (strequals(recv.client_closed, "0:0"))
 	return 0;
-      return clipboard_death(recv_client_closed);
+      return clipboard_death(recv.client_closed);
     }
   
-  if (recv_action == NULL)
+  if (recv.action == 0)
     return eprint("received message without any action, ignoring."), 0;
-  if (recv_level == NULL)
+  if (!MDS_CLIPBOARD_GIVEN(&recv, LEVEL))
     return eprint("received message without specified clipboard level, ignoring."), 0;
-  level = atoi(recv_level);
-  if ((level < 0) || (CLIPBOARD_LEVELS <= level))
+  if (MDS_CLIPBOARD_INVALID(&recv, LEVEL) || (recv.level < 0) || (CLIPBOARD_LEVELS <= recv.level))
     return eprint("received message without invalid clipboard level, ignoring."), 0;
-  if (strequals(recv_client_id, "0:0"))
-    if (strequals(recv_action, "read") || strequals(recv_action, "get-size"))
+  if (strequals(recv.client_id, "0:0"))
+    if ((recv.action == MDS_CLIPBOARD_ACTION_READ) || (recv.action == MDS_CLIPBOARD_ACTION_GET_SIZE))
       return eprint("received information request from an anonymous client, ignoring."), 0;
   
-  if (strequals(recv_action, "add"))
+  switch (recv.action)
     {
-      if (recv_length == NULL)
+    case MDS_CLIPBOARD_ACTION_ADD:
+      if (recv.length == NULL)
 	return eprint("received request for adding a clipboard entry "
 		      "but did not receive any content, ignoring."), 0;
-      if ((strequals(recv_client_id, "0:0")) && startswith(recv_time_to_live, "until-death"))
+      if ((strequals(recv.client_id, "0:0")) && startswith(recv.time_to_live, "until-death"))
 	return eprint("received request new clipboard entry with autopurge upon"
 		      " client close from an anonymous client, ignoring."), 0;
-      return clipboard_add(level, recv_time_to_live, recv_client_id);
-    }
-  else if (strequals(recv_action, "read"))
-    return clipboard_read(level, atoz(recv_index), recv_client_id, recv_message_id);
-  else if (strequals(recv_action, "clear"))
-    return clipboard_clear(level);
-  else if (strequals(recv_action, "set-size"))
-    {
-      if (recv_size == NULL)
+      return clipboard_add(recv.level, recv.time_to_live, recv.client_id);
+      
+    case MDS_CLIPBOARD_ACTION_READ:
+      return clipboard_read(recv.level, recv.index, recv.client_id, recv.message_id);
+      
+    case MDS_CLIPBOARD_ACTION_CLEAR:
+      return clipboard_clear(recv.level);
+      
+    case MDS_CLIPBOARD_ACTION_SET_SIZE:
+      if (!MDS_CLIPBOARD_GIVEN(&recv, SIZE))
 	return eprint("received request for clipboard resizing without a new size, ignoring."), 0;
-      return clipboard_set_size(level, atoz(recv_size));
+      return clipboard_set_size(recv.level, recv.size);
+      
+    case MDS_CLIPBOARD_ACTION_GET_SIZE:
+      return clipboard_get_size(recv.level, recv.client_id, recv.message_id);
+      
+    default:
+      eprint("received message with invalid action, ignoring.");
+      return 0;
     }
-  else if (strequals(recv_action, "get-size"))
-    return clipboard_get_size(level, recv_client_id, recv_message_id);
-  
-  eprint("received message with invalid action, ignoring.");
-  return 0;
 }
 
 
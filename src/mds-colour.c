@@ -373,54 +373,28 @@ int master_loop(void)
  */
 int handle_message(void)
 {
-  const char* recv_command = NULL;
-  const char* recv_client_id = "0:0";
-  const char* recv_message_id = NULL;
-  const char* recv_include_values = NULL;
-  const char* recv_name = NULL;
-  const char* recv_remove = NULL;
-  const char* recv_bytes = NULL;
-  const char* recv_red = NULL;
-  const char* recv_green = NULL;
-  const char* recv_blue = NULL;
-  size_t i;
-  
-#define __get_header(storage, header)			\
-  (startswith(received.headers[i], header))		\
-    storage = received.headers[i] + strlen(header)
-  
-  for (i = 0; i < received.header_count; i++)
-    {
-      if      __get_header(recv_command,        "Command: ");
-      else if __get_header(recv_client_id,      "Client ID: ");
-      else if __get_header(recv_message_id,     "Message ID: ");
-      else if __get_header(recv_include_values, "Include values: ");
-      else if __get_header(recv_name,           "Name: ");
-      else if __get_header(recv_remove,         "Remove: ");
-      else if __get_header(recv_bytes,          "Bytes: ");
-      else if __get_header(recv_red,            "Red: ");
-      else if __get_header(recv_green,          "Green: ");
-      else if __get_header(recv_blue,           "Blue: ");
-    }
+  mds_colour_message_t recv;
   
-#undef __get_header
+  mds_colour_parse(&recv, &received);
   
-  if (recv_message_id == NULL)
+  if (recv.message_id == NULL)
     {
       eprint("received message without ID, ignoring, master server is misbehaving.");
       return 0;
     }
   
-  if (recv_command == NULL)
-    return 0; /* How did that get here, not matter, just ignore it? */
-
 #define t(expr)  do { fail_if (expr); return 0; } while (0)
-  if (strequals(recv_command, "list-colours"))
-    t (handle_list_colours(recv_client_id, recv_message_id, recv_include_values));
-  if (strequals(recv_command, "get-colour"))
-    t (handle_get_colour(recv_client_id, recv_message_id, recv_name));
-  if (strequals(recv_command, "set-colour"))
-    t (handle_set_colour(recv_name, recv_remove, recv_bytes, recv_red, recv_green, recv_blue));
+  switch (recv.command)
+    {
+    case MDS_COLOUR_COMMAND_LIST_COLOURS:
+      t (handle_list_colours(recv.client_id, recv.message_id, recv.include_values));
+    case MDS_COLOUR_COMMAND_GET_COLOUR:
+      t (handle_get_colour(recv.client_id, recv.message_id, recv.name));
+    case MDS_COLOUR_COMMAND_SET_COLOUR:
+      t (handle_set_colour(&recv));
+    default:
+      break;
+    }
 #undef t
   
   return 0; /* How did that get here, not matter, just ignore it? */
@@ -510,11 +484,11 @@ static int create_colour_list_buffer_with_values(void)
  * 
  * @param   recv_client_id       The value of the `Client ID`-header, "0:0" if omitted
  * @param   recv_message_id      The value of the `Message ID`-header
- * @param   recv_include_values  The value of the `Include values`-header, `NULL` if omitted
+ * @param   recv_include_values  The value of the `Include values`-header, `MDS_COLOUR_INCLUDE_VALUES_*`,
+ *                               `MDS_COLOUR_INCLUDE_VALUES_NO` if omitted, -1 if invalid
  * @return                       Zero on success, -1 on error
  */
-int handle_list_colours(const char* recv_client_id, const char* recv_message_id,
-			const char* recv_include_values)
+int handle_list_colours(const char* recv_client_id, const char* recv_message_id, int recv_include_values)
 {
   int include_values = 0;
   char* payload;
@@ -525,14 +499,12 @@ int handle_list_colours(const char* recv_client_id, const char* recv_message_id,
   if (strequals(recv_client_id, "0:0"))
     return eprint("got a query from an anonymous client, ignoring."), 0;
   
-  if      (recv_include_values == NULL)            include_values = 0;
-  else if (strequals(recv_include_values, "yes"))  include_values = 1;
-  else if (strequals(recv_include_values, "no"))   include_values = 0;
-  else
+  if (recv_include_values < 0)
     {
       fail_if (send_error(recv_client_id, recv_message_id, "list-colours", 0, EPROTO, NULL));
       return 0;
     }
+  include_values = recv_include_values == MDS_COLOUR_INCLUDE_VALUES_YES;
   
   if ((colour_list_buffer_with_values == NULL) && include_values)
     fail_if (create_colour_list_buffer_with_values());
@@ -651,37 +623,31 @@ int handle_get_colour(const char* recv_client_id, const char* recv_message_id, c
  * Handle the received message after it has been
  * identified to contain `Command: set-colour`
  * 
- * @param   recv_name    The value of the `Name`-header, `NULL` if omitted
- * @param   recv_remove  The value of the `Remove`-header, `NULL` if omitted
- * @param   recv_bytes   The value of the `Bytes`-header, `NULL` if omitted
- * @param   recv_red     The value of the `Red`-header, `NULL` if omitted
- * @param   recv_green   The value of the `Green`-header, `NULL` if omitted
- * @param   recv_blue    The value of the `Blue`-header, `NULL` if omitted
- * @return               Zero on success, -1 on error
+ * @param   recv  The headers of the received message, the
+ *                `Name`, `Remove`, `Bytes`, `Red`, `Green`
+ *                and `Blue` headers are used
+ * @return        Zero on success, -1 on error
  */
-int handle_set_colour(const char* recv_name, const char* recv_remove, const char* recv_bytes,
-		      const char* recv_red, const char* recv_green, const char* recv_blue)
+int handle_set_colour(const mds_colour_message_t* restrict recv)
 {
   uint64_t limit = UINT64_MAX;
-  int remove_colour = 0;
   colour_t colour;
   int bytes;
   
-  if      (recv_remove == NULL)            remove_colour = 0;
-  else if (strequals(recv_remove, "yes"))  remove_colour = 1;
-  else if (strequals(recv_remove, "no"))   remove_colour = 0;
-  else
+  if (recv->remove < 0)
     return eprint("got an invalid value on the Remove-header, ignoring."), 0;
   
-  if (recv_name == NULL)
+  if (recv->name == NULL)
     return eprint("did not get all required headers, ignoring."), 0;
   
-  if (remove_colour == 0)
+  if (recv->remove == MDS_COLOUR_REMOVE_NO)
     {
-      if ((recv_bytes == NULL) || (recv_red == NULL) || (recv_green == NULL) || (recv_blue == NULL))
+      if (!MDS_COLOUR_GIVEN(recv, BYTES) || !MDS_COLOUR_GIVEN(recv, RED) ||
+	  !MDS_COLOUR_GIVEN(recv, GREEN) || !MDS_COLOUR_GIVEN(recv, BLUE))
 	return eprint("did not get all required headers, ignoring."), 0;
       
-      if (strict_atoi(recv_bytes, &bytes, 1, 8))
+      bytes = recv->bytes;
+      if (MDS_COLOUR_INVALID(recv, BYTES))
 	return eprint("got an invalid value on the Bytes-header, ignoring."), 0;
       if ((bytes != 1) && (bytes != 2) && (bytes != 4) && (bytes != 8))
 	return eprint("got an invalid value on the Bytes-header, ignoring."), 0;
@@ -690,17 +656,20 @@ int handle_set_colour(const char* recv_name, const char* recv_remove, const char
 	limit = (((uint64_t)1) << (bytes * 8)) - 1;
       
       colour.bytes = bytes;
-      if (strict_atou64(recv_red, &(colour.red), 0, limit))
+      colour.red = recv->red;
+      colour.green = recv->green;
+      colour.blue = recv->blue;
+      if (MDS_COLOUR_INVALID(recv, RED) || (colour.red > limit))
 	return eprint("got an invalid value on the Red-header, ignoring."), 0;
-      if (strict_atou64(recv_green, &(colour.green), 0, limit))
+      if (MDS_COLOUR_INVALID(recv, GREEN) || (colour.green > limit))
 	return eprint("got an invalid value on the Green-header, ignoring."), 0;
-      if (strict_atou64(recv_blue, &(colour.blue), 0, limit))
+      if (MDS_COLOUR_INVALID(recv, BLUE) || (colour.blue > limit))
 	return eprint("got an invalid value on the Blue-header, ignoring."), 0;
       
-      fail_if (set_colour(recv_name, &colour));
+      fail_if (set_colour(recv->name, &colour));
     }
   else
-    fail_if (set_colour(recv_name, NULL));
+    fail_if (set_colour(recv->name, NULL));
   
   return 0;
  fail:
@@ -809,6 +778,7 @@ int broadcast_update(const char* event, const char* name, const colour_t* colour
   
   length = sizeof("Command: \nMessage ID: \nName: \nLast update: \n\n") / sizeof(char) - 1;
   length += strlen(event) + 10 + strlen(name) + strlen(last_update);
+  length += sizeof("Coalesce:  \n") / sizeof(char) - 1 + strlen(event) + strlen(name);
   
   if (colour != NULL)
     {
@@ -831,6 +801,14 @@ int broadcast_update(const char* event, const char* name, const colour_t* colour
 	  event, message_id, name, &part_length),
     length += (size_t)part_length;
   
+  /* Only the newest value of a colour matters to a client that has fallen
+     behind, but it must still see every colour that is added or removed. */
+  if (!strcmp(event, "colour-changed"))
+    sprintf(send_buffer + length,
+	    "Coalesce: %s %s\n%zn",
+	    event, name, &part_length),
+      length += (size_t)part_length;
+  
   if (colour != NULL)
     sprintf(send_buffer + length,
 	    "Bytes: %i\n"
@@ -21,6 +21,8 @@
 
 #include "mds-base.h"
 
+#include "schema/mds-colour.h"
+
 #include <libmdsserver/hash-list.h>
 
 #include <stdint.h>
@@ -70,11 +72,11 @@ int handle_message(void);
  * 
  * @param   recv_client_id       The value of the `Client ID`-header, "0:0" if omitted
  * @param   recv_message_id      The value of the `Message ID`-header
- * @param   recv_include_values  The value of the `Include values`-header, `NULL` if omitted
+ * @param   recv_include_values  The value of the `Include values`-header, `MDS_COLOUR_INCLUDE_VALUES_*`,
+ *                               `MDS_COLOUR_INCLUDE_VALUES_NO` if omitted, -1 if invalid
  * @return                       Zero on success, -1 on error
  */
-int handle_list_colours(const char* recv_client_id, const char* recv_message_id,
-			const char* recv_include_values);
+int handle_list_colours(const char* recv_client_id, const char* recv_message_id, int recv_include_values);
 
 /**
  * Handle the received message after it has been
@@ -91,16 +93,12 @@ int handle_get_colour(const char* recv_client_id, const char* recv_message_id, c
  * Handle the received message after it has been
  * identified to contain `Command: set-colour`
  * 
- * @param   recv_name    The value of the `Name`-header, `NULL` if omitted
- * @param   recv_remove  The value of the `Remove`-header, `NULL` if omitted
- * @param   recv_bytes   The value of the `Bytes`-header, `NULL` if omitted
- * @param   recv_red     The value of the `Red`-header, `NULL` if omitted
- * @param   recv_green   The value of the `Green`-header, `NULL` if omitted
- * @param   recv_blue    The value of the `Blue`-header, `NULL` if omitted
- * @return               Zero on success, -1 on error
+ * @param   recv  The headers of the received message, the
+ *                `Name`, `Remove`, `Bytes`, `Red`, `Green`
+ *                and `Blue` headers are used
+ * @return        Zero on success, -1 on error
  */
-int handle_set_colour(const char* recv_name, const char* recv_remove, const char* recv_bytes,
-		      const char* recv_red, const char* recv_green, const char* recv_blue);
+int handle_set_colour(const mds_colour_message_t* restrict recv);
 
 /**
  * Add, remove or modify a colour
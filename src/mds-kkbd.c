@@ -19,6 +19,8 @@
 /* TODO: This server should wait for `Command: get-vt` to be available,
          query the active VT and connect to that TTY instead of stdin. */
 
+#include "schema/mds-kkbd.h"
+
 #include <libmdsserver/macros.h>
 #include <libmdsserver/util.h>
 #include <libmdsserver/mds-message.h>
@@ -587,56 +589,34 @@ void* keyboard_loop(void* data)
  */
 int handle_message(void)
 {
-  const char* recv_command = NULL;
-  const char* recv_client_id = "0:0";
-  const char* recv_message_id = NULL;
-  const char* recv_modify_id = NULL;
-  const char* recv_active = NULL;
-  const char* recv_mask = NULL;
-  const char* recv_keyboard = NULL;
-  const char* recv_action = NULL;
-  size_t i;
-  
-#define __get_header(storage, header)			\
-  (startswith(received.headers[i], header))		\
-    storage = received.headers[i] + strlen(header)
-  
-  for (i = 0; i < received.header_count; i++)
-    {
-      if      __get_header(recv_command,    "Command: ");
-      else if __get_header(recv_client_id,  "Client ID: ");
-      else if __get_header(recv_message_id, "Message ID: ");
-      else if __get_header(recv_modify_id,  "Modify ID: ");
-      else if __get_header(recv_active,     "Active: ");
-      else if __get_header(recv_mask,       "Mask: ");
-      else if __get_header(recv_keyboard,   "Keyboard: ");
-      else if __get_header(recv_action,     "Action: ");
-    }
+  mds_kkbd_message_t recv;
   
-#undef __get_header
+  mds_kkbd_parse(&recv, &received);
   
-  if (recv_message_id == NULL)
+  if (recv.message_id == NULL)
     return eprint("received message without ID, ignoring, master server is misbehaving."), 0;
   
-  if (recv_command == NULL)
-    return 0; /* How did that get here, not matter, just ignore it? */
-
 #define t(expr)  do { fail_if (expr); return 0; } while (0)
-  if (strequals(recv_command, "enumerate-keyboards"))
-    t (handle_enumerate_keyboards(recv_client_id, recv_message_id, recv_modify_id));
-  if (strequals(recv_command, "keyboard-enumeration"))
-    t (handle_keyboard_enumeration(recv_modify_id));
-  if (strequals(recv_command, "keycode-map"))
-    t (handle_keycode_map(recv_client_id, recv_message_id, recv_action, recv_keyboard));
-  /* The following do not need to be inside a mutex, because this server
-     only interprets on message at the time, thus there can not be any
-     conflicts and access to LED:s are automatically atomic. */
-  if (strequals(recv_command, "set-keyboard-leds"))
-    t (handle_set_keyboard_leds(recv_active, recv_mask, recv_keyboard));
-  if (strequals(recv_command, "get-keyboard-leds"))
-    t (handle_get_keyboard_leds(recv_client_id, recv_message_id, recv_keyboard));
-  if (strequals(recv_command, "map-keyboard-leds"))
-    t (handle_map_keyboard_leds(recv_keyboard));
+  switch (recv.command)
+    {
+    case MDS_KKBD_COMMAND_ENUMERATE_KEYBOARDS:
+      t (handle_enumerate_keyboards(recv.client_id, recv.message_id, recv.modify_id));
+    case MDS_KKBD_COMMAND_KEYBOARD_ENUMERATION:
+      t (handle_keyboard_enumeration(recv.modify_id));
+    case MDS_KKBD_COMMAND_KEYCODE_MAP:
+      t (handle_keycode_map(recv.client_id, recv.message_id, recv.action, recv.keyboard));
+      /* The following do not need to be inside a mutex, because this server
+	 only interprets on message at the time, thus there can not be any
+	 conflicts and access to LED:s are automatically atomic. */
+    case MDS_KKBD_COMMAND_SET_KEYBOARD_LEDS:
+      t (handle_set_keyboard_leds(recv.active, recv.mask, recv.keyboard));
+    case MDS_KKBD_COMMAND_GET_KEYBOARD_LEDS:
+      t (handle_get_keyboard_leds(recv.client_id, recv.message_id, recv.keyboard));
+    case MDS_KKBD_COMMAND_MAP_KEYBOARD_LEDS:
+      t (handle_map_keyboard_leds(recv.keyboard));
+    default:
+      break;
+    }
 #undef t
   
   return 0; /* How did that get here, not matter, just ignore it? */
@@ -1391,21 +1371,25 @@ static int mapping_query(const char* recv_client_id, const char* recv_message_id
  * 
  * @param   recv_client_id   The value of the `Client ID`-header, "0:0" if omitted
  * @param   recv_message_id  The value of the `Message ID`-header
- * @param   recv_action      The value of the `Action`-header, `NULL` if omitted
+ * @param   recv_action      The value of the `Action`-header, `MDS_KKBD_ACTION_*`,
+ *                           0 if omitted, -1 if invalid
  * @param   recv_keyboard    The value of the `Keyboard`-header, `NULL` if omitted
  * @return                   Zero on success, -1 on error
  */
 int handle_keycode_map(const char* recv_client_id, const char* recv_message_id,
-		       const char* recv_action, const char* recv_keyboard)
+		       int recv_action, const char* recv_keyboard)
 {
   int r;
   if ((recv_keyboard != NULL) && !strequals(recv_keyboard, KEYBOARD_ID))
     return 0;
   
-  if (recv_action == NULL)
-    eprint("received keycode map request but without any action, ignoring.");
-  else if (strequals(recv_action, "remap"))
+  switch (recv_action)
     {
+    case 0:
+      eprint("received keycode map request but without any action, ignoring.");
+      break;
+      
+    case MDS_KKBD_ACTION_REMAP:
       if (received.payload_size == 0)
 	return eprint("received keycode remap request without a payload, ignoring."), 0;
       
@@ -1414,23 +1398,26 @@ int handle_keycode_map(const char* recv_client_id, const char* recv_message_id,
 		  if (r)  r = errno ? errno : -1;
 		  );
       fail_if (errno = (r == -1 ? 0 : r), r);
-    }
-  else if (strequals(recv_action, "reset"))
-    {
+      break;
+      
+    case MDS_KKBD_ACTION_RESET:
       with_mutex (mapping_mutex,
 		  free(mapping);
 		  mapping_size = 0;
 		  );
-    }
-  else if (strequals(recv_action, "query"))
-    {
+      break;
+      
+    case MDS_KKBD_ACTION_QUERY:
       if (strequals(recv_client_id, "0:0"))
 	return eprint("received information request from an anonymous client, ignoring."), 0;
       
       fail_if (mapping_query(recv_client_id, recv_message_id));
+      break;
+      
+    default:
+      eprint("received keycode map request with invalid action, ignoring.");
+      break;
     }
-  else
-    eprint("received keycode map request with invalid action, ignoring.");
   
   return 0;
  fail:
@@ -97,13 +97,14 @@ int handle_map_keyboard_leds(const char* recv_keyboard);
  * 
  * @param   recv_client_id   The value of the `Client ID`-header, "0:0" if omitted
  * @param   recv_message_id  The value of the `Message ID`-header
- * @param   recv_action      The value of the `Action`-header, `NULL` if omitted
+ * @param   recv_action      The value of the `Action`-header, `MDS_KKBD_ACTION_*`,
+ *                           0 if omitted, -1 if invalid
  * @param   recv_keyboard    The value of the `Keyboard`-header, `NULL` if omitted
  * @return                   Zero on success, -1 on error
  */
 __attribute__((nonnull(1, 2)))
 int handle_keycode_map(const char* recv_client_id, const char* recv_message_id,
-		       const char* recv_action, const char* recv_keyboard);
+		       int recv_action, const char* recv_keyboard);
 
 /**
  * Remap a LED, from the command line
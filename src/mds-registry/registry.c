@@ -22,6 +22,7 @@
 #include "slave.h"
 
 #include "../mds-base.h"
+#include "../schema/mds-registry.h"
 
 #include <libmdsserver/util.h>
 #include <libmdsserver/macros.h>
@@ -64,14 +65,15 @@ static int handle_close_message(void)
   size_t i, j, ptr = 0, size = 1;
   size_t* keys = NULL;
   size_t* old_keys;
+  const char* value;
   
   
   /* Remove server for all protocols. */
   
   for (i = 0; i < received.header_count; i++)
-    if (startswith(received.headers[i], "Client closed: "))
+    if (mds_registry_header(received.headers[i], &value) == MDS_REGISTRY_HEADER_CLIENT_CLOSED)
       {
-	uint64_t client = parse_client_id(received.headers[i] + strlen("Client closed: "));
+	uint64_t client = parse_client_id(value);
 	hash_entry_t* entry;
 	
 	foreach_hash_table_entry (reg_table, j, entry)
@@ -419,70 +421,35 @@ static int list_registry(const char* recv_client_id, const char* recv_message_id
 /**
  * Handle the received message containing ‘Command: register’-header–value
  * 
- * @return  Zero on success -1 on error or interruption,
- *          `errno` will be set accordingly
+ * @param   recv  The headers of the received message
+ * @return        Zero on success -1 on error or interruption,
+ *                `errno` will be set accordingly
  */
-static int handle_register_message(void)
+static int handle_register_message(const mds_registry_message_t* restrict recv)
 {
-  /* Fetch message headers. */
-  
-  const char* recv_client_id = NULL;
-  const char* recv_message_id = NULL;
-  const char* recv_length = NULL;
-  const char* recv_action = NULL;
-  size_t i, length = 0;
-  
-#define __get_header(storage, header)			\
-  (startswith(received.headers[i], header))		\
-    storage = received.headers[i] + strlen(header)
-  
-  for (i = 0; i < received.header_count; i++)
-    {
-      if      __get_header(recv_client_id,  "Client ID: ");
-      else if __get_header(recv_message_id, "Message ID: ");
-      else if __get_header(recv_length,     "Length: ");
-      else if __get_header(recv_action,     "Action: ");
-      else
-	continue;
-      
-      /* Stop if we got all headers we recognised, except ‘Time to live’. */
-      if (recv_client_id && recv_message_id && recv_length && recv_action)
-	break;
-    }
-  
-#undef __get_header
-  
-  
   /* Validate headers. */
   
-  if ((recv_client_id == NULL) || (strequals(recv_client_id, "0:0")))
+  if ((recv->client_id == NULL) || (strequals(recv->client_id, "0:0")))
       return eprint("received message from anonymous sender, ignoring."), 0;
-  else if (strchr(recv_client_id, ':') == NULL)
+  else if (strchr(recv->client_id, ':') == NULL)
     return eprint("received message from sender without a colon it its ID, ignoring, invalid ID."), 0;
-  else if ((recv_length == NULL) && ((recv_action == NULL) || !strequals(recv_action, "list")))
+  else if (!MDS_REGISTRY_GIVEN(recv, LENGTH) && (recv->action != MDS_REGISTRY_ACTION_LIST))
     return eprint("received empty message without `Action: list`, ignoring, has no effect."), 0;
-  else if (recv_message_id == NULL)
+  else if (recv->message_id == NULL)
     return eprint("received message without ID, ignoring, master server is misbehaving."), 0;
   
   
-  /* Get message length, and make sure the action is defined. */
-  
-  if (recv_length != NULL)
-    length = atoz(recv_length);
-  if (recv_action != NULL)
-    recv_action = "add";
-  
-  
   /* Perform action. */
   
-#define __registry_action(action)  registry_action(length, action, recv_client_id, recv_message_id)
+#define __registry_action(action)  registry_action(recv->length, action, recv->client_id, recv->message_id)
   
-  if      (strequals(recv_action, "add"))     return __registry_action(1);
-  else if (strequals(recv_action, "remove"))  return __registry_action(-1);
-  else if (strequals(recv_action, "wait"))    return __registry_action(0);
-  else if (strequals(recv_action, "list"))    return list_registry(recv_client_id, recv_message_id);
-  else
+  switch (recv->action)
     {
+    case MDS_REGISTRY_ACTION_ADD:     return __registry_action(1);
+    case MDS_REGISTRY_ACTION_REMOVE:  return __registry_action(-1);
+    case MDS_REGISTRY_ACTION_WAIT:    return __registry_action(0);
+    case MDS_REGISTRY_ACTION_LIST:    return list_registry(recv->client_id, recv->message_id);
+    default:
       eprint("received invalid action, ignoring.");
       return 0;
     }
@@ -499,13 +466,13 @@ static int handle_register_message(void)
  */
 int handle_message(void)
 {
-  size_t i;
-  for (i = 0; i < received.header_count; i++)
-    if (strequals(received.headers[i], "Command: register"))
-      {
-	fail_if (handle_register_message());
-	return 0;
-      }
+  mds_registry_message_t recv;
+  mds_registry_parse(&recv, &received);
+  if (recv.command & MDS_REGISTRY_COMMAND_REGISTER)
+    {
+      fail_if (handle_register_message(&recv));
+      return 0;
+    }
   fail_if (handle_close_message());
   return 0;
  fail:
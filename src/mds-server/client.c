@@ -25,6 +25,7 @@
 #include <string.h>
 #include <pthread.h>
 #include <errno.h>
+#include <unistd.h>
 
 
 
@@ -35,8 +36,6 @@
  * - message
  * - thread
  * - mutex
- * - modify_mutex
- * - modify_cond
  * 
  * The follow fields will be initialised to `-1`:
  * - list_entry
@@ -50,16 +49,51 @@ void client_initialise(client_t* restrict this)
   this->socket_fd = -1;
   this->open = 0;
   this->id = 0;
+  this->coalesce_sender = 0;
   this->mutex_created = 0;
   this->interception_conditions = NULL;
   this->interception_conditions_count = 0;
   this->multicasts = NULL;
+  this->multicasts_last = NULL;
   this->multicasts_count = 0;
-  this->send_pending = NULL;
-  this->send_pending_size = 0;
+  this->outbound = NULL;
+  this->outbound_head = 0;
+  this->outbound_count = 0;
+  this->outbound_capacity = 0;
+  this->outbound_pending = 0;
+  this->outbound_high_water = 0;
+  this->outbound_progress = 0;
+  this->outbound_dropping = 0;
+  this->evicted = 0;
+  this->received_messages = 0;
+  this->received_bytes = 0;
+  this->sent_messages = 0;
+  this->sent_bytes = 0;
+  this->credit_messages = UINT64_MAX;
+  this->credit_bytes = UINT64_MAX;
+  this->send_window = 0;
+  this->send_owed = 0;
+  this->outbound_withheld = 0;
+  this->outbound_withheld_bytes = 0;
+  this->outbound_waiters = 0;
+  this->outbound_blocked_on = NULL;
+  this->wake_fd = -1;
   this->modify_message = NULL;
-  this->modify_mutex_created = 0;
-  this->modify_cond_created = 0;
+  this->modify_recipient = NULL;
+  this->modify_started = 0;
+  this->modify_deadline = 0;
+  this->reply_timeout = 0;
+  this->accepts_lanes = 0;
+  this->binary = 0;
+  this->attached_count = 0;
+  this->rings.map = NULL;
+  this->ring_fd = -1;
+  this->ring_data_bell = -1;
+  this->ring_room_bell = -1;
+  this->ring_writing = 0;
+  this->ring_hangup = 0;
+  this->reactor_state = 0;
+  this->references = 1;
 }
 
 
@@ -69,8 +103,6 @@ void client_initialise(client_t* restrict this)
  * This method initialises the following fields:
  * - thread
  * - mutex
- * - modify_mutex
- * - modify_cond
  * 
  * @param   this  The client information
  * @return        Zero on success, -1 on error
@@ -83,13 +115,8 @@ int client_initialise_threading(client_t* restrict this)
   /* Create mutex to make sure two thread to not try to send
      messages concurrently, and other client local actions. */
   fail_if ((errno = pthread_mutex_init(&(this->mutex), NULL)));
-  this->mutex_created = 1;
-  
-  /* Create mutex and codition for multicast interception replies. */
-  fail_if ((errno = pthread_mutex_init(&(this->modify_mutex), NULL)));
-  this->modify_mutex_created = 1;
-  fail_if ((errno = pthread_cond_init(&(this->modify_cond), NULL)));
-  this->modify_cond_created = 1;
+  /* Released so that `signal_all` sees the thread once it sees this. */
+  __atomic_store_n(&(this->mutex_created), 1, __ATOMIC_RELEASE);
   
   return 0;
  fail:
@@ -98,7 +125,28 @@ int client_initialise_threading(client_t* restrict this)
 
 
 /**
- * Release all resources assoicated with a client
+ * Release a client's pending multicast messages
+ * 
+ * @param  this  The client information
+ */
+static void free_multicasts(client_t* restrict this)
+{
+  multicast_t* multicast;
+  
+  while ((multicast = this->multicasts) != NULL)
+    {
+      this->multicasts = multicast->next;
+      multicast_destroy(multicast);
+      free(multicast);
+    }
+  this->multicasts_last = NULL;
+  this->multicasts_count = 0;
+}
+
+
+/**
+ * Release all resources assoicated with a client, the
+ * memory is freed once the last reference is released
  * 
  * @param  this  The client information
  */
@@ -111,30 +159,93 @@ void client_destroy(client_t* restrict this)
 	free(this->interception_conditions[i].condition);
       free(this->interception_conditions);
     }
-  if (this->mutex_created)
-    pthread_mutex_destroy(&(this->mutex));
   mds_message_destroy(&(this->message));
-  if (this->multicasts != NULL)
+  free_multicasts(this);
+  if (this->outbound != NULL)
     {
       size_t i;
-      for (i = 0; i < this->multicasts_count; i++)
-	multicast_destroy(this->multicasts + i);
-      free(this->multicasts);
+      for (i = this->outbound_head; i < this->outbound_count; i++)
+	{
+	  message_buffer_unref(this->outbound[i].prefix);
+	  message_buffer_unref(this->outbound[i].message);
+	  if (this->outbound[i].fd >= 0)
+	    close(this->outbound[i].fd);
+	}
+      free(this->outbound);
     }
-  free(this->send_pending);
+  if (this->wake_fd >= 0)
+    close(this->wake_fd);
+  while (this->attached_count > 0)
+    close(this->attached_fds[--(this->attached_count)]);
+  shm_rings_unmap(&(this->rings));
+  if (this->ring_fd >= 0)
+    close(this->ring_fd);
+  if (this->ring_data_bell >= 0)
+    close(this->ring_data_bell);
+  if (this->ring_room_bell >= 0)
+    close(this->ring_room_bell);
   if (this->modify_message != NULL)
     {
       mds_message_destroy(this->modify_message);
       free(this->modify_message);
     }
-  if (this->modify_mutex_created)
-    pthread_mutex_destroy(&(this->modify_mutex));
-  if (this->modify_cond_created)
-    pthread_cond_destroy(&(this->modify_cond));
+  client_unref(this);
+}
+
+
+/**
+ * Add a reference to a client, so that it is not freed while
+ * it is used, this must be done while the client is listed,
+ * that is, while `client_lock` is held, or by one that holds
+ * another reference
+ * 
+ * @param   this  The client information
+ * @return        `this`
+ */
+client_t* client_ref(client_t* restrict this)
+{
+  __atomic_add_fetch(&(this->references), 1, __ATOMIC_RELAXED);
+  return this;
+}
+
+
+/**
+ * Release a reference to a client, and free
+ * it if it was the last reference
+ * 
+ * @param  this  The client information, may be `NULL`
+ */
+void client_unref(client_t* restrict this)
+{
+  if (this == NULL)
+    return;
+  if (__atomic_sub_fetch(&(this->references), 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  if (this->mutex_created)
+    pthread_mutex_destroy(&(this->mutex));
   free(this);
 }
 
 
+/**
+ * Add a multicast message to the end of a client's queue of pending
+ * multicasts, this may only be done by the thread that serves the client
+ * 
+ * @param  this       The client information
+ * @param  multicast  The multicast message, the client takes ownership of it
+ */
+void client_queue_multicast(client_t* restrict this, multicast_t* restrict multicast)
+{
+  multicast->next = NULL;
+  if (this->multicasts_last == NULL)
+    this->multicasts = multicast;
+  else
+    this->multicasts_last->next = multicast;
+  this->multicasts_last = multicast;
+  this->multicasts_count++;
+}
+
+
 /**
  * Calculate the buffer size need to marshal client information
  * 
@@ -143,14 +254,15 @@ void client_destroy(client_t* restrict this)
  */
 size_t client_marshal_size(const client_t* restrict this)
 {
-  size_t i, n = sizeof(ssize_t) + 3 * sizeof(int) + sizeof(uint64_t) + 5 * sizeof(size_t);
+  size_t i, n = sizeof(ssize_t) + 9 * sizeof(int) + 10 * sizeof(uint64_t) + 7 * sizeof(size_t);
+  const multicast_t* multicast;
   
   n += mds_message_marshal_size(&(this->message));
   for (i = 0; i < this->interception_conditions_count; i++)
     n += interception_condition_marshal_size(this->interception_conditions + i);
-  for (i = 0; i < this->multicasts_count; i++)
-    n += multicast_marshal_size(this->multicasts + i);
-  n += this->send_pending_size * sizeof(char);
+  for (multicast = this->multicasts; multicast != NULL; multicast = multicast->next)
+    n += multicast_marshal_size(multicast);
+  n += this->outbound_pending * sizeof(char);
   n += this->modify_message == NULL ? 0 : mds_message_marshal_size(this->modify_message);
   
   return n;
@@ -166,12 +278,21 @@ size_t client_marshal_size(const client_t* restrict this)
  */
 size_t client_marshal(const client_t* restrict this, char* restrict data)
 {
+  outbound_message_t* message;
+  const multicast_t* multicast;
   size_t i, n;
   buf_set_next(data, int, CLIENT_T_VERSION);
   buf_set_next(data, ssize_t, this->list_entry);
   buf_set_next(data, int, this->socket_fd);
   buf_set_next(data, int, this->open);
   buf_set_next(data, uint64_t, this->id);
+  buf_set_next(data, uint64_t, this->reply_timeout);
+  buf_set_next(data, int, this->accepts_lanes);
+  buf_set_next(data, int, this->binary);
+  buf_set_next(data, int, this->ring_fd);
+  buf_set_next(data, int, this->ring_data_bell);
+  buf_set_next(data, int, this->ring_room_bell);
+  buf_set_next(data, int, this->ring_writing);
   n = mds_message_marshal_size(&(this->message));
   buf_set_next(data, size_t, n);
   if (n > 0)
@@ -181,12 +302,51 @@ size_t client_marshal(const client_t* restrict this, char* restrict data)
   for (i = 0; i < this->interception_conditions_count; i++)
     data += n = interception_condition_marshal(this->interception_conditions + i, data) / sizeof(char);
   buf_set_next(data, size_t, this->multicasts_count);
-  for (i = 0; i < this->multicasts_count; i++)
-    data += multicast_marshal(this->multicasts + i, data) / sizeof(char);
-  buf_set_next(data, size_t, this->send_pending_size);
-  if (this->send_pending_size > 0)
-    memcpy(data, this->send_pending, this->send_pending_size * sizeof(char));
-  data += this->send_pending_size;
+  for (multicast = this->multicasts; multicast != NULL; multicast = multicast->next)
+    data += multicast_marshal(multicast, data) / sizeof(char);
+  /* The queued messages are marshalled as one message, file descriptors
+     that have not been sent are lost, they are closed on exec, but how
+     much of them that is sent over the socket, rather than written to
+     the ring, is remembered. They are sent without taking credit. */
+  for (i = this->outbound_head, n = 0; (this->ring_writing == 0) && (i < this->outbound_count); i++)
+    {
+      message = this->outbound + i;
+      n += message->message->length + (message->prefix == NULL ? 0 : message->prefix->length) - message->sent;
+      if (message->last_on_socket)
+	break;
+    }
+  buf_set_next(data, size_t, i < this->outbound_count ? n : 0);
+  buf_set_next(data, size_t, this->outbound_pending);
+  for (i = this->outbound_head; i < this->outbound_count; i++)
+    {
+      size_t skip;
+      message = this->outbound + i;
+      skip = message->sent;
+      if (message->prefix != NULL)
+	{
+	  if (skip < message->prefix->length)
+	    {
+	      n = message->prefix->length - skip;
+	      memcpy(data, message->prefix->data + skip, n * sizeof(char));
+	      data += n;
+	      skip = 0;
+	    }
+	  else
+	    skip -= message->prefix->length;
+	}
+      n = message->message->length - skip;
+      memcpy(data, message->message->data + skip, n * sizeof(char));
+      data += n;
+    }
+  buf_set_next(data, size_t, this->outbound_high_water);
+  buf_set_next(data, uint64_t, this->received_messages);
+  buf_set_next(data, uint64_t, this->received_bytes);
+  buf_set_next(data, uint64_t, this->sent_messages);
+  buf_set_next(data, uint64_t, this->sent_bytes);
+  buf_set_next(data, uint64_t, this->credit_messages);
+  buf_set_next(data, uint64_t, this->credit_bytes);
+  buf_set_next(data, uint64_t, this->send_window);
+  buf_set_next(data, uint64_t, this->send_owed);
   n = this->modify_message == NULL ? 0 : mds_message_marshal_size(this->modify_message);
   buf_set_next(data, size_t, n);
   if (this->modify_message != NULL)
@@ -204,21 +364,52 @@ size_t client_marshal(const client_t* restrict this, char* restrict data)
  */
 size_t client_unmarshal(client_t* restrict this, char* restrict data)
 {
-  size_t i, n, rc = sizeof(ssize_t) + 3 * sizeof(int) + sizeof(uint64_t) + 5 * sizeof(size_t);
-  int saved_errno, stage = 0;
+  size_t i, n, rc = sizeof(ssize_t) + 9 * sizeof(int) + 10 * sizeof(uint64_t) + 7 * sizeof(size_t);
+  size_t on_socket;
+  multicast_t* multicast;
+  int saved_errno, stage = 0, version;
   this->interception_conditions = NULL;
   this->multicasts = NULL;
-  this->send_pending = NULL;
-  this->mutex_created = 0;
-  this->modify_mutex_created = 0;
-  this->modify_cond_created = 0;
+  this->multicasts_last = NULL;
   this->multicasts_count = 0;
-  /* buf_get_next(data, int, CLIENT_T_VERSION); */
-  buf_next(data, int, 1);
+  this->outbound = NULL;
+  this->outbound_head = 0;
+  this->outbound_count = 0;
+  this->outbound_capacity = 0;
+  this->outbound_progress = 0;
+  this->outbound_dropping = 0;
+  this->outbound_withheld = 0;
+  this->outbound_withheld_bytes = 0;
+  this->evicted = 0;
+  this->outbound_waiters = 0;
+  this->outbound_blocked_on = NULL;
+  this->wake_fd = -1;
+  this->mutex_created = 0;
+  this->modify_message = NULL;
+  this->modify_recipient = NULL;
+  this->modify_started = 0;
+  this->modify_deadline = 0;
+  this->reactor_state = 0;
+  this->attached_count = 0;
+  this->rings.map = NULL;
+  this->ring_hangup = 0;
+  this->coalesce_sender = 0;
+  this->references = 1;
+  buf_get_next(data, int, version);
+  /* Clients marshalled before version 1 have another layout. */
+  if (version != CLIENT_T_VERSION)
+    fail_if ((errno = EPROTO));
   buf_get_next(data, ssize_t, this->list_entry);
   buf_get_next(data, int, this->socket_fd);
   buf_get_next(data, int, this->open);
   buf_get_next(data, uint64_t, this->id);
+  buf_get_next(data, uint64_t, this->reply_timeout);
+  buf_get_next(data, int, this->accepts_lanes);
+  buf_get_next(data, int, this->binary);
+  buf_get_next(data, int, this->ring_fd);
+  buf_get_next(data, int, this->ring_data_bell);
+  buf_get_next(data, int, this->ring_room_bell);
+  buf_get_next(data, int, this->ring_writing);
   buf_get_next(data, size_t, n);
   if (n > 0)
     fail_if (mds_message_unmarshal(&(this->message), data));
@@ -240,26 +431,67 @@ size_t client_unmarshal(client_t* restrict this, char* restrict data)
       rc += n;
     }
   buf_get_next(data, size_t, n);
-  fail_if (xmalloc(this->multicasts, n, multicast_t));
-  for (i = 0; i < n; i++, this->multicasts_count++)
+  for (i = 0; i < n; i++)
     {
-      size_t m = multicast_unmarshal(this->multicasts + i, data);
-      fail_if (m == 0);
+      size_t m;
+      fail_if (xmalloc(multicast, 1, multicast_t));
+      if ((m = multicast_unmarshal(multicast, data)) == 0)
+	{
+	  saved_errno = errno;
+	  free(multicast);
+	  fail_if (errno = saved_errno, 1);
+	}
+      client_queue_multicast(this, multicast);
       data += m / sizeof(char);
       rc += m;
     }
-  buf_get_next(data, size_t, this->send_pending_size);
-  if (this->send_pending_size > 0)
+  buf_get_next(data, size_t, on_socket);
+  buf_get_next(data, size_t, this->outbound_pending);
+  if (this->outbound_pending > 0)
     {
-      fail_if (xmemdup(this->send_pending, data, this->send_pending_size, char));
-      data += this->send_pending_size, rc += this->send_pending_size * sizeof(char);
+      /* The queued messages are split where the ring starts to be used. */
+      fail_if (xmalloc(this->outbound, 2, outbound_message_t));
+      this->outbound_capacity = 2;
+      for (i = 0, n = 0; n < this->outbound_pending; i++)
+	{
+	  size_t m = ((i == 0) && (on_socket > 0)) ? on_socket : (this->outbound_pending - n);
+	  this->outbound[i].prefix = NULL;
+	  this->outbound[i].fd = -1;
+	  this->outbound[i].last_on_socket = (i == 0) && (on_socket > 0);
+	  this->outbound[i].sent = 0;
+	  this->outbound[i].needs_credit = 0;
+	  this->outbound[i].sender = 0;
+	  fail_if ((this->outbound[i].message = message_buffer_copy(data + n, m)) == NULL);
+	  this->outbound_count++;
+	  n += m;
+	}
+      data += this->outbound_pending, rc += this->outbound_pending * sizeof(char);
     }
+  buf_get_next(data, size_t, this->outbound_high_water);
+  buf_get_next(data, uint64_t, this->received_messages);
+  buf_get_next(data, uint64_t, this->received_bytes);
+  buf_get_next(data, uint64_t, this->sent_messages);
+  buf_get_next(data, uint64_t, this->sent_bytes);
+  buf_get_next(data, uint64_t, this->credit_messages);
+  buf_get_next(data, uint64_t, this->credit_bytes);
+  buf_get_next(data, uint64_t, this->send_window);
+  buf_get_next(data, uint64_t, this->send_owed);
   buf_get_next(data, size_t, n);
   if (n > 0)
-    mds_message_unmarshal(this->modify_message, data);
-  else
-    this->modify_message = NULL;
+    {
+      fail_if (xmalloc(this->modify_message, 1, mds_message_t));
+      if (mds_message_unmarshal(this->modify_message, data))
+	{
+	  saved_errno = errno;
+	  free(this->modify_message);
+	  this->modify_message = NULL;
+	  fail_if (errno = saved_errno, 1);
+	}
+    }
   rc += n * sizeof(char);
+  /* The memory survives the re-exec, but not its mapping. */
+  if (this->ring_fd >= 0)
+    fail_if (shm_rings_map(&(this->rings), this->ring_fd));
   return rc;
   
  fail:
@@ -270,10 +502,10 @@ size_t client_unmarshal(client_t* restrict this, char* restrict data)
   for (i = 0; i < this->interception_conditions_count; i++)
     free(this->interception_conditions[i].condition);
   free(this->interception_conditions);
-  for (i = 0; i < this->multicasts_count; i++)
-    multicast_destroy(this->multicasts + i);
-  free(this->multicasts);
-  free(this->send_pending);
+  free_multicasts(this);
+  for (i = 0; i < this->outbound_count; i++)
+    message_buffer_unref(this->outbound[i].message);
+  free(this->outbound);
   if (this->modify_message != NULL)
     {
       mds_message_destroy(this->modify_message);
@@ -291,11 +523,12 @@ size_t client_unmarshal(client_t* restrict this, char* restrict data)
  */
 size_t client_unmarshal_skip(char* restrict data)
 {
-  size_t n, c, rc = sizeof(ssize_t) + 3 * sizeof(int) + sizeof(uint64_t) + 5 * sizeof(size_t);
+  size_t n, c, rc = sizeof(ssize_t) + 9 * sizeof(int) + 10 * sizeof(uint64_t) + 7 * sizeof(size_t);
   buf_next(data, int, 1);
   buf_next(data, ssize_t, 1);
   buf_next(data, int, 2);
-  buf_next(data, uint64_t, 1);
+  buf_next(data, uint64_t, 2);
+  buf_next(data, int, 6);
   buf_get_next(data, size_t, n);
   data += n / sizeof(char);
   rc += n;
@@ -313,9 +546,12 @@ size_t client_unmarshal_skip(char* restrict data)
       data += n / sizeof(char);
       rc += n;
     }
+  buf_next(data, size_t, 1);
   buf_get_next(data, size_t, n);
   data += n;
   rc += n * sizeof(char);
+  buf_next(data, size_t, 1);
+  buf_next(data, uint64_t, 8);
   buf_get_next(data, size_t, n);
   rc += n * sizeof(char);
   return rc;
@@ -21,8 +21,10 @@
 
 #include "interception-condition.h"
 #include "multicast.h"
+#include "message-buffer.h"
 
 #include <libmdsserver/mds-message.h>
+#include <libmdsserver/shm-ring.h>
 
 #include <stdlib.h>
 #include <pthread.h>
@@ -31,7 +33,64 @@
 
 
 
-#define CLIENT_T_VERSION  0
+#define CLIENT_T_VERSION  1
+
+/**
+ * The maximum number of file descriptors that a client
+ * may have passed to the server without them being taken
+ */
+#define CLIENT_ATTACHMENTS_MAX  16
+
+/**
+ * A message queued to be sent to a client
+ */
+typedef struct outbound_message
+{
+  /**
+   * A header to send before the message, `NULL` if none,
+   * the client holds a reference to it
+   */
+  struct message_buffer* prefix;
+  
+  /**
+   * The message, the client holds a reference to it
+   */
+  struct message_buffer* message;
+  
+  /**
+   * A file descriptor that is passed along with
+   * the message, `-1` if none, the client owns it
+   * until it has been sent
+   */
+  int fd;
+  
+  /**
+   * Whether this is the last message that is sent over the
+   * socket, the messages after it are written to the ring
+   */
+  int last_on_socket;
+  
+  /**
+   * How much of the prefix and the message,
+   * together, that has been sent
+   */
+  size_t sent;
+  
+  /**
+   * Whether the message is a delivery that has to be covered by
+   * the client's credit before it is sent, this is cleared when
+   * the credit has been taken
+   */
+  int needs_credit;
+  
+  /**
+   * The `coalesce_sender` of the client whose multicast
+   * the message is, zero if it is sent by the server
+   */
+  uint64_t sender;
+  
+} outbound_message_t;
+
 
 /**
  * Client information structure
@@ -53,6 +112,18 @@ typedef struct client
    */
   int open;
   
+  /**
+   * The number of references to the client, one is held by
+   * the server until it destroys the client, and one by each
+   * multicast interception and fast lane that is to be sent
+   * to the client, the memory and the mutex are released
+   * with the last reference, but nothing else is, so those
+   * that hold a reference may only use the client after they
+   * have checked, under its mutex, that it is still open,
+   * it is next to `open`, which is read when it is taken
+   */
+  size_t references;
+  
   /**
    * Message read buffer for the client
    */
@@ -68,6 +139,14 @@ typedef struct client
    */
   uint64_t id;
   
+  /**
+   * A number, from the same sequence as the IDs, that identifies
+   * the client as the sender of messages, so that its messages can
+   * be coalesced, zero until the client first multicasts, only used
+   * by the thread that serves the client, this is not marshalled
+   */
+  uint64_t coalesce_sender;
+  
   /**
    * Mutex for sending data and other
    * actions that only affacts this client
@@ -91,49 +170,256 @@ typedef struct client
   size_t interception_conditions_count;
   
   /**
-   * Pending multicast messages
+   * Pending multicast messages, linked through their `next`,
+   * they are only queued and sent by the thread that serves
+   * the client, so the queue is not locked
    */
   struct multicast* multicasts;
   
+  /**
+   * The last pending multicast message, `NULL` if there are none
+   */
+  struct multicast* multicasts_last;
+  
   /**
    * The number of pending multicast messages
    */
   size_t multicasts_count;
   
   /**
-   * Messages pending to be sent (concatenated)
+   * Messages queued to be sent to the client, they
+   * are sent by the thread that serves the client
+   */
+  outbound_message_t* outbound;
+  
+  /**
+   * The index of the first message in `outbound`
+   * that has not been sent completely
+   */
+  size_t outbound_head;
+  
+  /**
+   * The number of elements in `outbound`, including
+   * those before `outbound_head`
+   */
+  size_t outbound_count;
+  
+  /**
+   * The allocation size of `outbound`
+   */
+  size_t outbound_capacity;
+  
+  /**
+   * The number of characters in `outbound` that have not been sent
+   */
+  size_t outbound_pending;
+  
+  /**
+   * The largest number of characters that
+   * have been pending in `outbound` at once
+   */
+  size_t outbound_high_water;
+  
+  /**
+   * When something was last sent to the client, or when something
+   * was queued for it when nothing was pending, in nanoseconds on
+   * the monotonic clock, zero if not known, the client has stalled
+   * if this is longer than `stall_timeout` ago and it has anything
+   * pending
+   */
+  uint64_t outbound_progress;
+  
+  /**
+   * Whether the client has stalled and the oldest messages queued
+   * for it are dropped to make room rather than letting multicasts
+   * wait, until its queue has been emptied
+   */
+  int outbound_dropping;
+  
+  /**
+   * Whether the client has been disconnected because it stalled
+   */
+  int evicted;
+  
+  /**
+   * The number of messages that have been received from the
+   * client, updated by the thread that reads from the client
+   */
+  uint64_t received_messages;
+  
+  /**
+   * The number of bytes that have been received from the
+   * client, updated by the thread that reads from the client
+   */
+  uint64_t received_bytes;
+  
+  /**
+   * The number of messages that have been sent to the client,
+   * updated by the thread that holds `mutex`
+   */
+  uint64_t sent_messages;
+  
+  /**
+   * The number of bytes that have been sent to the client,
+   * updated by the thread that holds `mutex`
+   */
+  uint64_t sent_bytes;
+  
+  /**
+   * The number of further deliveries that the client has granted,
+   * `UINT64_MAX` if the client does not limit them, guarded by `mutex`
+   */
+  uint64_t credit_messages;
+  
+  /**
+   * The number of further bytes of deliveries that the client has
+   * granted, `UINT64_MAX` if the client does not limit them, a message
+   * is delivered if any is left, so it may be overdrawn by the last
+   * message, guarded by `mutex`
+   */
+  uint64_t credit_bytes;
+  
+  /**
+   * The number of messages in `outbound` that wait for credit,
+   * multicasts wait for room while they are as many as the credit,
+   * this is not marshalled, as queued messages are sent without
+   * credit after a re-exec, guarded by `mutex`
+   */
+  size_t outbound_withheld;
+  
+  /**
+   * The total length of the messages in `outbound` that
+   * wait for credit, guarded by `mutex`
+   */
+  size_t outbound_withheld_bytes;
+  
+  /**
+   * The number of messages that the client may send ahead of
+   * the server's routing, zero if it does not use send credit
+   */
+  uint64_t send_window;
+  
+  /**
+   * The number of messages that have been received from the client
+   * since it was last granted send credit, only used by the thread
+   * that reads from the client
    */
-  char* send_pending;
+  uint64_t send_owed;
   
   /**
-   * The character length of the messages pending to be sent
+   * The number of times multicasts have started waiting for
+   * room in `outbound` since they were last resumed
    */
-  size_t send_pending_size;
+  size_t outbound_waiters;
+  
+  /**
+   * The client in whose outbound queue this client's multicast
+   * is waiting for room, guarded by `slave_mutex`
+   */
+  struct client* outbound_blocked_on;
+  
+  /**
+   * Event file descriptor that wakes the client's slave thread
+   * when it has something to do other than reading from the
+   * client, `-1` if the client is served by the reactor
+   */
+  int wake_fd;
   
   /**
    * Pending reply to the multicast interception
+   * that this client is waiting for
    */
   struct mds_message* modify_message;
   
   /**
-   * Mutex for `modify_message` 
+   * The recipient whose reply this client is waiting for,
+   * set to `NULL` if the recipient closes before replying
+   */
+  struct client* modify_recipient;
+  
+  /**
+   * When the multicast that this client is waiting on
+   * a reply to was queued for the recipient, in
+   * nanoseconds on the monotonic clock
+   */
+  uint64_t modify_started;
+  
+  /**
+   * When this client stops waiting for the reply and lets
+   * its multicast continue unmodified, in nanoseconds on
+   * the monotonic clock, zero if it waits indefinitely
+   */
+  uint64_t modify_deadline;
+  
+  /**
+   * Whether other clients may open fast lanes to this client
+   */
+  int accepts_lanes;
+  
+  /**
+   * Whether the messages sent to the client are in the binary
+   * framing, they are translated when they are queued
    */
-  pthread_mutex_t modify_mutex;
+  int binary;
   
   /**
-   * Condidition for `modify_message` 
+   * File descriptors that the client has passed to the
+   * server, and that have not been taken by a message,
+   * in order of arrival
    */
-  pthread_cond_t modify_cond;
+  int attached_fds[CLIENT_ATTACHMENTS_MAX];
   
   /**
-   * Whether `modify_mutex` has been initialised
+   * The number of elements in `attached_fds`
    */
-  int modify_mutex_created;
+  size_t attached_count;
   
   /**
-   * Whether `modify_cond` has been initialised
+   * The rings in memory shared with the client, `rings.map` is
+   * `NULL` unless messages from the client are read from its ring
    */
-  int modify_cond_created;
+  shm_rings_t rings;
+  
+  /**
+   * The file descriptor of the memory of `rings`, `-1` if none
+   */
+  int ring_fd;
+  
+  /**
+   * Event file descriptor that wakes the client when it
+   * waits for messages in the ring to it, `-1` if none
+   */
+  int ring_data_bell;
+  
+  /**
+   * Event file descriptor that wakes the client when it waits
+   * for room in the ring to the server, `-1` if none
+   */
+  int ring_room_bell;
+  
+  /**
+   * Whether messages to the client are written to its ring
+   */
+  int ring_writing;
+  
+  /**
+   * Whether the client's end of the socket has been closed, the
+   * socket is only read for doorbells once the ring is used
+   */
+  int ring_hangup;
+  
+  /**
+   * The number of milliseconds clients wait for this
+   * client to reply to messages that it may modify,
+   * zero for the server's default
+   */
+  uint64_t reply_timeout;
+  
+  /**
+   * The client's scheduling state in the reactor,
+   * a combination of the `REACTOR_*` flags
+   */
+  int reactor_state;
   
 } client_t;
 
@@ -146,8 +432,6 @@ typedef struct client
  * - message
  * - thread
  * - mutex
- * - modify_mutex
- * - modify_cond
  * 
  * The follow fields will be initialised to `-1`:
  * - list_entry
@@ -164,8 +448,6 @@ void client_initialise(client_t* restrict this);
  * This method initialises the following fields:
  * - thread
  * - mutex
- * - modify_mutex
- * - modify_cond
  * 
  * @param   this  The client information
  * @return        Zero on success, -1 on error
@@ -174,13 +456,44 @@ __attribute__((nonnull))
 int client_initialise_threading(client_t* restrict this);
 
 /**
- * Release all resources assoicated with a client
+ * Release all resources assoicated with a client, the
+ * memory is freed once the last reference is released
  * 
  * @param  this  The client information
  */
 __attribute__((nonnull))
 void client_destroy(client_t* restrict this);
 
+/**
+ * Add a reference to a client, so that it is not freed while
+ * it is used, this must be done while the client is listed,
+ * that is, while `client_lock` is held, or by one that holds
+ * another reference
+ * 
+ * @param   this  The client information
+ * @return        `this`
+ */
+__attribute__((nonnull))
+client_t* client_ref(client_t* restrict this);
+
+/**
+ * Release a reference to a client, and free
+ * it if it was the last reference
+ * 
+ * @param  this  The client information, may be `NULL`
+ */
+void client_unref(client_t* restrict this);
+
+/**
+ * Add a multicast message to the end of a client's queue of pending
+ * multicasts, this may only be done by the thread that serves the client
+ * 
+ * @param  this       The client information
+ * @param  multicast  The multicast message, the client takes ownership of it
+ */
+__attribute__((nonnull))
+void client_queue_multicast(client_t* restrict this, struct multicast* restrict multicast);
+
 /**
  * Calculate the buffer size need to marshal client information
  * 
@@ -0,0 +1,345 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "condition-trie.h"
+
+#include <libmdsserver/macros.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/**
+ * Get the child of a node for a character
+ * 
+ * @param   node    The node
+ * @param   symbol  The character, not `*`
+ * @return          The child, `NULL` if none
+ */
+__attribute__((pure, nonnull))
+static condition_trie_node_t* get_child(const condition_trie_node_t* restrict node, char symbol)
+{
+  const char* p = memchr(node->symbols, symbol, node->count);
+  return p == NULL ? NULL : node->children[p - node->symbols];
+}
+
+
+/**
+ * Get the child of a node for a character in a pattern, and create it if missing
+ * 
+ * @param   this    The condition trie
+ * @param   node    The node
+ * @param   symbol  The character
+ * @return          The child, `NULL` on error
+ */
+__attribute__((nonnull))
+static condition_trie_node_t* put_child(condition_trie_t* restrict this,
+					condition_trie_node_t* restrict node, char symbol)
+{
+  condition_trie_node_t* child;
+  condition_trie_node_t** new_children;
+  char* new_symbols;
+  
+  child = symbol == '*' ? node->wildcard : get_child(node, symbol);
+  if (child != NULL)
+    return child;
+  
+  fail_if (xcalloc(child, 1, condition_trie_node_t));
+  this->nodes++;
+  if (symbol == '*')
+    return child->is_wildcard = 1, node->wildcard = child;
+  
+  new_symbols = node->symbols;
+  fail_if (xrealloc(new_symbols, node->count + 1, char));
+  node->symbols = new_symbols;
+  new_children = node->children;
+  fail_if (xrealloc(new_children, node->count + 1, condition_trie_node_t*));
+  node->children = new_children;
+  
+  node->symbols[node->count] = symbol;
+  node->children[node->count++] = child;
+  return child;
+ fail:
+  if (child != NULL)
+    this->nodes--;
+  free(child);
+  return NULL;
+}
+
+
+/**
+ * Release a node and its descendants
+ * 
+ * @param   node         The node
+ * @param   value_freer  Function that frees a value, `NULL` if value should not be freed
+ * @return               The number of released nodes
+ */
+static size_t free_node(condition_trie_node_t* node, free_func* value_freer)
+{
+  size_t i, n = 1;
+  if (node == NULL)
+    return 0;
+  for (i = 0; i < node->count; i++)
+    n += free_node(node->children[i], value_freer);
+  n += free_node(node->wildcard, value_freer);
+  if ((value_freer != NULL) && (node->value != NULL))
+    value_freer((size_t)(node->value));
+  free(node->symbols);
+  free(node->children);
+  free(node);
+  return n;
+}
+
+
+/**
+ * Remove the pattern that ends with a descendant of a node,
+ * and release the nodes that no other pattern passes through
+ * 
+ * @param   this     The condition trie
+ * @param   node     The node
+ * @param   pattern  The rest of the pattern
+ * @return           Whether the node is no longer needed
+ */
+__attribute__((nonnull))
+static int remove_pattern(condition_trie_t* restrict this, condition_trie_node_t* restrict node,
+			  const char* restrict pattern)
+{
+  condition_trie_node_t* child;
+  size_t i;
+  
+  if (*pattern == '\0')
+    node->value = NULL;
+  else if (*pattern == '*')
+    {
+      while (pattern[1] == '*')
+	pattern++;
+      if ((node->wildcard != NULL) && remove_pattern(this, node->wildcard, pattern + 1))
+	this->nodes -= free_node(node->wildcard, NULL), node->wildcard = NULL;
+    }
+  else if ((child = get_child(node, *pattern)) != NULL)
+    if (remove_pattern(this, child, pattern + 1))
+      {
+	i = (size_t)((char*)memchr(node->symbols, *pattern, node->count) - node->symbols);
+	this->nodes -= free_node(child, NULL);
+	node->count--;
+	node->symbols[i] = node->symbols[node->count];
+	node->children[i] = node->children[node->count];
+      }
+  
+  return (node->value == NULL) && (node->count == 0) && (node->wildcard == NULL);
+}
+
+
+/**
+ * Add a node, and the nodes reached from it without
+ * consuming any character, to a set of states
+ * 
+ * @param  states  The set of states, with room for the nodes
+ * @param  n       The number of elements in `states`, updated by the function
+ * @param  node    The node
+ */
+__attribute__((nonnull))
+static void add_state(const condition_trie_node_t** restrict states, size_t* restrict n,
+		      const condition_trie_node_t* restrict node)
+{
+  size_t i;
+  for (; node != NULL; node = node->wildcard)
+    {
+      for (i = 0; i < *n; i++)
+	if (states[i] == node)
+	  return;
+      states[(*n)++] = node;
+    }
+}
+
+
+/**
+ * Create a condition trie
+ * 
+ * @param  this  Memory slot in which to store the new condition trie
+ */
+void condition_trie_create(condition_trie_t* restrict this)
+{
+  memset(this, 0, sizeof(condition_trie_t));
+  this->nodes = 1;
+}
+
+
+/**
+ * Release all resources in a condition trie
+ * 
+ * @param  this         The condition trie
+ * @param  value_freer  Function that frees a value, `NULL` if value should not be freed
+ */
+void condition_trie_destroy(condition_trie_t* restrict this, free_func* value_freer)
+{
+  size_t i;
+  for (i = 0; i < this->root.count; i++)
+    free_node(this->root.children[i], value_freer);
+  free_node(this->root.wildcard, value_freer);
+  if ((value_freer != NULL) && (this->root.value != NULL))
+    value_freer((size_t)(this->root.value));
+  free(this->root.symbols);
+  free(this->root.children);
+  memset(this, 0, sizeof(condition_trie_t));
+  this->nodes = 1;
+}
+
+
+/**
+ * Get the value of a pattern
+ * 
+ * @param   this     The condition trie
+ * @param   pattern  The pattern
+ * @return           The value of the pattern, `NULL` if the pattern is not in the trie
+ */
+void* condition_trie_get(const condition_trie_t* restrict this, const char* restrict pattern)
+{
+  const condition_trie_node_t* node = &(this->root);
+  for (; (node != NULL) && *pattern; pattern++)
+    if (*pattern != '*')
+      node = get_child(node, *pattern);
+    else if (pattern[1] != '*')
+      node = node->wildcard;
+  return node == NULL ? NULL : node->value;
+}
+
+
+/**
+ * Add a pattern, or replace its value
+ * 
+ * @param   this     The condition trie
+ * @param   pattern  The pattern
+ * @param   value    The value of the pattern, must not be `NULL`
+ * @return           Zero on success, -1 on error
+ */
+int condition_trie_put(condition_trie_t* restrict this, const char* restrict pattern, void* value)
+{
+  condition_trie_node_t* node = &(this->root);
+  size_t nodes = this->nodes;
+  const char* p;
+  int saved_errno;
+  
+  /* Consecutive `*`:s are the same as one `*`. */
+  for (p = pattern; *p; p++)
+    if ((*p != '*') || (p[1] != '*'))
+      fail_if ((node = put_child(this, node, *p)) == NULL);
+  
+  if (node->value == NULL)
+    this->patterns++;
+  node->value = value;
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (this->nodes != nodes)
+    remove_pattern(this, &(this->root), pattern);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Remove a pattern
+ * 
+ * @param  this     The condition trie
+ * @param  pattern  The pattern
+ */
+void condition_trie_remove(condition_trie_t* restrict this, const char* restrict pattern)
+{
+  if (condition_trie_get(this, pattern) == NULL)
+    return;
+  remove_pattern(this, &(this->root), pattern);
+  this->patterns--;
+}
+
+
+/**
+ * Find the values of all patterns that match any of a set of strings,
+ * a value is listed once per matching string
+ * 
+ * The trie is not modified, so matching can be done concurrently
+ * 
+ * @param   this      The condition trie
+ * @param   strings   The strings
+ * @param   count     The number of elements in `strings`
+ * @param   values    Array to which the values are appended, it is reallocated as needed
+ * @param   n         The number of elements in `*values`, updated by the function
+ * @param   capacity  The allocation size of `*values`, updated by the function
+ * @return            Zero on success, -1 on error
+ */
+int condition_trie_match(const condition_trie_t* restrict this, char** restrict strings, size_t count,
+			 void*** restrict values, size_t* restrict n, size_t* restrict capacity)
+{
+  const condition_trie_node_t** states = NULL;
+  const condition_trie_node_t** next = NULL;
+  const condition_trie_node_t** tmp;
+  const condition_trie_node_t* child;
+  size_t i, j, states_n, next_n;
+  const char* s;
+  void** new_values;
+  
+  if (this->patterns == 0)
+    return 0;
+  
+  /* The string is matched by following every path that it fits at the
+     same time, a node is at most once in the set of followed paths. */
+  fail_if (xmalloc(states, this->nodes, const condition_trie_node_t*));
+  fail_if (xmalloc(next, this->nodes, const condition_trie_node_t*));
+  
+  for (i = 0; i < count; i++)
+    {
+      states_n = 0;
+      add_state(states, &states_n, &(this->root));
+      for (s = strings[i]; *s && states_n; s++)
+	{
+	  next_n = 0;
+	  for (j = 0; j < states_n; j++)
+	    {
+	      /* A `*` may match more characters. */
+	      if (states[j]->is_wildcard)
+		add_state(next, &next_n, states[j]);
+	      if ((child = get_child(states[j], *s)) != NULL)
+		add_state(next, &next_n, child);
+	    }
+	  tmp = states, states = next, next = tmp;
+	  states_n = next_n;
+	}
+      
+      for (j = 0; j < states_n; j++)
+	if (states[j]->value != NULL)
+	  {
+	    if (*n == *capacity)
+	      {
+		new_values = *values;
+		fail_if (xrealloc(new_values, *capacity ? (*capacity << 1) : 8, void*));
+		*values = new_values;
+		*capacity = *capacity ? (*capacity << 1) : 8;
+	      }
+	    (*values)[(*n)++] = states[j]->value;
+	  }
+    }
+  
+  free(states);
+  free(next);
+  return 0;
+ fail:
+  free(states);
+  free(next);
+  return -1;
+}
+
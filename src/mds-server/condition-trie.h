@@ -0,0 +1,159 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_CONDITION_TRIE_H
+#define MDS_MDS_SERVER_CONDITION_TRIE_H
+
+
+#include <libmdsserver/table-common.h>
+
+#include <stddef.h>
+
+
+
+/**
+ * A node in a condition trie
+ */
+typedef struct condition_trie_node
+{
+  /**
+   * The character of each child in `children`
+   */
+  char* symbols;
+  
+  /**
+   * The children, except for `wildcard`
+   */
+  struct condition_trie_node** children;
+  
+  /**
+   * The number of elements in `symbols` and `children`
+   */
+  size_t count;
+  
+  /**
+   * The child for a `*`, `NULL` if none
+   */
+  struct condition_trie_node* wildcard;
+  
+  /**
+   * The value of the pattern that ends at this node, `NULL` if none
+   */
+  void* value;
+  
+  /**
+   * Whether this node is reached by a `*`
+   */
+  int is_wildcard;
+  
+} condition_trie_node_t;
+
+
+/**
+ * Patterns, in which `*` matches any, possibly empty, string,
+ * compiled into a trie, so that a string is matched against
+ * all patterns in one pass over it
+ */
+typedef struct condition_trie
+{
+  /**
+   * The root of the trie
+   */
+  condition_trie_node_t root;
+  
+  /**
+   * The number of patterns in the trie
+   */
+  size_t patterns;
+  
+  /**
+   * The number of nodes in the trie, including the root
+   */
+  size_t nodes;
+  
+} condition_trie_t;
+
+
+
+/**
+ * Create a condition trie
+ * 
+ * @param  this  Memory slot in which to store the new condition trie
+ */
+__attribute__((nonnull))
+void condition_trie_create(condition_trie_t* restrict this);
+
+/**
+ * Release all resources in a condition trie
+ * 
+ * @param  this         The condition trie
+ * @param  value_freer  Function that frees a value, `NULL` if value should not be freed
+ */
+__attribute__((nonnull(1)))
+void condition_trie_destroy(condition_trie_t* restrict this, free_func* value_freer);
+
+/**
+ * Get the value of a pattern
+ * 
+ * @param   this     The condition trie
+ * @param   pattern  The pattern
+ * @return           The value of the pattern, `NULL` if the pattern is not in the trie
+ */
+__attribute__((pure, nonnull))
+void* condition_trie_get(const condition_trie_t* restrict this, const char* restrict pattern);
+
+/**
+ * Add a pattern, or replace its value
+ * 
+ * @param   this     The condition trie
+ * @param   pattern  The pattern
+ * @param   value    The value of the pattern, must not be `NULL`
+ * @return           Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int condition_trie_put(condition_trie_t* restrict this, const char* restrict pattern, void* value);
+
+/**
+ * Remove a pattern
+ * 
+ * @param  this     The condition trie
+ * @param  pattern  The pattern
+ */
+__attribute__((nonnull))
+void condition_trie_remove(condition_trie_t* restrict this, const char* restrict pattern);
+
+/**
+ * Find the values of all patterns that match any of a set of strings,
+ * a value is listed once per matching string
+ * 
+ * The trie is not modified, so matching can be done concurrently
+ * 
+ * @param   this      The condition trie
+ * @param   strings   The strings
+ * @param   count     The number of elements in `strings`
+ * @param   values    Array to which the values are appended, it is reallocated as needed
+ * @param   n         The number of elements in `*values`, updated by the function
+ * @param   capacity  The allocation size of `*values`, updated by the function
+ * @return            Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int condition_trie_match(const condition_trie_t* restrict this, char** restrict strings, size_t count,
+			 void*** restrict values, size_t* restrict n, size_t* restrict capacity);
+
+
+#endif
+
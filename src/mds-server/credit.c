@@ -0,0 +1,160 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "credit.h"
+
+#include "globals.h"
+#include "sending.h"
+#include "message-buffer.h"
+
+#include <libmdsserver/macros.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+
+
+/**
+ * Add credit, without overflowing into unlimited credit
+ * 
+ * @param   credit  The current credit, `UINT64_MAX` if unlimited
+ * @param   grant   The granted credit
+ * @return          The new credit
+ */
+__attribute__((const))
+static uint64_t add_credit(uint64_t credit, uint64_t grant)
+{
+  if (credit == UINT64_MAX)
+    return grant;
+  return credit + grant < credit ? UINT64_MAX - 1 : credit + grant;
+}
+
+
+/**
+ * Grant a client credit for sending
+ * 
+ * @param   client      The client
+ * @param   messages    The number of messages the client may send in addition
+ * @param   message_id  The message ID of the request, `NULL` if not in response to one
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull(1)))
+static int send_credit(client_t* client, uint64_t messages, const char* message_id)
+{
+  message_buffer_t* message = NULL;
+  char* msgbuf = NULL;
+  size_t n;
+  int rc = -1;
+  
+  n = 20 + (message_id == NULL ? 0 : strlen(message_id));
+  n += sizeof("Command: credit\nMessages: \nIn response to: \n\n") / sizeof(char);
+  fail_if (xmalloc(msgbuf, n, char));
+  snprintf(msgbuf, n,
+	   "Command: credit\n"
+	   "Messages: %" PRIu64 "\n"
+	   "%s%s%s"
+	   "\n",
+	   messages,
+	   message_id == NULL ? "" : "In response to: ",
+	   message_id == NULL ? "" : message_id,
+	   message_id == NULL ? "" : "\n");
+  
+  /* A client's own messages are queued regardless of the limit, and do not take credit. */
+  fail_if ((message = message_buffer_create(msgbuf, strlen(msgbuf))) == NULL);
+  msgbuf = NULL;
+  fail_if (enqueue_outbound(client, NULL, message, -1, NULL) < 0);
+  rc = 0;
+  
+ fail:
+  free(msgbuf);
+  message_buffer_unref(message);
+  return rc;
+}
+
+
+/**
+ * Apply a `Command: credit` message from a client
+ * 
+ * The client grants the server further deliveries, and it may
+ * ask to be granted credit for sending, in which case it is
+ * granted a window of messages at once, and then more credit
+ * as its messages are routed, see `credit_replenish`
+ * 
+ * @param   client      The client
+ * @param   message_id  The message ID of the request
+ * @param   messages    The value of the `Messages` header, `NULL` if none,
+ *                      the number of further messages that may be delivered
+ * @param   bytes       The value of the `Bytes` header, `NULL` if none,
+ *                      the number of further bytes that may be delivered
+ * @param   window      The value of the `Window` header, `NULL` if none, the number
+ *                      of messages the client wants to be able to send ahead of
+ *                      the routing, zero to stop using send credit
+ * @return              Zero on success, -1 on error
+ */
+int credit_received(client_t* client, const char* message_id, const char* messages,
+		    const char* bytes, const char* window)
+{
+  /* The client's queue is flushed by the thread that serves it, which is the calling thread. */
+  if ((messages != NULL) || (bytes != NULL))
+    with_mutex (client->mutex,
+		if (messages != NULL)
+		  client->credit_messages = add_credit(client->credit_messages, atou64(messages));
+		if (bytes != NULL)
+		  client->credit_bytes = add_credit(client->credit_bytes, atou64(bytes));
+		);
+  
+  if (window == NULL)
+    return 0;
+  
+  /* The whole window is granted at once, the messages the client has sent
+     before it asked do not count, whether or not they have been routed. */
+  client->send_window = atou64(window);
+  client->send_owed = 0;
+  return client->send_window ? send_credit(client, client->send_window, message_id) : 0;
+}
+
+
+/**
+ * Grant a client that uses send credit as much credit as the messages
+ * that it has sent and that have been routed, once they are at least
+ * half of its window, this should be done when the client's multicasts
+ * have been sent, so that the client cannot send more than the server
+ * can route
+ * 
+ * Only the thread that reads from the client may call this function
+ * 
+ * @param   client  The client
+ * @return          Zero on success, -1 on error
+ */
+int credit_replenish(client_t* client)
+{
+  uint64_t owed = client->send_owed;
+  
+  if ((client->send_window == 0) || (owed == 0) || (owed < (client->send_window + 1) / 2))
+    return 0;
+  
+  fail_if (send_credit(client, owed, NULL));
+  client->send_owed = 0;
+  return 0;
+ fail:
+  return -1;
+}
+
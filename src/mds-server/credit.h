@@ -0,0 +1,67 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_CREDIT_H
+#define MDS_MDS_SERVER_CREDIT_H
+
+
+#include "client.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * Apply a `Command: credit` message from a client
+ * 
+ * The client grants the server further deliveries, and it may
+ * ask to be granted credit for sending, in which case it is
+ * granted a window of messages at once, and then more credit
+ * as its messages are routed, see `credit_replenish`
+ * 
+ * @param   client      The client
+ * @param   message_id  The message ID of the request
+ * @param   messages    The value of the `Messages` header, `NULL` if none,
+ *                      the number of further messages that may be delivered
+ * @param   bytes       The value of the `Bytes` header, `NULL` if none,
+ *                      the number of further bytes that may be delivered
+ * @param   window      The value of the `Window` header, `NULL` if none, the number
+ *                      of messages the client wants to be able to send ahead of
+ *                      the routing, zero to stop using send credit
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull(1, 2)))
+int credit_received(client_t* client, const char* message_id, const char* messages,
+		    const char* bytes, const char* window);
+
+/**
+ * Grant a client that uses send credit as much credit as the messages
+ * that it has sent and that have been routed, once they are at least
+ * half of its window, this should be done when the client's multicasts
+ * have been sent, so that the client cannot send more than the server
+ * can route
+ * 
+ * Only the thread that reads from the client may call this function
+ * 
+ * @param   client  The client
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int credit_replenish(client_t* client);
+
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fast-lane.h"
+
+#include "globals.h"
+#include "client.h"
+#include "sending.h"
+#include "message-buffer.h"
+#include "queued-interception.h"
+
+#include <libmdsserver/macros.h>
+#include <libmdsserver/util.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+
+/**
+ * Find an open client by its ID
+ * 
+ * The caller must hold `client_lock`, at least for reading
+ * 
+ * @param   id  The client's ID
+ * @return      The client, `NULL` if there is none
+ */
+__attribute__((pure))
+static client_t* client_by_id(uint64_t id)
+{
+  ssize_t node;
+  foreach_linked_list_node (client_list, node)
+    {
+      client_t* client = (client_t*)(void*)(client_list.values[node]);
+      if ((client->id == id) && client->open)
+	return client;
+    }
+  return NULL;
+}
+
+
+/**
+ * Check whether any client, other than the two ends of a
+ * lane, intercepts messages from one end addressed to the other
+ * 
+ * This is the interception plan for a message with only the
+ * `To` header, so it includes interceptions of the header
+ * with or without a value, those with wildcards that match
+ * it, and interceptions of all messages, but the messages
+ * sent over the lane may have any headers
+ * 
+ * The caller must hold `client_lock`, at least for reading
+ * 
+ * @param   sender     The end of the lane that sends the messages
+ * @param   recipient  The end of the lane that the messages are addressed to
+ * @return             1 if another client intercepts the messages,
+ *                     0 if not, -1 on error
+ */
+__attribute__((nonnull))
+static int intercepted_by_others(client_t* sender, client_t* recipient)
+{
+  char key[] = "To";
+  char header[sizeof("To: 4294967296:4294967296")];
+  char* keys[1] = { key };
+  char* headers[1] = { header };
+  queued_interception_t* interceptions;
+  size_t i, n;
+  int rc = 0;
+  
+  xsnprintf(header, "To: %" PRIu32 ":%" PRIu32,
+	    (uint32_t)(recipient->id >> 32),
+	    (uint32_t)(recipient->id >>  0));
+  
+  interceptions = interception_index_find(&interception_index, sender, keys, headers, 1, &n);
+  fail_if (interceptions == NULL);
+  for (i = 0; i < n; i++)
+    if (interceptions[i].client != recipient)
+      rc = 1;
+  queued_interceptions_free(interceptions, n);
+  
+  return rc;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Queue a message to a client
+ * 
+ * @param   recipient  The client
+ * @param   msgbuf     The message, will be freed
+ * @param   n          The length of the message
+ * @param   fd         File descriptor to pass along with the message, `-1` if none,
+ *                     it will be closed unless the message is queued
+ * @return             See `enqueue_outbound`
+ */
+__attribute__((nonnull))
+static int send_to_client(client_t* recipient, char* msgbuf, size_t n, int fd)
+{
+  message_buffer_t* message;
+  int r = -1;
+  
+  fail_if ((message = message_buffer_create(msgbuf, n)) == NULL);
+  msgbuf = NULL;
+  r = enqueue_outbound(recipient, NULL, message, fd, NULL);
+  message_buffer_unref(message);
+  
+ fail:
+  free(msgbuf);
+  if ((r != 0) && (fd >= 0))
+    close(fd);
+  return r;
+}
+
+
+/**
+ * Pass one end of a fast lane to a client
+ * 
+ * @param   recipient   The client
+ * @param   lane        The ID of the lane
+ * @param   other       The ID of the client at the other end of the lane
+ * @param   message_id  The message ID of the request if `recipient` requested
+ *                      the lane, `NULL` otherwise
+ * @param   fd          The end of the lane, it will be closed unless it is queued
+ * @return              See `enqueue_outbound`
+ */
+__attribute__((nonnull(1)))
+static int send_lane_end(client_t* recipient, uint64_t lane, uint64_t other, const char* message_id, int fd)
+{
+  char* msgbuf = NULL;
+  size_t n;
+  
+  n = 3 * 20 + (message_id == NULL ? 0 : strlen(message_id));
+  n += sizeof("Command: fast-lane\nLane: \nClient ID: :\nIn response to: \nAttachment: fd\n\n") / sizeof(char);
+  fail_if (xmalloc(msgbuf, n, char));
+  snprintf(msgbuf, n,
+	   "Command: fast-lane\n"
+	   "Lane: %" PRIu64 "\n"
+	   "Client ID: %" PRIu32 ":%" PRIu32 "\n"
+	   "%s%s%s"
+	   "Attachment: fd\n"
+	   "\n",
+	   lane,
+	   (uint32_t)(other >> 32),
+	   (uint32_t)(other >>  0),
+	   message_id == NULL ? "" : "In response to: ",
+	   message_id == NULL ? "" : message_id,
+	   message_id == NULL ? "" : "\n");
+  
+  return send_to_client(recipient, msgbuf, strlen(msgbuf), fd);
+ fail:
+  close(fd);
+  return -1;
+}
+
+
+/**
+ * Tell a client that its request for a fast lane failed
+ * 
+ * @param   client       The client
+ * @param   message_id   The message ID of the request
+ * @param   error        The error number
+ * @param   description  Description of the error
+ * @return               Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int send_lane_error(client_t* client, const char* message_id, int error, const char* description)
+{
+  char client_id[sizeof("4294967296:4294967296")];
+  char* msgbuf = NULL;
+  size_t size = 0, n;
+  
+  xsnprintf(client_id, "%" PRIu32 ":%" PRIu32,
+	    (uint32_t)(client->id >> 32),
+	    (uint32_t)(client->id >>  0));
+  
+  n = construct_error_message(client_id, message_id, "fast-lane", 0, error, description, &msgbuf, &size, 0);
+  fail_if (n == 0);
+  
+  return send_to_client(client, msgbuf, n, -1) < 0 ? -1 : 0;
+ fail:
+  free(msgbuf);
+  return -1;
+}
+
+
+/**
+ * Open a fast lane, a socket pair whose ends are passed to two
+ * clients so that they can send messages directly to each other,
+ * or send an error to the client that requested it
+ * 
+ * A lane is only opened if the peer accepts fast lanes, and no
+ * other client intercepts messages that either end addresses to
+ * the other with the `To` header. That is only checked now, the
+ * messages sent over the lane bypass interception, so clients that
+ * intercept other headers do not see them, and the lane is not
+ * closed if a client starts intercepting messages to either end
+ * 
+ * @param   client      The client that requested the lane
+ * @param   peer_id     The ID of the client at the other end of the lane
+ * @param   message_id  The message ID of the request
+ * @return              Zero on success, -1 on error
+ */
+int open_fast_lane(client_t* client, const char* peer_id, const char* message_id)
+{
+  const char* description = NULL;
+  client_t* peer = NULL;
+  uint64_t lane = 0;
+  int fds[2] = { -1, -1 };
+  int error = 0, r;
+  
+  /* Check that the lane may be opened. */
+  if ((strlen(peer_id) >= sizeof("4294967296:4294967296")) || (strchr(peer_id, ':') == NULL))
+    error = EINVAL, description = "invalid client ID";
+  else
+    {
+      /* The peer is referenced so that it is not freed when the lock
+	 is released, the lock is not held while the lane is passed to
+	 it because that locks the peer's mutex, and clients lock
+	 `client_lock` while holding their mutex to intercept messages. */
+      pthread_rwlock_rdlock(&client_lock);
+      peer = client_by_id(parse_client_id(peer_id));
+      if ((peer == NULL) || (peer == client) || (peer->id == 0))
+	error = ENOENT, description = "there is no such client", peer = NULL;
+      else if (__atomic_load_n(&(peer->accepts_lanes), __ATOMIC_RELAXED) == 0)
+	error = ECONNREFUSED, description = "the client does not accept fast lanes", peer = NULL;
+      else if ((r = intercepted_by_others(client, peer)) || (r = intercepted_by_others(peer, client)))
+	error = r < 0 ? errno : EACCES, description = "other clients intercept messages over the lane", peer = NULL;
+      else
+	{
+	  client_ref(peer);
+	  while ((lane = __atomic_fetch_add(&next_lane_id, 1, __ATOMIC_RELAXED)) == 0);
+	}
+      pthread_rwlock_unlock(&client_lock);
+    }
+  
+  if ((error == 0) && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    error = errno, description = "the lane could not be created";
+  
+  /* Pass the ends of the lane to the clients, the peer first so that
+     the requesting client gets an error if the peer has closed. */
+  if (error == 0)
+    {
+      r = send_lane_end(peer, lane, client->id, NULL, fds[1]);
+      if (r == 0)
+	{
+	  r = send_lane_end(client, lane, peer->id, message_id, fds[0]);
+	  client_unref(peer);
+	  return r < 0 ? -1 : 0;
+	}
+      close(fds[0]);
+      error = r < 0 ? errno : ECONNREFUSED, description = "the lane could not be passed to the client";
+    }
+  
+  client_unref(peer);
+  return send_lane_error(client, message_id, error, description);
+}
+
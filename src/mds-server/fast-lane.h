@@ -0,0 +1,46 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_FAST_LANE_H
+#define MDS_MDS_SERVER_FAST_LANE_H
+
+
+#include "client.h"
+
+
+/**
+ * Open a fast lane, a socket pair whose ends are passed to two
+ * clients so that they can send messages directly to each other,
+ * or send an error to the client that requested it
+ * 
+ * A lane is only opened if the peer accepts fast lanes, and no
+ * other client intercepts messages addressed to the peer. That
+ * is only checked now, the messages sent over the lane bypass
+ * interception, and the lane is not closed if a client starts
+ * intercepting messages to either end
+ * 
+ * @param   client      The client that requested the lane
+ * @param   peer_id     The ID of the client at the other end of the lane
+ * @param   message_id  The message ID of the request
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int open_fast_lane(client_t* client, const char* peer_id, const char* message_id);
+
+
+#endif
+
@@ -24,6 +24,50 @@
 volatile sig_atomic_t running = 1;
 
 
+/**
+ * Whether clients are served by the reactor rather
+ * than by one slave thread per client
+ */
+int reactor_enabled = 0;
+
+/**
+ * The number of threads the reactor uses
+ */
+size_t reactor_threads = 4;
+
+/**
+ * The number of bytes a client's outbound queue may
+ * hold before multicasts to it have to wait for room
+ */
+size_t outbound_limit = (size_t)1 << 20;
+
+/**
+ * The number of bytes of queued messages that
+ * are gathered into one system call, at most
+ */
+size_t send_budget = (size_t)64 << 10;
+
+/**
+ * The number of milliseconds clients wait for a reply to a
+ * message that the recipient may modify, unless the recipient
+ * has chosen otherwise, zero if they wait indefinitely
+ */
+uint64_t default_reply_timeout = 0;
+
+/**
+ * The number of milliseconds a client with a full outbound queue
+ * may go without receiving anything before it is disconnected, or
+ * before messages are dropped for it, zero if it may stall indefinitely
+ */
+uint64_t stall_timeout = 0;
+
+/**
+ * Whether the oldest messages queued for a stalled client are
+ * dropped, rather than that the client is disconnected
+ */
+int stall_drop = 0;
+
+
 /**
  * The number of running slaves
  */
@@ -39,6 +83,13 @@ pthread_mutex_t slave_mutex;
  */
 pthread_cond_t slave_cond;
 
+/**
+ * Read–write lock for `client_map`, `client_list` and
+ * `interception_index`, routing only reads them so
+ * any number of slaves may hold it for reading
+ */
+pthread_rwlock_t client_lock;
+
 /**
  * Map from client socket file descriptor to all information (`client_t`)
  */
@@ -50,27 +101,33 @@ fd_table_t client_map;
 linked_list_t client_list;
 
 /**
- * The next free ID for a client
+ * The next free ID for a client, updated atomically
  */
 uint64_t next_client_id = 1;
 
 /**
- * The next free ID for a message modifications
+ * The next free ID for a message modifications, updated atomically
  */
 uint64_t next_modify_id = 1;
 
+/**
+ * The next free ID for a fast lane, updated atomically
+ */
+uint64_t next_lane_id = 1;
+
 /**
  * Mutex for message modification
  */
 pthread_mutex_t modify_mutex;
 
 /**
- * Condition for message modification
+ * Map from modification ID to waiting client, that is,
+ * the client whose multicast is awaiting the reply
  */
-pthread_cond_t modify_cond;
+hash_table_t modify_map;
 
 /**
- * Map from modification ID to waiting client
+ * Index of the clients' interception conditions
  */
-hash_table_t modify_map;
+interception_index_t interception_index;
 
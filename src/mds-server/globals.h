@@ -20,6 +20,8 @@
 
 #include "../mds-base.h" /* Include here so other do not need to. */
 
+#include "interception-index.h"
+
 
 #include <libmdsserver/linked-list.h>
 #include <libmdsserver/hash-table.h>
@@ -31,7 +33,7 @@
 
 
 
-#define MDS_SERVER_VARS_VERSION  0
+#define MDS_SERVER_VARS_VERSION  1
 
 
 
@@ -41,6 +43,50 @@
 extern volatile sig_atomic_t running;
 
 
+/**
+ * Whether clients are served by the reactor rather
+ * than by one slave thread per client
+ */
+extern int reactor_enabled;
+
+/**
+ * The number of threads the reactor uses
+ */
+extern size_t reactor_threads;
+
+/**
+ * The number of bytes a client's outbound queue may
+ * hold before multicasts to it have to wait for room
+ */
+extern size_t outbound_limit;
+
+/**
+ * The number of bytes of queued messages that
+ * are gathered into one system call, at most
+ */
+extern size_t send_budget;
+
+/**
+ * The number of milliseconds clients wait for a reply to a
+ * message that the recipient may modify, unless the recipient
+ * has chosen otherwise, zero if they wait indefinitely
+ */
+extern uint64_t default_reply_timeout;
+
+/**
+ * The number of milliseconds a client with a full outbound queue
+ * may go without receiving anything before it is disconnected, or
+ * before messages are dropped for it, zero if it may stall indefinitely
+ */
+extern uint64_t stall_timeout;
+
+/**
+ * Whether the oldest messages queued for a stalled client are
+ * dropped, rather than that the client is disconnected
+ */
+extern int stall_drop;
+
+
 /**
  * The number of running slaves
  */
@@ -56,6 +102,13 @@ extern pthread_mutex_t slave_mutex;
  */
 extern pthread_cond_t slave_cond;
 
+/**
+ * Read–write lock for `client_map`, `client_list` and
+ * `interception_index`, routing only reads them so
+ * any number of slaves may hold it for reading
+ */
+extern pthread_rwlock_t client_lock;
+
 /**
  * Map from client socket file descriptor to all information (`client_t`)
  */
@@ -67,29 +120,35 @@ extern fd_table_t client_map;
 extern linked_list_t client_list;
 
 /**
- * The next free ID for a client
+ * The next free ID for a client, updated atomically
  */
 extern uint64_t next_client_id;
 
 /**
- * The next free ID for a message modifications
+ * The next free ID for a message modifications, updated atomically
  */
 extern uint64_t next_modify_id;
 
+/**
+ * The next free ID for a fast lane, updated atomically
+ */
+extern uint64_t next_lane_id;
+
 /**
  * Mutex for message modification
  */
 extern pthread_mutex_t modify_mutex;
 
 /**
- * Condition for message modification
+ * Map from modification ID to waiting client, that is,
+ * the client whose multicast is awaiting the reply
  */
-extern pthread_cond_t modify_cond;
+extern hash_table_t modify_map;
 
 /**
- * Map from modification ID to waiting client
+ * Index of the clients' interception conditions
  */
-extern hash_table_t modify_map;
+extern interception_index_t interception_index;
 
 
 #endif
@@ -0,0 +1,619 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interception-index.h"
+
+#include <libmdsserver/macros.h>
+#include <libmdsserver/hash-help.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+
+
+
+/**
+ * Get the subscriber list for a condition
+ * 
+ * @param   this       The interception index
+ * @param   condition  The condition
+ * @return             The subscriber list, `NULL` if there is none
+ */
+__attribute__((pure, nonnull))
+static interception_subscribers_t* get_subscribers(interception_index_t* restrict this,
+						   const char* condition)
+{
+  size_t address;
+  if (*condition == '\0')
+    return &(this->catchall);
+  if (strchr(condition, '*') != NULL)
+    return condition_trie_get(&(this->globs), condition);
+  address = hash_table_get(&(this->table), (size_t)(const void*)condition);
+  return (interception_subscribers_t*)(void*)address;
+}
+
+
+/**
+ * Make the subscriber list for a condition findable
+ * 
+ * @param   this  The interception index
+ * @param   list  The subscriber list, not the list for all messages
+ * @return        Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int list_subscribers(interception_index_t* restrict this, interception_subscribers_t* list)
+{
+  if (strchr(list->condition, '*') != NULL)
+    return condition_trie_put(&(this->globs), list->condition, list);
+  if ((hash_table_put(&(this->table), (size_t)(void*)(list->condition), (size_t)(void*)list) == 0) && errno)
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Make the subscriber list for a condition unfindable
+ * 
+ * @param  this  The interception index
+ * @param  list  The subscriber list, not the list for all messages
+ */
+__attribute__((nonnull))
+static void unlist_subscribers(interception_index_t* restrict this, interception_subscribers_t* list)
+{
+  if (strchr(list->condition, '*') != NULL)
+    condition_trie_remove(&(this->globs), list->condition);
+  else
+    hash_table_remove(&(this->table), (size_t)(void*)(list->condition));
+}
+
+
+/**
+ * Calculate the hash of a condition
+ * 
+ * @param   condition:const char*  The condition
+ * @return                         The hash of the condition
+ */
+__attribute__((pure))
+static size_t condition_hash(size_t condition)
+{
+  return string_hash((const char*)(void*)condition);
+}
+
+
+/**
+ * Check whether two conditions are equal
+ * 
+ * @param   a:char*  One of the conditions
+ * @param   b:char*  The other of the two conditions
+ * @return           Whether the conditions are equal
+ */
+__attribute__((pure))
+static int condition_comparator(size_t a, size_t b)
+{
+  if ((a == b) || (a == 0) || (b == 0))
+    return a == b;
+  return !strcmp((const char*)(void*)a, (const char*)(void*)b);
+}
+
+
+/**
+ * Release a subscriber list
+ * 
+ * @param  list  The subscriber list
+ */
+static void free_subscribers(size_t list)
+{
+  interception_subscribers_t* subscribers = (interception_subscribers_t*)(void*)list;
+  if (subscribers == NULL)
+    return;
+  free(subscribers->condition);
+  free(subscribers->subscribers);
+  free(subscribers);
+}
+
+
+/**
+ * Calculate the hash of a delivery plan's key
+ * 
+ * @param   plan:const interception_plan_t*  The delivery plan
+ * @return                                   The hash of the plan's key
+ */
+__attribute__((pure))
+static size_t plan_hash(size_t plan)
+{
+  return ((const interception_plan_t*)(void*)plan)->hash;
+}
+
+
+/**
+ * Check whether two delivery plans have the same key
+ * 
+ * @param   a:const interception_plan_t*  One of the plans
+ * @param   b:const interception_plan_t*  The other of the two plans
+ * @return                                Whether the plans' keys are equal
+ */
+__attribute__((pure))
+static int plan_comparator(size_t a, size_t b)
+{
+  const interception_plan_t* p = (const interception_plan_t*)(void*)a;
+  const interception_plan_t* q = (const interception_plan_t*)(void*)b;
+  return (p->lists_count == q->lists_count) &&
+    !memcmp(p->lists, q->lists, p->lists_count * sizeof(*(p->lists)));
+}
+
+
+/**
+ * Release a delivery plan
+ * 
+ * @param  plan  The delivery plan
+ */
+static void free_plan(size_t plan)
+{
+  interception_plan_t* this = (interception_plan_t*)(void*)plan;
+  if (this == NULL)
+    return;
+  free(this->lists);
+  free(this->interceptions);
+  free(this);
+}
+
+
+/**
+ * Remove all cached delivery plans, this must be done
+ * whenever the subscriptions change
+ * 
+ * @param  this  The interception index
+ */
+__attribute__((nonnull))
+static void flush_plans(interception_index_t* restrict this)
+{
+  hash_entry_t* entry;
+  size_t i;
+  
+  if ((this->plans.buckets == NULL) || (this->plans.size == 0))
+    return;
+  
+  foreach_hash_table_entry (this->plans, i, entry)
+    free_plan(entry->value);
+  hash_table_clear(&(this->plans));
+}
+
+
+/**
+ * Compare two queued interceptors by priority
+ * 
+ * @param   a:const queued_interception_t*  One of the interceptors
+ * @param   b:const queued_interception_t*  The other of the two interceptors
+ * @return                                  Negative if a before b, positive if a after b, otherwise zero
+ */
+__attribute__((nonnull))
+static int cmp_queued_interception(const void* a, const void* b)
+{
+  const queued_interception_t* p = b; /* Highest first, so swap them. */
+  const queued_interception_t* q = a;
+  return p->priority < q->priority ? -1 :
+         p->priority > q->priority ? 1 : 0;
+}
+
+
+/**
+ * Create an interception index
+ * 
+ * @param   this  Memory slot in which to store the new interception index
+ * @return        Non-zero on error, `errno` will have been set accordingly
+ */
+int interception_index_create(interception_index_t* restrict this)
+{
+  memset(&(this->catchall), 0, sizeof(interception_subscribers_t));
+  this->table.buckets = NULL;
+  this->plans.buckets = NULL;
+  this->plan_lock_created = 0;
+  condition_trie_create(&(this->globs));
+  fail_if (hash_table_create(&(this->table)));
+  this->table.key_comparator = condition_comparator;
+  this->table.hasher = condition_hash;
+  fail_if (hash_table_create(&(this->plans)));
+  this->plans.key_comparator = plan_comparator;
+  this->plans.hasher = plan_hash;
+  fail_if ((errno = pthread_rwlock_init(&(this->plan_lock), NULL)));
+  this->plan_lock_created = 1;
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Release all resources in an interception index, should
+ * be done even if `interception_index_create` fails
+ * 
+ * @param  this  The interception index
+ */
+void interception_index_destroy(interception_index_t* restrict this)
+{
+  /* The keys are owned by the values. */
+  if (this->table.buckets != NULL)
+    hash_table_destroy(&(this->table), NULL, free_subscribers);
+  this->table.buckets = NULL;
+  condition_trie_destroy(&(this->globs), free_subscribers);
+  if (this->plans.buckets != NULL)
+    {
+      flush_plans(this);
+      hash_table_destroy(&(this->plans), NULL, NULL);
+    }
+  this->plans.buckets = NULL;
+  if (this->plan_lock_created)
+    pthread_rwlock_destroy(&(this->plan_lock));
+  this->plan_lock_created = 0;
+  free(this->catchall.subscribers);
+  this->catchall.subscribers = NULL;
+  this->catchall.count = 0;
+  this->catchall.capacity = 0;
+}
+
+
+/**
+ * Add a condition for a client to the index, or
+ * update it if the client already has it
+ * 
+ * @param   this       The interception index
+ * @param   client     The intercepting client
+ * @param   condition  The header, optionally with value, to look for, or empty (not NULL) for all messages
+ * @param   priority   Interception priority
+ * @param   modifying  Whether the client may modify the messages
+ * @return             Zero on success, -1 on error
+ */
+int interception_index_put(interception_index_t* restrict this, struct client* client,
+			   const char* condition, int64_t priority, int modifying)
+{
+  interception_subscribers_t* list = get_subscribers(this, condition);
+  interception_subscriber_t* subscribers;
+  int saved_errno;
+  size_t i;
+  
+  /* The cached delivery plans may include the subscription, or may lack it. */
+  flush_plans(this);
+  
+  /* Create the list for the condition if this is its first subscriber. */
+  if (list == NULL)
+    {
+      fail_if (xcalloc(list, 1, interception_subscribers_t));
+      fail_if ((list->condition = strdup(condition)) == NULL);
+      fail_if (list_subscribers(this, list));
+    }
+  
+  /* Update the client's subscription if it already has one. */
+  for (i = 0; i < list->count; i++)
+    if (list->subscribers[i].client == client)
+      {
+	list->subscribers[i].priority = priority;
+	list->subscribers[i].modifying = modifying;
+	return 0;
+      }
+  
+  /* Grow the list. */
+  if (list->count == list->capacity)
+    {
+      subscribers = list->subscribers;
+      fail_if (xrealloc(subscribers, list->capacity == 0 ? 4 : (list->capacity << 1),
+			interception_subscriber_t));
+      list->subscribers = subscribers;
+      list->capacity = list->capacity == 0 ? 4 : (list->capacity << 1);
+    }
+  
+  /* Add the subscription. */
+  list->subscribers[list->count].client = client;
+  list->subscribers[list->count].priority = priority;
+  list->subscribers[list->count].modifying = modifying;
+  list->count++;
+  
+  return 0;
+ fail:
+  saved_errno = errno;
+  if ((list != NULL) && (list != &(this->catchall)) && (list->count == 0))
+    {
+      if (list->condition != NULL)
+	unlist_subscribers(this, list);
+      free_subscribers((size_t)(void*)list);
+    }
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Remove a condition for a client from the index
+ * 
+ * @param  this       The interception index
+ * @param  client     The intercepting client
+ * @param  condition  The header, optionally with value, to look for, or empty (not NULL) for all messages
+ */
+void interception_index_remove(interception_index_t* restrict this, struct client* client,
+			       const char* condition)
+{
+  interception_subscribers_t* list = get_subscribers(this, condition);
+  size_t i;
+  
+  if (list == NULL)
+    return;
+  
+  /* The subscriber list may be freed, and the cached delivery plans refer to it. */
+  flush_plans(this);
+  
+  /* Remove the subscription, the order of the subscribers is irrelevant. */
+  for (i = 0; i < list->count; i++)
+    if (list->subscribers[i].client == client)
+      {
+	list->subscribers[i] = list->subscribers[--(list->count)];
+	break;
+      }
+  
+  /* Do not keep conditions that no client has. */
+  if ((list->count == 0) && (list != &(this->catchall)))
+    {
+      unlist_subscribers(this, list);
+      free_subscribers((size_t)(void*)list);
+    }
+}
+
+
+/**
+ * Add all of a client's interception conditions to the index
+ * 
+ * @param   this    The interception index
+ * @param   client  The intercepting client
+ * @return          Zero on success, -1 on error
+ */
+int interception_index_put_client(interception_index_t* restrict this, struct client* client)
+{
+  interception_condition_t* conds = client->interception_conditions;
+  size_t i, n = client->interception_conditions_count;
+  
+  for (i = 0; i < n; i++)
+    fail_if (interception_index_put(this, client, conds[i].condition,
+				    conds[i].priority, conds[i].modifying));
+  
+  return 0;
+ fail:
+  return -1;
+}
+
+
+/**
+ * Remove all of a client's interception conditions from the index
+ * 
+ * @param  this    The interception index
+ * @param  client  The intercepting client
+ */
+void interception_index_remove_client(interception_index_t* restrict this, struct client* client)
+{
+  interception_condition_t* conds = client->interception_conditions;
+  size_t i, n = client->interception_conditions_count;
+  
+  for (i = 0; i < n; i++)
+    interception_index_remove(this, client, conds[i].condition);
+}
+
+
+/**
+ * Create a delivery plan for a set of matched conditions
+ * 
+ * @param   lists        The subscriber lists of the matched conditions, the plan takes ownership of them
+ * @param   lists_count  The number of elements in `lists`
+ * @param   hash         The hash of `lists`
+ * @return               The delivery plan, `NULL` on error, `lists` is not freed on error
+ */
+static interception_plan_t* build_plan(interception_subscribers_t** lists, size_t lists_count, size_t hash)
+{
+  interception_plan_t* plan = NULL;
+  queued_interception_t* interceptions = NULL;
+  size_t* listed = NULL;
+  size_t total = 0, n = 0;
+  size_t i, j, k, mask;
+  int saved_errno;
+  
+  for (i = 0; i < lists_count; i++)
+    total += lists[i]->count;
+  
+  /* Collect the subscribers, a client subscribed to multiple of the
+     conditions is listed once, the listed clients are found in a set,
+     of their positions plus one, that is private to the lookup. */
+  for (mask = 1; mask < 2 * total; mask <<= 1);
+  fail_if (xcalloc(listed, mask, size_t));
+  mask -= 1;
+  fail_if (xmalloc(interceptions, total + 1, queued_interception_t));
+  for (i = 0; i < lists_count; i++)
+    for (j = 0; j < lists[i]->count; j++)
+      {
+	interception_subscriber_t* subscriber = lists[i]->subscribers + j;
+	client_t* client = subscriber->client;
+	/* The clients are far larger than 64 bytes, so this spreads them. */
+	for (k = ((size_t)(void*)client >> 6) & mask; listed[k]; k = (k + 1) & mask)
+	  if (interceptions[listed[k] - 1].client == client)
+	    break;
+	if (listed[k])
+	  {
+	    queued_interception_t* known = interceptions + listed[k] - 1;
+	    known->modifying |= subscriber->modifying;
+	    if (subscriber->priority > known->priority)
+	      known->priority = subscriber->priority;
+	    continue;
+	  }
+	listed[k] = n + 1;
+	interceptions[n].client    = client;
+	interceptions[n].priority  = subscriber->priority;
+	interceptions[n].modifying = subscriber->modifying;
+	interceptions[n].delivered = 0;
+	n++;
+      }
+  free(listed), listed = NULL;
+  
+  /* Sort interceptors. */
+  qsort(interceptions, n, sizeof(queued_interception_t), cmp_queued_interception);
+  
+  fail_if (xmalloc(plan, 1, interception_plan_t));
+  plan->lists = lists;
+  plan->lists_count = lists_count;
+  plan->hash = hash;
+  plan->interceptions = interceptions;
+  plan->count = n;
+  return plan;
+  
+ fail:
+  saved_errno = errno;
+  free(listed);
+  free(interceptions);
+  return errno = saved_errno, NULL;
+}
+
+
+/**
+ * Copy the interceptors of a delivery plan, with
+ * a reference to each interceptor for the caller
+ * 
+ * @param   plan                     The delivery plan
+ * @param   sender                   The original sender of the message, it is not included
+ * @param   interceptions_count_out  Slot at where to store the number of interceptors
+ * @return                           The interceptors, `NULL` on error
+ */
+__attribute__((nonnull(1, 3)))
+static queued_interception_t* copy_plan(const interception_plan_t* restrict plan, const struct client* sender,
+					size_t* interceptions_count_out)
+{
+  queued_interception_t* interceptions;
+  size_t i, n = 0;
+  
+  fail_if (xmalloc(interceptions, plan->count + 1, queued_interception_t));
+  for (i = 0; i < plan->count; i++)
+    if ((plan->interceptions[i].client != sender) && plan->interceptions[i].client->open)
+      {
+	interceptions[n] = plan->interceptions[i];
+	client_ref(interceptions[n++].client);
+      }
+  
+  *interceptions_count_out = n;
+  return interceptions;
+ fail:
+  return NULL;
+}
+
+
+/**
+ * Get all interceptors who have at least one condition matching any of a set of acceptable patterns,
+ * a client that has multiple matching conditions is listed once, as modifying if any of the
+ * conditions is modifying, and with the highest priority among those conditions,
+ * the interceptors are sorted by priority, highest first
+ * 
+ * Lookups can be made concurrently, they only modify the cache of delivery plans
+ * 
+ * @param   this                     The interception index
+ * @param   sender                   The original sender of the message
+ * @param   keys                     The header names
+ * @param   headers                  The header name–value pairs
+ * @param   count                    The number of accepted patterns
+ * @param   interceptions_count_out  Slot at where to store the number of found interceptors
+ * @return                           The found interceptors, with a reference to each, which are
+ *                                   released with `queued_interceptions_free`, `NULL` on error
+ */
+queued_interception_t* interception_index_find(interception_index_t* restrict this,
+					       const struct client* sender, char** keys, char** headers,
+					       size_t count, size_t* interceptions_count_out)
+{
+  interception_subscribers_t** lists = NULL;
+  interception_subscribers_t** new_lists;
+  queued_interception_t* interceptions = NULL;
+  interception_subscribers_t* list;
+  void** globbed = NULL;
+  size_t globbed_count = 0, globbed_capacity = 0;
+  interception_plan_t key;
+  interception_plan_t* plan = NULL;
+  size_t lists_count = 0, hash, address;
+  size_t i;
+  int saved_errno;
+  
+  /* Look up the subscribers of each header, with and without its value. */
+  fail_if (xmalloc(lists, 2 * count + 1, interception_subscribers_t*));
+  if (this->catchall.count > 0)
+    lists[lists_count++] = &(this->catchall);
+  for (i = 0; i < count; i++)
+    {
+      if ((list = get_subscribers(this, keys[i])) != NULL)
+	lists[lists_count++] = list;
+      if ((list = get_subscribers(this, headers[i])) != NULL)
+	lists[lists_count++] = list;
+    }
+  
+  /* Match the headers against all conditions with `*` at once. */
+  if (this->globs.patterns > 0)
+    {
+      fail_if (condition_trie_match(&(this->globs), headers, count, &globbed, &globbed_count, &globbed_capacity));
+      if (globbed_count > 0)
+	{
+	  new_lists = lists;
+	  fail_if (xrealloc(new_lists, lists_count + globbed_count, interception_subscribers_t*));
+	  lists = new_lists;
+	  for (i = 0; i < globbed_count; i++)
+	    lists[lists_count++] = globbed[i];
+	}
+      free(globbed), globbed = NULL;
+    }
+  
+  /* The subscriber lists that were found identify the delivery plan. */
+  for (hash = lists_count, i = 0; i < lists_count; i++)
+    hash = hash * 31 + ((size_t)(void*)(lists[i]) >> 4);
+  key.lists = lists;
+  key.lists_count = lists_count;
+  key.hash = hash;
+  
+  /* Use the cached plan if there is one. */
+  pthread_rwlock_rdlock(&(this->plan_lock));
+  address = hash_table_get(&(this->plans), (size_t)(void*)&key);
+  if ((plan = (interception_plan_t*)(void*)address) != NULL)
+    interceptions = copy_plan(plan, sender, interceptions_count_out);
+  pthread_rwlock_unlock(&(this->plan_lock));
+  if (plan != NULL)
+    {
+      free(lists);
+      return interceptions;
+    }
+  
+  /* Otherwise, create the plan, and cache it. */
+  fail_if ((plan = build_plan(lists, lists_count, hash)) == NULL);
+  lists = NULL;
+  fail_if ((interceptions = copy_plan(plan, sender, interceptions_count_out)) == NULL);
+  pthread_rwlock_wrlock(&(this->plan_lock));
+  if (hash_table_contains_key(&(this->plans), (size_t)(void*)plan) == 0)
+    {
+      if (this->plans.size >= INTERCEPTION_INDEX_MAX_PLANS)
+	flush_plans(this);
+      /* If the plan cannot be cached, it is just not cached. */
+      if ((hash_table_put(&(this->plans), (size_t)(void*)plan, (size_t)(void*)plan) != 0) || !errno)
+	plan = NULL;
+    }
+  pthread_rwlock_unlock(&(this->plan_lock));
+  free_plan((size_t)(void*)plan);
+  
+  return interceptions;
+  
+ fail:
+  saved_errno = errno;
+  free(lists);
+  free(globbed);
+  free_plan((size_t)(void*)plan);
+  return errno = saved_errno, NULL;
+}
+
@@ -0,0 +1,273 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_INTERCEPTION_INDEX_H
+#define MDS_MDS_SERVER_INTERCEPTION_INDEX_H
+
+
+#include "client.h"
+#include "queued-interception.h"
+#include "condition-trie.h"
+
+#include <libmdsserver/hash-table.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+
+/**
+ * The maximum number of delivery plans that are cached,
+ * the cache is emptied when it is full
+ */
+#define INTERCEPTION_INDEX_MAX_PLANS  256
+
+
+/**
+ * A client that intercepts messages matching a condition
+ */
+typedef struct interception_subscriber
+{
+  /**
+   * The intercepting client
+   */
+  struct client* client;
+  
+  /**
+   * The interception priority
+   */
+  int64_t priority;
+  
+  /**
+   * Whether the messages may get modified by the client
+   */
+  int modifying;
+  
+} interception_subscriber_t;
+
+
+/**
+ * All clients that intercept messages matching a condition
+ */
+typedef struct interception_subscribers
+{
+  /**
+   * The condition, the header optionally with a value,
+   * empty for all messages
+   */
+  char* condition;
+  
+  /**
+   * The subscribers, at most one per client
+   */
+  interception_subscriber_t* subscribers;
+  
+  /**
+   * The number of elements in `subscribers`
+   */
+  size_t count;
+  
+  /**
+   * The allocation size of `subscribers`
+   */
+  size_t capacity;
+  
+} interception_subscribers_t;
+
+
+/**
+ * The interceptors, in delivery order, of the messages
+ * that match a specific set of conditions
+ */
+typedef struct interception_plan
+{
+  /**
+   * The subscriber lists of the matched conditions,
+   * in the order they were found, this is the key
+   */
+  interception_subscribers_t** lists;
+  
+  /**
+   * The number of elements in `lists`
+   */
+  size_t lists_count;
+  
+  /**
+   * The hash of `lists`
+   */
+  size_t hash;
+  
+  /**
+   * The interceptors, highest priority first, the sender
+   * of a message is removed when the plan is copied
+   */
+  queued_interception_t* interceptions;
+  
+  /**
+   * The number of elements in `interceptions`
+   */
+  size_t count;
+  
+} interception_plan_t;
+
+
+/**
+ * Index of all clients' interception conditions,
+ * this lets us find the interceptors of a message
+ * by looking up its headers rather than by testing
+ * every condition of every client
+ * 
+ * The index is not marshalled, it is rebuilt from
+ * the clients' conditions after a re-exec.
+ * 
+ * Most messages have the same few shapes, so the sorted
+ * interceptors of each set of matching conditions are
+ * cached as a delivery plan. The index must not be
+ * modified concurrently with lookups.
+ */
+typedef struct interception_index
+{
+  /**
+   * Map from condition, the header optionally with
+   * a value, to `interception_subscribers_t*`, for
+   * conditions without `*`
+   */
+  hash_table_t table;
+  
+  /**
+   * The `interception_subscribers_t*` of conditions with
+   * `*`, which matches any, possibly empty, string, these
+   * are matched against the headers' name–value pairs
+   */
+  condition_trie_t globs;
+  
+  /**
+   * The clients that intercept all messages
+   */
+  interception_subscribers_t catchall;
+  
+  /**
+   * Cache of delivery plans, maps from and to `interception_plan_t*`,
+   * it is emptied whenever the index is modified
+   */
+  hash_table_t plans;
+  
+  /**
+   * Lock for `plans`, lookups only read the rest of
+   * the index, but may add plans to the cache
+   */
+  pthread_rwlock_t plan_lock;
+  
+  /**
+   * Whether `plan_lock` has been created
+   */
+  int plan_lock_created;
+  
+} interception_index_t;
+
+
+
+/**
+ * Create an interception index
+ * 
+ * @param   this  Memory slot in which to store the new interception index
+ * @return        Non-zero on error, `errno` will have been set accordingly
+ */
+__attribute__((nonnull))
+int interception_index_create(interception_index_t* restrict this);
+
+/**
+ * Release all resources in an interception index, should
+ * be done even if `interception_index_create` fails
+ * 
+ * @param  this  The interception index
+ */
+__attribute__((nonnull))
+void interception_index_destroy(interception_index_t* restrict this);
+
+/**
+ * Add a condition for a client to the index, or
+ * update it if the client already has it
+ * 
+ * @param   this       The interception index
+ * @param   client     The intercepting client
+ * @param   condition  The header, optionally with value, to look for, or empty (not NULL) for all messages,
+ *                     `*` matches any, possibly empty, string
+ * @param   priority   Interception priority
+ * @param   modifying  Whether the client may modify the messages
+ * @return             Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int interception_index_put(interception_index_t* restrict this, struct client* client,
+			   const char* condition, int64_t priority, int modifying);
+
+/**
+ * Remove a condition for a client from the index
+ * 
+ * @param  this       The interception index
+ * @param  client     The intercepting client
+ * @param  condition  The header, optionally with value, to look for, or empty (not NULL) for all messages
+ */
+__attribute__((nonnull))
+void interception_index_remove(interception_index_t* restrict this, struct client* client,
+			       const char* condition);
+
+/**
+ * Add all of a client's interception conditions to the index
+ * 
+ * @param   this    The interception index
+ * @param   client  The intercepting client
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int interception_index_put_client(interception_index_t* restrict this, struct client* client);
+
+/**
+ * Remove all of a client's interception conditions from the index
+ * 
+ * @param  this    The interception index
+ * @param  client  The intercepting client
+ */
+__attribute__((nonnull))
+void interception_index_remove_client(interception_index_t* restrict this, struct client* client);
+
+/**
+ * Get all interceptors who have at least one condition matching any of a set of acceptable patterns,
+ * a client that has multiple matching conditions is listed once, as modifying if any of the
+ * conditions is modifying, and with the highest priority among those conditions,
+ * the interceptors are sorted by priority, highest first
+ * 
+ * Lookups can be made concurrently, they only modify the cache of delivery plans
+ * 
+ * @param   this                     The interception index
+ * @param   sender                   The original sender of the message
+ * @param   keys                     The header names
+ * @param   headers                  The header name–value pairs
+ * @param   count                    The number of accepted patterns
+ * @param   interceptions_count_out  Slot at where to store the number of found interceptors
+ * @return                           The found interceptors, with a reference to each, which are
+ *                                   released with `queued_interceptions_free`, `NULL` on error
+ */
+__attribute__((nonnull(1, 6)))
+queued_interception_t* interception_index_find(interception_index_t* restrict this,
+					       const struct client* sender, char** keys, char** headers,
+					       size_t count, size_t* interceptions_count_out);
+
+
+#endif
+
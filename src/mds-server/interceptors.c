@@ -46,7 +46,7 @@ static void remove_intercept_condition(client_t* client, size_t index)
   
   /* Remove the condition from the list. */
   free(conds[index].condition);
-  memmove(conds + index, conds + index + 1, --n - index);
+  memmove(conds + index, conds + index + 1, (--n - index) * sizeof(interception_condition_t));
   client->interception_conditions_count--;
   
   /* Shrink the list. */
@@ -77,6 +77,7 @@ void add_intercept_condition(client_t* client, char* condition, int64_t priority
   size_t n = client->interception_conditions_count;
   interception_condition_t* conds = client->interception_conditions;
   ssize_t nonmodifying = -1;
+  int indexed;
   char* header = condition;
   char* colon = NULL;
   char* value;
@@ -107,18 +108,24 @@ void add_intercept_condition(client_t* client, char* condition, int64_t priority
 	  /* Look for the first non-modifying, this is a part of the
 	     optimisation where we put all modifying conditions at the
 	     beginning. */
-	  if ((nonmodifying < 0) && conds[i].modifying)
+	  if ((nonmodifying < 0) && (conds[i].modifying == 0))
 	    nonmodifying = (ssize_t)i;
 	  continue;
 	}
       
       if (stop)
-	remove_intercept_condition(client, i);
+	{
+	  with_wrlock (client_lock, interception_index_remove(&interception_index, client, condition););
+	  remove_intercept_condition(client, i);
+	}
       else
 	{
 	  /* Update parameters. */
 	  conds[i].priority = priority;
 	  conds[i].modifying = modifying;
+	  with_wrlock (client_lock,
+		       if (interception_index_put(&interception_index, client, condition, priority, modifying))
+			 xperror(*argv););
 	  
 	  if (modifying && (nonmodifying >= 0))
 	    {
@@ -145,7 +152,14 @@ void add_intercept_condition(client_t* client, char* condition, int64_t priority
       
       /* Grow the interception condition list. */
       fail_if (xrealloc(conds, n + 1, interception_condition_t));
-      client->interception_conditions = conds; 
+      client->interception_conditions = conds;
+      
+      /* Make the condition visible to the message routing. */
+      with_wrlock (client_lock,
+		   indexed = interception_index_put(&interception_index, client, condition,
+						    priority, modifying) == 0;);
+      fail_if (!indexed);
+      
       /* Store condition. */
       client->interception_conditions_count++;
       conds[n].condition = condition;
@@ -176,120 +190,23 @@ void add_intercept_condition(client_t* client, char* condition, int64_t priority
 
 
 /**
- * Check if a condition matches any of a set of accepted patterns
+ * Get all interceptors who have at least one condition matching any of a set of acceptable patterns,
+ * sorted by priority, highest first
  * 
- * @param   cond     The condition
- * @param   hashes   The hashes of the accepted header names
- * @param   keys     The header names
- * @param   headers  The header name–value pairs
- * @param   count    The number of accepted patterns
- * @return           Evaluates to true if and only if a matching pattern was found
- */
-int is_condition_matching(interception_condition_t* cond, size_t* hashes,
-			  char** keys, char** headers, size_t count)
-{
-  size_t i;
-  for (i = 0; i < count; i++)
-    if (*(cond->condition) == '\0')
-      return 1;
-    else if ((cond->header_hash == hashes[i]) &&
-	     (strequals(cond->condition, keys[i]) ||
-	      strequals(cond->condition, headers[i])))
-      return 1;
-  return 0;
-}
-
-
-/**
- * Find a matching condition to any of a set of acceptable conditions
- * 
- * @param   client            The intercepting client
- * @param   hashes            The hashes of the accepted header names
- * @param   keys              The header names
- * @param   headers           The header name–value pairs
- * @param   count             The number of accepted patterns
- * @param   interception_out  Storage slot for found interception
- * @return                    -1 on error, otherwise: evalutes to true iff a matching condition was found
- */
-int find_matching_condition(client_t* client, size_t* hashes, char** keys, char** headers,
-			    size_t count, queued_interception_t* interception_out)
-{
-  pthread_mutex_t mutex = client->mutex;
-  interception_condition_t* conds = client->interception_conditions;
-  size_t n = 0, i;
-  
-  fail_if ((errno = pthread_mutex_lock(&(mutex))));
-  
-  /* Look for a matching condition. */
-  if (client->open)
-    n = client->interception_conditions_count;
-  for (i = 0; i < n; i++)
-    if (is_condition_matching(conds + i, hashes, keys, headers, count))
-      {
-	/* Report matching condition. */
-	interception_out->client    = client;
-	interception_out->priority  = conds[i].priority;
-	interception_out->modifying = conds[i].modifying;
-	break;
-      }
-  
-  pthread_mutex_unlock(&(mutex));
-  
-  return i < n;
- fail:
-  return -1;
-}
-
-
-/**
- * Get all interceptors who have at least one condition matching any of a set of acceptable patterns
+ * The caller must hold `client_lock`, at least for reading
  * 
  * @param   sender                   The original sender of the message
- * @param   hashes                   The hashes of the accepted header names
  * @param   keys                     The header names
  * @param   headers                  The header name–value pairs
  * @param   count                    The number of accepted patterns
  * @param   interceptions_count_out  Slot at where to store the number of found interceptors
- * @return                           The found interceptors, `NULL` on error
+ * @return                           The found interceptors, with a reference to each, which are
+ *                                   released with `queued_interceptions_free`, `NULL` on error
  */
-queued_interception_t* get_interceptors(client_t* sender, size_t* hashes, char** keys, char** headers,
+queued_interception_t* get_interceptors(client_t* sender, char** keys, char** headers,
 					size_t count, size_t* interceptions_count_out)
 {
-  queued_interception_t* interceptions = NULL;
-  size_t interceptions_count = 0, n = 0;
-  ssize_t node;
-  int saved_errno;
-  
-  /* Count clients. */
-  foreach_linked_list_node (client_list, node)
-    n++;
-  
-  /* Allocate interceptor list. */
-  fail_if (xmalloc(interceptions, n, queued_interception_t));
-  
-  /* Search clients. */
-  foreach_linked_list_node (client_list, node)
-    {
-      client_t* client = (client_t*)(void*)(client_list.values[node]);
-      
-      /* Look for and list a matching condition. */
-      if (client->open && (client != sender))
-	{
-	  int r = find_matching_condition(client, hashes, keys, headers, count,
-					  interceptions + interceptions_count);
-	  fail_if (r == -1);
-	  if (r)
-	    /* List client of there was a matching condition. */
-	    interceptions_count++;
-	}
-    }
-  
-  *interceptions_count_out = interceptions_count;
-  return interceptions;
-  
- fail:
-  saved_errno = errno;
-  free(interceptions);
-  return errno = saved_errno, NULL;
+  return interception_index_find(&interception_index, sender, keys, headers,
+				 count, interceptions_count_out);
 }
 
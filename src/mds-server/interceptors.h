@@ -41,49 +41,21 @@ void add_intercept_condition(client_t* client, char* condition, int64_t priority
 
 
 /**
- * Check if a condition matches any of a set of accepted patterns
+ * Get all interceptors who have at least one condition matching any of a set of acceptable patterns,
+ * sorted by priority, highest first
  * 
- * @param   cond     The condition
- * @param   hashes   The hashes of the accepted header names
- * @param   keys     The header names
- * @param   headers  The header name–value pairs
- * @param   count    The number of accepted patterns
- * @return           Evaluates to true if and only if a matching pattern was found
- */
-__attribute__((pure, nonnull(1)))
-int is_condition_matching(interception_condition_t* cond, size_t* hashes,
-			  char** keys, char** headers, size_t count);
-
-
-/**
- * Find a matching condition to any of a set of acceptable conditions
- * 
- * @param   client            The intercepting client
- * @param   hashes            The hashes of the accepted header names
- * @param   keys              The header names
- * @param   headers           The header name–value pairs
- * @param   count             The number of accepted patterns
- * @param   interception_out  Storage slot for found interception
- * @return                    -1 on error, otherwise: evalutes to true iff a matching condition was found
- */
-__attribute__((pure, nonnull(1, 6)))
-int find_matching_condition(client_t* client, size_t* hashes, char** keys, char** headers,
-			    size_t count, queued_interception_t* interception_out);
-
-
-/**
- * Get all interceptors who have at least one condition matching any of a set of acceptable patterns
+ * The caller must hold `client_lock`, at least for reading
  * 
  * @param   sender                   The original sender of the message
- * @param   hashes                   The hashes of the accepted header names
  * @param   keys                     The header names
  * @param   headers                  The header name–value pairs
  * @param   count                    The number of accepted patterns
  * @param   interceptions_count_out  Slot at where to store the number of found interceptors
- * @return                           The found interceptors, `NULL` on error
+ * @return                           The found interceptors, with a reference to each, which are
+ *                                   released with `queued_interceptions_free`, `NULL` on error
  */
-__attribute__((pure, nonnull(1, 6)))
-queued_interception_t* get_interceptors(client_t* sender, size_t* hashes, char** keys, char** headers,
+__attribute__((nonnull(1, 5)))
+queued_interception_t* get_interceptors(client_t* sender, char** keys, char** headers,
 					size_t count, size_t* interceptions_count_out);
 
 #endif
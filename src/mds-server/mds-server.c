@@ -26,6 +26,8 @@
 #include "sending.h"
 #include "slavery.h"
 #include "receiving.h"
+#include "reactor.h"
+#include "stats.h"
 
 #include <libmdsserver/config.h>
 #include <libmdsserver/linked-list.h>
@@ -33,16 +35,19 @@
 #include <libmdsserver/fd-table.h>
 #include <libmdsserver/macros.h>
 #include <libmdsserver/util.h>
-#include <libmdsserver/hash-help.h>
+#include <libmdsserver/scan.h>
 
 #include <stdio.h>
 #include <limits.h>
 #include <unistd.h>
 #include <pwd.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <dirent.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
 
 
 /**
@@ -63,14 +68,16 @@ server_characteristics_t server_characteristics =
 
 
 
-#define __free(I)                                           \
-  if (I >  0)  pthread_mutex_destroy(&slave_mutex);         \
-  if (I >  1)  pthread_cond_destroy(&slave_cond);           \
-  if (I >  2)  pthread_mutex_destroy(&modify_mutex);        \
-  if (I >  3)  pthread_cond_destroy(&modify_cond);          \
-  if (I >= 4)  hash_table_destroy(&modify_map, NULL, NULL); \
-  if (I >= 5)  fd_table_destroy(&client_map, NULL, NULL);   \
-  if (I >= 6)  linked_list_destroy(&client_list)
+#define __free(I)                                               \
+  if (I >  0)  pthread_mutex_destroy(&slave_mutex);             \
+  if (I >  1)  pthread_cond_destroy(&slave_cond);               \
+  if (I >  2)  pthread_rwlock_destroy(&client_lock);            \
+  if (I >  3)  pthread_mutex_destroy(&modify_mutex);            \
+  if (I >= 4)  hash_table_destroy(&modify_map, NULL, NULL);     \
+  if (I >= 5)  interception_index_destroy(&interception_index); \
+  if (I >= 6)  fd_table_destroy(&client_map, NULL, NULL);       \
+  if (I >= 7)  linked_list_destroy(&client_list);              \
+  if (I >= 8)  stats_destroy()
   
 #define error_if(I, CONDITION)  \
   if (CONDITION)  { xperror(*argv); __free(I); return 1; }
@@ -106,6 +113,51 @@ int preinitialise_server(void)
 	}
       else if (startswith(arg, "--alarm=")) /* Schedule an alarm signal for forced abort. */
 	alarm((unsigned)min(atou(arg + strlen("--alarm=")), 60)); /* At most 1 minute. */
+      else if (strequals(arg, "--reactor")) /* Multiplex clients with a few threads. */
+	reactor_enabled = 1;
+      else if (startswith(arg, "--reactor-threads=")) /* Number of threads, implies --reactor. */
+	{
+	  int threads;
+	  exit_if (strict_atoi(arg += strlen("--reactor-threads="), &threads, 1, 1024) < 0,
+		   eprintf("invalid value for %s: %s.", "--reactor-threads", arg););
+	  reactor_threads = (size_t)threads;
+	  reactor_enabled = 1;
+	}
+      else if (startswith(arg, "--outbound-limit=")) /* Bytes queued for a client before senders wait. */
+	{
+	  int limit;
+	  exit_if (strict_atoi(arg += strlen("--outbound-limit="), &limit, 1, INT_MAX) < 0,
+		   eprintf("invalid value for %s: %s.", "--outbound-limit", arg););
+	  outbound_limit = (size_t)limit;
+	}
+      else if (startswith(arg, "--send-budget=")) /* Bytes gathered into one send at most. */
+	{
+	  int budget;
+	  exit_if (strict_atoi(arg += strlen("--send-budget="), &budget, 1, INT_MAX) < 0,
+		   eprintf("invalid value for %s: %s.", "--send-budget", arg););
+	  send_budget = (size_t)budget;
+	}
+      else if (startswith(arg, "--reply-timeout=")) /* Milliseconds to wait for modifications, 0 for ever. */
+	{
+	  int timeout;
+	  exit_if (strict_atoi(arg += strlen("--reply-timeout="), &timeout, 0, INT_MAX) < 0,
+		   eprintf("invalid value for %s: %s.", "--reply-timeout", arg););
+	  default_reply_timeout = (uint64_t)timeout;
+	}
+      else if (startswith(arg, "--stall-timeout=")) /* Milliseconds a full client may stall, 0 for ever. */
+	{
+	  int timeout;
+	  exit_if (strict_atoi(arg += strlen("--stall-timeout="), &timeout, 0, INT_MAX) < 0,
+		   eprintf("invalid value for %s: %s.", "--stall-timeout", arg););
+	  stall_timeout = (uint64_t)timeout;
+	}
+      else if (startswith(arg, "--stall-policy=")) /* What to do with stalled clients. */
+	{
+	  arg += strlen("--stall-policy=");
+	  exit_if (!strequals(arg, "close") && !strequals(arg, "drop"),
+		   eprintf("invalid value for %s: %s.", "--stall-policy", arg););
+	  stall_drop = strequals(arg, "drop");
+	}
       else
 	if (!strequals(arg, "--initial-spawn") && !strequals(arg, "--respawn"))
 	  /* Not recognised, it is probably for another server. */
@@ -139,11 +191,16 @@ int preinitialise_server(void)
   error_if (0, (errno = pthread_mutex_init(&slave_mutex, NULL)));
   error_if (1, (errno = pthread_cond_init(&slave_cond, NULL)));
   
-  /* Create mutex, condition and map for message modification. */
-  error_if (2, (errno = pthread_mutex_init(&modify_mutex, NULL)));
-  error_if (3, (errno = pthread_cond_init(&modify_cond, NULL)));
+  /* Create lock for the list, table and interception index of clients. */
+  error_if (2, (errno = pthread_rwlock_init(&client_lock, NULL)));
+  
+  /* Create mutex and map for message modification. */
+  error_if (3, (errno = pthread_mutex_init(&modify_mutex, NULL)));
   error_if (4, hash_table_create(&modify_map));
   
+  /* Create index of interception conditions. */
+  error_if (5, interception_index_create(&interception_index));
+  
   
   return 0;
   
@@ -162,8 +219,8 @@ int preinitialise_server(void)
 int initialise_server(void)
 {
   /* Create list and table of clients. */
-  error_if (5, fd_table_create(&client_map));
-  error_if (6, linked_list_create(&client_list, 32));
+  error_if (6, fd_table_create(&client_map));
+  error_if (7, linked_list_create(&client_list, 32));
   
   return 0;
 }
@@ -189,13 +246,24 @@ int __attribute__((const)) postinitialise_server(void)
  */
 int master_loop(void)
 {
+  /* Let the reactor serve the clients, if enabled. */
+  if (reactor_enabled)
+    {
+      if (reactor_run())
+	{
+	  __free(9999);
+	  return 1;
+	}
+      goto done;
+    }
+  
   /* Accepting incoming connections and take care of dangers. */
   while (running && (terminating == 0))
     {
       if (danger)
 	{
 	  danger = 0;
-	  with_mutex (slave_mutex, linked_list_pack(&client_list););
+	  with_wrlock (client_lock, linked_list_pack(&client_list););
 	}
       
       if (accept_connection() == 1)
@@ -207,6 +275,7 @@ int master_loop(void)
 	      while (running_slaves > 0)
 		pthread_cond_wait(&slave_cond, &slave_mutex););
   
+ done:
   if (reexecing == 0)
     {
       /* Release resources. */
@@ -262,14 +331,17 @@ int accept_connection(void)
 void* slave_loop(void* data)
 {
   int slave_fd = (int)(intptr_t)data;
-  size_t information_address = fd_table_get(&client_map, (size_t)slave_fd);
-  client_t* information = (client_t*)(void*)information_address;
-  char* msgbuf = NULL;
+  size_t information_address;
+  client_t* information;
   char buf[] = "To: all";
-  size_t n;
-  int r;
+  int readable = 1;
+  int r, flags, wake_fd;
   
   
+  /* The table may be growing in another thread. */
+  with_rdlock (client_lock, information_address = fd_table_get(&client_map, (size_t)slave_fd););
+  information = (client_t*)(void*)information_address;
+  
   if (information == NULL) /* Did not re-exec. */
     {
       /* Initialise the client. */
@@ -282,6 +354,13 @@ void* slave_loop(void* data)
   /* Store slave thread and create mutexes and conditions. */
   fail_if (client_initialise_threading(information));
   
+  /* Other threads only queue messages for the client, and wake this thread, which
+     sends them whenever the client is writable, and only reads when it is readable. */
+  fail_if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0);
+  with_mutex (information->mutex, information->wake_fd = wake_fd;);
+  fail_if ((flags = fcntl(slave_fd, F_GETFL)) < 0);
+  fail_if (fcntl(slave_fd, F_SETFL, flags | O_NONBLOCK) < 0);
+  
   /* Set up traps for especially handled signals. */
   fail_if (trap_signals() < 0);
   
@@ -292,8 +371,19 @@ void* slave_loop(void* data)
       /* Send queued multicast messages. */
       send_multicast_queue(information);
       
-      /* Send queued messages. */
-      send_reply_queue(information);
+      /* Send as much of the queued messages as the client will take now. */
+      flush_outbound(information);
+      
+      /* Do not wait for a message if sending was interrupted by re-exec or termination. */
+      if (terminating)
+	goto terminate;
+      
+      /* Wait until the client has sent something, or until there is something to send. */
+      if (readable == 0)
+	{
+	  readable = await_client(information, 1, 1000);
+	  continue;
+	}
       
       
       /* Fetch message. */
@@ -304,6 +394,8 @@ void* slave_loop(void* data)
 	goto done;
       else if (r && (errno == EINTR) && terminating)
       	goto terminate; /* Stop the thread if we are re-exec:ing or terminating the server. */
+      else if (r && (errno == EAGAIN))
+	readable = 0;
     }
   /* Stop the thread if we are re-exec:ing or terminating the server. */
   if (terminating)
@@ -311,16 +403,7 @@ void* slave_loop(void* data)
   
   
   /* Multicast information about the client closing. */
-  n = 2 * 10 + 1 + strlen("Client closed: :\n\n");
-  fail_if (xmalloc(msgbuf, n, char));
-  snprintf(msgbuf, n,
-	   "Client closed: %" PRIu32 ":%" PRIu32 "\n"
-	   "\n",
-	   (uint32_t)(information->id >> 32),
-	   (uint32_t)(information->id >>  0));
-  n = strlen(msgbuf);
-  queue_message_multicast(msgbuf, n, information);
-  msgbuf = NULL;
+  queue_client_closed_multicast(information);
   send_multicast_queue(information);
   
   
@@ -331,17 +414,27 @@ void* slave_loop(void* data)
  done:
   /* Close socket and free resources. */
   xclose(slave_fd);
-  free(msgbuf);
   if (information != NULL)
     {
-      /* Unlist and free client. */
-      with_mutex (slave_mutex, linked_list_remove(&client_list, information->list_entry););
+      /* Stop other clients from waiting for replies from, or room for messages to, this client. */
+      if (information->mutex_created)
+	with_mutex (information->mutex, information->open = 0;);
+      abandon_modify_waits(information);
+      release_outbound_waits(information);
+      
+      /* Unlist, unmap, and free client, it is unmapped with the rest
+	 so that no one can take a reference to it once it is destroyed. */
+      with_wrlock (client_lock,
+		   interception_index_remove_client(&interception_index, information);
+		   linked_list_remove(&client_list, information->list_entry);
+		   fd_table_remove(&client_map, slave_fd););
       client_destroy(information);
     }
+  else
+    with_wrlock (client_lock, fd_table_remove(&client_map, slave_fd););
   
-  /* Unmap client and decrease the slave count. */
+  /* Decrease the slave count. */
   with_mutex (slave_mutex,
-	      fd_table_remove(&client_map, slave_fd);
 	      running_slaves--;
 	      pthread_cond_signal(&slave_cond););
   return NULL;
@@ -353,6 +446,11 @@ void* slave_loop(void* data)
   
   
  reexec:
+  /* `signal_all` may still be signalling the clients' threads, and an
+     exited thread must not be signalled. It holds a read lock on the
+     client list while it does, so wait for it to release it. */
+  with_wrlock (client_lock, ;);
+  
   /* Tell the master thread that the slave has closed,
      this is done because re-exec causes a race-condition
      between the acception of a slave and the execution
@@ -365,19 +463,29 @@ void* slave_loop(void* data)
 
 
 /**
- * Compare two queued interceptors by priority
+ * Queue a multicast message with information about a client closing
  * 
- * @param   a:const queued_interception_t*  One of the interceptors
- * @param   b:const queued_interception_t*  The other of the two interceptors
- * @return                                  Negative if a before b, positive if a after b, otherwise zero
+ * @param   client  The client that has closed
+ * @return          Zero on success, -1 on error
  */
-__attribute__((nonnull))
-static int cmp_queued_interception(const void* a, const void* b)
+int queue_client_closed_multicast(client_t* client)
 {
-  const queued_interception_t* p = b; /* Highest first, so swap them. */
-  const queued_interception_t* q = a;
-  return p->priority < q->priority ? -1 :
-         p->priority > q->priority ? 1 : 0;
+  char* msgbuf = NULL;
+  size_t n;
+  
+  n = 2 * 10 + 1 + strlen("Client closed: :\n\n");
+  fail_if (xmalloc(msgbuf, n, char));
+  snprintf(msgbuf, n,
+	   "Client closed: %" PRIu32 ":%" PRIu32 "\n"
+	   "\n",
+	   (uint32_t)(client->id >> 32),
+	   (uint32_t)(client->id >>  0));
+  n = strlen(msgbuf);
+  queue_message_multicast(msgbuf, n, -1, client);
+  return 0;
+ fail:
+  xperror(*argv);
+  return -1;
 }
 
 
@@ -386,120 +494,112 @@ static int cmp_queued_interception(const void* a, const void* b)
  * 
  * @param  message  The message
  * @param  length   The length of the message
+ * @param  fd       The file descriptor attached to the message, `-1` if none,
+ *                  it is closed once the message has been multicast
  * @param  sender   The original sender of the message
  */
-void queue_message_multicast(char* message, size_t length, client_t* sender)
+void queue_message_multicast(char* message, size_t length, int fd, client_t* sender)
 {
+  uint64_t started = monotonic_time();
   char* msg = message;
+  char* end = message + length;
+  const char* eol;
+  const char* colon;
   size_t header_count = 0;
-  size_t n = length - 1;
-  size_t* hashes = NULL;
   char** headers = NULL;
   char** header_values = NULL;
   queued_interception_t* interceptions = NULL;
   size_t interceptions_count = 0;
   multicast_t* multicast = NULL;
   size_t i;
-  uint64_t modify_id;
-  char modify_id_header[13 + 3 * sizeof(uint64_t)];
-  void* new_buf;
   int saved_errno;
   
   /* Count the number of headers. */
-  for (i = 0; i < n; i++)
-    if (message[i] == '\n')
-      if (header_count++, message[i + 1] == '\n')
-	break;
+  for (; ((eol = scan_line(msg, (size_t)(end - msg), &colon)) != NULL) && (eol != msg); msg += eol - msg + 1)
+    header_count++;
   
   if (header_count == 0)
-    return; /* Invalid message. */
+    {
+      if (fd >= 0)
+	close(fd);
+      return; /* Invalid message. */
+    }
   
   /* Allocate multicast message. */
-  fail_if (xmalloc(multicast, 1, multicast_t));
+  if (xmalloc(multicast, 1, multicast_t))
+    {
+      if (fd >= 0)
+	close(fd);
+      fail_if (1);
+    }
   multicast_initialise(multicast);
   
+  /* The attached file descriptor is closed with the multicast, and must survive re-exec. */
+  multicast->fd = fd;
+  fail_if ((fd >= 0) && (fcntl(fd, F_SETFD, 0) < 0));
+  
   /* Allocate header lists. */
-  fail_if (xmalloc(hashes,        header_count, size_t));
   fail_if (xmalloc(headers,       header_count, char*));
   fail_if (xmalloc(header_values, header_count, char*));
   
   /* Populate header lists. */
-  for (i = 0; i < header_count; i++)
+  for (i = 0, msg = message; i < header_count; i++)
     {
-      char* end = strchr(msg, '\n');
-      char* colon = strchr(msg, ':');
+      char* lf = msg + (scan_line(msg, (size_t)(end - msg), &colon) - msg);
+      char* name_end = colon == NULL ? lf : msg + (colon - msg);
       
-      *end = '\0';
+      *lf = '\0';
       if (xstrdup(header_values[i], msg))
 	{
 	  header_count = i;
 	  fail_if (1);
 	}
-      *colon = '\0';
+      *name_end = '\0';
       if (xstrdup(headers[i], msg))
 	{
 	  saved_errno = errno, free(headers[i]), errno = saved_errno;
 	  header_count = i;
 	  fail_if (1);
 	}
-      *colon = ':';
-      *end = '\n';
-      hashes[i] = string_hash(headers[i]);
+      *name_end = ':';
+      *lf = '\n';
       
-      msg = end + 1;
+      msg = lf + 1;
     }
   
-  /* Get intercepting clients. */
-  pthread_mutex_lock(&(slave_mutex));
-  interceptions = get_interceptors(sender, hashes, headers, header_values, header_count, &interceptions_count);
-  pthread_mutex_unlock(&(slave_mutex));
+  /* Get intercepting clients, they are sorted by priority. */
+  pthread_rwlock_rdlock(&client_lock);
+  interceptions = get_interceptors(sender, headers, header_values, header_count, &interceptions_count);
+  pthread_rwlock_unlock(&client_lock);
   fail_if (interceptions == NULL);
   
-  /* Sort interceptors. */
-  qsort(interceptions, interceptions_count, sizeof(queued_interception_t), cmp_queued_interception);
+  /* Assign the message a modify ID, the ‘Modify ID’ header is
+     sent separately from the message to modifying interceptors.
+     Zero is not a valid ID, so it is skipped if the counter wraps. */
+  while ((multicast->modify_id = __atomic_fetch_add(&next_modify_id, 1, __ATOMIC_RELAXED)) == 0);
   
-  /* Add prefix to message with ‘Modify ID’ header. */
-  with_mutex (slave_mutex,
-	      modify_id = next_modify_id++;
-	      if (next_modify_id == 0)
-		next_modify_id = 1;
-	      );
-  xsnprintf(modify_id_header, "Modify ID: %" PRIu64 "\n", modify_id);
-  n = strlen(modify_id_header);
-  new_buf = message;
-  fail_if (xrealloc(new_buf, n + length, char));
-  message = new_buf;
-  memmove(message + n, message, length * sizeof(char));
-  memcpy(message, modify_id_header, n * sizeof(char));
-  
-  /* Store information. */
+  /* Store information, the message is shared by the recipients rather than copied. */
   multicast->interceptions = interceptions;
   multicast->interceptions_count = interceptions_count;
-  multicast->message = message;
-  multicast->message_length = length + n;
-  multicast->message_prefix = n;
+  fail_if ((multicast->message = message_buffer_create(message, length)) == NULL);
   message = NULL;
+  fail_if (message_buffer_find_coalesce(multicast->message));
   
-#define fail  fail_in_mutex
   /* Queue message multicasting. */
-  with_mutex (sender->mutex,
-	      new_buf = sender->multicasts;
-	      fail_if (xrealloc(new_buf, sender->multicasts_count + 1, multicast_t));
-	      sender->multicasts = new_buf;
-	      sender->multicasts[sender->multicasts_count++] = *multicast;
-	      free(multicast);
-	      multicast = NULL;
-	      errno = 0;
-	     fail_in_mutex:
-	      xperror(*argv);
-	      );
-#undef fail
+  client_queue_multicast(sender, multicast);
+  multicast = NULL;
+  
+  /* Count the multicast and how long it took to route it. */
+  started = monotonic_time() - started;
+  stats_add(multicasts, 1);
+  stats_add(routing_time, started);
+  stats_add(routing_times[stats_bucket(started, STATS_TIME_BUCKETS)], 1);
+  stats_add(interceptors[stats_bucket(interceptions_count, STATS_INTERCEPTOR_BUCKETS)], 1);
   
  done:
   /* Release resources. */
   xfree(headers, header_count);
   xfree(header_values, header_count);
-  free(hashes);
   free(message);
   if (multicast != NULL)
     multicast_destroy(multicast);
@@ -44,10 +44,21 @@ void* slave_loop(void* data);
  * 
  * @param  message  The message
  * @param  length   The length of the message
+ * @param  fd       The file descriptor attached to the message, `-1` if none,
+ *                  it is closed once the message has been multicast
  * @param  sender   The original sender of the message
  */
 __attribute__((nonnull))
-void queue_message_multicast(char* message, size_t length, client_t* sender);
+void queue_message_multicast(char* message, size_t length, int fd, client_t* sender);
+
+/**
+ * Queue a multicast message with information about a client closing
+ * 
+ * @param   client  The client that has closed
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int queue_client_closed_multicast(client_t* client);
 
 /**
  * Exec into the mdsinitrc script
@@ -0,0 +1,197 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "message-buffer.h"
+
+#include <libmdsserver/macros.h>
+#include <libmdsserver/mds-message.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * Create a message buffer
+ * 
+ * @param   data    The message, the buffer takes over the ownership of it on success
+ * @param   length  The length of the message
+ * @return          The message buffer, with one reference, `NULL` on error
+ */
+message_buffer_t* message_buffer_create(char* data, size_t length)
+{
+  message_buffer_t* this;
+  if (xmalloc(this, 1, message_buffer_t))
+    return NULL;
+  this->data = data;
+  this->length = length;
+  this->references = 1;
+  this->binary = NULL;
+  this->coalesce = NULL;
+  return this;
+}
+
+
+/**
+ * Create a message buffer with a copy of a message
+ * 
+ * @param   data    The message
+ * @param   length  The length of the message
+ * @return          The message buffer, with one reference, `NULL` on error
+ */
+message_buffer_t* message_buffer_copy(const char* data, size_t length)
+{
+  message_buffer_t* this;
+  char* copy = NULL;
+  if (length > 0)
+    if (xmemdup(copy, data, length, char))
+      return NULL;
+  if ((this = message_buffer_create(copy, length)) == NULL)
+    free(copy);
+  return this;
+}
+
+
+/**
+ * Get a message buffer, in the binary framing, with a message
+ * that is in the text framing, the translation is made once
+ * and shared by all clients that use the binary framing
+ * 
+ * @param   this    The message buffer, in the text framing
+ * @param   prefix  A header to translate before the message, `NULL` if
+ *                  none, the translation is not shared if there is one
+ * @return          The message buffer, in the binary framing, with a
+ *                  reference for the caller, `NULL` on error, `errno`
+ *                  is `EMSGSIZE` if a field of the message is too
+ *                  large for the binary framing
+ */
+message_buffer_t* message_buffer_binary(message_buffer_t* restrict this, const message_buffer_t* restrict prefix)
+{
+  message_buffer_t* binary = NULL;
+  message_buffer_t* expected = NULL;
+  char* text = NULL;
+  char* data = NULL;
+  size_t length, size;
+  
+  if ((prefix == NULL) && ((binary = __atomic_load_n(&(this->binary), __ATOMIC_ACQUIRE)) != NULL))
+    return message_buffer_ref(binary);
+  
+  /* The prefix is a header of the message, so it is translated with it. */
+  if (prefix != NULL)
+    {
+      length = prefix->length + this->length;
+      fail_if (xmalloc(text, length, char));
+      memcpy(text, prefix->data, prefix->length * sizeof(char));
+      memcpy(text + prefix->length, this->data, this->length * sizeof(char));
+    }
+  size = mds_message_binary_size(text == NULL ? this->data : text, text == NULL ? this->length : length);
+  fail_if (size == 0);
+  fail_if (xmalloc(data, size, char));
+  fail_if (mds_message_to_binary(text == NULL ? this->data : text, text == NULL ? this->length : length, data));
+  free(text), text = NULL;
+  fail_if ((binary = message_buffer_create(data, size)) == NULL);
+  data = NULL;
+  if ((this->coalesce != NULL) && xstrdup(binary->coalesce, this->coalesce))
+    {
+      message_buffer_unref(binary);
+      return NULL;
+    }
+  
+  /* Share the translation, unless another thread was faster. */
+  if (prefix == NULL)
+    {
+      message_buffer_ref(binary);
+      if (!__atomic_compare_exchange_n(&(this->binary), &expected, binary, 0,
+				       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+	  message_buffer_unref(binary);
+	  message_buffer_unref(binary);
+	  binary = message_buffer_ref(expected);
+	}
+    }
+  
+  return binary;
+ fail:
+  free(text);
+  free(data);
+  return NULL;
+}
+
+
+/**
+ * Look up the `Coalesce` header of a message that is to be multicast,
+ * a newer message from the same client with the same value replaces
+ * it in the outbound queues where it has not started being sent
+ * 
+ * @param   this  The message buffer, in the text framing
+ * @return        Zero on success, -1 on error
+ */
+int message_buffer_find_coalesce(message_buffer_t* restrict this)
+{
+  const char* header = this->data;
+  const char* end = this->data + this->length;
+  const char* eol;
+  size_t n = strlen("Coalesce: ");
+  
+  free(this->coalesce);
+  this->coalesce = NULL;
+  
+  /* The headers end with an empty line. */
+  while ((header < end) && (*header != '\n'))
+    {
+      if ((eol = memchr(header, '\n', (size_t)(end - header))) == NULL)
+	break;
+      if (((size_t)(eol - header) > n) && !memcmp(header, "Coalesce: ", n))
+	return (this->coalesce = strndup(header + n, (size_t)(eol - header) - n)) == NULL ? -1 : 0;
+      header = eol + 1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Add a reference to a message buffer
+ * 
+ * @param   this  The message buffer
+ * @return        `this`
+ */
+message_buffer_t* message_buffer_ref(message_buffer_t* restrict this)
+{
+  __atomic_add_fetch(&(this->references), 1, __ATOMIC_RELAXED);
+  return this;
+}
+
+
+/**
+ * Release a reference to a message buffer, and
+ * free it if it was the last reference
+ * 
+ * @param  this  The message buffer, may be `NULL`
+ */
+void message_buffer_unref(message_buffer_t* restrict this)
+{
+  if (this == NULL)
+    return;
+  if (__atomic_sub_fetch(&(this->references), 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  message_buffer_unref(this->binary);
+  free(this->coalesce);
+  free(this->data);
+  free(this);
+}
+
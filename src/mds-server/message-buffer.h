@@ -0,0 +1,131 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_MESSAGE_BUFFER_H
+#define MDS_MDS_SERVER_MESSAGE_BUFFER_H
+
+
+#include <stddef.h>
+
+
+/**
+ * An immutable message that is shared, rather than copied,
+ * between all clients to which it is being sent
+ * 
+ * A message that is modified by an interceptor is not changed in
+ * place, instead a new buffer is created for the modified message
+ */
+typedef struct message_buffer
+{
+  /**
+   * The message
+   */
+  char* data;
+  
+  /**
+   * The length of `data`
+   */
+  size_t length;
+  
+  /**
+   * The number of references to the buffer, it
+   * is freed when the last reference is released
+   */
+  size_t references;
+  
+  /**
+   * The message translated to the binary framing, `NULL` until
+   * it is sent to a client that uses the binary framing
+   */
+  struct message_buffer* binary;
+  
+  /**
+   * The value of the message's `Coalesce` header, `NULL` if it has
+   * none, only multicast messages are looked up, and the binary
+   * translation of a message has a copy of it
+   */
+  char* coalesce;
+  
+} message_buffer_t;
+
+
+
+/**
+ * Create a message buffer
+ * 
+ * @param   data    The message, the buffer takes over the ownership of it on success
+ * @param   length  The length of the message
+ * @return          The message buffer, with one reference, `NULL` on error
+ */
+message_buffer_t* message_buffer_create(char* data, size_t length);
+
+/**
+ * Create a message buffer with a copy of a message
+ * 
+ * @param   data    The message
+ * @param   length  The length of the message
+ * @return          The message buffer, with one reference, `NULL` on error
+ */
+message_buffer_t* message_buffer_copy(const char* data, size_t length);
+
+/**
+ * Get a message buffer, in the binary framing, with a message
+ * that is in the text framing, the translation is made once
+ * and shared by all clients that use the binary framing
+ * 
+ * @param   this    The message buffer, in the text framing
+ * @param   prefix  A header to translate before the message, `NULL` if
+ *                  none, the translation is not shared if there is one
+ * @return          The message buffer, in the binary framing, with a
+ *                  reference for the caller, `NULL` on error, `errno`
+ *                  is `EMSGSIZE` if a field of the message is too
+ *                  large for the binary framing
+ */
+__attribute__((nonnull(1)))
+message_buffer_t* message_buffer_binary(message_buffer_t* restrict this, const message_buffer_t* restrict prefix);
+
+/**
+ * Look up the `Coalesce` header of a message that is to be multicast,
+ * a newer message from the same client with the same value replaces
+ * it in the outbound queues where it has not started being sent
+ * 
+ * @param   this  The message buffer, in the text framing
+ * @return        Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int message_buffer_find_coalesce(message_buffer_t* restrict this);
+
+/**
+ * Add a reference to a message buffer
+ * 
+ * @param   this  The message buffer
+ * @return        `this`
+ */
+__attribute__((nonnull))
+message_buffer_t* message_buffer_ref(message_buffer_t* restrict this);
+
+/**
+ * Release a reference to a message buffer, and
+ * free it if it was the last reference
+ * 
+ * @param  this  The message buffer, may be `NULL`
+ */
+void message_buffer_unref(message_buffer_t* restrict this);
+
+
+#endif
+
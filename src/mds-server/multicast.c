@@ -23,6 +23,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 
 /**
@@ -32,13 +34,15 @@
  */
 void multicast_initialise(multicast_t* restrict this)
 {
+  this->next = NULL;
   this->interceptions = NULL;
   this->interceptions_count = 0;
   this->interceptions_ptr = 0;
   this->message = NULL;
-  this->message_length = 0;
   this->message_ptr = 0;
-  this->message_prefix = 0;
+  this->modify_id = 0;
+  this->prefix = NULL;
+  this->fd = -1;
 }
 
 
@@ -49,8 +53,12 @@ void multicast_initialise(multicast_t* restrict this)
  */
 void multicast_destroy(multicast_t* restrict this)
 {
-  free(this->interceptions);
-  free(this->message);
+  queued_interceptions_free(this->interceptions, this->interceptions_count);
+  message_buffer_unref(this->message);
+  message_buffer_unref(this->prefix);
+  if (this->fd >= 0)
+    close(this->fd);
+  this->fd = -1;
 }
 
 
@@ -62,8 +70,10 @@ void multicast_destroy(multicast_t* restrict this)
  */
 size_t multicast_marshal_size(const multicast_t* restrict this)
 {
-  size_t rc = sizeof(int) + 5 * sizeof(size_t) + this->message_length * sizeof(char);
+  size_t rc = 2 * sizeof(int) + 4 * sizeof(size_t) + sizeof(uint64_t);
   size_t i;
+  if (this->message != NULL)
+    rc += this->message->length * sizeof(char);
   for (i = 0; i < this->interceptions_count; i++)
     rc += queued_interception_marshal_size();
   return rc;
@@ -79,24 +89,26 @@ size_t multicast_marshal_size(const multicast_t* restrict this)
  */
 size_t multicast_marshal(const multicast_t* restrict this, char* restrict data)
 {
-  size_t rc = sizeof(int) + 5 * sizeof(size_t);
+  size_t rc = 2 * sizeof(int) + 4 * sizeof(size_t) + sizeof(uint64_t);
+  size_t length = this->message == NULL ? 0 : this->message->length;
   size_t i, n;
   buf_set_next(data, int, MULTICAST_T_VERSION);
   buf_set_next(data, size_t, this->interceptions_count);
   buf_set_next(data, size_t, this->interceptions_ptr);
-  buf_set_next(data, size_t, this->message_length);
+  buf_set_next(data, size_t, length);
   buf_set_next(data, size_t, this->message_ptr);
-  buf_set_next(data, size_t, this->message_prefix);
+  buf_set_next(data, uint64_t, this->modify_id);
+  buf_set_next(data, int, this->fd);
   for (i = 0; i < this->interceptions_count; i++)
     {
       n = queued_interception_marshal(this->interceptions + i, data);
       data += n / sizeof(char);
       rc += n;
     }
-  if (this->message_length > 0)
+  if (length > 0)
     {
-      memcpy(data, this->message, this->message_length * sizeof(char));
-      rc += this->message_length * sizeof(char);
+      memcpy(data, this->message->data, length * sizeof(char));
+      rc += length * sizeof(char);
     }
   return rc;
 }
@@ -112,17 +124,23 @@ size_t multicast_marshal(const multicast_t* restrict this, char* restrict data)
  */
 size_t multicast_unmarshal(multicast_t* restrict this, char* restrict data)
 {
-  size_t rc = sizeof(int) + 5 * sizeof(size_t);
-  size_t i, n;
+  size_t rc = 2 * sizeof(int) + 4 * sizeof(size_t) + sizeof(uint64_t);
+  size_t i, n, length;
+  int version;
+  this->next = NULL;
   this->interceptions = NULL;
   this->message = NULL;
-  /* buf_get_next(data, int, MULTICAST_T_VERSION); */
-  buf_next(data, int, 1);
+  this->prefix = NULL;
+  buf_get_next(data, int, version);
+  /* Multicasts marshalled before version 1 have another layout. */
+  if (version != MULTICAST_T_VERSION)
+    fail_if ((errno = EPROTO));
   buf_get_next(data, size_t, this->interceptions_count);
   buf_get_next(data, size_t, this->interceptions_ptr);
-  buf_get_next(data, size_t, this->message_length);
+  buf_get_next(data, size_t, length);
   buf_get_next(data, size_t, this->message_ptr);
-  buf_get_next(data, size_t, this->message_prefix);
+  buf_get_next(data, uint64_t, this->modify_id);
+  buf_get_next(data, int, this->fd);
   if (this->interceptions_count > 0)
     fail_if (xmalloc(this->interceptions, this->interceptions_count, queued_interception_t));
   for (i = 0; i < this->interceptions_count; i++)
@@ -131,11 +149,9 @@ size_t multicast_unmarshal(multicast_t* restrict this, char* restrict data)
       data += n / sizeof(char);
       rc += n;
     }
-  if (this->message_length > 0)
-    {
-      fail_if (xmemdup(this->message, data, this->message_length, char));
-      rc += this->message_length * sizeof(char);
-    }
+  fail_if ((this->message = message_buffer_copy(data, length)) == NULL);
+  fail_if (message_buffer_find_coalesce(this->message));
+  rc += length * sizeof(char);
   return rc;
  fail:
   return 0;
@@ -150,13 +166,19 @@ size_t multicast_unmarshal(multicast_t* restrict this, char* restrict data)
  */
 size_t multicast_unmarshal_skip(char* restrict data)
 {
-  size_t interceptions_count = buf_cast(data, size_t, 0);
-  size_t message_length = buf_cast(data, size_t, 2);
-  size_t rc = sizeof(int) + 5 * sizeof(size_t) + message_length * sizeof(char);
-  size_t n;
+  size_t rc = 2 * sizeof(int) + 4 * sizeof(size_t) + sizeof(uint64_t);
+  size_t interceptions_count, message_length, n;
+  buf_next(data, int, 1);
+  buf_get_next(data, size_t, interceptions_count);
+  buf_next(data, size_t, 1);
+  buf_get_next(data, size_t, message_length);
+  buf_next(data, size_t, 1);
+  buf_next(data, uint64_t, 1);
+  buf_next(data, int, 1);
+  rc += message_length * sizeof(char);
   while (interceptions_count--)
     {
-      n = queued_interception_unmarshal_skip();
+      n = queued_interception_unmarshal_skip(data);
       data += n / sizeof(char);
       rc += n;
     }
@@ -20,15 +20,24 @@
 
 
 #include "queued-interception.h"
+#include "message-buffer.h"
 
+#include <stdint.h>
 
-#define MULTICAST_T_VERSION  0
+
+#define MULTICAST_T_VERSION  1
 
 /**
  * Message multicast state
  */
 typedef struct multicast
 {
+  /**
+   * The next multicast in the sender's queue of
+   * multicasts, `NULL` if last, not marshalled
+   */
+  struct multicast* next;
+  
   /**
    * Queue of clients that is listening this message
    */
@@ -45,24 +54,33 @@ typedef struct multicast
   size_t interceptions_ptr;
   
   /**
-   * The message to send
+   * The message to send, it is shared with the
+   * outbound queues of the recipients
    */
-  char* message;
+  struct message_buffer* message;
   
   /**
-   * The length of `message`
+   * Non-zero if the message has been queued for the current recipient
    */
-  size_t message_length;
+  size_t message_ptr;
   
   /**
-   * How much of the message that has already been sent to the current recipient
+   * The modify ID of the message, modifying recipients are sent
+   * a ‘Modify ID’ header with it before the message
    */
-  size_t message_ptr;
+  uint64_t modify_id;
+  
+  /**
+   * The ‘Modify ID’ header, created when the first modifying
+   * recipient is sent the message, not marshalled
+   */
+  struct message_buffer* prefix;
   
   /**
-   * How much of the message to skip if the recipient is not a modifier
+   * The file descriptor that is attached to the message, `-1` if none,
+   * each recipient is passed a duplicate of it, it is not closed on exec
    */
-  size_t message_prefix;
+  int fd;
   
 } multicast_t;
 
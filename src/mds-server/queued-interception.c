@@ -19,6 +19,26 @@
 
 #include <libmdsserver/macros.h>
 
+#include <stdlib.h>
+
+
+/**
+ * Release the references that a list of queued interceptions
+ * holds to the intercepting clients, and free the list
+ * 
+ * @param  interceptions  The queued interceptions, may be `NULL`
+ * @param  count          The number of elements in `interceptions`
+ */
+void queued_interceptions_free(queued_interception_t* restrict interceptions, size_t count)
+{
+  size_t i;
+  if (interceptions == NULL)
+    return;
+  for (i = 0; i < count; i++)
+    client_unref(interceptions[i].client);
+  free(interceptions);
+}
+
 
 /**
  * Calculate the buffer size need to marshal a queued interception
@@ -28,7 +48,7 @@
  */
 size_t queued_interception_marshal_size(void)
 {
-  return sizeof(int64_t) + 3 * sizeof(int);
+  return sizeof(int64_t) + 4 * sizeof(int);
 }
 
 
@@ -45,6 +65,7 @@ size_t queued_interception_marshal(const queued_interception_t* restrict this, c
   buf_set_next(data, int64_t, this->priority);
   buf_set_next(data, int, this->modifying);
   buf_set_next(data, int, this->client->socket_fd);
+  buf_set_next(data, int, this->delivered);
   return queued_interception_marshal_size();
 }
 
@@ -58,13 +79,17 @@ size_t queued_interception_marshal(const queued_interception_t* restrict this, c
  */
 size_t queued_interception_unmarshal(queued_interception_t* restrict this, char* restrict data)
 {
+  int version;
   this->client = NULL;
-  /* buf_get_next(data, int, QUEUED_INTERCEPTION_T_VERSION); */
-  buf_next(data, int, 1);
+  this->delivered = 0;
+  buf_get_next(data, int, version);
   buf_get_next(data, int64_t, this->priority);
   buf_get_next(data, int, this->modifying);
   buf_get_next(data, int, this->socket_fd);
-  return queued_interception_marshal_size();
+  /* Before version 1, interceptions were not marked when delivered. */
+  if (version >= 1)
+    buf_get_next(data, int, this->delivered);
+  return sizeof(int64_t) + (version >= 1 ? 4 : 3) * sizeof(int);
 }
 
 
@@ -74,8 +99,9 @@ size_t queued_interception_unmarshal(queued_interception_t* restrict this, char*
  * @param   data  In buffer with the marshalled data
  * @return        The number of read bytes
  */
-size_t queued_interception_unmarshal_skip(void)
+size_t queued_interception_unmarshal_skip(char* restrict data)
 {
-  return queued_interception_marshal_size();
+  int version = buf_cast(data, int, 0);
+  return sizeof(int64_t) + (version >= 1 ? 4 : 3) * sizeof(int);
 }
 
@@ -24,7 +24,7 @@
 #include <stdint.h>
 
 
-#define QUEUED_INTERCEPTION_T_VERSION  0
+#define QUEUED_INTERCEPTION_T_VERSION  1
 
 /**
  * A queued interception
@@ -32,7 +32,7 @@
 typedef struct queued_interception
 {
   /**
-   * The intercepting client
+   * The intercepting client, the interception holds a reference to it
    */
   struct client* client;
   
@@ -51,9 +51,24 @@ typedef struct queued_interception
    */
   int socket_fd;
   
+  /**
+   * Whether the message has been queued for the client,
+   * only used for non-modifying clients
+   */
+  int delivered;
+  
 } queued_interception_t;
 
 
+/**
+ * Release the references that a list of queued interceptions
+ * holds to the intercepting clients, and free the list
+ * 
+ * @param  interceptions  The queued interceptions, may be `NULL`
+ * @param  count          The number of elements in `interceptions`
+ */
+void queued_interceptions_free(queued_interception_t* restrict interceptions, size_t count);
+
 /**
  * Calculate the buffer size need to marshal a queued interception
  * 
@@ -89,8 +104,8 @@ size_t queued_interception_unmarshal(queued_interception_t* restrict this, char*
  * @param   data  In buffer with the marshalled data
  * @return        The number of read bytes
  */
-__attribute__((const, nonnull))
-size_t queued_interception_unmarshal_skip(void);
+__attribute__((pure, nonnull))
+size_t queued_interception_unmarshal_skip(char* restrict data);
 
 
 #endif
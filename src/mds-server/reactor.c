@@ -0,0 +1,713 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "reactor.h"
+
+#include "globals.h"
+#include "client.h"
+#include "interceptors.h"
+#include "sending.h"
+#include "slavery.h"
+#include "receiving.h"
+#include "mds-server.h"
+#include "shm-transport.h"
+
+#include <libmdsserver/linked-list.h>
+#include <libmdsserver/fd-table.h>
+#include <libmdsserver/macros.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+
+
+/**
+ * The maximum number of events a reactor thread fetches at a time
+ */
+#define REACTOR_EVENTS  32
+
+
+
+/**
+ * The epoll instance that all reactor threads wait on
+ */
+static int epoll_fd = -1;
+
+/**
+ * File descriptor from which signals are read
+ */
+static int signal_fd = -1;
+
+/**
+ * Event file descriptor that is used to wake all reactor threads
+ */
+static int wake_fd = -1;
+
+/**
+ * Timer file descriptor that expires at the earliest reply deadline
+ */
+static int timer_fd = -1;
+
+/**
+ * The reply deadline the timer is set to, in nanoseconds on
+ * the monotonic clock, zero if the timer is not set,
+ * guarded by `reactor_mutex`
+ */
+static uint64_t timer_deadline = 0;
+
+/**
+ * Mutex for the clients' `reactor_state`
+ */
+static pthread_mutex_t reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * Start, or restart, watching a file descriptor
+ * 
+ * The events identify the file descriptor rather than the client
+ * so that events that are reported after the client has been
+ * released can be recognised as stale
+ * 
+ * @param   fd      The file descriptor
+ * @param   op      `EPOLL_CTL_ADD` or `EPOLL_CTL_MOD`
+ * @param   events  The events to watch for, `EPOLLONESHOT` is always added
+ * @return          Zero on success, -1 on error
+ */
+static int watch(int fd, int op, uint32_t events)
+{
+  struct epoll_event event;
+  event.events = events | EPOLLONESHOT;
+  event.data.fd = fd;
+  return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
+
+/**
+ * Make a file descriptor nonblocking
+ * 
+ * @param   fd  The file descriptor
+ * @return      The previous file status flags, -1 on error
+ */
+static int make_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return -1;
+  if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+  return flags;
+}
+
+
+/**
+ * Start serving a client
+ * 
+ * @param   client     The client, `NULL` if it is new
+ * @param   client_fd  The file descriptor of the client's socket
+ * @return             Zero on success, -1 on error
+ */
+static int add_client(client_t* client, int client_fd)
+{
+  char buf[] = "To: all";
+  int r;
+  
+  if (client == NULL)
+    {
+      /* Initialise the client. */
+      fail_if ((client = initialise_client(client_fd)) == NULL);
+      
+      /* Messages may be queued for the client as soon as it is
+	 registered, it is not notified until it is watched. */
+      client->reactor_state = REACTOR_BUSY;
+      
+      /* Register client to receive broadcasts. */
+      add_intercept_condition(client, buf, 0, 0, 0);
+    }
+  else
+    {
+      client->reactor_state = REACTOR_BUSY;
+      fail_if (make_nonblocking(client_fd) < 0);
+    }
+  
+  /* Create mutexes and conditions. */
+  fail_if (client_initialise_threading(client));
+  
+  /* The client is served immediately, because it is writable, in case
+     it has something pending from before the re-exec or from above. */
+  with_mutex (slave_mutex, running_slaves++;);
+  with_mutex (reactor_mutex,
+	      client->reactor_state = 0;
+	      r = watch(client_fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLOUT););
+  if (r < 0)
+    {
+      with_mutex (slave_mutex, running_slaves--;);
+      fail_if (1);
+    }
+  
+  return 0;
+ fail:
+  xperror(*argv);
+  if (client != NULL)
+    {
+      with_wrlock (client_lock,
+		   interception_index_remove_client(&interception_index, client);
+		   linked_list_remove(&client_list, client->list_entry);
+		   fd_table_remove(&client_map, client_fd););
+      client_destroy(client);
+    }
+  return -1;
+}
+
+
+/**
+ * Stop serving a client and release its resources
+ * 
+ * @param  client  The client
+ */
+static void release_client(client_t* client)
+{
+  int client_fd = client->socket_fd;
+  
+  /* Messages are not queued for closed clients, so
+     no one will try to watch the client once it is closed. */
+  with_mutex (client->mutex,
+	      client->open = 0;
+	      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL););
+  abandon_modify_waits(client);
+  release_outbound_waits(client);
+  xclose(client_fd);
+  
+  with_wrlock (client_lock,
+	       interception_index_remove_client(&interception_index, client);
+	       linked_list_remove(&client_list, client->list_entry);
+	       fd_table_remove(&client_map, client_fd););
+  with_mutex (slave_mutex,
+	      if ((--running_slaves == 0) && (running == 0))
+		reactor_wake(););
+  client_destroy(client);
+}
+
+
+/**
+ * Accept all pending connections
+ */
+static void accept_connections(void)
+{
+  int client_fd;
+  
+  for (;;)
+    {
+      client_fd = accept4(socket_fd, NULL, NULL, SOCK_NONBLOCK);
+      if (client_fd >= 0)
+	{
+	  if (add_client(NULL, client_fd) < 0)
+	    xclose(client_fd);
+	}
+      else if ((errno == EAGAIN))
+	break;
+      else if (errno == EINTR)
+	{
+	  if (terminating)
+	    return;
+	}
+      else if ((errno == ECONNABORTED) || (errno == EINVAL)) /* Closing. */
+	{
+	  running = 0;
+	  reactor_wake();
+	  return; /* Stop watching the socket. */
+	}
+      else
+	{
+	  xperror(*argv);
+	  break;
+	}
+    }
+  
+  if (watch(socket_fd, EPOLL_CTL_MOD, EPOLLIN) < 0)
+    xperror(*argv);
+}
+
+
+/**
+ * Act upon all pending signals
+ */
+static void handle_signals(void)
+{
+  struct signalfd_siginfo info;
+  ssize_t got;
+  int signo;
+  
+  for (;;)
+    {
+      got = read(signal_fd, &info, sizeof(info));
+      if (got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if ((errno != EAGAIN))
+	    xperror(*argv);
+	  break;
+	}
+      
+      signo = (int)(info.ssi_signo);
+      if (signo == SIGUPDATE)
+	received_reexec(signo);
+      else if ((signo == SIGTERM) || (signo == SIGINT))
+	received_terminate(signo);
+      else if (signo == SIGDANGER)
+	received_danger(signo);
+      else if (signo == SIGINFO)
+	received_info(signo);
+    }
+  
+  if (watch(signal_fd, EPOLL_CTL_MOD, EPOLLIN) < 0)
+    xperror(*argv);
+}
+
+
+/**
+ * Set the timer to expire at a reply deadline
+ * 
+ * `reactor_mutex` must be held
+ * 
+ * @param  deadline  The deadline, in nanoseconds on the monotonic clock
+ */
+static void set_timer(uint64_t deadline)
+{
+  struct itimerspec value;
+  uint64_t now = monotonic_time();
+  uint64_t left = deadline > now ? (deadline - now) : 1;
+  
+  memset(&value, 0, sizeof(value));
+  value.it_value.tv_sec = (time_t)(left / 1000000000);
+  value.it_value.tv_nsec = (long)(left % 1000000000);
+  if (timerfd_settime(timer_fd, 0, &value, NULL) < 0)
+    xperror(*argv);
+}
+
+
+/**
+ * Resume the clients whose reply deadline has passed,
+ * or that wait for room for a client that has stalled
+ */
+static void handle_timer(void)
+{
+  uint64_t expirations, next, stalled;
+  
+  if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+    if (errno != EAGAIN)
+      xperror(*argv);
+  
+  /* Deadlines that are scheduled during the scan set the timer again. */
+  with_mutex (reactor_mutex, timer_deadline = 0;);
+  next = resume_expired_modify_waits();
+  if (next > 0)
+    reactor_schedule(next);
+  stalled = resume_stalled_outbound_waits();
+  if (stalled > 0)
+    reactor_schedule(stalled);
+  
+  if (watch(timer_fd, EPOLL_CTL_MOD, EPOLLIN) < 0)
+    xperror(*argv);
+}
+
+
+/**
+ * Serve a client that has become readable or writable,
+ * or that has been resumed
+ * 
+ * @param  client_fd  The file descriptor of the client's socket
+ */
+static void serve_client(int client_fd)
+{
+  client_t* client;
+  size_t address;
+  int parked, pending, r;
+  uint32_t events;
+  
+  /* The event may be stale, the client may have been released, and
+     the file descriptor reused, which is harmless, or the client
+     may already be served by another thread, which is told to
+     serve it again in case the event is for something new. */
+  pthread_rwlock_rdlock(&client_lock);
+  address = fd_table_get(&client_map, client_fd);
+  client = (client_t*)(void*)address;
+  if (client != NULL)
+    with_mutex (reactor_mutex,
+		if ((client->reactor_state & REACTOR_BUSY))
+		  {
+		    client->reactor_state |= REACTOR_RESUME;
+		    client = NULL;
+		  }
+		else
+		  client->reactor_state = REACTOR_BUSY;
+		);
+  pthread_rwlock_unlock(&client_lock);
+  if (client == NULL)
+    return;
+  
+ again:
+  for (;;)
+    {
+      /* Send queued multicast messages, unless waiting for a reply or for room. */
+      parked = send_multicast_queue(client) && (terminating == 0);
+      
+      /* A parked client is not read, so the doorbells that it rings when there
+	 is room in its ring are drained, or they would wake the reactor again. */
+      if (parked && client->ring_writing)
+	drain_doorbell(client);
+      
+      /* Send as much of the queued messages as the client will take now. */
+      flush_outbound(client);
+      
+      if (parked || terminating || (client->open == 0))
+	break;
+      
+      /* Fetch message, everything that has been read is processed before
+	 we return to the reactor because it will not become readable again. */
+      r = fetch_message(client);
+      if (r == 0)
+	{
+	  if (message_received(client))
+	    break;
+	}
+      else if (r == -2)
+	{
+	  release_client(client);
+	  return;
+	}
+      else if (client->open == 0)
+	{
+	  /* Multicast information about the client closing. */
+	  queue_client_closed_multicast(client);
+	}
+      else if (errno != EINTR)
+	break;
+    }
+  
+  /* The reactor stops on re-exec and termination, clients are released or marshalled by it. */
+  if (terminating)
+    return;
+  
+  if ((parked == 0) && (client->open == 0))
+    {
+      release_client(client);
+      return;
+    }
+  
+  /* The doorbell that tells that there is room in the ring may have been drained when it was read. */
+  if (client->ring_writing)
+    flush_outbound(client);
+  
+  /* Messages queued after this are noticed because the client is still busy. */
+  with_mutex (client->mutex, pending = outbound_sendable(client););
+  
+  pthread_mutex_lock(&reactor_mutex);
+  if ((client->reactor_state & REACTOR_RESUME))
+    {
+      client->reactor_state = REACTOR_BUSY;
+      pthread_mutex_unlock(&reactor_mutex);
+      goto again;
+    }
+  /* A parked client is only watched for room in its socket, so that its queue keeps draining,
+     once the client uses its ring, it rings the doorbell on its socket when there is room. */
+  client->reactor_state = parked ? REACTOR_PARKED : 0;
+  events = (parked ? 0 : EPOLLIN) | (pending ? (client->ring_writing ? EPOLLIN : EPOLLOUT) : 0);
+  if (events)
+    if (watch(client->socket_fd, EPOLL_CTL_MOD, events) < 0)
+      xperror(*argv);
+  pthread_mutex_unlock(&reactor_mutex);
+}
+
+
+/**
+ * Check whether the reactor should stop
+ * 
+ * @return  Whether the reactor should stop
+ */
+static int reactor_stopping(void)
+{
+  int rc;
+  if (terminating)
+    return 1;
+  if (running)
+    return 0;
+  with_mutex (slave_mutex, rc = running_slaves == 0;);
+  return rc;
+}
+
+
+/**
+ * Master function for reactor threads
+ * 
+ * @param   data  Input data, not used
+ * @return        Output data, not used
+ */
+static void* reactor_loop(void* data)
+{
+  struct epoll_event events[REACTOR_EVENTS];
+  int i, n;
+  
+  (void) data;
+  
+  while (reactor_stopping() == 0)
+    {
+      if (danger)
+	{
+	  danger = 0;
+	  with_wrlock (client_lock, linked_list_pack(&client_list););
+	}
+      
+      n = epoll_wait(epoll_fd, events, REACTOR_EVENTS, -1);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  xperror(*argv);
+	  break;
+	}
+      
+      for (i = 0; i < n; i++)
+	{
+	  int fd = events[i].data.fd;
+	  if (fd == wake_fd)
+	    continue;
+	  else if (fd == socket_fd)
+	    accept_connections();
+	  else if (fd == signal_fd)
+	    handle_signals();
+	  else if (fd == timer_fd)
+	    handle_timer();
+	  else
+	    serve_client(fd);
+	}
+    }
+  
+  /* Make sure the other threads stops too. */
+  reactor_wake();
+  return NULL;
+}
+
+
+/**
+ * Serve all clients, and accept new clients, with a fixed
+ * number of threads that multiplex the clients' sockets,
+ * until the server re-exec:s or terminates
+ * 
+ * @return  Non-zero on error
+ */
+int reactor_run(void)
+{
+  pthread_t* threads = NULL;
+  size_t i, started = 0;
+  sigset_t signals;
+  sigset_t old_signals;
+  int signals_blocked = 0;
+  int socket_flags = -1;
+  ssize_t node;
+  int rc = 0;
+  
+  /* Re-exec and termination signals are read from a file descriptor,
+     they are blocked in all threads, which inherit the signal mask. */
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUPDATE);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGDANGER);
+  sigaddset(&signals, SIGINFO);
+  fail_if ((errno = pthread_sigmask(SIG_BLOCK, &signals, &old_signals)));
+  signals_blocked = 1;
+  
+  fail_if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0);
+  fail_if ((signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0);
+  fail_if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0);
+  fail_if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0);
+  fail_if ((socket_flags = make_nonblocking(socket_fd)) < 0);
+  
+  fail_if (watch(signal_fd, EPOLL_CTL_ADD, EPOLLIN) < 0);
+  fail_if (watch(timer_fd, EPOLL_CTL_ADD, EPOLLIN) < 0);
+  fail_if (watch(socket_fd, EPOLL_CTL_ADD, EPOLLIN) < 0);
+  {
+    /* The wake file descriptor is never drained, and is
+       level-triggered so that all threads are woken. */
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    fail_if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0);
+  }
+  
+  /* Set the timer for the reply deadlines of the multicasts that survived a re-exec. */
+  with_mutex (reactor_mutex,
+	      if (timer_deadline > 0)
+		set_timer(timer_deadline);
+	      );
+  
+  /* Serve clients that survived a re-exec. */
+  foreach_linked_list_node (client_list, node)
+    {
+      client_t* client = (client_t*)(void*)(client_list.values[node]);
+      add_client(client, client->socket_fd);
+    }
+  
+  /* Start the reactor threads, this thread is one of them. */
+  if (reactor_threads > 1)
+    {
+      fail_if (xmalloc(threads, reactor_threads - 1, pthread_t));
+      for (; started < reactor_threads - 1; started++)
+	if ((errno = pthread_create(threads + started, NULL, reactor_loop, NULL)))
+	  {
+	    xperror(*argv);
+	    break;
+	  }
+    }
+  reactor_loop(NULL);
+  
+ done:
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  
+  /* Release the clients, unless they will be marshalled. */
+  if (reexecing == 0)
+    {
+      foreach_linked_list_node (client_list, node)
+	{
+	  client_t* client = (client_t*)(void*)(client_list.values[node]);
+	  xclose(client->socket_fd);
+	  client_destroy(client);
+	}
+    }
+  
+  if (socket_flags >= 0)
+    fcntl(socket_fd, F_SETFL, socket_flags);
+  if (wake_fd >= 0)
+    xclose(wake_fd), wake_fd = -1;
+  if (timer_fd >= 0)
+    xclose(timer_fd), timer_fd = -1;
+  timer_deadline = 0;
+  if (signal_fd >= 0)
+    xclose(signal_fd), signal_fd = -1;
+  if (epoll_fd >= 0)
+    xclose(epoll_fd), epoll_fd = -1;
+  
+  /* The signal mask is inherited over exec. */
+  if (signals_blocked)
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  
+  return rc;
+  
+ fail:
+  xperror(*argv);
+  rc = -1;
+  goto done;
+}
+
+
+/**
+ * Serve a client again, this is used to resume
+ * a client when it has received a reply to a
+ * multicast that it is waiting for
+ * 
+ * @param  client  The client
+ */
+void reactor_resume(client_t* client)
+{
+  with_mutex (reactor_mutex,
+	      if ((client->reactor_state & REACTOR_BUSY))
+		client->reactor_state |= REACTOR_RESUME;
+	      else if ((client->reactor_state & REACTOR_PARKED))
+		{
+		  client->reactor_state = 0;
+		  /* Writability is reported immediately. */
+		  if (watch(client->socket_fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT) < 0)
+		    xperror(*argv);
+		}
+	      );
+}
+
+
+/**
+ * Tell the reactor that messages have been queued for a client
+ * 
+ * The client's mutex must be held, and the client must be open
+ * 
+ * @param  client  The client
+ */
+void reactor_notify(client_t* client)
+{
+  uint32_t events;
+  with_mutex (reactor_mutex,
+	      if ((client->reactor_state & REACTOR_BUSY))
+		client->reactor_state |= REACTOR_RESUME;
+	      else
+		{
+		  /* A parked client is not watched for readability. */
+		  events = (client->reactor_state & REACTOR_PARKED) ? EPOLLOUT : (EPOLLIN | EPOLLOUT);
+		  if (watch(client->socket_fd, EPOLL_CTL_MOD, events) < 0)
+		    xperror(*argv);
+		}
+	      );
+}
+
+
+/**
+ * Resume the clients that wait for a reply, or for room for
+ * a client that may stall, no later than at a deadline, the
+ * clients themselves check whether their deadline has passed
+ * 
+ * @param  deadline  The deadline, in nanoseconds on the monotonic clock
+ */
+void reactor_schedule(uint64_t deadline)
+{
+  with_mutex (reactor_mutex,
+	      if ((timer_deadline == 0) || (deadline < timer_deadline))
+		{
+		  timer_deadline = deadline;
+		  /* The timer is set when the reactor starts, if this is done before. */
+		  if (timer_fd >= 0)
+		    set_timer(deadline);
+		}
+	      );
+}
+
+
+/**
+ * Wake all reactor threads so that they
+ * notice re-exec and termination
+ */
+void reactor_wake(void)
+{
+  uint64_t value = 1;
+  if (wake_fd >= 0)
+    if (write(wake_fd, &value, sizeof(value)) < 0)
+      if (errno != EAGAIN)
+	xperror(*argv);
+}
+
@@ -0,0 +1,92 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_REACTOR_H
+#define MDS_MDS_SERVER_REACTOR_H
+
+
+#include "client.h"
+
+
+
+/**
+ * A reactor thread is serving the client
+ */
+#define REACTOR_BUSY  1
+
+/**
+ * The client should be served again when
+ * the reactor thread serving it is done
+ */
+#define REACTOR_RESUME  2
+
+/**
+ * The client is waiting for a reply to one of its multicasts,
+ * or for room for it, and is not watched for readability
+ * until the wait has completed
+ */
+#define REACTOR_PARKED  4
+
+
+
+/**
+ * Serve all clients, and accept new clients, with a fixed
+ * number of threads that multiplex the clients' sockets,
+ * until the server re-exec:s or terminates
+ * 
+ * @return  Non-zero on error
+ */
+int reactor_run(void);
+
+/**
+ * Serve a client again, this is used to resume
+ * a client when it has received a reply to a
+ * multicast that it is waiting for
+ * 
+ * @param  client  The client
+ */
+__attribute__((nonnull))
+void reactor_resume(client_t* client);
+
+/**
+ * Tell the reactor that messages have been queued for a client
+ * 
+ * The client's mutex must be held, and the client must be open
+ * 
+ * @param  client  The client
+ */
+__attribute__((nonnull))
+void reactor_notify(client_t* client);
+
+/**
+ * Resume the clients that wait for a reply, or for room for
+ * a client that may stall, no later than at a deadline, the
+ * clients themselves check whether their deadline has passed
+ * 
+ * @param  deadline  The deadline, in nanoseconds on the monotonic clock
+ */
+void reactor_schedule(uint64_t deadline);
+
+/**
+ * Wake all reactor threads so that they
+ * notice re-exec and termination
+ */
+void reactor_wake(void);
+
+
+#endif
+
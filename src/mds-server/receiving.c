@@ -20,16 +20,26 @@
 #include "globals.h"
 #include "client.h"
 #include "interceptors.h"
+#include "sending.h"
+#include "fast-lane.h"
+#include "shm-transport.h"
+#include "stats.h"
+#include "credit.h"
+
+#include "../schema/mds-server.h"
 
 #include <libmdsserver/hash-table.h>
 #include <libmdsserver/mds-message.h>
 #include <libmdsserver/macros.h>
+#include <libmdsserver/util.h>
 
 #include <stddef.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
 
 
 /**
@@ -37,10 +47,12 @@
  * 
  * @param  message  The message
  * @param  length   The length of the message
+ * @param  fd       The file descriptor attached to the message, `-1` if none,
+ *                  it is closed once the message has been multicast
  * @param  sender   The original sender of the message
  */
 __attribute__((nonnull))
-void queue_message_multicast(char* message, size_t length, client_t* sender);
+void queue_message_multicast(char* message, size_t length, int fd, client_t* sender);
 
 
 /**
@@ -54,52 +66,39 @@ void queue_message_multicast(char* message, size_t length, client_t* sender);
 __attribute__((nonnull))
 static int modifying_notify(client_t* client, mds_message_t message, uint64_t modify_id)
 {
-  /* pthread_cond_timedwait is required to handle re-exec and termination because
-     pthread_cond_timedwait and pthread_cond_wait ignore interruptions via signals. */
-  struct timespec timeout =
-    {
-      .tv_sec = 1,
-      .tv_nsec = 0
-    };
-  size_t address;
-  client_t* recipient;
-  mds_message_t* multicast;
+  mds_message_t* reply = NULL;
   size_t i;
   
-  pthread_mutex_lock(&(modify_mutex));
-  while (hash_table_contains_key(&modify_map, (size_t)modify_id) == 0)
+  /* Copy the reply, the waiting client takes ownership of it. */
+  fail_if (xmalloc(reply, 1, mds_message_t));
+  mds_message_zero_initialise(reply);
+  if (message.payload_size > 0)
+    fail_if (xmemdup(reply->payload, message.payload, message.payload_size, char));
+  reply->payload_size = message.payload_size;
+  fail_if (xmalloc(reply->headers, message.header_count, char*));
+  for (i = 0; i < message.header_count; i++, reply->header_count++)
+    fail_if (xstrdup(reply->headers[i], message.headers[i]));
+  
+  /* Hand over the reply to the client waiting for it, if there is one. */
+  if (complete_modify_wait(client, modify_id, reply) == 0)
+    reply = NULL;
+  else
     {
-      if (terminating)
-	{
-	  pthread_mutex_unlock(&(modify_mutex));
-	  return 1;
-	}
-      pthread_cond_timedwait(&slave_cond, &slave_mutex, &timeout);
+      eprint("received reply to a message modification that is not awaited, ignoring.");
+      mds_message_destroy(reply);
+      free(reply);
     }
-  address = hash_table_get(&modify_map, (size_t)modify_id);
-  recipient = (client_t*)(void*)address;
-  fail_if (xmalloc(multicast = recipient->modify_message, 1, mds_message_t));
-  mds_message_zero_initialise(multicast);
-  fail_if (xmemdup(multicast->payload, message.payload, message.payload_size, char));
-  fail_if (xmalloc(multicast->headers, message.header_count, char*));
-  for (i = 0; i < message.header_count; i++, multicast->header_count++)
-    fail_if (xstrdup(multicast->headers[i], message.headers[i]));
- done:
-  pthread_mutex_unlock(&(modify_mutex));
-  with_mutex (client->modify_mutex, pthread_cond_signal(&(client->modify_cond)););
-  
-  return 0;
   
+  return terminating ? 1 : 0;
   
  fail:
   xperror(*argv);
-  if (multicast != NULL)
+  if (reply != NULL)
     {
-      mds_message_destroy(multicast);
-      free(multicast);
-      recipient->modify_message = NULL;
+      mds_message_destroy(reply);
+      free(reply);
     }
-  goto done;
+  return 0;
 }
 
 
@@ -180,6 +179,7 @@ static int add_intercept_conditions_from_message(client_t* client, int modifying
 __attribute__((nonnull(1)))
 static int assign_and_send_id(client_t* client, const char* message_id)
 {
+  message_buffer_t* reply = NULL;
   char* msgbuf = NULL;
   char* msgbuf_;
   size_t n;
@@ -200,36 +200,82 @@ static int assign_and_send_id(client_t* client, const char* message_id)
   
   /* Multicast the reply. */
   fail_if (xstrdup(msgbuf_, msgbuf));
-  queue_message_multicast(msgbuf_, n, client);
-  
-  /* Queue message to be sent when this function returns.
-     This done to simplify `multicast_message` for re-exec and termination. */
-#define fail  fail_in_mutex
-  with_mutex (client->mutex,
-	      if (client->send_pending_size == 0)
-		{
-		  /* Set the pending message. */
-		  client->send_pending = msgbuf;
-		  client->send_pending_size = n;
-		}
-	      else
-		{
-		  /* Concatenate message to already pending messages. */
-		  size_t new_len = client->send_pending_size + n;
-		  char* msg_new = client->send_pending;
-		  fail_if (xrealloc(msg_new, new_len, char));
-		  memcpy(msg_new + client->send_pending_size, msgbuf, n * sizeof(char));
-		  client->send_pending = msg_new;
-		  client->send_pending_size = new_len;
-		}
-	      (msgbuf = NULL, rc = 0, errno = 0);
-	     fail_in_mutex:
-	      );
-#undef fail
+  queue_message_multicast(msgbuf_, n, -1, client);
+  
+  /* Queue message to be sent when this function returns, a
+     client's own messages are queued regardless of the limit. */
+  fail_if ((reply = message_buffer_create(msgbuf, n)) == NULL);
+  msgbuf = NULL;
+  fail_if (enqueue_outbound(client, NULL, reply, -1, NULL) < 0);
+  (rc = 0, errno = 0);
   
  fail: /* Also success. */
   xperror(*argv);
   free(msgbuf);
+  message_buffer_unref(reply);
+  return rc;
+}
+
+
+/**
+ * Switch the framing of the messages between a client and the server,
+ * or send an error to the client if the framing is not recognised
+ * 
+ * The client sends its messages in the requested framing as soon as
+ * it has sent the request, and reads the server's messages in the
+ * requested framing once it has received the reply
+ * 
+ * @param   client      The client that sent the request
+ * @param   message_id  The message ID of the request
+ * @param   framing     The requested framing, `NULL` if none was specified
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull(1, 2)))
+static int switch_framing(client_t* client, const char* message_id, const char* framing)
+{
+  char client_id[sizeof("4294967296:4294967296")];
+  message_buffer_t* reply = NULL;
+  char* msgbuf = NULL;
+  size_t size = 0, n;
+  int binary, rc = -1;
+  
+  if ((framing == NULL) || (!strequals(framing, "binary") && !strequals(framing, "text")))
+    {
+      xsnprintf(client_id, "%" PRIu32 ":%" PRIu32,
+		(uint32_t)(client->id >> 32),
+		(uint32_t)(client->id >>  0));
+      n = construct_error_message(client_id, message_id, "framing", 0, EINVAL,
+				  "the framing is not recognised", &msgbuf, &size, 0);
+      fail_if (n == 0);
+      fail_if ((reply = message_buffer_create(msgbuf, n)) == NULL);
+      msgbuf = NULL;
+      fail_if (enqueue_outbound(client, NULL, reply, -1, NULL) < 0);
+      rc = 0;
+      goto fail;
+    }
+  binary = strequals(framing, "binary");
+  
+  /* The messages that follow the request are read in the requested framing. */
+  client->message.binary = binary;
+  
+  /* The reply is the last message that is sent in the old framing. */
+  n = strlen(framing) + strlen(message_id);
+  n += sizeof("Command: framing\nFraming: \nIn response to: \n\n") / sizeof(char);
+  fail_if (xmalloc(msgbuf, n, char));
+  snprintf(msgbuf, n,
+	   "Command: framing\n"
+	   "Framing: %s\n"
+	   "In response to: %s\n"
+	   "\n",
+	   framing, message_id);
+  fail_if ((reply = message_buffer_create(msgbuf, strlen(msgbuf))) == NULL);
+  msgbuf = NULL;
+  fail_if (enqueue_last_in_framing(client, reply, binary) < 0);
+  rc = 0;
+  
+ fail: /* Also success. */
+  free(msgbuf);
+  message_buffer_unref(reply);
   return rc;
 }
 
@@ -244,33 +290,77 @@ static int assign_and_send_id(client_t* client, const char* message_id)
 int message_received(client_t* client)
 {
   mds_message_t message = client->message;
-  int assign_id = 0;
-  int modifying = 0;
-  int intercept = 0;
-  int64_t priority = 0;
-  int stop = 0;
-  const char* message_id = NULL;
-  uint64_t modify_id = 0;
+  mds_server_message_t headers;
+  int assign_id;
+  int modifying;
+  int modify_reply;
+  int intercept;
+  int fast_lane;
+  int shm_ring;
+  int framing;
+  int server_stats;
+  int credit;
+  int attachment;
+  int accept_lanes;
+  int64_t priority;
+  int stop;
+  const char* message_id;
+  uint64_t modify_id;
+  const char* recipient;
+  const char* framing_name;
+  const char* credit_messages;
+  const char* credit_bytes;
+  const char* credit_window;
   char* msgbuf = NULL;
-  size_t i, n;
+  size_t n;
+  int fd = -1;
   
   
+  /* Count the message, the client is only read by one thread at a time. */
+  stats_add_to(&(client->received_messages), 1);
+  stats_add(received_messages, 1);
+  
   /* Parser headers. */
-  for (i = 0; i < message.header_count; i++)
+  mds_server_parse(&headers, &message);
+  assign_id       = (headers.command & MDS_SERVER_COMMAND_ASSIGN_ID) != 0;
+  intercept       = (headers.command & MDS_SERVER_COMMAND_INTERCEPT) != 0;
+  fast_lane       = (headers.command & MDS_SERVER_COMMAND_FAST_LANE) != 0;
+  shm_ring        = (headers.command & MDS_SERVER_COMMAND_SHM_RING) != 0;
+  framing         = (headers.command & MDS_SERVER_COMMAND_FRAMING) != 0;
+  server_stats    = (headers.command & MDS_SERVER_COMMAND_SERVER_STATS) != 0;
+  credit          = (headers.command & MDS_SERVER_COMMAND_CREDIT) != 0;
+  modifying       = headers.modifying == MDS_SERVER_MODIFYING_YES;
+  stop            = headers.stop == MDS_SERVER_STOP_YES;
+  attachment      = headers.attachment == MDS_SERVER_ATTACHMENT_FD;
+  modify_reply    = MDS_SERVER_GIVEN(&headers, MODIFY);
+  message_id      = headers.message_id;
+  priority        = headers.priority;
+  modify_id       = headers.modify_id;
+  accept_lanes    = MDS_SERVER_GIVEN(&headers, ACCEPT) ? (headers.accept == MDS_SERVER_ACCEPT_YES) : -1;
+  recipient       = headers.to;
+  framing_name    = headers.framing;
+  credit_messages = headers.messages;
+  credit_bytes    = headers.bytes;
+  credit_window   = headers.window;
+  
+  /* Every message but a credit grant is covered by the client's send credit. */
+  if ((credit == 0) && (client->send_window > 0))
+    client->send_owed++;
+  
+  
+  /* Take the file descriptor that is attached to the message, even
+     if the message is ignored, so that the next message does not. It is
+     only passed on with the message, its content is never read. */
+  if (attachment && ((fd = take_attachment(client)) < 0))
     {
-      const char* h = message.headers[i];
-      if      (strequals(h,  "Command: assign-id"))  assign_id  = 1;
-      else if (strequals(h,  "Command: intercept"))  intercept  = 1;
-      else if (strequals(h,  "Modifying: yes"))      modifying  = 1;
-      else if (strequals(h,  "Stop: yes"))           stop       = 1;
-      else if (startswith(h, "Message ID: "))        message_id = strstr(h, ": ") + 2;
-      else if (startswith(h, "Priority: "))          priority   = ato64(strstr(h, ": ") + 2);
-      else if (startswith(h, "Modify ID: "))         modify_id  = atou64(strstr(h, ": ") + 2);
+      eprint("received message with an attachment but no file descriptor, ignoring.");
+      return 0;
     }
-  
+  if ((fd >= 0) && (modify_reply || (message_id == NULL) || fast_lane || shm_ring || framing || server_stats || credit))
+    close(fd), fd = -1;
   
   /* Notify waiting client about a received message modification. */
-  if (modifying)
+  if (modify_reply && (modify_id != 0))
     return modifying_notify(client, message, modify_id);
     /* Do nothing more, not not even multicast this message. */
   
@@ -281,19 +371,68 @@ int message_received(client_t* client)
       return 0;
     }
   
+  /* Set whether the client accepts fast lanes, and open a fast lane,
+     the lanes are private to the clients, so this is not multicast. */
+  if (fast_lane)
+    {
+      if (accept_lanes >= 0)
+	__atomic_store_n(&(client->accepts_lanes), accept_lanes, __ATOMIC_RELAXED);
+      if ((recipient != NULL) && open_fast_lane(client, recipient, message_id))
+	xperror(*argv);
+      return 0;
+    }
+  
+  /* Start using the rings that the client shares with the server, this
+     is a matter between the client and the server, so it is not multicast. */
+  if (shm_ring)
+    {
+      if (open_shm_rings(client, message_id))
+	xperror(*argv);
+      return 0;
+    }
+  
+  /* Switch the framing of the messages between the client and the
+     server, this is also a matter between them, so it is not multicast. */
+  if (framing)
+    {
+      if (switch_framing(client, message_id, framing_name))
+	xperror(*argv);
+      return 0;
+    }
+  
+  /* Report the server's counters, the report is only sent to the client
+     that requested it, so that the request cannot be intercepted. */
+  if (server_stats)
+    {
+      if (stats_send_report(client, message_id))
+	xperror(*argv);
+      return 0;
+    }
+  
+  /* Take the credit that the client grants the server, and grant it
+     send credit, this too is a matter between the client and the
+     server, so it is not multicast. */
+  if (credit)
+    {
+      if (credit_received(client, message_id, credit_messages, credit_bytes, credit_window))
+	xperror(*argv);
+      return 0;
+    }
+  
   /* Assign ID if not already assigned. */
   if (assign_id && (client->id == 0))
     {
       intercept |= 2;
-      with_mutex_if (slave_mutex, (client->id = next_client_id++) == 0,
-		     eprint("this is impossible, ID counter has overflowed.");
-		     /* If the program ran for a millennium it would
-			take c:a 585 assignments per nanosecond. This
-			cannot possibly happen. (It would require serious
-			dedication by generations of ponies (or just an alicorn)
-			to maintain the process and transfer it new hardware.) */
-		     abort();
-		     );
+      if ((client->id = __atomic_fetch_add(&next_client_id, 1, __ATOMIC_RELAXED)) == 0)
+	{
+	  eprint("this is impossible, ID counter has overflowed.");
+	  /* If the program ran for a millennium it would
+	     take c:a 585 assignments per nanosecond. This
+	     cannot possibly happen. (It would require serious
+	     dedication by generations of ponies (or just an alicorn)
+	     to maintain the process and transfer it new hardware.) */
+	  abort();
+	}
     }
   
   /* Make the client listen for messages addressed to it. */
@@ -302,6 +441,9 @@ int message_received(client_t* client)
       pthread_mutex_lock(&(client->mutex));
       if ((intercept & 1)) /* from payload */
 	fail_if (add_intercept_conditions_from_message(client, modifying, priority, stop) < 0);
+      if ((intercept & 1) && MDS_SERVER_GIVEN(&headers, TIMEOUT)) /* milliseconds, 0 for the server's default */
+	__atomic_store_n(&(client->reply_timeout), min(headers.timeout, (uint64_t)INT_MAX),
+			 __ATOMIC_RELAXED);
       if ((intercept & 2)) /* "To: $(client->id)" */
 	{
 	  char buf[26];
@@ -318,7 +460,8 @@ int message_received(client_t* client)
   n = mds_message_compose_size(&message);
   fail_if (xbmalloc(msgbuf, n));
   mds_message_compose(&message, msgbuf);
-  queue_message_multicast(msgbuf, n / sizeof(char), client);
+  queue_message_multicast(msgbuf, n / sizeof(char), fd, client);
+  fd = -1;
   msgbuf = NULL;
   
   
@@ -331,5 +474,7 @@ int message_received(client_t* client)
  fail:
   xperror(*argv);
   free(msgbuf);
+  if (fd >= 0)
+    close(fd);
   return 0;
 }
@@ -19,6 +19,7 @@
 #include "globals.h"
 #include "client.h"
 #include "slavery.h"
+#include "sending.h"
 
 #include <libmdsserver/linked-list.h>
 #include <libmdsserver/hash-table.h>
@@ -65,7 +66,7 @@ size_t marshal_server_size(void)
     }
   
   /* Add the size of the rest of the program's state. */
-  state_n += sizeof(int) + sizeof(sig_atomic_t) + 2 * sizeof(uint64_t) + 2 * sizeof(size_t);
+  state_n += sizeof(int) + sizeof(sig_atomic_t) + 3 * sizeof(uint64_t) + 2 * sizeof(size_t);
   state_n += list_elements * sizeof(size_t) + list_size + map_size;
   
   return state_n;
@@ -88,9 +89,10 @@ int marshal_server(char* state_buf)
   /* Release resources. */
   pthread_mutex_destroy(&slave_mutex);
   pthread_cond_destroy(&slave_cond);
+  pthread_rwlock_destroy(&client_lock);
   pthread_mutex_destroy(&modify_mutex);
-  pthread_cond_destroy(&modify_cond);
   hash_table_destroy(&modify_map, NULL, NULL);
+  interception_index_destroy(&interception_index);
   
   
   /* Count the number of clients that online. */
@@ -104,6 +106,7 @@ int marshal_server(char* state_buf)
   buf_set_next(state_buf, sig_atomic_t, running);
   buf_set_next(state_buf, uint64_t, next_client_id);
   buf_set_next(state_buf, uint64_t, next_modify_id);
+  buf_set_next(state_buf, uint64_t, next_lane_id);
   
   /* Tell the program how large the marshalled client list is and how any clients are marshalled. */
   buf_set_next(state_buf, size_t, list_size);
@@ -172,13 +175,26 @@ static size_t unmarshal_remapper(size_t old)
  */
 int unmarshal_server(char* state_buf)
 {
-  int with_error = 0;
+  int with_error = 0, version;
   size_t list_size;
   size_t list_elements;
   size_t i;
   ssize_t node;
   pthread_t slave_thread;
   
+  /* Get the marshal protocal version. */
+  buf_get_next(state_buf, int, version);
+  
+  /* The state of an image from before version 1 has another layout, and cannot
+     be read. Start without the clients, the caller closes their sockets. */
+  if (version != MDS_SERVER_VARS_VERSION)
+    {
+      eprint("the marshalled state has another version, disconnecting all clients.");
+      if (initialise_server())
+	abort();
+      return -1;
+    }
+  
 #define fail  soft_fail
 
   /* Create memory address remapping table. */
@@ -187,14 +203,11 @@ int unmarshal_server(char* state_buf)
 #undef fail
 #define fail  clients_fail
   
-  /* Get the marshal protocal version. Not needed, there is only the one version right now. */
-  /* buf_get(state_buf, int, 0, MDS_SERVER_VARS_VERSION); */
-  buf_next(state_buf, int, 1);
-  
   /* Unmarshal the miscellaneous state data. */
   buf_get_next(state_buf, sig_atomic_t, running);
   buf_get_next(state_buf, uint64_t, next_client_id);
   buf_get_next(state_buf, uint64_t, next_modify_id);
+  buf_get_next(state_buf, uint64_t, next_lane_id);
   
   /* Get the marshalled size of the client list and how any clients that are marshalled. */
   buf_get_next(state_buf, size_t, list_size);
@@ -260,28 +273,42 @@ int unmarshal_server(char* state_buf)
 	__bit(i, &= ~);
 #undef __bit
   
-  /* Remap the linked list and remove non-found elements, and start the clients. */
+  /* Remap the linked list and remove non-found elements. */
   foreach_linked_list_node (client_list, node)
     {
-      /* Remap the linked list and remove non-found elements. */
       size_t new_address = unmarshal_remapper(client_list.values[node]);
       client_list.values[node] = new_address;
       if (new_address == 0) /* Returned if missing (or if the address is the invalid NULL.) */
 	linked_list_remove(&client_list, node);
       else
 	{
-	  /* Start the clients. (Errors do not need to be reported.) */
 	  client_t* client = (client_t*)(void*)new_address;
-	  int slave_fd = client->socket_fd;
 	  
-	  /* Increase number of running slaves. */
-	  with_mutex (slave_mutex, running_slaves++;);
+	  /* Make sure replies to an interrupted multicast are not lost. */
+	  restore_modify_wait(client);
 	  
-	  /* Start slave thread. */
-	  create_slave(&slave_thread, slave_fd);
+	  /* The interception index is not marshalled, rebuild it. */
+	  if (interception_index_put_client(&interception_index, client) < 0)
+	    xperror(*argv);
 	}
     }
   
+  /* Start the clients, not until the list and the index are complete, because
+     a client's thread walks the list and looks up interceptors in the index.
+     (Errors do not need to be reported.) The reactor starts serving the
+     clients when it starts. */
+  if (reactor_enabled == 0)
+    foreach_linked_list_node (client_list, node)
+      {
+	client_t* client = (client_t*)(void*)(client_list.values[node]);
+	
+	/* Increase number of running slaves. */
+	with_mutex (slave_mutex, running_slaves++;);
+	
+	/* Start slave thread. */
+	create_slave(&slave_thread, client->socket_fd);
+      }
+  
   /* Release the remapping table's resources. */
   hash_table_destroy(&unmarshal_remap_map, NULL, NULL);
   
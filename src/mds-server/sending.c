@@ -21,31 +21,835 @@
 #include "client.h"
 #include "queued-interception.h"
 #include "multicast.h"
+#include "reactor.h"
+#include "shm-transport.h"
+#include "stats.h"
+#include "credit.h"
 
 #include <libmdsserver/mds-message.h>
 #include <libmdsserver/macros.h>
 #include <libmdsserver/util.h>
+#include <libmdsserver/linked-list.h>
 
 #include <stddef.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 
 
 /**
- * Get the client by its socket's file descriptor in a synchronised manner
+ * The maximum number of parts of queued messages
+ * that are sent with one system call
+ */
+#define OUTBOUND_PARTS  64
+
+
+
+/**
+ * Get the client by its socket's file descriptor in a synchronised
+ * manner, with a reference to it for the caller
  * 
  * @param   client_fd  The file descriptor of the client's socket
- * @return             The client
+ * @return             The client, `NULL` if there is none
  */
 static client_t* client_by_socket(int client_fd)
 {
+  client_t* client;
   size_t address;
-  with_mutex (slave_mutex, address = fd_table_get(&client_map, client_fd););
-  return (client_t*)(void*)address;
+  with_rdlock (client_lock,
+	       address = fd_table_get(&client_map, client_fd);
+	       if ((client = (client_t*)(void*)address) != NULL)
+		 client_ref(client););
+  return client;
+}
+
+
+/**
+ * Wake the slave thread that serves a client,
+ * this does nothing in reactor mode
+ * 
+ * @param  client  The client
+ */
+__attribute__((nonnull))
+static void wake_slave(client_t* client)
+{
+  uint64_t value = 1;
+  if (client->wake_fd >= 0)
+    if (write(client->wake_fd, &value, sizeof(value)) < 0)
+      if (errno != EAGAIN)
+	xperror(*argv);
+}
+
+
+/**
+ * Get when a client with something pending stalls,
+ * unless something is sent to it before then
+ * 
+ * @param   client  The client
+ * @return          The time, in nanoseconds on the monotonic clock,
+ *                  zero if the client may stall indefinitely
+ */
+__attribute__((nonnull))
+static uint64_t stall_deadline(client_t* client)
+{
+  uint64_t progress = __atomic_load_n(&(client->outbound_progress), __ATOMIC_RELAXED);
+  if ((stall_timeout == 0) || (progress == 0))
+    return 0;
+  return progress + stall_timeout * 1000000;
+}
+
+
+/**
+ * Check whether a client that has something pending has stalled,
+ * the caller must hold the client's mutex
+ * 
+ * @param   client  The client
+ * @return          Whether the client has stalled
+ */
+__attribute__((nonnull))
+static int outbound_stalled(client_t* client)
+{
+  uint64_t deadline;
+  
+  /* The time of the last progress is not kept over re-exec, so it starts over. */
+  if ((stall_timeout > 0) && (client->outbound_progress == 0))
+    __atomic_store_n(&(client->outbound_progress), monotonic_time(), __ATOMIC_RELAXED);
+  
+  deadline = stall_deadline(client);
+  return (deadline > 0) && (monotonic_time() >= deadline);
+}
+
+
+/**
+ * Disconnect a client that has stalled, the thread that serves
+ * the client will find its socket closed, and close the client,
+ * the caller must hold the client's mutex
+ * 
+ * @param  client  The client
+ */
+__attribute__((nonnull))
+static void evict(client_t* client)
+{
+  client->evicted = 1;
+  if (shutdown(client->socket_fd, SHUT_RDWR) < 0)
+    xperror(*argv);
+  stats_add(evictions, 1);
+}
+
+
+/**
+ * Check whether the messages queued for a client that wait for
+ * credit take all of the credit that the client has granted,
+ * the caller must hold the client's mutex
+ * 
+ * @param   client  The client
+ * @return          Whether further deliveries must wait for credit
+ */
+__attribute__((nonnull, pure))
+static int credit_exhausted(const client_t* client)
+{
+  return ((uint64_t)(client->outbound_withheld) >= client->credit_messages) ||
+         ((uint64_t)(client->outbound_withheld_bytes) >= client->credit_bytes);
+}
+
+
+/**
+ * Drop the oldest messages queued for a client that has stalled
+ * until there is room for another message, messages that have been
+ * partly sent, that the client may modify, or after which it is
+ * sent to differently, are kept, the caller must hold the client's mutex
+ * 
+ * @param   client  The client
+ * @param   length  The length of the message that needs room
+ * @return          The number of characters pending for the client
+ */
+__attribute__((nonnull))
+static size_t drop_oldest(client_t* client, size_t length)
+{
+  outbound_message_t* message;
+  size_t i, j, dropped = 0;
+  
+  for (i = j = client->outbound_head; i < client->outbound_count; i++)
+    {
+      message = client->outbound + i;
+      if ((client->outbound_pending + length > outbound_limit) && (message->sent == 0) &&
+	  (message->prefix == NULL) && (message->last_on_socket == 0))
+	{
+	  client->outbound_pending -= message->message->length;
+	  if (message->needs_credit)
+	    {
+	      client->outbound_withheld -= 1;
+	      client->outbound_withheld_bytes -= message->message->length;
+	    }
+	  message_buffer_unref(message->message);
+	  if (message->fd >= 0)
+	    close(message->fd);
+	  dropped++;
+	  continue;
+	}
+      client->outbound[j++] = *message;
+    }
+  client->outbound_count = j;
+  
+  stats_add(dropped_messages, dropped);
+  return client->outbound_pending;
+}
+
+
+/**
+ * Replace the newest message in a client's queue that has not started
+ * being sent, that is from the same client and that has the same
+ * `Coalesce` header as a new message, with the new message, the
+ * caller must hold the client's mutex
+ * 
+ * The server's own messages are not passed, as they may change
+ * how the messages after them are sent
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   message    The new message, in the recipient's framing
+ * @param   length     The length of the message
+ * @param   sender     The `coalesce_sender` of the client whose multicast is being sent
+ * @return             Whether a message was replaced
+ */
+__attribute__((nonnull))
+static int coalesce(client_t* recipient, message_buffer_t* message, size_t length, uint64_t sender)
+{
+  outbound_message_t* queued;
+  size_t i;
+  
+  for (i = recipient->outbound_count; i-- > recipient->outbound_head;)
+    {
+      queued = recipient->outbound + i;
+      if ((queued->sender == 0) || queued->last_on_socket)
+	break;
+      if ((queued->sender != sender) || queued->sent || (queued->prefix != NULL) || (queued->fd >= 0))
+	continue;
+      if ((queued->message->coalesce == NULL) || strcmp(queued->message->coalesce, message->coalesce))
+	continue;
+      
+      recipient->outbound_pending -= queued->message->length;
+      recipient->outbound_pending += length;
+      if (queued->needs_credit)
+	{
+	  recipient->outbound_withheld_bytes -= queued->message->length;
+	  recipient->outbound_withheld_bytes += length;
+	}
+      message_buffer_unref(queued->message);
+      queued->message = message_buffer_ref(message);
+      stats_add(coalesced_messages, 1);
+      return 1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Queue a message to be sent to a client by the thread that serves it
+ * 
+ * @param   recipient       The client to which the message should be sent
+ * @param   prefix          A header to send before the message, `NULL` if none
+ * @param   message         The message
+ * @param   fd              A file descriptor to pass along with the message, `-1` if
+ *                          none, the queue takes ownership of it if the message is queued
+ * @param   last_on_socket  Whether the messages after this one are written to the ring
+ * @param   binary_after    -1 to keep the recipient's framing, otherwise whether the
+ *                          messages after this one are sent in the binary framing
+ * @param   sender          The client whose multicast is being sent, `NULL` if the
+ *                          message should be queued regardless of the queue's size
+ * @return                  See `enqueue_outbound`
+ */
+__attribute__((nonnull(1, 3)))
+static int enqueue(client_t* recipient, message_buffer_t* prefix, message_buffer_t* message,
+		   int fd, int last_on_socket, int binary_after, client_t* sender)
+{
+  size_t length = message->length + (prefix == NULL ? 0 : prefix->length);
+  size_t pending, capacity;
+  outbound_message_t* new_buf;
+  message_buffer_t* binary = NULL;
+  int rc = 0, full, modifying = prefix != NULL;
+  
+  pthread_mutex_lock(&(recipient->mutex));
+  
+  if ((recipient->open == 0) || recipient->evicted)
+    {
+      rc = 2;
+      goto done;
+    }
+  
+  /* The message is translated, along with its prefix, for clients that use the binary framing. */
+  if (recipient->binary)
+    {
+      if ((binary = message_buffer_binary(message, prefix)) == NULL)
+	{
+	  rc = -1;
+	  goto done;
+	}
+      message = binary;
+      prefix = NULL;
+      length = message->length;
+    }
+  
+  /* A newer state replaces the queued one rather than waiting for room behind it,
+     unless the recipient may modify it, or it passes a file descriptor. */
+  if ((sender != NULL) && (sender->coalesce_sender == 0))
+    while ((sender->coalesce_sender = __atomic_fetch_add(&next_client_id, 1, __ATOMIC_RELAXED)) == 0);
+  if ((sender != NULL) && (message->coalesce != NULL) && !modifying && (fd < 0))
+    if (coalesce(recipient, message, length, sender->coalesce_sender))
+      goto done;
+  
+  /* Multicasts also wait for room when the recipient has not granted credit for
+     more, the recipient has stalled if it does not grant more within the timeout,
+     but a client cannot grant credit while its own multicast waits. */
+  pending = recipient->outbound_pending;
+  full = (pending > 0) && (pending + length > outbound_limit);
+  full = full || ((recipient != sender) && credit_exhausted(recipient));
+  if ((sender != NULL) && full)
+    {
+      if ((pending == 0) && (recipient->outbound_waiters == 0) && (stall_timeout > 0))
+	__atomic_store_n(&(recipient->outbound_progress), monotonic_time(), __ATOMIC_RELAXED);
+      
+      /* A recipient that has stalled is not waited upon, it is
+	 disconnected, or its oldest messages are dropped. */
+      if (outbound_stalled(recipient))
+	{
+	  if (stall_drop == 0)
+	    {
+	      evict(recipient);
+	      rc = 2;
+	      goto done;
+	    }
+	  recipient->outbound_dropping = 1;
+	}
+      if (recipient->outbound_dropping)
+	pending = drop_oldest(recipient, length);
+      else
+	{
+	  recipient->outbound_waiters++;
+	  with_mutex (slave_mutex, sender->outbound_blocked_on = recipient;);
+	  /* In reactor mode the sender is resumed no later than when the recipient stalls. */
+	  if (reactor_enabled && stall_deadline(recipient))
+	    reactor_schedule(stall_deadline(recipient));
+	  rc = 1;
+	  goto done;
+	}
+    }
+  
+  /* Make room for the message, first by discarding what has been sent. */
+  if ((recipient->outbound_head > 0) && (recipient->outbound_count == recipient->outbound_capacity))
+    {
+      recipient->outbound_count -= recipient->outbound_head;
+      memmove(recipient->outbound, recipient->outbound + recipient->outbound_head,
+	      recipient->outbound_count * sizeof(outbound_message_t));
+      recipient->outbound_head = 0;
+    }
+  if (recipient->outbound_count == recipient->outbound_capacity)
+    {
+      capacity = recipient->outbound_capacity == 0 ? 8 : (recipient->outbound_capacity << 1);
+      new_buf = recipient->outbound;
+      if (xrealloc(new_buf, capacity, outbound_message_t))
+	{
+	  rc = -1;
+	  goto done;
+	}
+      recipient->outbound = new_buf;
+      recipient->outbound_capacity = capacity;
+    }
+  
+  new_buf = recipient->outbound + recipient->outbound_count++;
+  new_buf->prefix = prefix == NULL ? NULL : message_buffer_ref(prefix);
+  new_buf->message = message_buffer_ref(message);
+  new_buf->fd = fd;
+  new_buf->last_on_socket = last_on_socket;
+  new_buf->sent = 0;
+  new_buf->needs_credit = sender != NULL;
+  new_buf->sender = sender == NULL ? 0 : sender->coalesce_sender;
+  if (new_buf->needs_credit)
+    {
+      recipient->outbound_withheld += 1;
+      recipient->outbound_withheld_bytes += length;
+    }
+  recipient->outbound_pending = pending += length;
+  if (pending > recipient->outbound_high_water)
+    recipient->outbound_high_water = pending;
+  if (binary_after >= 0)
+    recipient->binary = binary_after;
+  
+  /* The thread that serves the recipient keeps sending until the queue is empty. */
+  if (pending == length)
+    {
+      if (stall_timeout > 0)
+	__atomic_store_n(&(recipient->outbound_progress), monotonic_time(), __ATOMIC_RELAXED);
+      if (reactor_enabled)
+	reactor_notify(recipient);
+      else
+	wake_slave(recipient);
+    }
+  
+ done:
+  pthread_mutex_unlock(&(recipient->mutex));
+  message_buffer_unref(binary);
+  return rc;
+}
+
+
+/**
+ * Queue a message to be sent to a client by the thread that serves it
+ * 
+ * A message is always accepted into an empty queue, but if the queue is
+ * not empty and the message does not fit within `outbound_limit`, the
+ * message is not queued, instead the sender is registered as waiting for
+ * room in the queue, and will be resumed when there is room
+ * 
+ * A multicast with a `Coalesce` header replaces the last message queued
+ * for the recipient, that has not started being sent, from the same
+ * client and with the same `Coalesce` header, if there is one
+ * 
+ * The message is not copied, the recipient takes a reference to it
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   prefix     A header to send before the message, `NULL` if none
+ * @param   message    The message
+ * @param   fd         A file descriptor to pass along with the message, `-1` if
+ *                     none, the queue takes ownership of it if the message is queued
+ * @param   sender     The client whose multicast is being sent, `NULL` if the
+ *                     message should be queued regardless of the queue's size
+ * @return             Zero if the message was queued, 1 if the queue is full,
+ *                     2 if the recipient has closed, and -1 on error
+ */
+int enqueue_outbound(client_t* recipient, message_buffer_t* prefix, message_buffer_t* message,
+		     int fd, client_t* sender)
+{
+  return enqueue(recipient, prefix, message, fd, 0, -1, sender);
+}
+
+
+/**
+ * Queue the last message that is sent to a client over its socket,
+ * the messages queued after it are written to the client's ring
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   message    The message
+ * @return             See `enqueue_outbound`
+ */
+int enqueue_last_on_socket(client_t* recipient, message_buffer_t* message)
+{
+  return enqueue(recipient, NULL, message, -1, 1, -1, NULL);
+}
+
+
+/**
+ * Queue the last message that is sent to a client in its current
+ * framing, the messages queued after it are sent in another framing
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   message    The message
+ * @param   binary     Whether the messages after this one are sent in the binary framing
+ * @return             See `enqueue_outbound`
+ */
+int enqueue_last_in_framing(client_t* recipient, message_buffer_t* message, int binary)
+{
+  return enqueue(recipient, NULL, message, -1, 0, binary, NULL);
+}
+
+
+/**
+ * Let the multicasts that wait for room in a client's outbound queue continue
+ * 
+ * @param  client  The client whose queue has room, or that has closed
+ */
+__attribute__((nonnull))
+static void resume_outbound_waiters(client_t* client)
+{
+  ssize_t node;
+  
+  pthread_rwlock_rdlock(&client_lock);
+  with_mutex (slave_mutex,
+	      foreach_linked_list_node (client_list, node)
+		{
+		  client_t* waiter = (client_t*)(void*)(client_list.values[node]);
+		  if (waiter->outbound_blocked_on != client)
+		    continue;
+		  waiter->outbound_blocked_on = NULL;
+		  resume_client(waiter);
+		}
+	      );
+  pthread_rwlock_unlock(&client_lock);
+}
+
+
+/**
+ * Get the number of characters of a queued message that have not been sent
+ * 
+ * @param   message  The queued message
+ * @return           The number of characters left to send
+ */
+__attribute__((pure, nonnull))
+static size_t outbound_message_left(const outbound_message_t* message)
+{
+  size_t n = message->message->length;
+  if (message->prefix != NULL)
+    n += message->prefix->length;
+  return n - message->sent;
+}
+
+
+/**
+ * Add what is left to send of a queued message to the parts of a system call
+ * 
+ * @param  header   The message header for `sendmsg`
+ * @param  message  The queued message
+ */
+__attribute__((nonnull))
+static void add_outbound_parts(struct msghdr* header, const outbound_message_t* message)
+{
+  size_t skip = message->sent;
+  
+  if (message->prefix != NULL)
+    {
+      if (skip < message->prefix->length)
+	{
+	  header->msg_iov[header->msg_iovlen].iov_base = message->prefix->data + skip;
+	  header->msg_iov[header->msg_iovlen].iov_len = (message->prefix->length - skip) * sizeof(char);
+	  header->msg_iovlen++;
+	  skip = 0;
+	}
+      else
+	skip -= message->prefix->length;
+    }
+  
+  if (skip < message->message->length)
+    {
+      header->msg_iov[header->msg_iovlen].iov_base = message->message->data + skip;
+      header->msg_iov[header->msg_iovlen].iov_len = (message->message->length - skip) * sizeof(char);
+      header->msg_iovlen++;
+    }
+}
+
+
+/**
+ * Take credit for a delivery to a client, the caller must hold the client's mutex
+ * 
+ * @param   client  The client
+ * @param   length  The number of characters in the message
+ * @return          Whether the client had the credit
+ */
+__attribute__((nonnull))
+static int take_credit(client_t* client, size_t length)
+{
+  if ((client->credit_messages == 0) || (client->credit_bytes == 0))
+    return 0;
+  if (client->credit_messages != UINT64_MAX)
+    client->credit_messages -= 1;
+  if (client->credit_bytes != UINT64_MAX)
+    client->credit_bytes -= min((uint64_t)length, client->credit_bytes);
+  return 1;
+}
+
+
+/**
+ * Send as much of a client's outbound queue as
+ * can be sent without waiting
+ * 
+ * The queued messages are sent together, with one system call
+ * for up to `send_budget` bytes, the prefixes and the messages
+ * are sent as separate parts, or they are written to the client's
+ * ring in the same way, once it is used
+ * 
+ * Deliveries are withheld once the credit that the client
+ * has granted, if it uses credit, has been taken
+ * 
+ * @param   client  The client
+ * @return          Zero if the queue has been emptied, 1 if the
+ *                  client cannot receive more right now, -1 if the
+ *                  queue was discarded because the client cannot
+ *                  receive anything more
+ */
+int flush_outbound(client_t* client)
+{
+  struct msghdr header;
+  struct iovec parts[OUTBOUND_PARTS];
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr* cmsg;
+  outbound_message_t* message;
+  outbound_message_t* passing;
+  uint64_t calls = 0, messages = 0, bytes = 0;
+  size_t i, n, left, length;
+  ssize_t sent;
+  int rc = 0, no_fd = -1;
+  
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = parts;
+  
+  pthread_mutex_lock(&(client->mutex));
+  
+  while (client->outbound_head < client->outbound_count)
+    {
+      /* Gather queued messages until the budget is reached, but at least one,
+	 at most one file descriptor is passed per system call, the recipient
+	 receives the file descriptors in order, no later than the message
+	 that they are passed along with. */
+      header.msg_iovlen = 0;
+      header.msg_control = NULL;
+      header.msg_controllen = 0;
+      passing = NULL;
+      length = 0;
+      for (i = client->outbound_head; i < client->outbound_count; i++)
+	{
+	  message = client->outbound + i;
+	  if ((length >= send_budget) || (header.msg_iovlen + 2 > OUTBOUND_PARTS))
+	    break;
+	  if (message->needs_credit)
+	    {
+	      if (take_credit(client, outbound_message_left(message)) == 0)
+		break;
+	      message->needs_credit = 0;
+	      client->outbound_withheld -= 1;
+	      client->outbound_withheld_bytes -= outbound_message_left(message);
+	    }
+	  if (message->fd >= 0)
+	    {
+	      if (passing != NULL)
+		break;
+	      passing = message;
+	      header.msg_control = control.buf;
+	      header.msg_controllen = sizeof(control.buf);
+	      cmsg = CMSG_FIRSTHDR(&header);
+	      cmsg->cmsg_level = SOL_SOCKET;
+	      cmsg->cmsg_type = SCM_RIGHTS;
+	      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	      memcpy(CMSG_DATA(cmsg), &(message->fd), sizeof(int));
+	    }
+	  add_outbound_parts(&header, message);
+	  length += outbound_message_left(message);
+	  if (message->last_on_socket)
+	    break;
+	}
+      
+      /* The rest is withheld until the client grants more credit. */
+      if (length == 0)
+	{
+	  rc = 1;
+	  break;
+	}
+      
+      sent = 0;
+      if ((length > 0) && client->ring_writing)
+	{
+	  sent = write_client_ring(client, parts, header.msg_iovlen, passing == NULL ? &no_fd : &(passing->fd));
+	  calls++;
+	}
+      else if (length > 0)
+	{
+	  sent = sendmsg(client->socket_fd, &header, MSG_NOSIGNAL | MSG_DONTWAIT);
+	  calls++;
+	}
+      if (sent < 0)
+	{
+	  if (errno == EAGAIN)
+	    {
+	      rc = 1;
+	      break;
+	    }
+	  if (errno == EINTR)
+	    continue;
+	  /* The client will be closed when its end of the socket is read. */
+	  if ((errno != EPIPE) && (errno != ECONNRESET))
+	    xperror(*argv);
+	  rc = -1;
+	  sent = (ssize_t)(client->outbound_pending * sizeof(char));
+	}
+      else
+	bytes += (uint64_t)sent;
+      
+      /* The file descriptor has been passed with the first byte that was sent. */
+      if ((passing != NULL) && (passing->fd >= 0) && (sent > 0))
+	{
+	  close(passing->fd);
+	  passing->fd = -1;
+	}
+      
+      /* Release the messages that have been sent, or discarded if the client cannot receive them. */
+      n = (size_t)sent / sizeof(char);
+      client->outbound_pending -= min(n, client->outbound_pending);
+      while (client->outbound_head < client->outbound_count)
+	{
+	  message = client->outbound + client->outbound_head;
+	  left = outbound_message_left(message);
+	  if (n < left)
+	    {
+	      message->sent += n;
+	      break;
+	    }
+	  n -= left;
+	  message_buffer_unref(message->prefix);
+	  message_buffer_unref(message->message);
+	  if (message->fd >= 0)
+	    close(message->fd);
+	  if (message->last_on_socket)
+	    client->ring_writing = 1;
+	  client->outbound_head++;
+	  messages++;
+	}
+    }
+  
+  /* A client that receives has not stalled. */
+  if ((bytes > 0) && (stall_timeout > 0))
+    __atomic_store_n(&(client->outbound_progress), monotonic_time(), __ATOMIC_RELAXED);
+  
+  if (client->outbound_head == client->outbound_count)
+    {
+      client->outbound_head = client->outbound_count = 0;
+      client->outbound_dropping = 0;
+      /* Do not hold on to the memory after a burst. */
+      if (client->outbound_capacity > 64)
+	{
+	  free(client->outbound);
+	  client->outbound = NULL;
+	  client->outbound_capacity = 0;
+	}
+    }
+  
+  /* Let the multicasts that wait for room continue when half of the limit is free,
+     and the client has granted credit for more than what is queued. */
+  if ((client->outbound_waiters > 0) && (client->outbound_pending <= outbound_limit / 2) &&
+      !credit_exhausted(client))
+    {
+      client->outbound_waiters = 0;
+      resume_outbound_waiters(client);
+    }
+  
+  stats_add_to(&(client->sent_messages), messages);
+  stats_add_to(&(client->sent_bytes), bytes);
+  pthread_mutex_unlock(&(client->mutex));
+  
+  stats_add(send_calls, calls);
+  stats_add(sent_messages, messages);
+  stats_add(sent_bytes, bytes);
+  return rc;
+}
+
+
+/**
+ * Check whether any of a client's queued messages can be sent
+ * once the client can receive more, the caller must hold the
+ * client's mutex
+ * 
+ * @param   client  The client
+ * @return          Whether messages are queued and not withheld
+ *                  until the client grants more credit
+ */
+int outbound_sendable(const client_t* client)
+{
+  if ((client->outbound_pending == 0) || (client->outbound_head == client->outbound_count))
+    return 0;
+  if (client->outbound[client->outbound_head].needs_credit == 0)
+    return 1;
+  return (client->credit_messages > 0) && (client->credit_bytes > 0);
+}
+
+
+/**
+ * Stop all multicasts from waiting for room in a client's
+ * outbound queue, and stop the client's own multicast from
+ * waiting, this should be done when the client closes
+ * 
+ * @param  client  The client that has closed
+ */
+void release_outbound_waits(client_t* client)
+{
+  with_mutex (client->mutex, client->outbound_waiters = 0;);
+  with_mutex (slave_mutex, client->outbound_blocked_on = NULL;);
+  resume_outbound_waiters(client);
+}
+
+
+/**
+ * Wait, in thread mode, until a client's socket becomes readable,
+ * if `readable` is set, until more of what is queued for the client
+ * can be sent, until the client's slave thread is woken, or until
+ * the timeout, which should be at most a second so that re-exec
+ * and termination are noticed
+ * 
+ * @param   client    The client
+ * @param   readable  Whether to wait for the client's socket to become readable
+ * @param   timeout   The number of milliseconds to wait at most
+ * @return            Whether the client's socket is readable, or closed
+ */
+int await_client(client_t* client, int readable, int timeout)
+{
+  struct pollfd pfds[2];
+  uint64_t value;
+  int pending, ring = client->ring_writing;
+  
+  with_mutex (client->mutex, pending = outbound_sendable(client););
+  
+  /* Once the ring is used, the client rings the doorbell, on the socket, when there is room. */
+  pfds[0].fd = (readable || pending) ? client->socket_fd : -1;
+  pfds[0].events = (short)(((readable || (pending && ring)) ? POLLIN : 0) | ((pending && !ring) ? POLLOUT : 0));
+  pfds[0].revents = 0;
+  pfds[1].fd = client->wake_fd;
+  pfds[1].events = POLLIN;
+  pfds[1].revents = 0;
+  
+  if (poll(pfds, 2, timeout) < 0)
+    {
+      if (errno != EINTR)
+	xperror(*argv);
+      return 0;
+    }
+  
+  if ((pfds[1].revents & POLLIN))
+    if (read(client->wake_fd, &value, sizeof(value)) < 0)
+      if (errno != EAGAIN)
+	xperror(*argv);
+  
+  /* The doorbell must be drained if the socket is not read, or it remains readable. */
+  if (ring && !readable && (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+    drain_doorbell(client);
+  
+  return readable && (pfds[0].revents & (POLLIN | POLLHUP | POLLERR));
+}
+
+
+/**
+ * Check whether a message has an `Attachment: fd` header
+ * 
+ * @param   message  The message
+ * @param   length   The length of the message
+ * @return           Whether the message has the header
+ */
+__attribute__((pure))
+static int has_attachment(const char* message, size_t length)
+{
+  const char* end;
+  
+  while ((length > 0) && (*message != '\n'))
+    {
+      end = memchr(message, '\n', length);
+      if (end == NULL)
+	break;
+      if ((size_t)(end - message) == strlen("Attachment: fd"))
+	if (!memcmp(message, "Attachment: fd", strlen("Attachment: fd")))
+	  return 1;
+      length -= (size_t)(end - message) + 1;
+      message = end + 1;
+    }
+  
+  return 0;
 }
 
 
@@ -55,118 +859,332 @@ static client_t* client_by_socket(int client_fd)
  * @param   multicast  The message
  * @param   recipient  The recipient
  * @param   modifying  Whether the recipient may modify the message
- * @return             Evaluates to true if and only if the entire message was sent
+ * @param   sender     The client whose multicast is being sent
+ * @return             See `enqueue_outbound`
  */
 __attribute__((nonnull))
-static int send_multicast_to_recipient(multicast_t* multicast, client_t* recipient, int modifying)
+static int send_multicast_to_recipient(multicast_t* multicast, client_t* recipient,
+				       int modifying, client_t* sender)
 {
-  char* msg = multicast->message + multicast->message_ptr;
-  size_t n = multicast->message_length - multicast->message_ptr;
-  size_t sent;
+  char header[13 + 3 * sizeof(uint64_t)];
+  int r, fd = -1;
   
-  /* Skip Modify ID header if the interceptors will not perform a modification. */
-  if ((modifying == 0) && (multicast->message_ptr == 0))
+  /* Only interceptors that may perform a modification are sent the
+     Modify ID header, it is created once and shared between them. */
+  if (modifying && (multicast->prefix == NULL))
     {
-      n -= multicast->message_prefix;
-      multicast->message_ptr += multicast->message_prefix;
+      xsnprintf(header, "Modify ID: %" PRIu64 "\n", multicast->modify_id);
+      if ((multicast->prefix = message_buffer_copy(header, strlen(header))) == NULL)
+	return -1;
     }
   
-  /* Send the message. */
-  n *= sizeof(char);
-  with_mutex (recipient->mutex,
-	      if (recipient->open)
-		{
-		  sent = send_message(recipient->socket_fd, msg + multicast->message_ptr, n);
-		  n -= sent;
-		  multicast->message_ptr += sent / sizeof(char);
-		  if ((n > 0) && (errno != EINTR))
-		    xperror(*argv);
-		}
-	      );
+  /* Each recipient is passed its own duplicate of the attached file
+     descriptor, so that what is attached is never read or copied. */
+  if ((multicast->fd >= 0) && ((fd = fcntl(multicast->fd, F_DUPFD_CLOEXEC, 0)) < 0))
+    return -1;
   
-  return n == 0;
+  /* Queue the message, it has been sent as far as the sender is concerned. */
+  r = enqueue_outbound(recipient, modifying ? multicast->prefix : NULL, multicast->message, fd, sender);
+  if (r == 0)
+    multicast->message_ptr = 1;
+  else if (fd >= 0)
+    close(fd);
+  return r;
 }
 
 
 /**
- * Wait for the recipient of a multicast to reply
+ * Record the round trip time of a reply to
+ * a message that the recipient may modify
+ * 
+ * @param  round_trip  The round trip time, in nanoseconds
+ */
+static void record_round_trip(uint64_t round_trip)
+{
+  stats_add(reply_round_trips[stats_bucket(round_trip / 1000, STATS_TIME_BUCKETS)], 1);
+}
+
+
+/**
+ * Register that a client is waiting for a recipient of its
+ * multicast to reply, this must be done before the message is
+ * sent so that the reply cannot arrive before the registration
+ * 
+ * The client's wait slot is the completion of the multicast:
+ * the reply is stored in it and the client is resumed directly,
+ * the modify map is only used to find the client by modify ID,
+ * and the client only takes its lock to register and, unless
+ * the reply did so, to unregister. The map is global rather than
+ * kept by the recipient, as its lock is what stops either client
+ * from being freed while the other one uses the wait
  * 
+ * @param  sender     The client whose multicast is being sent
  * @param  recipient  The recipient
  * @param  modify_id  The modify ID of the multicast
  */
 __attribute__((nonnull))
-static void wait_for_reply(client_t* recipient, uint64_t modify_id)
+static void register_modify_wait(client_t* sender, client_t* recipient, uint64_t modify_id)
+{
+  uint64_t timeout = __atomic_load_n(&(recipient->reply_timeout), __ATOMIC_RELAXED);
+  uint64_t now = monotonic_time();
+  
+  if (timeout == 0)
+    timeout = default_reply_timeout;
+  
+  pthread_mutex_lock(&modify_mutex);
+  if (hash_table_put(&modify_map, (size_t)modify_id, (size_t)(void*)sender) == 0)
+    if (errno)
+      xperror(*argv);
+  __atomic_store_n(&(sender->modify_recipient), recipient, __ATOMIC_RELAXED);
+  sender->modify_started = now;
+  sender->modify_deadline = timeout == 0 ? 0 : (now + timeout * 1000000);
+  /* In reactor mode, arm the timer so that the deadline fires without a thread blocking on it. */
+  if (reactor_enabled && sender->modify_deadline)
+    reactor_schedule(sender->modify_deadline);
+  pthread_mutex_unlock(&modify_mutex);
+}
+
+
+/**
+ * Stop waiting for a reply to a multicast
+ * 
+ * @param  sender     The client whose multicast is being sent
+ * @param  modify_id  The modify ID of the multicast
+ */
+__attribute__((nonnull))
+static void unregister_modify_wait(client_t* sender, uint64_t modify_id)
+{
+  with_mutex (modify_mutex,
+	      hash_table_remove(&modify_map, (size_t)modify_id);
+	      __atomic_store_n(&(sender->modify_recipient), NULL, __ATOMIC_RELAXED);
+	      sender->modify_deadline = 0;
+	      );
+}
+
+
+/**
+ * Wait for the recipient of a multicast to reply
+ * 
+ * In reactor mode this function does not wait, instead
+ * the reactor will resume the sender when the reply arrives,
+ * or when the reply deadline has passed
+ * 
+ * @param   sender     The client whose multicast is being sent
+ * @param   modify_id  The modify ID of the multicast
+ * @return             Zero if the reply has arrived, the recipient
+ *                     has closed, or the reply deadline has passed,
+ *                     1 if the wait has not completed
+ */
+__attribute__((nonnull))
+static int wait_for_reply(client_t* sender, uint64_t modify_id)
 {
-  /* pthread_cond_timedwait is required to handle re-exec and termination because
-     pthread_cond_timedwait and pthread_cond_wait ignore interruptions via signals. */
-  struct timespec timeout =
+  uint64_t now, deadline, left;
+  int expired = 0;
+  
+  for (;;)
     {
-      .tv_sec = 1,
-      .tv_nsec = 0
-    };
+      /* The reply, and the closing of the recipient, clear the recipient
+	 before the sender is resumed, so it is checked without the lock. */
+      if (__atomic_load_n(&(sender->modify_recipient), __ATOMIC_ACQUIRE) == NULL)
+	break;
+      now = monotonic_time();
+      deadline = sender->modify_deadline;
+      if ((deadline > 0) && (now >= deadline))
+	break;
+      if (terminating || reactor_enabled)
+	return 1;
+      
+      /* Keep sending to the sender while it waits. */
+      flush_outbound(sender);
+      left = deadline == 0 ? 1000 : min((deadline - now + 999999) / 1000000, 1000);
+      await_client(sender, 0, (int)left);
+    }
   
-  with_mutex_if (modify_mutex, recipient->modify_message == NULL,
-		 if (hash_table_contains_key(&modify_map, (size_t)modify_id) == 0)
-		   {
-		     hash_table_put(&modify_map, (size_t)modify_id, (size_t)(void*)recipient);
-		     pthread_cond_signal(&slave_cond);
-		   }
-		 );
+  /* The reply takes the wait out of the modify map, otherwise
+     it is still there, and the reply may be arriving. */
+  if ((__atomic_load_n(&(sender->modify_recipient), __ATOMIC_ACQUIRE) != NULL) || (sender->modify_message == NULL))
+    with_mutex (modify_mutex,
+		expired = sender->modify_recipient != NULL;
+		hash_table_remove(&modify_map, (size_t)modify_id);
+		__atomic_store_n(&(sender->modify_recipient), NULL, __ATOMIC_RELAXED);
+		);
+  sender->modify_deadline = 0;
   
-  with_mutex_if (recipient->modify_mutex, recipient->modify_message == NULL,
-		 while ((recipient->modify_message == NULL) && (terminating == 0))
-		   pthread_cond_timedwait(&slave_cond, &slave_mutex, &timeout);
-		 if (terminating == 0)
-		   hash_table_remove(&modify_map, (size_t)modify_id);
-		 );
+  /* A late reply is ignored, the message continues unmodified. */
+  if (expired)
+    stats_add(reply_timeouts, 1);
+  return 0;
 }
 
 
 /**
- * Multicast a message
+ * Wait until there is room for the sender's multicast in the outbound
+ * queue of the recipient, if the queue was full
  * 
- * @param  multicast  The multicast message
+ * In reactor mode this function does not wait, instead the reactor
+ * will resume the sender when there is room
+ * 
+ * @param   sender  The client whose multicast is being sent
+ * @return          Zero if there is room, 1 if the wait has not completed
  */
-void multicast_message(multicast_t* multicast)
+__attribute__((nonnull))
+static int wait_for_room(client_t* sender)
 {
-  int consumed = 0;
-  uint64_t modify_id = 0;
-  size_t n = strlen("Modify ID: ");
+  client_t* blocked_on;
+  uint64_t now, deadline;
   
-  if (startswith_n(multicast->message, "Modify ID: ", multicast->message_length, n))
+  for (;;)
     {
-      char* value = multicast->message + n;
-      char* lf = strchr(value, '\n');
-      *lf = '\0';
-      modify_id = atou64(value);
-      *lf = '\n';
+      /* Once the recipient has stalled, the message is queued again, which deals with the recipient. */
+      now = monotonic_time();
+      with_mutex (slave_mutex,
+		  blocked_on = sender->outbound_blocked_on;
+		  deadline = blocked_on == NULL ? 0 : stall_deadline(blocked_on);
+		  if ((deadline > 0) && (now >= deadline))
+		    blocked_on = sender->outbound_blocked_on = NULL;
+		  );
+      if (blocked_on == NULL)
+	return 0;
+      if (terminating || reactor_enabled)
+	return 1;
+      /* Keep sending to the sender while it waits. */
+      flush_outbound(sender);
+      await_client(sender, 0, deadline == 0 ? 1000 : (int)min((deadline - now + 999999) / 1000000, 1000));
     }
+}
+
+
+/**
+ * Send a multicast message to the run of non-modifying recipients that
+ * starts at the current recipient, the message is queued for all of them
+ * before the sender waits for room in any of their outbound queues, so
+ * that a recipient whose queue is full does not delay the others
+ * 
+ * The recipients still receive the sender's messages in order because
+ * the sender does not continue before the message has been queued for
+ * the whole run
+ * 
+ * @param   multicast  The message
+ * @param   sender     The client whose multicast is being sent
+ * @return             Zero if the message has been queued for every
+ *                     recipient in the run, `multicast->interceptions_ptr`
+ *                     will be set to the last recipient in the run, 1 if
+ *                     it must be resumed later, see `multicast_message`
+ */
+__attribute__((nonnull))
+static int send_multicast_to_run(multicast_t* multicast, client_t* sender)
+{
+  queued_interception_t* client_;
+  size_t i, end = multicast->interceptions_ptr;
+  int waiting, r;
+  
+  while ((end < multicast->interceptions_count) && (multicast->interceptions[end].modifying == 0))
+    end++;
+  
+  for (;;)
+    {
+      waiting = 0;
+      for (i = multicast->interceptions_ptr; i < end; i++)
+	{
+	  client_ = multicast->interceptions + i;
+	  if (client_->delivered)
+	    continue;
+	  
+	  /* After unmarshalling at re-exec, client will be NULL and must be mapped from its socket,
+	     skip the recipient if it did not survive the re-exec. */
+	  if (client_->client == NULL)
+	    client_->client = client_by_socket(client_->socket_fd);
+	  r = client_->client == NULL ? 2 : send_multicast_to_recipient(multicast, client_->client, 0, sender);
+	  
+	  /* A full queue is retried when the sender has been resumed. */
+	  if (r == 1)
+	    {
+	      waiting = 1;
+	      continue;
+	    }
+	  if (r < 0)
+	    xperror(*argv);
+	  client_->delivered = 1;
+	}
+      
+      if (waiting == 0)
+	break;
+      if (wait_for_room(sender))
+	return 1;
+    }
+  
+  multicast->interceptions_ptr = end - 1;
+  multicast->message_ptr = 0;
+  return 0;
+}
+
+
+/**
+ * Multicast a message
+ * 
+ * @param   multicast  The multicast message
+ * @param   sender     The client whose multicast is being sent
+ * @return             Zero if the multicast has completed, 1 if it
+ *                     must be resumed later, either because of re-exec
+ *                     or termination, or because it is waiting for
+ *                     a reply, or for room in the outbound queue
+ *                     of a recipient, in reactor mode
+ */
+int multicast_message(multicast_t* multicast, client_t* sender)
+{
+  uint64_t modify_id = multicast->modify_id;
+  int consumed = 0;
   
   for (; multicast->interceptions_ptr < multicast->interceptions_count; multicast->interceptions_ptr++)
     {
-      queued_interception_t client_ = multicast->interceptions[multicast->interceptions_ptr];
-      client_t* client = client_.client;
+      queued_interception_t* client_ = multicast->interceptions + multicast->interceptions_ptr;
+      client_t* client = client_->client;
       int modifying = 0;
-      char* old_buf;
+      message_buffer_t* new_version;
       size_t i;
       mds_message_t* mod;
+      int r;
+      
+      /* The non-modifying recipients are sent to together, the modifying recipients one at a time. */
+      if (client_->modifying == 0)
+	{
+	  if (send_multicast_to_run(multicast, sender))
+	    return 1;
+	  continue;
+	}
       
       /* After unmarshalling at re-exec, client will be NULL and must be mapped from its socket. */
       if (client == NULL)
-	client_.client = client = client_by_socket(client_.socket_fd);
+	client_->client = client = client_by_socket(client_->socket_fd);
       
-      /* Send the message to the recipient. */
-      if (send_multicast_to_recipient(multicast, client, client_.modifying) == 0)
+      /* Skip the recipient if it did not survive the re-exec. */
+      if (client == NULL)
 	{
-	  /* Stop if we are re-exec:ing or terminating, or continue to next recipient on error. */
-	  if (terminating)
-	    return;
-	  else
-	    continue;
+	  multicast->message_ptr = 0;
+	  continue;
 	}
       
-      /* Do not wait for a reply if it is non-modifying. */
-      if (client_.modifying == 0)
+      /* Queue the message for the recipient, unless that was done before the multicast was
+	 suspended, start waiting for a reply before it is queued so that the reply cannot
+	 arrive before the registration, a full queue is waited upon, and then retried. */
+      r = 0;
+      while (multicast->message_ptr == 0)
+	{
+	  if (wait_for_room(sender))
+	    return 1;
+	  register_modify_wait(sender, client, modify_id);
+	  r = send_multicast_to_recipient(multicast, client, 1, sender);
+	  if (r == 0)
+	    break;
+	  unregister_modify_wait(sender, modify_id);
+	  if (r != 1)
+	    break;
+	}
+      if (r < 0)
+	xperror(*argv);
+      
+      /* Do not wait for a reply if the message was not queued. */
+      if (r)
 	{
 	  /* Reset how much of the message has been sent before we continue with next recipient. */
 	  multicast->message_ptr = 0;
@@ -174,34 +1192,56 @@ void multicast_message(multicast_t* multicast)
 	}
       
       /* Wait for a reply. */
-      wait_for_reply(client, modify_id);
-      if (terminating)
-	return;
+      if (wait_for_reply(sender, modify_id))
+	return 1;
       
-      /* Act upon the reply. */
-      mod = client->modify_message;
-      for (i = 0; i < mod->header_count; i++)
+      /* Act upon the reply, there is none if the recipient closed. */
+      mod = sender->modify_message;
+      for (i = 0; (mod != NULL) && (i < mod->header_count); i++)
 	if (strequals(mod->headers[i], "Modify: yes"))
 	  {
 	    modifying = 1;
 	    consumed = mod->payload_size == 0;
 	    break;
 	  }
+      /* The attached file descriptor cannot be replaced, but it can be removed. */
+      if (modifying && !consumed && (multicast->fd < 0) && has_attachment(mod->payload, mod->payload_size))
+	{
+	  eprint("received modification that adds an attachment, ignoring.");
+	  modifying = 0;
+	}
+      if (modifying && !consumed && (multicast->fd >= 0) && !has_attachment(mod->payload, mod->payload_size))
+	close(multicast->fd), multicast->fd = -1;
       if (modifying && !consumed)
 	{
-	  n = mod->payload_size;
-	  old_buf = multicast->message;
-	  if (xrealloc(multicast->message, multicast->message_prefix + n, char))
+	  /* The previous recipients may still be sending the message, so the modified
+	     message is a new version of it rather than a modification in place. The
+	     payload is taken over, unless it is stored in the reply's read buffer. */
+	  if (mod->in_place)
+	    new_version = message_buffer_copy(mod->payload, mod->payload_size);
+	  else
+	    new_version = message_buffer_create(mod->payload, mod->payload_size);
+	  if (new_version == NULL)
+	    xperror(*argv);
+	  else
 	    {
-	      xperror(*argv);
-	      multicast->message = old_buf;
+	      /* The modification may have changed, or removed, the `Coalesce` header. */
+	      if (message_buffer_find_coalesce(new_version))
+		xperror(*argv);
+	      if (mod->in_place == 0)
+		mod->payload = NULL, mod->payload_size = 0;
+	      message_buffer_unref(multicast->message);
+	      multicast->message = new_version;
 	    }
-	  else
-	    memcpy(multicast->message + multicast->message_prefix, mod->payload, n);
 	}
       
       /* Free the reply. */
-      mds_message_destroy(client->modify_message);
+      if (mod != NULL)
+	{
+	  mds_message_destroy(mod);
+	  free(mod);
+	  sender->modify_message = NULL;
+	}
       
       /* Reset how much of the message has been sent before we continue with next recipient. */
       multicast->message_ptr = 0;
@@ -209,66 +1249,234 @@ void multicast_message(multicast_t* multicast)
       if (consumed)
 	break;
     }
+  
+  return 0;
 }
 
 
 /**
- * Send the next message in a clients multicast queue
+ * Send the messages in a clients multicast queue
  * 
- * @param  client  The client
+ * Only the client's own thread adds to the queue,
+ * so the head of the queue is stable while it is sent
+ * 
+ * @param   client  The client
+ * @return          Zero if the queue has been emptied, 1 if the
+ *                  multicast at the head of the queue must be
+ *                  resumed later, see `multicast_message`
  */
-void send_multicast_queue(client_t* client)
+int send_multicast_queue(client_t* client)
 {
-  while (client->multicasts_count > 0)
+  multicast_t* multicast;
+  
+  while ((multicast = client->multicasts) != NULL)
     {
-      multicast_t multicast;
-      with_mutex_if (client->mutex, client->multicasts_count > 0,
-		     size_t c = (client->multicasts_count -= 1) * sizeof(multicast_t);
-		     multicast = client->multicasts[0];
-		     memmove(client->multicasts, client->multicasts + 1, c);
-		     if (c == 0)
-		       {
-			 free(client->multicasts);
-			 client->multicasts = NULL;
-		       }
-		     );
-      multicast_message(&multicast);
-      multicast_destroy(&multicast);
+      if (multicast_message(multicast, client))
+	return 1;
+      if ((client->multicasts = multicast->next) == NULL)
+	client->multicasts_last = NULL;
+      client->multicasts_count--;
+      multicast_destroy(multicast);
+      free(multicast);
     }
+  /* The client's messages have been routed, so it may send more. */
+  if (credit_replenish(client))
+    xperror(*argv);
+  return 0;
 }
 
 
 /**
- * Send the messages that are in a clients reply queue
+ * Stop all clients from waiting for a reply from a
+ * client, this should be done when the client closes
  * 
- * @param  client  The client
+ * @param  recipient  The client that has closed
  */
-void send_reply_queue(client_t* client)
+void abandon_modify_waits(client_t* recipient)
 {
-  char* sendbuf = client->send_pending;
-  char* sendbuf_ = sendbuf;
-  size_t sent;
-  size_t n;
+  hash_entry_t* entry;
+  size_t i;
   
-  if (client->send_pending_size == 0)
-    return;
+  with_mutex (modify_mutex,
+	      foreach_hash_table_entry (modify_map, i, entry)
+		{
+		  client_t* waiter = (client_t*)(void*)(entry->value);
+		  if (waiter->modify_recipient != recipient)
+		    continue;
+		  __atomic_store_n(&(waiter->modify_recipient), NULL, __ATOMIC_RELEASE);
+		  resume_client(waiter);
+		}
+	      );
+}
+
+
+/**
+ * Hand over a reply to a multicast to the client that is waiting for it
+ * 
+ * @param   recipient  The client that replied
+ * @param   modify_id  The modify ID of the multicast
+ * @param   reply      The reply, the waiting client takes ownership of it
+ * @return             Zero if the reply was handed over,
+ *                     -1 if it is not awaited
+ */
+int complete_modify_wait(client_t* recipient, uint64_t modify_id, mds_message_t* reply)
+{
+  size_t address;
+  client_t* waiter;
+  uint64_t started = 0;
+  int rc = -1;
+  
+  pthread_mutex_lock(&modify_mutex);
+  address = hash_table_get(&modify_map, (size_t)modify_id);
+  waiter = (client_t*)(void*)address;
+  if ((waiter != NULL) && (waiter->modify_recipient == recipient) && (waiter->modify_message == NULL))
+    {
+      /* The waiter sees the reply without the lock once the recipient is cleared, but
+	 it cannot be freed before the lock is released, as it takes the lock when it
+	 closes, to abandon the other clients' waits for its replies. */
+      waiter->modify_message = reply;
+      started = waiter->modify_started;
+      hash_table_remove(&modify_map, (size_t)modify_id);
+      __atomic_store_n(&(waiter->modify_recipient), NULL, __ATOMIC_RELEASE);
+      resume_client(waiter);
+      rc = 0;
+    }
+  pthread_mutex_unlock(&modify_mutex);
+  
+  if (rc == 0)
+    record_round_trip(monotonic_time() - started);
+  return rc;
+}
+
+
+/**
+ * Resume, in reactor mode, the clients whose reply
+ * deadline has passed, so that they stop waiting
+ * 
+ * @return  The earliest reply deadline that has not passed,
+ *          in nanoseconds on the monotonic clock, zero if none
+ */
+uint64_t resume_expired_modify_waits(void)
+{
+  hash_entry_t* entry;
+  uint64_t now = monotonic_time();
+  uint64_t next = 0;
+  size_t i;
+  
+  with_mutex (modify_mutex,
+	      foreach_hash_table_entry (modify_map, i, entry)
+		{
+		  client_t* waiter = (client_t*)(void*)(entry->value);
+		  uint64_t deadline = waiter->modify_deadline;
+		  if ((deadline == 0) || (waiter->modify_recipient == NULL) || (waiter->modify_message != NULL))
+		    continue;
+		  if (deadline <= now)
+		    resume_client(waiter);
+		  else if ((next == 0) || (deadline < next))
+		    next = deadline;
+		}
+	      );
+  
+  return next;
+}
+
+
+/**
+ * Resume, in reactor mode, the clients whose multicast waits for
+ * room in the outbound queue of a client that has stalled, so
+ * that they deal with the stalled client
+ * 
+ * @return  The earliest time a client that is waited upon stalls,
+ *          in nanoseconds on the monotonic clock, zero if none
+ */
+uint64_t resume_stalled_outbound_waits(void)
+{
+  uint64_t now = monotonic_time();
+  uint64_t next = 0, deadline;
+  ssize_t node;
   
-  n = client->send_pending_size;
-  client->send_pending_size = 0;
-  client->send_pending = NULL;
-  with_mutex (client->mutex,
-	      while (n > 0)
+  if (stall_timeout == 0)
+    return 0;
+  
+  pthread_rwlock_rdlock(&client_lock);
+  with_mutex (slave_mutex,
+	      foreach_linked_list_node (client_list, node)
 		{
-		  sent = send_message(client->socket_fd, sendbuf_, n);
-		  n -= sent;
-		  sendbuf_ += sent / sizeof(char);
-		  if ((n > 0) && (errno != EINTR)) /* Ignore EINTR */
+		  client_t* waiter = (client_t*)(void*)(client_list.values[node]);
+		  if (waiter->outbound_blocked_on == NULL)
+		    continue;
+		  deadline = stall_deadline(waiter->outbound_blocked_on);
+		  if (deadline == 0)
+		    continue;
+		  if (deadline <= now)
 		    {
-		      xperror(*argv);
-		      break;
+		      waiter->outbound_blocked_on = NULL;
+		      resume_client(waiter);
 		    }
+		  else if ((next == 0) || (deadline < next))
+		    next = deadline;
 		}
-	      free(sendbuf);
 	      );
+  pthread_rwlock_unlock(&client_lock);
+  
+  return next;
+}
+
+
+/**
+ * Restore the wait for a reply to a multicast that was
+ * in progress when the server re-exec:ed
+ * 
+ * @param  sender  The client whose multicast queue to inspect
+ */
+void restore_modify_wait(client_t* sender)
+{
+  multicast_t* multicast = sender->multicasts;
+  queued_interception_t* client_;
+  
+  if ((multicast == NULL) || (sender->modify_message != NULL))
+    return;
+  if (multicast->interceptions_ptr >= multicast->interceptions_count)
+    return;
+  client_ = multicast->interceptions + multicast->interceptions_ptr;
+  if ((client_->modifying == 0) || (multicast->message_ptr == 0))
+    return;
+  
+  if (client_->client == NULL)
+    client_->client = client_by_socket(client_->socket_fd);
+  if (client_->client == NULL)
+    return;
+  
+  register_modify_wait(sender, client_->client, multicast->modify_id);
+}
+
+
+/**
+ * Get the current time of the monotonic clock
+ * 
+ * @return  The time, in nanoseconds
+ */
+uint64_t monotonic_time(void)
+{
+  struct timespec now;
+  if (monotone(&now) < 0)
+    return 0;
+  return (uint64_t)(now.tv_sec) * 1000000000 + (uint64_t)(now.tv_nsec);
+}
+
+
+/**
+ * Tell the thread that serves a client that a wait that the client
+ * is in has completed, that is, that a reply to its multicast has
+ * arrived or that there is room for its multicast
+ * 
+ * @param  client  The client
+ */
+void resume_client(client_t* client)
+{
+  if (reactor_enabled)
+    reactor_resume(client);
+  else
+    wake_slave(client);
 }
 
@@ -21,31 +21,211 @@
 
 #include "multicast.h"
 #include "client.h"
+#include "message-buffer.h"
 
 
 /**
  * Multicast a message
  * 
- * @param  multicast  The multicast message
+ * @param   multicast  The multicast message
+ * @param   sender     The client whose multicast is being sent
+ * @return             Zero if the multicast has completed, 1 if it
+ *                     must be resumed later, either because of re-exec
+ *                     or termination, or because it is waiting for
+ *                     a reply, or for room in the outbound queue
+ *                     of a recipient, in reactor mode
  */
 __attribute__((nonnull))
-void multicast_message(multicast_t* multicast);
+int multicast_message(multicast_t* multicast, client_t* sender);
 
 /**
- * Send the next message in a clients multicast queue
+ * Send the messages in a clients multicast queue
  * 
- * @param  client  The client
+ * Only the client's own thread adds to the queue,
+ * so the head of the queue is stable while it is sent
+ * 
+ * @param   client  The client
+ * @return          Zero if the queue has been emptied, 1 if the
+ *                  multicast at the head of the queue must be
+ *                  resumed later, see `multicast_message`
+ */
+__attribute__((nonnull))
+int send_multicast_queue(client_t* client);
+
+/**
+ * Queue a message to be sent to a client by the thread that serves it
+ * 
+ * A message is always accepted into an empty queue, but if the queue is
+ * not empty and the message does not fit within `outbound_limit`, the
+ * message is not queued, instead the sender is registered as waiting for
+ * room in the queue, and will be resumed when there is room
+ * 
+ * A multicast with a `Coalesce` header replaces the last message queued
+ * for the recipient, that has not started being sent, from the same
+ * client and with the same `Coalesce` header, if there is one
+ * 
+ * The message is not copied, the recipient takes a reference to it
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   prefix     A header to send before the message, `NULL` if none
+ * @param   message    The message
+ * @param   fd         A file descriptor to pass along with the message, `-1` if
+ *                     none, the queue takes ownership of it if the message is queued
+ * @param   sender     The client whose multicast is being sent, `NULL` if the
+ *                     message should be queued regardless of the queue's size
+ * @return             Zero if the message was queued, 1 if the queue is full,
+ *                     2 if the recipient has closed, and -1 on error
+ */
+__attribute__((nonnull(1, 3)))
+int enqueue_outbound(client_t* recipient, message_buffer_t* prefix, message_buffer_t* message,
+		     int fd, client_t* sender);
+
+/**
+ * Queue the last message that is sent to a client over its socket,
+ * the messages queued after it are written to the client's ring
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   message    The message
+ * @return             See `enqueue_outbound`
+ */
+__attribute__((nonnull))
+int enqueue_last_on_socket(client_t* recipient, message_buffer_t* message);
+
+/**
+ * Queue the last message that is sent to a client in its current
+ * framing, the messages queued after it are sent in another framing
+ * 
+ * @param   recipient  The client to which the message should be sent
+ * @param   message    The message
+ * @param   binary     Whether the messages after this one are sent in the binary framing
+ * @return             See `enqueue_outbound`
+ */
+__attribute__((nonnull))
+int enqueue_last_in_framing(client_t* recipient, message_buffer_t* message, int binary);
+
+/**
+ * Send as much of a client's outbound queue as
+ * can be sent without waiting
+ * 
+ * The queued messages are sent together, with one system call
+ * for up to `send_budget` bytes, the prefixes and the messages
+ * are sent as separate parts, or they are written to the client's
+ * ring in the same way, once it is used
+ * 
+ * Deliveries are withheld once the credit that the client
+ * has granted, if it uses credit, has been taken
+ * 
+ * @param   client  The client
+ * @return          Zero if the queue has been emptied, 1 if the
+ *                  client cannot receive more right now, -1 if the
+ *                  queue was discarded because the client cannot
+ *                  receive anything more
  */
 __attribute__((nonnull))
-void send_multicast_queue(client_t* client);
+int flush_outbound(client_t* client);
+
+/**
+ * Check whether any of a client's queued messages can be sent
+ * once the client can receive more, the caller must hold the
+ * client's mutex
+ * 
+ * @param   client  The client
+ * @return          Whether messages are queued and not withheld
+ *                  until the client grants more credit
+ */
+__attribute__((nonnull, pure))
+int outbound_sendable(const client_t* client);
+
+/**
+ * Stop all multicasts from waiting for room in a client's
+ * outbound queue, and stop the client's own multicast from
+ * waiting, this should be done when the client closes
+ * 
+ * @param  client  The client that has closed
+ */
+__attribute__((nonnull))
+void release_outbound_waits(client_t* client);
+
+/**
+ * Wait, in thread mode, until a client's socket becomes readable,
+ * if `readable` is set, until more of what is queued for the client
+ * can be sent, until the client's slave thread is woken, or until
+ * the timeout, which should be at most a second so that re-exec
+ * and termination are noticed
+ * 
+ * @param   client    The client
+ * @param   readable  Whether to wait for the client's socket to become readable
+ * @param   timeout   The number of milliseconds to wait at most
+ * @return            Whether the client's socket is readable, or closed
+ */
+__attribute__((nonnull))
+int await_client(client_t* client, int readable, int timeout);
+
+/**
+ * Stop all clients from waiting for a reply from a
+ * client, this should be done when the client closes
+ * 
+ * @param  recipient  The client that has closed
+ */
+__attribute__((nonnull))
+void abandon_modify_waits(client_t* recipient);
+
+/**
+ * Hand over a reply to a multicast to the client that is waiting for it
+ * 
+ * @param   recipient  The client that replied
+ * @param   modify_id  The modify ID of the multicast
+ * @param   reply      The reply, the waiting client takes ownership of it
+ * @return             Zero if the reply was handed over,
+ *                     -1 if it is not awaited
+ */
+__attribute__((nonnull))
+int complete_modify_wait(client_t* recipient, uint64_t modify_id, mds_message_t* reply);
+
+/**
+ * Resume, in reactor mode, the clients whose reply
+ * deadline has passed, so that they stop waiting
+ * 
+ * @return  The earliest reply deadline that has not passed,
+ *          in nanoseconds on the monotonic clock, zero if none
+ */
+uint64_t resume_expired_modify_waits(void);
+
+/**
+ * Resume, in reactor mode, the clients whose multicast waits for
+ * room in the outbound queue of a client that has stalled, so
+ * that they deal with the stalled client
+ * 
+ * @return  The earliest time a client that is waited upon stalls,
+ *          in nanoseconds on the monotonic clock, zero if none
+ */
+uint64_t resume_stalled_outbound_waits(void);
+
+/**
+ * Restore the wait for a reply to a multicast that was
+ * in progress when the server re-exec:ed
+ * 
+ * @param  sender  The client whose multicast queue to inspect
+ */
+__attribute__((nonnull))
+void restore_modify_wait(client_t* sender);
+
+/**
+ * Get the current time of the monotonic clock
+ * 
+ * @return  The time, in nanoseconds
+ */
+uint64_t monotonic_time(void);
 
 /**
- * Send the messages that are in a clients reply queue
+ * Tell the thread that serves a client that a wait that the client
+ * is in has completed, that is, that a reply to its multicast has
+ * arrived or that there is room for its multicast
  * 
  * @param  client  The client
  */
 __attribute__((nonnull))
-void send_reply_queue(client_t* client);
+void resume_client(client_t* client);
 
 
 #endif
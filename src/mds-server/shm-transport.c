@@ -0,0 +1,454 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "shm-transport.h"
+
+#include "globals.h"
+#include "client.h"
+#include "sending.h"
+#include "message-buffer.h"
+#include "stats.h"
+
+#include <libmdsserver/macros.h>
+#include <libmdsserver/util.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+
+/**
+ * Ring a doorbell of a client
+ * 
+ * @param  bell  The client's event file descriptor
+ */
+static void ring_bell(int bell)
+{
+  uint64_t value = 1;
+  if (write(bell, &value, sizeof(value)) < 0)
+    if (errno != EAGAIN)
+      xperror(*argv);
+}
+
+
+/**
+ * Read from a client's socket, and keep the file descriptors that are passed along
+ * 
+ * @param   client  The client
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @param   flags   Flags for recvmsg(3)
+ * @return          See recvmsg(3)
+ */
+__attribute__((nonnull))
+static ssize_t receive(client_t* client, char* buffer, size_t size, int flags)
+{
+  union
+  {
+    char buf[CMSG_SPACE(CLIENT_ATTACHMENTS_MAX * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr header;
+  struct iovec part;
+  struct cmsghdr* cmsg;
+  size_t i, n;
+  ssize_t got;
+  int fd;
+  
+  part.iov_base = buffer;
+  part.iov_len = size;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &part;
+  header.msg_iovlen = 1;
+  header.msg_control = control.buf;
+  header.msg_controllen = sizeof(control.buf);
+  
+  got = recvmsg(client->socket_fd, &header, MSG_CMSG_CLOEXEC | flags);
+  if (got < 0)
+    return -1;
+  
+  /* Keep the file descriptors until the message that they are attached
+     to has been received, a client cannot make the server keep more
+     than a few of them. */
+  for (cmsg = CMSG_FIRSTHDR(&header); cmsg != NULL; cmsg = CMSG_NXTHDR(&header, cmsg))
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+      for (i = 0, n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i < n; i++)
+	{
+	  memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+	  if (client->attached_count < CLIENT_ATTACHMENTS_MAX)
+	    client->attached_fds[client->attached_count++] = fd;
+	  else
+	    close(fd);
+	}
+  
+  return got;
+}
+
+
+/**
+ * Count bytes that have been read from a client
+ * 
+ * @param  client  The client
+ * @param  n       The number of bytes
+ */
+__attribute__((nonnull))
+static void count_received(client_t* client, size_t n)
+{
+  stats_add_to(&(client->received_bytes), n);
+  stats_add(received_bytes, n);
+}
+
+
+/**
+ * Read from a client's socket, and keep the file descriptors that
+ * are passed along, this is the source of messages until the client
+ * has started to use its ring, see `mds_message_source_t`
+ * 
+ * @param   client  The client
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          See recv(3)
+ */
+ssize_t read_client_socket(void* client, char* buffer, size_t size)
+{
+  ssize_t got = receive(client, buffer, size, 0);
+  if (got > 0)
+    count_received(client, (size_t)got);
+  return got;
+}
+
+
+/**
+ * Read from the ring from a client, this is the source of messages
+ * once the client has started to use its ring, see `mds_message_source_t`
+ * 
+ * The socket is read for doorbells, and -1 is returned with `errno`
+ * set to `EAGAIN` when the ring is empty and the client has been told
+ * to ring the doorbell once it writes to the ring, zero is returned
+ * once the ring is empty and the client has closed its socket
+ * 
+ * @param   client  The client
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          See recv(3)
+ */
+ssize_t read_client_ring(void* client_, char* buffer, size_t size)
+{
+  client_t* client = client_;
+  shm_ring_t* ring = &(client->rings.inbound);
+  size_t n;
+  int r;
+  
+  for (;;)
+    {
+      n = shm_ring_read(ring, buffer, size);
+      if (n > 0)
+	{
+	  if (shm_ring_writer_waiting(ring))
+	    ring_bell(client->ring_room_bell);
+	  count_received(client, n);
+	  return (ssize_t)n;
+	}
+      
+      /* The client rings the doorbell if it writes after this. */
+      if (shm_ring_await_data(ring))
+	continue;
+      
+      r = drain_doorbell(client);
+      if (r == 0)
+	return errno = EAGAIN, -1;
+      if (r < 0)
+	return client->ring_hangup ? 0 : -1;
+    }
+}
+
+
+/**
+ * Pass a file descriptor to a client over its socket, with one byte
+ * 
+ * @param   client  The client
+ * @param   fd      The file descriptor
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int pass_fd(client_t* client, int fd)
+{
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr header;
+  struct iovec part;
+  struct cmsghdr* cmsg;
+  char byte = '\0';
+  
+  part.iov_base = &byte;
+  part.iov_len = sizeof(byte);
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &part;
+  header.msg_iovlen = 1;
+  header.msg_control = control.buf;
+  header.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&header);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  
+  while (sendmsg(client->socket_fd, &header, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+
+/**
+ * Write to the ring to a client
+ * 
+ * @param   client  The client
+ * @param   parts   The data to write
+ * @param   count   The number of elements in `parts`
+ * @param   fd      Pointer to a file descriptor to pass to the client before
+ *                  the data, which points to `-1` if none, it will be closed,
+ *                  and the pointer will be set to `-1`, once it has been passed
+ * @return          The number of written bytes, -1 on error, `errno` is set
+ *                  to `EAGAIN` if the ring is full, the client will ring the
+ *                  doorbell once there is room, and to `EPIPE` if the client
+ *                  has closed its socket
+ */
+ssize_t write_client_ring(client_t* client, const struct iovec* parts, size_t count, int* fd)
+{
+  shm_ring_t* ring = &(client->rings.outbound);
+  size_t n;
+  
+  if (client->ring_hangup)
+    return errno = EPIPE, -1;
+  
+  /* The file descriptor is passed before the message that it is attached
+     to is written to the ring, so that the client has it when it reads the
+     message. The socket is only full if the client has not read messages
+     in the ring, so it is told to ring the doorbell when it reads them. */
+  if (*fd >= 0)
+    {
+      if (pass_fd(client, *fd) < 0)
+	{
+	  if (errno == EAGAIN)
+	    __atomic_store_n(&(ring->control->writer_waiting), 1, __ATOMIC_SEQ_CST);
+	  return -1;
+	}
+      close(*fd);
+      *fd = -1;
+    }
+  
+  /* The client rings the doorbell if it reads after it has been told to. */
+  while ((n = shm_ring_writev(ring, parts, count)) == 0)
+    if (shm_ring_await_room(ring) == 0)
+      return errno = EAGAIN, -1;
+  
+  if (shm_ring_reader_waiting(ring))
+    ring_bell(client->ring_data_bell);
+  return (ssize_t)n;
+}
+
+
+/**
+ * Read all doorbells that a client has rung
+ * 
+ * This is always safe, because the rings are checked after
+ * the client is told to ring the doorbell, so it should be
+ * done whenever the client's socket is readable and it is
+ * not read, so that it does not remain readable
+ * 
+ * @param   client  The client
+ * @return          1 if the doorbell was rung, 0 if it was not,
+ *                  -1 if the client has closed its socket, or on error
+ */
+int drain_doorbell(client_t* client)
+{
+  char buffer[64];
+  ssize_t got;
+  
+  if (client->ring_hangup)
+    return errno = ECONNRESET, -1;
+  
+  for (;;)
+    {
+      got = receive(client, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (got > 0)
+	return 1;
+      if ((got < 0) && (errno == EINTR))
+	continue;
+      if ((got < 0) && (errno == EAGAIN))
+	return 0;
+      /* Nothing but the doorbells are read once the ring is used,
+	 so this is where the server learns that the client has closed. */
+      if (got == 0)
+	errno = ECONNRESET;
+      client->ring_hangup = 1;
+      return -1;
+    }
+}
+
+
+/**
+ * Take the oldest file descriptor that a client has passed, and
+ * that has not been taken, for a message that it is attached to
+ * 
+ * A client that uses its ring passes the file descriptor over the
+ * socket before it writes the message to the ring, so it has
+ * been sent, but perhaps not been read, when the message is read
+ * 
+ * @param   client  The client
+ * @return          The file descriptor, -1 if none has been passed,
+ *                  with `errno` set to `EBADMSG`, or on error
+ */
+int take_attachment(client_t* client)
+{
+  int fd;
+  
+  if ((client->attached_count == 0) && (client->rings.map != NULL))
+    if (drain_doorbell(client) < 0)
+      return -1;
+  if (client->attached_count == 0)
+    return errno = EBADMSG, -1;
+  
+  fd = client->attached_fds[0];
+  client->attached_count -= 1;
+  memmove(client->attached_fds, client->attached_fds + 1, client->attached_count * sizeof(int));
+  return fd;
+}
+
+
+/**
+ * Tell a client that its request to use rings failed
+ * 
+ * @param   client       The client
+ * @param   message_id   The message ID of the request
+ * @param   error        The error number
+ * @param   description  Description of the error
+ * @return               Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+static int send_ring_error(client_t* client, const char* message_id, int error, const char* description)
+{
+  char client_id[sizeof("4294967296:4294967296")];
+  message_buffer_t* reply = NULL;
+  char* msgbuf = NULL;
+  size_t size = 0, n;
+  int rc = -1;
+  
+  xsnprintf(client_id, "%" PRIu32 ":%" PRIu32,
+	    (uint32_t)(client->id >> 32),
+	    (uint32_t)(client->id >>  0));
+  
+  n = construct_error_message(client_id, message_id, "shm-ring", 0, error, description, &msgbuf, &size, 0);
+  fail_if (n == 0);
+  fail_if ((reply = message_buffer_create(msgbuf, n)) == NULL);
+  msgbuf = NULL;
+  fail_if (enqueue_outbound(client, NULL, reply, -1, NULL) < 0);
+  rc = 0;
+ fail:
+  free(msgbuf);
+  message_buffer_unref(reply);
+  return rc;
+}
+
+
+/**
+ * Start using the rings in memory shared with a client, whose file
+ * descriptors the client has passed along with the request, or send
+ * an error to the client if it is already using rings
+ * 
+ * The client writes to its ring as soon as it has sent the request,
+ * so its messages are read from the ring immediately, its socket is
+ * shut down if the ring cannot be used, and the server writes to the
+ * ring to the client once the reply has been sent over the socket
+ * 
+ * @param   client      The client that sent the request
+ * @param   message_id  The message ID of the request
+ * @return              Zero on success, -1 on error
+ */
+int open_shm_rings(client_t* client, const char* message_id)
+{
+  message_buffer_t* reply = NULL;
+  char* msgbuf = NULL;
+  size_t n;
+  int saved_errno;
+  
+  if (client->rings.map != NULL)
+    return send_ring_error(client, message_id, EALREADY, "the client is already using rings");
+  
+  /* The memory and the client's doorbells, in that order, survive re-exec. */
+  if (client->attached_count < 3)
+    {
+      errno = EBADMSG;
+      goto refuse;
+    }
+  client->ring_fd        = client->attached_fds[0];
+  client->ring_data_bell = client->attached_fds[1];
+  client->ring_room_bell = client->attached_fds[2];
+  client->attached_count -= 3;
+  memmove(client->attached_fds, client->attached_fds + 3, client->attached_count * sizeof(int));
+  if ((fcntl(client->ring_fd,        F_SETFD, 0) < 0) ||
+      (fcntl(client->ring_data_bell, F_SETFD, 0) < 0) ||
+      (fcntl(client->ring_room_bell, F_SETFD, 0) < 0) ||
+      (shm_rings_map(&(client->rings), client->ring_fd) < 0))
+    goto refuse;
+  
+  /* Reply over the socket, the client starts reading its ring when it
+     receives the reply, and everything after it is written to the ring. */
+  n = strlen(message_id) + sizeof("Command: shm-ring\nIn response to: \n\n") / sizeof(char);
+  fail_if (xmalloc(msgbuf, n, char));
+  snprintf(msgbuf, n,
+	   "Command: shm-ring\n"
+	   "In response to: %s\n"
+	   "\n",
+	   message_id);
+  fail_if ((reply = message_buffer_create(msgbuf, strlen(msgbuf))) == NULL);
+  msgbuf = NULL;
+  fail_if (enqueue_last_on_socket(client, reply) < 0);
+  message_buffer_unref(reply);
+  return 0;
+  
+ fail:
+  /* The ring is still read, and everything is still sent over the socket. */
+  saved_errno = errno;
+  free(msgbuf);
+  message_buffer_unref(reply);
+  return errno = saved_errno, -1;
+  
+ refuse:
+  /* The client has started to write to a ring that cannot be read, so it is closed. */
+  saved_errno = errno;
+  if (client->ring_fd >= 0)
+    close(client->ring_fd), client->ring_fd = -1;
+  if (client->ring_data_bell >= 0)
+    close(client->ring_data_bell), client->ring_data_bell = -1;
+  if (client->ring_room_bell >= 0)
+    close(client->ring_room_bell), client->ring_room_bell = -1;
+  shutdown(client->socket_fd, SHUT_RDWR);
+  return errno = saved_errno, -1;
+}
+
@@ -0,0 +1,125 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_SHM_TRANSPORT_H
+#define MDS_MDS_SERVER_SHM_TRANSPORT_H
+
+
+#include "client.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+
+/**
+ * Read from a client's socket, and keep the file descriptors that
+ * are passed along, this is the source of messages until the client
+ * has started to use its ring, see `mds_message_source_t`
+ * 
+ * @param   client  The client
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          See recv(3)
+ */
+__attribute__((nonnull))
+ssize_t read_client_socket(void* client, char* buffer, size_t size);
+
+/**
+ * Read from the ring from a client, this is the source of messages
+ * once the client has started to use its ring, see `mds_message_source_t`
+ * 
+ * The socket is read for doorbells, and -1 is returned with `errno`
+ * set to `EAGAIN` when the ring is empty and the client has been told
+ * to ring the doorbell once it writes to the ring, zero is returned
+ * once the ring is empty and the client has closed its socket
+ * 
+ * @param   client  The client
+ * @param   buffer  Output buffer for the read data
+ * @param   size    The size of `buffer`
+ * @return          See recv(3)
+ */
+__attribute__((nonnull))
+ssize_t read_client_ring(void* client, char* buffer, size_t size);
+
+/**
+ * Write to the ring to a client
+ * 
+ * @param   client  The client
+ * @param   parts   The data to write
+ * @param   count   The number of elements in `parts`
+ * @param   fd      Pointer to a file descriptor to pass to the client before
+ *                  the data, which points to `-1` if none, it will be closed,
+ *                  and the pointer will be set to `-1`, once it has been passed
+ * @return          The number of written bytes, -1 on error, `errno` is set
+ *                  to `EAGAIN` if the ring is full, the client will ring the
+ *                  doorbell once there is room, and to `EPIPE` if the client
+ *                  has closed its socket
+ */
+__attribute__((nonnull))
+ssize_t write_client_ring(client_t* client, const struct iovec* parts, size_t count, int* fd);
+
+/**
+ * Read all doorbells that a client has rung
+ * 
+ * This is always safe, because the rings are checked after
+ * the client is told to ring the doorbell, so it should be
+ * done whenever the client's socket is readable and it is
+ * not read, so that it does not remain readable
+ * 
+ * @param   client  The client
+ * @return          1 if the doorbell was rung, 0 if it was not,
+ *                  -1 if the client has closed its socket, or on error
+ */
+__attribute__((nonnull))
+int drain_doorbell(client_t* client);
+
+/**
+ * Take the oldest file descriptor that a client has passed, and
+ * that has not been taken, for a message that it is attached to
+ * 
+ * A client that uses its ring passes the file descriptor over the
+ * socket before it writes the message to the ring, so it has
+ * been sent, but perhaps not been read, when the message is read
+ * 
+ * @param   client  The client
+ * @return          The file descriptor, -1 if none has been passed,
+ *                  with `errno` set to `EBADMSG`, or on error
+ */
+__attribute__((nonnull))
+int take_attachment(client_t* client);
+
+/**
+ * Start using the rings in memory shared with a client, whose file
+ * descriptors the client has passed along with the request, or send
+ * an error to the client if it is already using rings
+ * 
+ * The client writes to its ring as soon as it has sent the request,
+ * so its messages are read from the ring immediately, its socket is
+ * shut down if the ring cannot be used, and the server writes to the
+ * ring to the client once the reply has been sent over the socket
+ * 
+ * @param   client      The client that sent the request
+ * @param   message_id  The message ID of the request
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int open_shm_rings(client_t* client, const char* message_id);
+
+
+#endif
+
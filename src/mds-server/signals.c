@@ -18,11 +18,14 @@
 
 #include "globals.h"
 #include "client.h"
+#include "reactor.h"
+#include "stats.h"
 
 #include <libmdsserver/linked-list.h>
 #include <libmdsserver/macros.h>
 
 #include <pthread.h>
+#include <stdio.h>
 
 
 /**
@@ -35,18 +38,48 @@ void signal_all(int signo)
   pthread_t current_thread;
   ssize_t node;
   
+  /* The reactor reads signals itself, it just needs to be woken. */
+  if (reactor_enabled)
+    {
+      reactor_wake();
+      return;
+    }
+  
   current_thread = pthread_self();
   
   if (pthread_equal(current_thread, master_thread) == 0)
     pthread_kill(master_thread, signo);
   
-  with_mutex (slave_mutex,
-	      foreach_linked_list_node (client_list, node)
-	        {
-		  client_t* value = (client_t*)(void*)(client_list.values[node]);
-		  if (pthread_equal(current_thread, value->thread) == 0)
-		    pthread_kill(value->thread, signo);
-		}
-	      );
+  with_rdlock (client_lock,
+	       foreach_linked_list_node (client_list, node)
+	         {
+		   client_t* value = (client_t*)(void*)(client_list.values[node]);
+		   /* A client whose thread has not started has no thread to signal yet,
+		      the thread checks whether to terminate once it starts. */
+		   if (__atomic_load_n(&(value->mutex_created), __ATOMIC_ACQUIRE) == 0)
+		     continue;
+		   if (pthread_equal(current_thread, value->thread) == 0)
+		     pthread_kill(value->thread, signo);
+		 }
+	       );
+}
+
+
+/**
+ * This function is called when a signal that
+ * signals that the system to dump state information
+ * and statistics has been received
+ * 
+ * @param  signo  The signal that has been received
+ */
+void received_info(int signo)
+{
+  char prefix[64];
+  SIGHANDLER_START;
+  (void) signo;
+  /* Do not wait for the clients, the signal may have interrupted a thread that holds the lock. */
+  snprintf(prefix, sizeof(prefix), "%s: info: ", *argv);
+  stats_report(stderr, prefix, 0);
+  SIGHANDLER_END;
 }
 
@@ -19,6 +19,7 @@
 
 #include "globals.h"
 #include "client.h"
+#include "shm-transport.h"
 
 #include <libmdsserver/macros.h>
 #include <libmdsserver/linked-list.h>
@@ -41,12 +42,17 @@ void* slave_loop(void*);
 /**
  * Receive a full message and update open status if the client closes
  * 
+ * If the client's socket is nonblocking, -1 is returned
+ * with `errno` set to `EAGAIN` when the message is incomplete
+ * 
  * @param   client  The client
  * @return          Zero on success, -2 on failure, otherwise -1
  */
 int fetch_message(client_t* client)
 {
-  int r = mds_message_read(&(client->message), client->socket_fd);
+  /* Once the client uses its ring, the ring is read, and the socket is only read for doorbells. */
+  mds_message_source_t* source = client->rings.map == NULL ? read_client_socket : read_client_ring;
+  int r = mds_message_read_from(&(client->message), source, client);
   
   if (r == 0)
     return 0;
@@ -58,11 +64,11 @@ int fetch_message(client_t* client)
     }
   else if (errno == ECONNRESET)
     {
-      r = mds_message_read(&(client->message), client->socket_fd);
+      r = mds_message_read_from(&(client->message), source, client);
       client->open = 0;
       /* Connection closed. */
     }
-  else if (errno != EINTR)
+  else if ((errno != EINTR) && (errno != EAGAIN))
     {
       xperror(*argv);
       fail_if (1);
@@ -119,7 +125,7 @@ client_t* initialise_client(int client_fd)
   client_initialise(information);
   
   /* Add to list of clients. */
-  fail_if ((errno = pthread_mutex_lock(&slave_mutex)));
+  fail_if ((errno = pthread_rwlock_wrlock(&client_lock)));
   locked = 1;
   entry = linked_list_insert_end(&client_list, (size_t)(void*)information);
   fail_if (entry == LINKED_LIST_UNUSED);
@@ -127,7 +133,7 @@ client_t* initialise_client(int client_fd)
   /* Add client to table. */
   tmp = fd_table_put(&client_map, client_fd, (size_t)(void*)information);
   fail_if ((tmp == 0) && errno);
-  pthread_mutex_unlock(&slave_mutex);
+  pthread_rwlock_unlock(&client_lock);
   locked = 0;
   
   /* Fill information table. */
@@ -142,10 +148,10 @@ client_t* initialise_client(int client_fd)
  fail:
   saved_errno = errno;
   if (locked)
-    pthread_mutex_unlock(&slave_mutex);
+    pthread_rwlock_unlock(&client_lock);
   free(information);
   if (entry != LINKED_LIST_UNUSED)
-    with_mutex (slave_mutex, linked_list_remove(&client_list, entry););
+    with_wrlock (client_lock, linked_list_remove(&client_list, entry););
   return errno = saved_errno, NULL;
 }
 
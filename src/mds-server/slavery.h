@@ -27,6 +27,9 @@
 /**
  * Receive a full message and update open status if the client closes
  * 
+ * If the client's socket is nonblocking, -1 is returned
+ * with `errno` set to `EAGAIN` when the message is incomplete
+ * 
  * @param   client  The client
  * @return          Zero on success, -2 on failure, otherwise -1
  */
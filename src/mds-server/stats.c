@@ -0,0 +1,330 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "stats.h"
+
+#include "globals.h"
+#include "sending.h"
+#include "message-buffer.h"
+
+#include <libmdsserver/linked-list.h>
+#include <libmdsserver/macros.h>
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+
+
+/**
+ * The current thread's block of counters, `NULL` if it has not
+ * claimed one yet, use `stats_add` rather than this variable
+ */
+__thread server_stats_t* stats_block = NULL;
+
+/**
+ * All blocks of counters, new blocks are pushed
+ * atomically, and blocks are not removed until
+ * all threads have exited
+ */
+static server_stats_t* all_blocks = NULL;
+
+/**
+ * Key whose destructor releases a thread's block when the thread exits
+ */
+static pthread_key_t release_key;
+
+/**
+ * Whether `release_key` has been created
+ */
+static int release_key_created = 0;
+
+/**
+ * Makes sure `release_key` is only created once
+ */
+static pthread_once_t release_key_once = PTHREAD_ONCE_INIT;
+
+
+
+/**
+ * Release a thread's block of counters, so that
+ * the next new thread can continue counting in it
+ * 
+ * @param  block:server_stats_t*  The block
+ */
+static void release_block(void* block)
+{
+  __atomic_store_n(&(((server_stats_t*)block)->claimed), 0, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Create `release_key`
+ */
+static void create_release_key(void)
+{
+  release_key_created = pthread_key_create(&release_key, release_block) == 0;
+}
+
+
+/**
+ * Claim a block of counters for the current thread, a block
+ * that another thread has released is reused if there is one
+ * 
+ * @return  The block, also stored in `stats_block`, `NULL` on error
+ */
+server_stats_t* stats_claim(void)
+{
+  server_stats_t* block;
+  void* new_block;
+  int expected;
+  
+  pthread_once(&release_key_once, create_release_key);
+  
+  /* Continue counting where an exited thread stopped, if any has. */
+  for (block = __atomic_load_n(&all_blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next)
+    {
+      expected = 0;
+      if (__atomic_compare_exchange_n(&(block->claimed), &expected, 1, 0,
+				      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	goto claimed;
+    }
+  
+  /* Otherwise, allocate a new block on a cache line of its own. */
+  if (posix_memalign(&new_block, 64, sizeof(server_stats_t)))
+    return NULL;
+  block = new_block;
+  memset(block, 0, sizeof(server_stats_t));
+  block->claimed = 1;
+  block->next = __atomic_load_n(&all_blocks, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&all_blocks, &(block->next), block, 1,
+				      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  
+ claimed:
+  if (release_key_created)
+    pthread_setspecific(release_key, block);
+  return stats_block = block;
+}
+
+
+/**
+ * Get the element of a histogram that a value is counted in
+ * 
+ * @param   value    The value
+ * @param   buckets  The number of elements in the histogram
+ * @return           The number of bits needed to represent `value`,
+ *                   but at most `buckets - 1`
+ */
+size_t stats_bucket(uint64_t value, size_t buckets)
+{
+  size_t bucket = 0;
+  while (value > 0)
+    value >>= 1, bucket++;
+  return min(bucket, buckets - 1);
+}
+
+
+/**
+ * Sum the counters of all threads
+ * 
+ * @param  total  Output parameter for the sums, `next` and `claimed` are not set
+ */
+void stats_collect(server_stats_t* restrict total)
+{
+  /* All counters are `uint64_t` and precede `next`. */
+  const size_t n = offsetof(server_stats_t, next) / sizeof(uint64_t);
+  uint64_t* restrict sums = (uint64_t*)(void*)total;
+  server_stats_t* block;
+  size_t i;
+  
+  memset(total, 0, sizeof(server_stats_t));
+  for (block = __atomic_load_n(&all_blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next)
+    for (i = 0; i < n; i++)
+      sums[i] += __atomic_load_n((uint64_t*)(void*)block + i, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Write the non-zero elements of a histogram
+ * 
+ * @param  output     The stream to write to
+ * @param  prefix     Text to print at the beginning of each line
+ * @param  histogram  The histogram
+ * @param  buckets    The number of elements in `histogram`
+ * @param  what       What is counted, in plural
+ * @param  unit       What the counted values are measured in, in plural
+ */
+__attribute__((nonnull))
+static void report_histogram(FILE* output, const char* prefix, const uint64_t* histogram,
+			     size_t buckets, const char* what, const char* unit)
+{
+  size_t i;
+  for (i = 0; i + 1 < buckets; i++)
+    if (histogram[i])
+      fprintf(output, "%s%s with less than 2^%zu %s: %" PRIu64 "\n",
+	      prefix, what, i, unit, histogram[i]);
+  if (histogram[i])
+    fprintf(output, "%s%s with at least 2^%zu %s: %" PRIu64 "\n",
+	    prefix, what, i - 1, unit, histogram[i]);
+}
+
+
+/**
+ * Write a report of the counters of all threads, and
+ * the traffic and outbound queue of each client, one
+ * line per figure, in the form ‘name: value’
+ * 
+ * @param   output  The stream to write the report to
+ * @param   prefix  Text to print at the beginning of each line
+ * @param   wait    Whether to wait for the client list if another thread
+ *                  is modifying it, otherwise the clients are skipped
+ * @return          Zero on success, -1 on error
+ */
+int stats_report(FILE* output, const char* prefix, int wait)
+{
+  server_stats_t total;
+  ssize_t node;
+  
+  stats_collect(&total);
+  
+  fprintf(output, "%soutbound queue limit: %zu bytes\n", prefix, outbound_limit);
+  fprintf(output, "%sreply timeout: %" PRIu64 " milliseconds\n", prefix, default_reply_timeout);
+  fprintf(output, "%sstall timeout: %" PRIu64 " milliseconds\n", prefix, stall_timeout);
+  fprintf(output, "%sstall policy: %s\n", prefix, stall_drop ? "drop" : "close");
+  fprintf(output, "%sreceived messages: %" PRIu64 "\n", prefix, total.received_messages);
+  fprintf(output, "%sreceived bytes: %" PRIu64 "\n", prefix, total.received_bytes);
+  fprintf(output, "%ssent messages: %" PRIu64 "\n", prefix, total.sent_messages);
+  fprintf(output, "%ssent bytes: %" PRIu64 "\n", prefix, total.sent_bytes);
+  fprintf(output, "%ssend system calls: %" PRIu64 "\n", prefix, total.send_calls);
+  fprintf(output, "%smulticasts: %" PRIu64 "\n", prefix, total.multicasts);
+  fprintf(output, "%srouting time: %" PRIu64 " nanoseconds\n", prefix, total.routing_time);
+  report_histogram(output, prefix, total.routing_times, STATS_TIME_BUCKETS,
+		   "multicasts routed", "nanoseconds");
+  report_histogram(output, prefix, total.interceptors, STATS_INTERCEPTOR_BUCKETS,
+		   "multicasts", "recipients");
+  fprintf(output, "%sreplies that timed out: %" PRIu64 "\n", prefix, total.reply_timeouts);
+  report_histogram(output, prefix, total.reply_round_trips, STATS_TIME_BUCKETS,
+		   "replies", "microseconds");
+  fprintf(output, "%sclients disconnected for stalling: %" PRIu64 "\n", prefix, total.evictions);
+  fprintf(output, "%smessages dropped for stalled clients: %" PRIu64 "\n", prefix, total.dropped_messages);
+  fprintf(output, "%smessages replaced by newer messages: %" PRIu64 "\n", prefix, total.coalesced_messages);
+  fprintf(output, "%sfast lanes opened: %" PRIu64 "\n",
+	  prefix, __atomic_load_n(&next_lane_id, __ATOMIC_RELAXED) - 1);
+  fprintf(output, "%slast re-exec pause: %" PRIu64 " nanoseconds\n", prefix, reexec_pause);
+  
+  /* A signal may have interrupted a thread that holds the lock, so it does not wait. */
+  if ((errno = wait ? pthread_rwlock_rdlock(&client_lock) : pthread_rwlock_tryrdlock(&client_lock)))
+    {
+      fprintf(output, "%sclients are busy, try again.\n", prefix);
+      goto done;
+    }
+  foreach_linked_list_node (client_list, node)
+    {
+      client_t* client = (client_t*)(void*)(client_list.values[node]);
+      size_t head = __atomic_load_n(&(client->outbound_head), __ATOMIC_RELAXED);
+      size_t count = __atomic_load_n(&(client->outbound_count), __ATOMIC_RELAXED);
+      fprintf(output, "%sclient %" PRIu32 ":%" PRIu32 ": "
+	      "%" PRIu64 " messages (%" PRIu64 " bytes) received, "
+	      "%" PRIu64 " messages (%" PRIu64 " bytes) sent, "
+	      "%zu messages (%zu bytes) queued, at most %zu bytes queued\n",
+	      prefix, (uint32_t)(client->id >> 32), (uint32_t)(client->id >> 0),
+	      __atomic_load_n(&(client->received_messages), __ATOMIC_RELAXED),
+	      __atomic_load_n(&(client->received_bytes), __ATOMIC_RELAXED),
+	      __atomic_load_n(&(client->sent_messages), __ATOMIC_RELAXED),
+	      __atomic_load_n(&(client->sent_bytes), __ATOMIC_RELAXED),
+	      count > head ? count - head : 0,
+	      __atomic_load_n(&(client->outbound_pending), __ATOMIC_RELAXED),
+	      __atomic_load_n(&(client->outbound_high_water), __ATOMIC_RELAXED));
+    }
+  pthread_rwlock_unlock(&client_lock);
+  
+ done:
+  return ferror(output) ? -1 : 0;
+}
+
+
+/**
+ * Reply to a `Command: server-stats` message with a report
+ * of the counters, in the form `stats_report` writes
+ * 
+ * @param   client      The client that requested the report
+ * @param   message_id  The message ID of the request
+ * @return              Zero on success, -1 on error
+ */
+int stats_send_report(client_t* client, const char* message_id)
+{
+  message_buffer_t* reply = NULL;
+  FILE* output = NULL;
+  char* report = NULL;
+  char* msgbuf = NULL;
+  size_t report_size = 0, n;
+  int saved_errno;
+  
+  fail_if ((output = open_memstream(&report, &report_size)) == NULL);
+  fail_if (stats_report(output, "", 1) < 0);
+  fail_if (fclose(output));
+  output = NULL;
+  
+  n = strlen(message_id) + 3 * sizeof(size_t) + report_size;
+  n += sizeof("Command: server-stats\nIn response to: \nLength: \n\n") / sizeof(char);
+  fail_if (xmalloc(msgbuf, n, char));
+  snprintf(msgbuf, n,
+	   "Command: server-stats\n"
+	   "In response to: %s\n"
+	   "Length: %zu\n"
+	   "\n"
+	   "%s",
+	   message_id, report_size, report);
+  fail_if ((reply = message_buffer_create(msgbuf, strlen(msgbuf))) == NULL);
+  msgbuf = NULL;
+  fail_if (enqueue_outbound(client, NULL, reply, -1, NULL) < 0);
+  
+  message_buffer_unref(reply);
+  free(report);
+  return 0;
+ fail:
+  saved_errno = errno;
+  if (output != NULL)
+    fclose(output);
+  message_buffer_unref(reply);
+  free(msgbuf);
+  free(report);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Release all blocks of counters, this
+ * is done once all threads have exited
+ */
+void stats_destroy(void)
+{
+  server_stats_t* block;
+  while ((block = all_blocks) != NULL)
+    {
+      all_blocks = block->next;
+      free(block);
+    }
+  stats_block = NULL;
+  if (release_key_created)
+    pthread_key_delete(release_key);
+  release_key_created = 0;
+}
+
@@ -0,0 +1,247 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MDS_MDS_SERVER_STATS_H
+#define MDS_MDS_SERVER_STATS_H
+
+
+#include "client.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+
+/**
+ * The number of elements in the histograms of durations
+ */
+#define STATS_TIME_BUCKETS  32
+
+/**
+ * The number of elements in `interceptors`
+ */
+#define STATS_INTERCEPTOR_BUCKETS  8
+
+
+/**
+ * Counters of what the server has done, each thread counts in a
+ * block of its own, so that counting does not need to lock anything
+ * or contend for a cache line, and the blocks are summed when read
+ * 
+ * Only the thread that has claimed a block writes to it, but
+ * any thread may read it, so the fields are stored atomically,
+ * see `stats_add`
+ */
+typedef struct server_stats
+{
+  /**
+   * The number of messages that have been received from the clients
+   */
+  uint64_t received_messages;
+  
+  /**
+   * The number of bytes that have been received from the clients
+   */
+  uint64_t received_bytes;
+  
+  /**
+   * The number of messages that have been sent to the clients
+   */
+  uint64_t sent_messages;
+  
+  /**
+   * The number of bytes that have been sent to the clients
+   */
+  uint64_t sent_bytes;
+  
+  /**
+   * The number of system calls that have been made to send messages to the clients
+   */
+  uint64_t send_calls;
+  
+  /**
+   * The number of messages that have been queued for multicasting
+   */
+  uint64_t multicasts;
+  
+  /**
+   * The total time that has been spent finding the recipients
+   * of messages and queuing the multicasts, in nanoseconds
+   */
+  uint64_t routing_time;
+  
+  /**
+   * Histogram of the time it took to find the recipients of a
+   * message and queue its multicast, element `i` is the number
+   * of messages that took less than 2 to the power of `i`
+   * nanoseconds but at least half of that, except the last
+   * element which counts the rest
+   */
+  uint64_t routing_times[STATS_TIME_BUCKETS];
+  
+  /**
+   * Histogram of the number of recipients of a message, element
+   * `i` is the number of messages that had less than 2 to the
+   * power of `i` recipients but at least half of that, except
+   * the last element which counts the rest
+   */
+  uint64_t interceptors[STATS_INTERCEPTOR_BUCKETS];
+  
+  /**
+   * The number of replies to messages that the recipient may modify
+   * that did not arrive in time, so that the messages were sent on unmodified
+   */
+  uint64_t reply_timeouts;
+  
+  /**
+   * Histogram of the time from that a message that the recipient may modify
+   * has been queued until the reply arrives, element `i` is the number of
+   * replies that took less than 2 to the power of `i` microseconds but at
+   * least half of that, except the last element which counts the rest
+   */
+  uint64_t reply_round_trips[STATS_TIME_BUCKETS];
+  
+  /**
+   * The number of clients that have been disconnected because they stalled
+   */
+  uint64_t evictions;
+  
+  /**
+   * The number of messages that have been dropped because their recipient stalled
+   */
+  uint64_t dropped_messages;
+  
+  /**
+   * The number of queued messages that have been replaced by a newer
+   * message from the same client with the same `Coalesce` header
+   */
+  uint64_t coalesced_messages;
+  
+  /**
+   * The next block in the list of all blocks
+   */
+  struct server_stats* next;
+  
+  /**
+   * Whether a thread has claimed the block, it is
+   * released when the thread exits, so that the next
+   * new thread can continue counting in it
+   */
+  int claimed;
+  
+} __attribute__((aligned(64))) server_stats_t;
+
+
+
+/**
+ * The current thread's block of counters, `NULL` if it has not
+ * claimed one yet, use `stats_add` rather than this variable
+ */
+extern __thread server_stats_t* stats_block;
+
+
+/**
+ * Add to a counter that is only written to by one thread,
+ * but may be read by others, there is no need for a locked
+ * instruction when there is only one writer
+ * 
+ * @param  COUNTER:uint64_t*  The counter
+ * @param  N:uint64_t         The number to add to the counter
+ */
+#define stats_add_to(COUNTER, N)  \
+  __atomic_store_n(COUNTER, __atomic_load_n(COUNTER, __ATOMIC_RELAXED) + (N), __ATOMIC_RELAXED)
+
+/**
+ * Add to a counter in the current thread's block of counters,
+ * nothing is counted if no block could be allocated
+ * 
+ * @param  FIELD:identifier  The counter, for example `sent_messages`
+ *                           or `routing_times[bucket]`
+ * @param  N:uint64_t        The number to add to the counter
+ */
+#define stats_add(FIELD, N)					\
+  do								\
+    {								\
+      server_stats_t* stats__ = stats_block;			\
+      if ((stats__ != NULL) || ((stats__ = stats_claim())))	\
+	stats_add_to(&(stats__->FIELD), N);			\
+    }								\
+  while (0)
+
+
+
+/**
+ * Claim a block of counters for the current thread, a block
+ * that another thread has released is reused if there is one
+ * 
+ * @return  The block, also stored in `stats_block`, `NULL` on error
+ */
+server_stats_t* stats_claim(void);
+
+/**
+ * Get the element of a histogram that a value is counted in
+ * 
+ * @param   value    The value
+ * @param   buckets  The number of elements in the histogram
+ * @return           The number of bits needed to represent `value`,
+ *                   but at most `buckets - 1`
+ */
+__attribute__((const))
+size_t stats_bucket(uint64_t value, size_t buckets);
+
+/**
+ * Sum the counters of all threads
+ * 
+ * @param  total  Output parameter for the sums, `next` and `claimed` are not set
+ */
+__attribute__((nonnull))
+void stats_collect(server_stats_t* restrict total);
+
+/**
+ * Write a report of the counters of all threads, and
+ * the traffic and outbound queue of each client, one
+ * line per figure, in the form ‘name: value’
+ * 
+ * @param   output  The stream to write the report to
+ * @param   prefix  Text to print at the beginning of each line
+ * @param   wait    Whether to wait for the client list if another thread
+ *                  is modifying it, otherwise the clients are skipped
+ * @return          Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int stats_report(FILE* output, const char* prefix, int wait);
+
+/**
+ * Reply to a `Command: server-stats` message with a report
+ * of the counters, in the form `stats_report` writes
+ * 
+ * @param   client      The client that requested the report
+ * @param   message_id  The message ID of the request
+ * @return              Zero on success, -1 on error
+ */
+__attribute__((nonnull))
+int stats_send_report(client_t* client, const char* message_id);
+
+/**
+ * Release all blocks of counters, this
+ * is done once all threads have exited
+ */
+void stats_destroy(void);
+
+
+#endif
+
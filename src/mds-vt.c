@@ -17,6 +17,8 @@
  */
 #include "mds-vt.h"
 
+#include "schema/mds-vt.h"
+
 #include <libmdsserver/config.h>
 #include <libmdsserver/macros.h>
 #include <libmdsserver/util.h>
@@ -548,55 +550,42 @@ int handle_message(void)
 {
   /* Fetch message headers. */
   
-  const char* recv_client_id = "0:0";
-  const char* recv_message_id = NULL;
-  const char* recv_graphical = "neither";
-  const char* recv_exclusive = "neither";
-  const char* recv_command = NULL;
-  size_t i;
-  
-#define __get_header(storage, header)			\
-  (startswith(received.headers[i], header))		\
-    storage = received.headers[i] + strlen(header)
-  
-  for (i = 0; i < received.header_count; i++)
-    {
-      if      __get_header(recv_client_id,  "Client ID: ");
-      else if __get_header(recv_message_id, "Message ID: ");
-      else if __get_header(recv_graphical,  "Graphical: ");
-      else if __get_header(recv_exclusive,  "Exclusive: ");
-      else if __get_header(recv_command,    "Command: ");
-    }
+  mds_vt_message_t recv;
   
-#undef __get_header
+  mds_vt_parse(&recv, &received);
   
   
   /* Validate headers. */
   
-  if (recv_message_id == NULL)
+  if (recv.message_id == NULL)
     return eprint("received message without ID, ignoring, master server is misbehaving."), 0;
   
-  if (strequals(recv_client_id, "0:0"))
+  if (strequals(recv.client_id, "0:0"))
     return eprint("received information request from an anonymous client, ignoring."), 0;
   
-  if (strlen(recv_client_id) > 21)
+  if (strlen(recv.client_id) > 21)
     return eprint("received invalid client ID, ignoring."), 0;
-  if (strlen(recv_message_id) > 10)
+  if (strlen(recv.message_id) > 10)
     return eprint("received invalid message ID, ignoring."), 0;
   
   
   /* Take appropriate action. */
   
-  if (recv_command == NULL)
-    return 0; /* How did that get here, not matter, just ignore it? */
-  
-  if (strequals(recv_command, "get-vt"))
-    fail_if (handle_get_vt(recv_client_id, recv_message_id));
-  
-  if (strequals(recv_command, "configure-vt"))
-    fail_if (handle_configure_vt(recv_client_id, recv_message_id, recv_graphical, recv_exclusive));
+  switch (recv.command)
+    {
+    case MDS_VT_COMMAND_GET_VT:
+      fail_if (handle_get_vt(recv.client_id, recv.message_id));
+      break;
+      
+    case MDS_VT_COMMAND_CONFIGURE_VT:
+      fail_if (handle_configure_vt(recv.client_id, recv.message_id, recv.graphical, recv.exclusive));
+      break;
+      
+    default:
+      break; /* How did that get here, not matter, just ignore it? */
+    }
   
-  return 0; /* How did that get here, not matter, just ignore it? */
+  return 0;
  fail:
   return -1;
 }
@@ -641,29 +630,29 @@ int handle_get_vt(const char* client, const char* message)
  * 
  * @param   client     The value of the header `Client ID` in the received message
  * @param   message    The value of the header `Message ID` in the received message
- * @param   graphical  The value of the header `Graphical` in the received message
- * @param   exclusive  The value of the header `Exclusive` in the received message
+ * @param   graphical  The value of the header `Graphical` in the received message, `MDS_VT_GRAPHICAL_*`
+ * @param   exclusive  The value of the header `Exclusive` in the received message, `MDS_VT_EXCLUSIVE_*`
  * @return             Zero on success, -1 on error
  */
-int handle_configure_vt(const char* client, const char* message, const char* graphical, const char* exclusive)
+int handle_configure_vt(const char* client, const char* message, int graphical, int exclusive)
 {
   char buf[60 + 41 + 3 * sizeof(int)];
   int r = 0, set_nonexclusive;
   
-  if (strequals(exclusive, "yes") || strequals(exclusive, "no"))
+  if ((exclusive == MDS_VT_EXCLUSIVE_YES) || (exclusive == MDS_VT_EXCLUSIVE_NO))
     {
       /* Switch to exclusive mode when no server has request
 	 non-exclusive mode anymore, and switch to non-exclusive
 	 mode when the number of server that server that has
 	 request non-exclusive switches from zero to one. */
-      set_nonexclusive = strequals(exclusive, "no");
+      set_nonexclusive = exclusive == MDS_VT_EXCLUSIVE_NO;
       if (nonexclusive_counter == (ssize_t)!set_nonexclusive)
 	r |= vt_set_exclusive(display_tty_fd, !set_nonexclusive);
       nonexclusive_counter += set_nonexclusive ? 1 : -1;
     }
   
-  if (strequals(graphical, "yes") || strequals(graphical, "no"))
-    r |= vt_set_graphical(display_tty_fd, strequals(graphical, "yes"));
+  if ((graphical == MDS_VT_GRAPHICAL_YES) || (graphical == MDS_VT_GRAPHICAL_NO))
+    r |= vt_set_graphical(display_tty_fd, graphical == MDS_VT_GRAPHICAL_YES);
   
   sprintf(buf,
 	  "Command: error\n"
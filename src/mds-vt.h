@@ -65,11 +65,11 @@ int handle_get_vt(const char* client, const char* message);
  * 
  * @param   client     The value of the header `Client ID` in the received message
  * @param   message    The value of the header `Message ID` in the received message
- * @param   graphical  The value of the header `Graphical` in the received message
- * @param   exclusive  The value of the header `Exclusive` in the received message
+ * @param   graphical  The value of the header `Graphical` in the received message, `MDS_VT_GRAPHICAL_*`
+ * @param   exclusive  The value of the header `Exclusive` in the received message, `MDS_VT_EXCLUSIVE_*`
  * @return             Zero on success, -1 on error
  */
-int handle_configure_vt(const char* client, const char* message, const char* graphical, const char* exclusive);
+int handle_configure_vt(const char* client, const char* message, int graphical, int exclusive);
 
 
 /**
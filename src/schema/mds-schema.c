@@ -0,0 +1,956 @@
+/**
+ * mds — A micro-display server
+ * Copyright © 2014, 2015  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compiles a protocol schema, the headers a server reads, into
+ * a C header with the server's header dispatch. Each line in a
+ * schema, except for empty lines and comments, which start with
+ * `#`, is written like the header that it describes:
+ * 
+ *   Name: type [arguments] [= default]
+ * 
+ * The types are:
+ * 
+ *   string                 The value as is
+ *   int [MIN MAX]          An `int`
+ *   size [MIN MAX]         A `size_t`
+ *   int64 [MIN MAX]        An `int64_t`
+ *   uint64 [MIN MAX]       An `uint64_t`
+ *   enum VALUE...          One of the values, numbered from 1
+ *   set VALUE...           Any of the values, the header may be repeated
+ * 
+ * The prefix of the generated identifiers is the name of the schema
+ * file. Headers and values are looked up with perfect hash tables,
+ * so a message is parsed with one lookup per header.
+ * 
+ * This program is run at build time, it does not use libmdsserver.
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * The maximum number of headers in a schema, limited by
+ * the bits in the `given` and `invalid` members
+ */
+#define MAX_FIELDS  64
+
+/**
+ * The maximum number of values of an `enum` or `set`,
+ * limited by the bits in a `set`
+ */
+#define MAX_VALUES  32
+
+/**
+ * The number of seeds that are tried for each table size
+ */
+#define SEED_ATTEMPTS  (1 << 16)
+
+/**
+ * The initial value of the FNV-1a hash, before the seed is mixed in
+ */
+#define FNV_OFFSET_BASIS  2166136261U
+
+/**
+ * The prime multiplier of the FNV-1a hash
+ */
+#define FNV_PRIME  16777619U
+
+
+
+/**
+ * The type of a header's value
+ */
+typedef enum field_type
+{
+  TYPE_STRING,
+  TYPE_INT,
+  TYPE_SIZE,
+  TYPE_INT64,
+  TYPE_UINT64,
+  TYPE_ENUM,
+  TYPE_SET
+  
+} field_type_t;
+
+
+/**
+ * A header in a schema
+ */
+typedef struct field
+{
+  /**
+   * The name of the header
+   */
+  char* name;
+  
+  /**
+   * The name of the header in upper case, as used in identifiers
+   */
+  char* upper;
+  
+  /**
+   * The name of the header in lower case, as used in identifiers
+   */
+  char* lower;
+  
+  /**
+   * The type of the header's value
+   */
+  field_type_t type;
+  
+  /**
+   * The values of an `enum` or `set`
+   */
+  char* values[MAX_VALUES];
+  
+  /**
+   * The values of an `enum` or `set` in upper case
+   */
+  char* upper_values[MAX_VALUES];
+  
+  /**
+   * The number of elements in `values`
+   */
+  size_t value_count;
+  
+  /**
+   * The minimum value of an integer, `NULL` for the type's minimum
+   */
+  char* minimum;
+  
+  /**
+   * The maximum value of an integer, `NULL` for the type's maximum
+   */
+  char* maximum;
+  
+  /**
+   * The default value, `NULL` if none
+   */
+  char* fallback;
+  
+} field_t;
+
+
+/**
+ * A perfect hash table over a set of strings
+ */
+typedef struct perfect_hash
+{
+  /**
+   * The seed that makes the hash perfect
+   */
+  uint32_t seed;
+  
+  /**
+   * The number of slots, a power of two
+   */
+  size_t size;
+  
+  /**
+   * The index of the string in each slot, -1 for empty slots
+   */
+  int slots[MAX_FIELDS * 64];
+  
+} perfect_hash_t;
+
+
+
+/**
+ * The pathname of the schema
+ */
+static const char* pathname;
+
+/**
+ * The line in the schema being parsed
+ */
+static size_t line_number = 0;
+
+/**
+ * The headers in the schema
+ */
+static field_t fields[MAX_FIELDS];
+
+/**
+ * The number of elements in `fields`
+ */
+static size_t field_count = 0;
+
+/**
+ * The prefix of the generated identifiers, in lower case
+ */
+static char* prefix;
+
+/**
+ * The prefix of the generated identifiers, in upper case
+ */
+static char* upper_prefix;
+
+
+
+/**
+ * Print an error about the schema and exit
+ * 
+ * @param  format  The error message, `printf`-style
+ * @param  ...     The arguments of `format`
+ */
+__attribute__((noreturn, format(printf, 1, 2)))
+static void die(const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  if (line_number > 0)
+    fprintf(stderr, "%s:%zu: ", pathname, line_number);
+  else
+    fprintf(stderr, "%s: ", pathname);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  exit(1);
+}
+
+
+/**
+ * Duplicate a string, or exit
+ * 
+ * @param   string  The string
+ * @param   length  The length of the string
+ * @return          The duplicate
+ */
+static char* duplicate(const char* string, size_t length)
+{
+  char* rc = malloc(length + 1);
+  if (rc == NULL)
+    perror("mds-schema"), exit(1);
+  memcpy(rc, string, length);
+  rc[length] = '\0';
+  return rc;
+}
+
+
+/**
+ * Create an identifier from a name, all characters but
+ * letters and digits are replaced by underscores
+ * 
+ * @param   name   The name
+ * @param   upper  Whether the identifier is in upper case, otherwise lower case
+ * @return         The identifier
+ */
+static char* identifier(const char* name, int upper)
+{
+  char* rc = duplicate(name, strlen(name));
+  char* p;
+  for (p = rc; *p; p++)
+    if (('a' <= *p) && (*p <= 'z'))
+      *p = (char)(upper ? (*p - 'a' + 'A') : *p);
+    else if (('A' <= *p) && (*p <= 'Z'))
+      *p = (char)(upper ? *p : (*p - 'A' + 'a'));
+    else if ((*p < '0') || ('9' < *p))
+      *p = '_';
+  return rc;
+}
+
+
+/**
+ * Check whether a string is an integer literal
+ * 
+ * @param   string  The string
+ * @param   sign    Whether the integer may be negative
+ * @return          1 if the string is an integer literal, 0 otherwise
+ */
+__attribute__((pure))
+static int is_integer(const char* string, int sign)
+{
+  if (sign && (*string == '-'))
+    string++;
+  if (*string == '\0')
+    return 0;
+  for (; *string; string++)
+    if ((*string < '0') || ('9' < *string))
+      return 0;
+  return 1;
+}
+
+
+/**
+ * Split the next word from a string
+ * 
+ * @param   string  The string, will be updated to point after the word
+ * @return          The word, `NULL` at the end of the string
+ */
+static char* next_word(char** string)
+{
+  char* rc = *string;
+  while ((*rc == ' ') || (*rc == '\t'))
+    rc++;
+  if (*rc == '\0')
+    return *string = rc, NULL;
+  for (*string = rc; **string && (**string != ' ') && (**string != '\t'); ++*string);
+  if (**string)
+    *(*string)++ = '\0';
+  return rc;
+}
+
+
+/**
+ * Parse a line in the schema
+ * 
+ * @param  line  The line, without the line feed
+ */
+static void parse_line(char* line)
+{
+  field_t* field;
+  char* colon;
+  char* rest;
+  char* word;
+  char* fallback = NULL;
+  size_t i, j, n;
+  
+  while ((*line == ' ') || (*line == '\t'))
+    line++;
+  if ((*line == '\0') || (*line == '#'))
+    return;
+  
+  if ((colon = strchr(line, ':')) == NULL)
+    die("expected ‘Name: type’");
+  if (colon == line)
+    die("the header has no name");
+  if (field_count == MAX_FIELDS)
+    die("a schema can have at most %i headers", MAX_FIELDS);
+  
+  field = fields + field_count;
+  memset(field, 0, sizeof(*field));
+  field->name = duplicate(line, (size_t)(colon - line));
+  field->upper = identifier(field->name, 1);
+  field->lower = identifier(field->name, 0);
+  for (i = 0; i < field_count; i++)
+    if (!strcmp(fields[i].name, field->name) || !strcmp(fields[i].upper, field->upper))
+      die("the header ‘%s’ clashes with ‘%s’", field->name, fields[i].name);
+  
+  rest = colon + 1;
+  if ((fallback = strstr(rest, " = ")) != NULL)
+    {
+      *fallback = '\0';
+      fallback += 3;
+      while ((*fallback == ' ') || (*fallback == '\t'))
+	fallback++;
+      for (n = strlen(fallback); n && ((fallback[n - 1] == ' ') || (fallback[n - 1] == '\t')); n--)
+	fallback[n - 1] = '\0';
+    }
+  
+  if ((word = next_word(&rest)) == NULL)
+    die("the header ‘%s’ has no type", field->name);
+  
+  if      (!strcmp(word, "string"))  field->type = TYPE_STRING;
+  else if (!strcmp(word, "int"))     field->type = TYPE_INT;
+  else if (!strcmp(word, "size"))    field->type = TYPE_SIZE;
+  else if (!strcmp(word, "int64"))   field->type = TYPE_INT64;
+  else if (!strcmp(word, "uint64"))  field->type = TYPE_UINT64;
+  else if (!strcmp(word, "enum"))    field->type = TYPE_ENUM;
+  else if (!strcmp(word, "set"))     field->type = TYPE_SET;
+  else
+    die("unknown type ‘%s’", word);
+  
+  switch (field->type)
+    {
+    case TYPE_STRING:
+      if (next_word(&rest) != NULL)
+	die("a string takes no arguments");
+      break;
+    
+    case TYPE_ENUM:
+    case TYPE_SET:
+      while ((word = next_word(&rest)) != NULL)
+	{
+	  if (field->value_count == MAX_VALUES)
+	    die("an enum or set can have at most %i values", MAX_VALUES);
+	  for (j = 0; j < field->value_count; j++)
+	    if (!strcmp(field->values[j], word))
+	      die("the value ‘%s’ is repeated", word);
+	  field->values[field->value_count] = duplicate(word, strlen(word));
+	  field->upper_values[field->value_count++] = identifier(word, 1);
+	}
+      if (field->value_count == 0)
+	die("an enum or set needs at least one value");
+      break;
+    
+    default:
+      field->minimum = next_word(&rest);
+      field->maximum = next_word(&rest);
+      if ((field->minimum != NULL) && (field->maximum == NULL))
+	die("an integer takes both a minimum and a maximum, or neither");
+      if (next_word(&rest) != NULL)
+	die("an integer takes at most two arguments");
+      if (field->minimum != NULL)
+	{
+	  if (!is_integer(field->minimum, 1) || !is_integer(field->maximum, 1))
+	    die("the bounds of an integer must be integers");
+	  field->minimum = duplicate(field->minimum, strlen(field->minimum));
+	  field->maximum = duplicate(field->maximum, strlen(field->maximum));
+	}
+      break;
+    }
+  
+  if (fallback != NULL)
+    {
+      if (field->type == TYPE_SET)
+	die("a set cannot have a default value");
+      if (field->type == TYPE_ENUM)
+	{
+	  for (j = 0; j < field->value_count; j++)
+	    if (!strcmp(field->values[j], fallback))
+	      break;
+	  if (j == field->value_count)
+	    die("the default value ‘%s’ is not one of the values", fallback);
+	}
+      else if (field->type == TYPE_STRING)
+	{
+	  if (strpbrk(fallback, "\"\\") != NULL)
+	    die("the default value cannot contain quotes or backslashes");
+	}
+      else if (!is_integer(fallback, (field->type == TYPE_INT) || (field->type == TYPE_INT64)))
+	die("the default value must be an integer");
+      field->fallback = duplicate(fallback, strlen(fallback));
+    }
+  
+  field_count++;
+}
+
+
+/**
+ * Hash a string, the same way as the generated code
+ * 
+ * @param   string  The string
+ * @param   seed    The seed
+ * @return          The hash
+ */
+__attribute__((pure))
+static uint32_t hash(const char* string, uint32_t seed)
+{
+  uint32_t h = FNV_OFFSET_BASIS ^ seed;
+  while (*string)
+    h = (h ^ (uint32_t)(unsigned char)*string++) * FNV_PRIME;
+  return h ^ (h >> 15);
+}
+
+
+/**
+ * Find a perfect hash table for a set of strings
+ * 
+ * @param  table    Output parameter for the table
+ * @param  strings  The strings
+ * @param  count    The number of elements in `strings`
+ */
+static void perfect_hash(perfect_hash_t* table, char* const* strings, size_t count)
+{
+  uint32_t seed;
+  size_t i, slot;
+  
+  for (table->size = 1; table->size < count; table->size <<= 1);
+  for (; table->size <= sizeof(table->slots) / sizeof(*(table->slots)); table->size <<= 1)
+    for (seed = 0; seed < SEED_ATTEMPTS; seed++)
+      {
+	for (i = 0; i < table->size; i++)
+	  table->slots[i] = -1;
+	for (i = 0; i < count; i++)
+	  {
+	    slot = hash(strings[i], seed) & (table->size - 1);
+	    if (table->slots[slot] >= 0)
+	      break;
+	    table->slots[slot] = (int)i;
+	  }
+	if (i == count)
+	  {
+	    table->seed = seed;
+	    return;
+	  }
+      }
+  
+  die("no perfect hash found");
+}
+
+
+/**
+ * Print the slots of a perfect hash table
+ * 
+ * @param  table  The table
+ */
+static void print_slots(const perfect_hash_t* table)
+{
+  size_t i;
+  for (i = 0; i < table->size; i++)
+    printf("%s%i", i == 0 ? "" : (i % 16 == 0) ? ",\n\t" : ", ", table->slots[i]);
+}
+
+
+/**
+ * Get the C type of a header's value
+ * 
+ * @param   field  The header
+ * @return         The C type
+ */
+__attribute__((pure))
+static const char* c_type(const field_t* field)
+{
+  switch (field->type)
+    {
+    case TYPE_STRING:  return "const char*";
+    case TYPE_INT:     return "int";
+    case TYPE_SIZE:    return "size_t";
+    case TYPE_INT64:   return "int64_t";
+    case TYPE_UINT64:  return "uint64_t";
+    case TYPE_ENUM:    return "int";
+    case TYPE_SET:     return "uint32_t";
+    default:
+      abort();
+    }
+}
+
+
+/**
+ * Print an integer bound for `strict_atoj` or `strict_atouj`
+ * 
+ * @param  field    The header
+ * @param  maximum  Whether the upper bound is printed, otherwise the lower bound
+ */
+static void print_bound(const field_t* field, int maximum)
+{
+  const char* bound = maximum ? field->maximum : field->minimum;
+  int sign = (field->type == TYPE_INT) || (field->type == TYPE_INT64);
+  
+  if (bound != NULL)
+    printf(sign ? "INTMAX_C(%s)" : "UINTMAX_C(%s)", bound);
+  else if (field->type == TYPE_INT)
+    printf(maximum ? "INT_MAX" : "INT_MIN");
+  else if (field->type == TYPE_INT64)
+    printf(maximum ? "INT64_MAX" : "INT64_MIN");
+  else if (field->type == TYPE_SIZE)
+    printf(maximum ? "SIZE_MAX" : "0");
+  else
+    printf(maximum ? "UINT64_MAX" : "0");
+}
+
+
+/**
+ * Print the lookup function of an `enum` or `set`
+ * 
+ * @param  field  The header
+ */
+static void print_value_lookup(const field_t* field)
+{
+  perfect_hash_t table;
+  size_t i;
+  
+  perfect_hash(&table, field->values, field->value_count);
+  
+  printf("/**\n");
+  printf(" * Look up a value of the ‘%s’-header\n", field->name);
+  printf(" * \n");
+  printf(" * @param   value  The value\n");
+  printf(" * @return         The index of the value, -1 if it is not recognised\n");
+  printf(" */\n");
+  printf("__attribute__((nonnull, pure, unused))\n");
+  printf("static int %s_lookup_%s(const char* value)\n", prefix, field->lower);
+  printf("{\n");
+  printf("  static const char* const values[] =\n");
+  printf("    {\n");
+  for (i = 0; i < field->value_count; i++)
+    printf("      \"%s\",\n", field->values[i]);
+  printf("    };\n");
+  printf("  static const signed char slots[%zu] =\n", table.size);
+  printf("    {\n");
+  printf("\t");
+  print_slots(&table);
+  printf("\n    };\n");
+  printf("  uint32_t h = %#" PRIx32 "U;\n", FNV_OFFSET_BASIS ^ table.seed);
+  printf("  const char* p;\n");
+  printf("  int i;\n");
+  printf("  \n");
+  printf("  for (p = value; *p; p++)\n");
+  printf("    h = (h ^ (uint32_t)(unsigned char)*p) * %uU;\n", FNV_PRIME);
+  printf("  i = slots[(h ^ (h >> 15)) & %zu];\n", table.size - 1);
+  printf("  return ((i < 0) || strcmp(values[i], value)) ? -1 : i;\n");
+  printf("}\n");
+  printf("\n\n");
+}
+
+
+/**
+ * Print the header
+ * 
+ * @param  schema  The name of the schema file, without directory
+ */
+static void print_header(const char* schema)
+{
+  perfect_hash_t table;
+  char* names[MAX_FIELDS];
+  const field_t* field;
+  size_t i, j;
+  int need_signed = 0, need_unsigned = 0, need_lookup = 0;
+  
+  for (i = 0; i < field_count; i++)
+    {
+      names[i] = fields[i].name;
+      need_signed |= (fields[i].type == TYPE_INT) || (fields[i].type == TYPE_INT64);
+      need_unsigned |= (fields[i].type == TYPE_SIZE) || (fields[i].type == TYPE_UINT64);
+      need_lookup |= (fields[i].type == TYPE_ENUM) || (fields[i].type == TYPE_SET);
+    }
+  perfect_hash(&table, names, field_count);
+  
+  printf("/* This file is generated by mds-schema from %s, do not edit it. */\n", schema);
+  printf("#ifndef MDS_SCHEMA_%s_H\n", upper_prefix);
+  printf("#define MDS_SCHEMA_%s_H\n", upper_prefix);
+  printf("\n\n");
+  printf("#include <libmdsserver/mds-message.h>\n");
+  printf("#include <libmdsserver/util.h>\n");
+  printf("\n");
+  printf("#include <limits.h>\n");
+  printf("#include <stddef.h>\n");
+  printf("#include <stdint.h>\n");
+  printf("#include <string.h>\n");
+  printf("\n\n\n");
+  
+  /* The headers. */
+  printf("/**\n");
+  printf(" * The headers in the schema\n");
+  printf(" */\n");
+  printf("typedef enum %s_header\n", prefix);
+  printf("{\n");
+  for (i = 0; i < field_count; i++)
+    {
+      printf("  /**\n");
+      printf("   * The ‘%s’-header\n", fields[i].name);
+      printf("   */\n");
+      printf("  %s_HEADER_%s = %zu%s\n", upper_prefix, fields[i].upper, i, i + 1 < field_count ? "," : "");
+      printf("  \n");
+    }
+  printf("} %s_header_t;\n", prefix);
+  printf("\n");
+  printf("/**\n");
+  printf(" * The number of headers in the schema\n");
+  printf(" */\n");
+  printf("#define %s_HEADER_COUNT  %zu\n", upper_prefix, field_count);
+  printf("\n\n");
+  
+  /* The values. */
+  for (i = 0; i < field_count; i++)
+    {
+      field = fields + i;
+      if ((field->type != TYPE_ENUM) && (field->type != TYPE_SET))
+	continue;
+      for (j = 0; j < field->value_count; j++)
+	{
+	  printf("/**\n");
+	  printf(" * `%s: %s`\n", field->name, field->values[j]);
+	  printf(" */\n");
+	  if (field->type == TYPE_ENUM)
+	    printf("#define %s_%s_%s  %zu\n", upper_prefix, field->upper, field->upper_values[j], j + 1);
+	  else
+	    printf("#define %s_%s_%s  (UINT32_C(1) << %zu)\n",
+		   upper_prefix, field->upper, field->upper_values[j], j);
+	  printf("\n");
+	}
+      printf("\n");
+    }
+  
+  /* The message. */
+  printf("/**\n");
+  printf(" * Check whether a message contained a header\n");
+  printf(" * \n");
+  printf(" * @param   message  `const %s_message_t*` The parsed message\n", prefix);
+  printf(" * @param   HEADER   The header, without the `%s_HEADER_` prefix\n", upper_prefix);
+  printf(" * @return           1 if the header was included, 0 otherwise\n");
+  printf(" */\n");
+  printf("#define %s_GIVEN(message, HEADER)  \\\n", upper_prefix);
+  printf("  (((message)->given & (UINT64_C(1) << %s_HEADER_##HEADER)) != 0)\n", upper_prefix);
+  printf("\n");
+  printf("/**\n");
+  printf(" * Check whether a message contained a header with a value that could not be parsed\n");
+  printf(" * \n");
+  printf(" * @param   message  `const %s_message_t*` The parsed message\n", prefix);
+  printf(" * @param   HEADER   The header, without the `%s_HEADER_` prefix\n", upper_prefix);
+  printf(" * @return           1 if the header's value was invalid, 0 otherwise\n");
+  printf(" */\n");
+  printf("#define %s_INVALID(message, HEADER)  \\\n", upper_prefix);
+  printf("  (((message)->invalid & (UINT64_C(1) << %s_HEADER_##HEADER)) != 0)\n", upper_prefix);
+  printf("\n\n");
+  printf("/**\n");
+  printf(" * The headers of a message, as described by the schema\n");
+  printf(" */\n");
+  printf("typedef struct %s_message\n", prefix);
+  printf("{\n");
+  printf("  /**\n");
+  printf("   * Bit `%s_HEADER_*` is set for each header in the message\n", upper_prefix);
+  printf("   */\n");
+  printf("  uint64_t given;\n");
+  printf("  \n");
+  printf("  /**\n");
+  printf("   * Bit `%s_HEADER_*` is set for each header with a value that could\n", upper_prefix);
+  printf("   * not be parsed, an integer keeps its default value, and an enum is -1\n");
+  printf("   */\n");
+  printf("  uint64_t invalid;\n");
+  printf("  \n");
+  for (i = 0; i < field_count; i++)
+    {
+      field = fields + i;
+      printf("  /**\n");
+      if (field->type == TYPE_ENUM)
+	printf("   * The value of the ‘%s’-header, `%s_%s_*`,\n"
+	       "   * %s if omitted, -1 if not recognised\n",
+	       field->name, upper_prefix, field->upper,
+	       field->fallback == NULL ? "0" : "the default");
+      else if (field->type == TYPE_SET)
+	printf("   * The values of the ‘%s’-headers, `%s_%s_*` or:ed together\n",
+	       field->name, upper_prefix, field->upper);
+      else if (field->fallback == NULL)
+	printf("   * The value of the ‘%s’-header, %s if omitted\n",
+	       field->name, field->type == TYPE_STRING ? "`NULL`" : "zero");
+      else
+	printf("   * The value of the ‘%s’-header, %s%s%s if omitted\n", field->name,
+	       field->type == TYPE_STRING ? "\"" : "", field->fallback,
+	       field->type == TYPE_STRING ? "\"" : "");
+      printf("   */\n");
+      printf("  %s %s;\n", c_type(field), field->lower);
+      printf("  \n");
+    }
+  printf("} %s_message_t;\n", prefix);
+  printf("\n\n\n");
+  
+  /* The header lookup. */
+  printf("/**\n");
+  printf(" * Look up a header by its name\n");
+  printf(" * \n");
+  printf(" * @param   header     The header, with its name and value separated by \": \"\n");
+  printf(" * @param   value_out  Output parameter for the value of the header\n");
+  printf(" * @return             The header, `%s_HEADER_*`, -1 if it is not in the schema\n", upper_prefix);
+  printf(" */\n");
+  printf("__attribute__((nonnull, unused))\n");
+  printf("static int %s_header(const char* restrict header, const char** restrict value_out)\n", prefix);
+  printf("{\n");
+  printf("  static const char* const names[] =\n");
+  printf("    {\n");
+  for (i = 0; i < field_count; i++)
+    printf("      \"%s\",\n", fields[i].name);
+  printf("    };\n");
+  printf("  static const size_t lengths[] =\n");
+  printf("    {\n");
+  printf("\t");
+  for (i = 0; i < field_count; i++)
+    printf("%s%zu", i == 0 ? "" : (i % 16 == 0) ? ",\n\t" : ", ", strlen(fields[i].name));
+  printf("\n    };\n");
+  printf("  static const signed char slots[%zu] =\n", table.size);
+  printf("    {\n");
+  printf("\t");
+  print_slots(&table);
+  printf("\n    };\n");
+  printf("  uint32_t h = %#" PRIx32 "U;\n", FNV_OFFSET_BASIS ^ table.seed);
+  printf("  size_t n;\n");
+  printf("  int i;\n");
+  printf("  \n");
+  printf("  for (n = 0; header[n] && (header[n] != ':'); n++)\n");
+  printf("    h = (h ^ (uint32_t)(unsigned char)(header[n])) * %uU;\n", FNV_PRIME);
+  printf("  i = slots[(h ^ (h >> 15)) & %zu];\n", table.size - 1);
+  printf("  if ((i < 0) || (header[n] != ':') || (header[n + 1] != ' ') ||\n");
+  printf("      (lengths[i] != n) || memcmp(names[i], header, n))\n");
+  printf("    return -1;\n");
+  printf("  \n");
+  printf("  *value_out = header + n + 2;\n");
+  printf("  return i;\n");
+  printf("}\n");
+  printf("\n\n");
+  
+  for (i = 0; i < field_count; i++)
+    if ((fields[i].type == TYPE_ENUM) || (fields[i].type == TYPE_SET))
+      print_value_lookup(fields + i);
+  
+  /* The parser. */
+  printf("/**\n");
+  printf(" * Parse the headers of a message\n");
+  printf(" * \n");
+  printf(" * Headers that are not in the schema are ignored, and if\n");
+  printf(" * a header is repeated, its last occurrence is used, except\n");
+  printf(" * that the values of a set are accumulated\n");
+  printf(" * \n");
+  printf(" * @param  this     Output parameter for the parsed headers\n");
+  printf(" * @param  message  The message\n");
+  printf(" */\n");
+  printf("__attribute__((nonnull, unused))\n");
+  printf("static void %s_parse(%s_message_t* restrict this, const mds_message_t* restrict message)\n",
+	 prefix, prefix);
+  printf("{\n");
+  printf("  const char* value;\n");
+  if (need_signed)
+    printf("  intmax_t signed_value;\n");
+  if (need_unsigned)
+    printf("  uintmax_t unsigned_value;\n");
+  printf("  size_t i;\n");
+  printf("  int header;\n");
+  if (need_lookup)
+    printf("  int r;\n");
+  printf("  \n");
+  printf("  this->given = 0;\n");
+  printf("  this->invalid = 0;\n");
+  for (i = 0; i < field_count; i++)
+    {
+      field = fields + i;
+      if (field->fallback == NULL)
+	printf("  this->%s = %s;\n", field->lower, field->type == TYPE_STRING ? "NULL" : "0");
+      else if (field->type == TYPE_STRING)
+	printf("  this->%s = \"%s\";\n", field->lower, field->fallback);
+      else if (field->type == TYPE_ENUM)
+	{
+	  for (j = 0; strcmp(field->values[j], field->fallback); j++);
+	  printf("  this->%s = %s_%s_%s;\n", field->lower, upper_prefix, field->upper, field->upper_values[j]);
+	}
+      else
+	printf("  this->%s = %s;\n", field->lower, field->fallback);
+    }
+  printf("  \n");
+  printf("  for (i = 0; i < message->header_count; i++)\n");
+  printf("    {\n");
+  printf("      if ((header = %s_header(message->headers[i], &value)) < 0)\n", prefix);
+  printf("\tcontinue;\n");
+  printf("      this->given |= UINT64_C(1) << header;\n");
+  printf("      switch (header)\n");
+  printf("\t{\n");
+  for (i = 0; i < field_count; i++)
+    {
+      field = fields + i;
+      printf("\tcase %s_HEADER_%s:\n", upper_prefix, field->upper);
+      switch (field->type)
+	{
+	case TYPE_STRING:
+	  printf("\t  this->%s = value;\n", field->lower);
+	  break;
+	case TYPE_ENUM:
+	  printf("\t  if ((r = %s_lookup_%s(value)) < 0)\n", prefix, field->lower);
+	  printf("\t    this->invalid |= UINT64_C(1) << header;\n");
+	  printf("\t  this->%s = r < 0 ? -1 : (r + 1);\n", field->lower);
+	  break;
+	case TYPE_SET:
+	  printf("\t  if ((r = %s_lookup_%s(value)) < 0)\n", prefix, field->lower);
+	  printf("\t    this->invalid |= UINT64_C(1) << header;\n");
+	  printf("\t  else\n");
+	  printf("\t    this->%s |= UINT32_C(1) << r;\n", field->lower);
+	  break;
+	case TYPE_INT:
+	case TYPE_INT64:
+	  printf("\t  if (strict_atoj(value, &signed_value, ");
+	  print_bound(field, 0);
+	  printf(", ");
+	  print_bound(field, 1);
+	  printf("))\n");
+	  printf("\t    this->invalid |= UINT64_C(1) << header;\n");
+	  printf("\t  else\n");
+	  printf("\t    this->%s = (%s)signed_value;\n", field->lower, c_type(field));
+	  break;
+	default:
+	  printf("\t  if (strict_atouj(value, &unsigned_value, ");
+	  print_bound(field, 0);
+	  printf(", ");
+	  print_bound(field, 1);
+	  printf("))\n");
+	  printf("\t    this->invalid |= UINT64_C(1) << header;\n");
+	  printf("\t  else\n");
+	  printf("\t    this->%s = (%s)unsigned_value;\n", field->lower, c_type(field));
+	  break;
+	}
+      printf("\t  break;\n");
+    }
+  printf("\tdefault:\n");
+  printf("\t  break;\n");
+  printf("\t}\n");
+  printf("    }\n");
+  printf("}\n");
+  printf("\n\n");
+  printf("#endif\n");
+  printf("\n");
+}
+
+
+/**
+ * Compile a protocol schema into a C header
+ * 
+ * @param   argc  The number of elements in `argv`
+ * @param   argv  The command line, the schema is the only argument,
+ *                the header is written to stdout
+ * @return        Zero on success, 1 on error
+ */
+int main(int argc, char** argv)
+{
+  FILE* file;
+  char* line = NULL;
+  size_t size = 0;
+  ssize_t length;
+  const char* basename;
+  char* dot;
+  
+  if (argc != 2)
+    {
+      fprintf(stderr, "usage: %s SCHEMA > HEADER\n", *argv);
+      return 1;
+    }
+  
+  pathname = argv[1];
+  basename = strrchr(pathname, '/') ? strrchr(pathname, '/') + 1 : pathname;
+  prefix = duplicate(basename, strlen(basename));
+  if ((dot = strrchr(prefix, '.')) != NULL)
+    *dot = '\0';
+  upper_prefix = identifier(prefix, 1);
+  prefix = identifier(prefix, 0);
+  
+  if ((file = fopen(pathname, "r")) == NULL)
+    {
+      perror(pathname);
+      return 1;
+    }
+  while ((length = getline(&line, &size, file)) >= 0)
+    {
+      line_number++;
+      if ((length > 0) && (line[length - 1] == '\n'))
+	line[--length] = '\0';
+      if (strlen(line) != (size_t)length)
+	die("the schema contains a NUL byte");
+      parse_line(line);
+    }
+  if (ferror(file))
+    {
+      perror(pathname);
+      return 1;
+    }
+  fclose(file);
+  free(line);
+  
+  line_number = 0;
+  if (field_count == 0)
+    die("the schema has no headers");
+  
+  print_header(basename);
+  if (fflush(stdout) || ferror(stdout))
+    {
+      perror("mds-schema");
+      return 1;
+    }
+  return 0;
+}
+